@@ -48,6 +48,17 @@ class PClassAmmo;
 struct FBlockNode;
 struct FPortalGroupArray;
 
+// Number of blockmap iterators that can be active at once without having to
+// fall back to keeping a list of the actors they returned.
+enum { NUM_BLOCKSTAMPS = 4 };
+
+// How an FBlockThingsIterator marks the actors it returned.
+struct FBlockStamp
+{
+	QWORD Search;		// returned during this search; only set for actors in several blocks
+	QWORD Visit;		// returned during this visit of a block
+};
+
 //
 // NOTES: AActor
 //
@@ -1032,6 +1043,7 @@ public:
 
 // interaction info
 	FBlockNode		*BlockNode;			// links in blocks (if needed)
+	FBlockStamp		BlockStamps[NUM_BLOCKSTAMPS];	// used by FBlockThingsIterator to skip actors it already returned
 	struct sector_t	*Sector;
 	subsector_t *		subsector;
 	double			floorz, ceilingz;	// closest together of contacted secs
@@ -788,8 +788,16 @@ void AddToConsole (int printlevel, const char *text)
 }
 
 /* Adds a string to the console and also to the notify buffer */
+static thread_local std::vector<FCapturedPrint> *PrintCapture;
+
 int PrintString (int printlevel, const char *outline)
 {
+	if (PrintCapture != NULL)
+	{
+		FCapturedPrint print = { printlevel, outline };
+		PrintCapture->push_back(print);
+		return (int)strlen(outline);
+	}
 	if (printlevel < msglevel || *outline == '\0')
 	{
 		return 0;
@@ -816,6 +824,38 @@ int PrintString (int printlevel, const char *outline)
 
 extern bool gameisdead;
 
+//==========================================================================
+//
+// C_CaptureOutput
+//
+// Makes everything this thread prints go into the buffer instead of the
+// console, or stops that if the buffer is NULL. Returns the previous one.
+//
+//==========================================================================
+
+std::vector<FCapturedPrint> *C_CaptureOutput (std::vector<FCapturedPrint> *buffer)
+{
+	std::vector<FCapturedPrint> *old = PrintCapture;
+	PrintCapture = buffer;
+	return old;
+}
+
+//==========================================================================
+//
+// C_ReplayOutput
+//
+// Prints what was captured, as if it was being printed right now.
+//
+//==========================================================================
+
+void C_ReplayOutput (const std::vector<FCapturedPrint> &buffer)
+{
+	for (size_t i = 0; i < buffer.size(); ++i)
+	{
+		PrintString (buffer[i].PrintLevel, buffer[i].Text.c_str());
+	}
+}
+
 int VPrintf (int printlevel, const char *format, va_list parms)
 {
 	if (gameisdead)
@@ -35,7 +35,10 @@
 #define __C_CONSOLE__
 
 #include <stdarg.h>
+#include <string>
+#include <vector>
 #include "basictypes.h"
+#include "zstring.h"
 
 struct event_t;
 
@@ -67,6 +70,16 @@ void AddToConsole (int printlevel, const char *string);
 int PrintString (int printlevel, const char *string);
 int VPrintf (int printlevel, const char *format, va_list parms) GCCFORMAT(2);
 
+// Console output can be diverted into a buffer, per thread, so that work done
+// off the main thread can have its messages shown later in a defined order.
+struct FCapturedPrint
+{
+	int PrintLevel;
+	std::string Text;
+};
+std::vector<FCapturedPrint> *C_CaptureOutput (std::vector<FCapturedPrint> *buffer);
+void C_ReplayOutput (const std::vector<FCapturedPrint> &buffer);
+
 void C_DrawConsole (bool hw2d);
 void C_ToggleConsole (void);
 void C_FullConsole (void);
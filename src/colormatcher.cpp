@@ -32,18 +32,183 @@
 **
 ** Once upon a time, this tried to be a fast closest color finding system.
 ** It was, but the results were not as good as I would like, so I didn't
-** actually use it. But I did keep the code around in case I ever felt like
-** revisiting the problem. I never did, so now it's relegated to the mists
-** of SVN history, and this is just a thin wrapper around BestColor().
+** actually use it. This time around, RGB space is split into a 32x32x32
+** cube, and every cell keeps a list of the only palette entries that can
+** possibly be closest to a color inside it. A color is a candidate for a
+** cell if its nearest distance to the cell is no greater than the smallest
+** farthest distance of any color to the cell. Searching just those in
+** palette order gives exactly the same answer BestColor() would, ties
+** included. Cells are filled in the first time something lands in them.
 **
 */
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <mutex>
+#include <atomic>
 
 #include "doomtype.h"
 #include "colormatcher.h"
 #include "v_palette.h"
+#include "c_dispatch.h"
+#include "m_random.h"
+#include "stats.h"
+#include "templates.h"
+
+#define CUBE_BITS		5
+#define CUBE_SHIFT		(8 - CUBE_BITS)
+#define CUBE_SIZE		(1 << CUBE_BITS)
+#define CUBE_CELLS		(CUBE_SIZE * CUBE_SIZE * CUBE_SIZE)
+#define CUBE_BLOCKSIZE	65536
+
+// Palette entries considered, matching BestColor's defaults.
+#define FIRST_COLOR		1
+#define LAST_COLOR		255
+
+struct FColorCube
+{
+	FColorCube (const PalEntry *palette);
+	~FColorCube ();
+
+	const BYTE *GetCell (int r, int g, int b);
+	const BYTE *BuildCell (int cell);
+
+	PalEntry Colors[256];
+
+	// Each cell points to a candidate count followed by that many palette
+	// indices, in ascending order. NULL until the cell is first used.
+	std::atomic<const BYTE *> Cells[CUBE_CELLS];
+
+	std::mutex BuildLock;
+	TArray<BYTE *> Blocks;
+	int BlockUsed;
+};
+
+//==========================================================================
+//
+// FColorCube Constructor
+//
+//==========================================================================
+
+FColorCube::FColorCube (const PalEntry *palette)
+{
+	memcpy (Colors, palette, sizeof(Colors));
+	for (int i = 0; i < CUBE_CELLS; ++i)
+	{
+		Cells[i].store (NULL, std::memory_order_relaxed);
+	}
+	BlockUsed = CUBE_BLOCKSIZE;
+}
+
+//==========================================================================
+//
+// FColorCube Destructor
+//
+//==========================================================================
+
+FColorCube::~FColorCube ()
+{
+	for (unsigned i = 0; i < Blocks.Size(); ++i)
+	{
+		delete[] Blocks[i];
+	}
+}
+
+//==========================================================================
+//
+// FColorCube :: GetCell
+//
+//==========================================================================
+
+inline const BYTE *FColorCube::GetCell (int r, int g, int b)
+{
+	int cell = ((r >> CUBE_SHIFT) << (CUBE_BITS*2)) | ((g >> CUBE_SHIFT) << CUBE_BITS) | (b >> CUBE_SHIFT);
+	const BYTE *list = Cells[cell].load (std::memory_order_acquire);
+	return list != NULL ? list : BuildCell (cell);
+}
+
+//==========================================================================
+//
+// FColorCube :: BuildCell
+//
+// Cells can be requested from texture loading threads too, so building
+// one is serialized. Finished lists are never moved or freed while the
+// cube is alive, so readers don't need the lock.
+//
+//==========================================================================
+
+const BYTE *FColorCube::BuildCell (int cell)
+{
+	std::lock_guard<std::mutex> lock(BuildLock);
+
+	const BYTE *list = Cells[cell].load (std::memory_order_acquire);
+	if (list != NULL)
+	{ // Somebody else got here first.
+		return list;
+	}
+
+	int lo[3], hi[3];
+	lo[0] = (cell >> (CUBE_BITS*2)) << CUBE_SHIFT;
+	lo[1] = ((cell >> CUBE_BITS) & (CUBE_SIZE-1)) << CUBE_SHIFT;
+	lo[2] = (cell & (CUBE_SIZE-1)) << CUBE_SHIFT;
+	for (int i = 0; i < 3; ++i)
+	{
+		hi[i] = lo[i] + (1 << CUBE_SHIFT) - 1;
+	}
+
+	int mindist[256];
+	int threshold = INT_MAX;
+
+	for (int color = FIRST_COLOR; color < LAST_COLOR; ++color)
+	{
+		int comp[3] = { Colors[color].r, Colors[color].g, Colors[color].b };
+		int nearest = 0, farthest = 0;
+
+		for (int i = 0; i < 3; ++i)
+		{
+			int v = comp[i];
+			int n = v < lo[i] ? lo[i] - v : v > hi[i] ? v - hi[i] : 0;
+			int f = MAX (abs(v - lo[i]), abs(v - hi[i]));
+			nearest += n * n;
+			farthest += f * f;
+		}
+		mindist[color] = nearest;
+		if (farthest < threshold)
+		{
+			threshold = farthest;
+		}
+	}
+
+	BYTE candidates[256];
+	int count = 0;
+	for (int color = FIRST_COLOR; color < LAST_COLOR; ++color)
+	{
+		if (mindist[color] <= threshold)
+		{
+			candidates[count++] = (BYTE)color;
+		}
+	}
+
+	if (BlockUsed + count + 1 > CUBE_BLOCKSIZE)
+	{
+		Blocks.Push (new BYTE[CUBE_BLOCKSIZE]);
+		BlockUsed = 0;
+	}
+	BYTE *out = Blocks.Last() + BlockUsed;
+	BlockUsed += count + 1;
+
+	out[0] = (BYTE)count;
+	memcpy (out + 1, candidates, count);
+	Cells[cell].store (out, std::memory_order_release);
+	return out;
+}
+
+//==========================================================================
+//
+// FColorMatcher
+//
+//==========================================================================
 
 FColorMatcher::FColorMatcher ()
 {
@@ -63,12 +228,21 @@ FColorMatcher::FColorMatcher (const FColorMatcher &other)
 FColorMatcher &FColorMatcher::operator= (const FColorMatcher &other)
 {
 	Pal = other.Pal;
+	Cube = other.Cube;
 	return *this;
 }
 
 void FColorMatcher::SetPalette (const DWORD *palette)
 {
 	Pal = (const PalEntry *)palette;
+	if (Pal == NULL)
+	{
+		Cube.reset ();
+	}
+	else if (Cube == NULL || memcmp (Cube->Colors, Pal, sizeof(Cube->Colors)) != 0)
+	{
+		Cube = std::make_shared<FColorCube> (Pal);
+	}
 }
 
 BYTE FColorMatcher::Pick (int r, int g, int b)
@@ -76,5 +250,87 @@ BYTE FColorMatcher::Pick (int r, int g, int b)
 	if (Pal == NULL)
 		return 1;
 
-	return (BYTE)BestColor ((uint32 *)Pal, r, g, b);
+	if ((unsigned)(r | g | b) > 255)
+	{ // Out of range components can't be looked up in the cube.
+		return (BYTE)BestColor ((uint32 *)Pal, r, g, b);
+	}
+
+	const BYTE *list = Cube->GetCell (r, g, b);
+	const PalEntry *pal = Cube->Colors;
+	int count = list[0];
+	int bestcolor = FIRST_COLOR;
+	int bestdist = INT_MAX;
+
+	for (int i = 1; i <= count; ++i)
+	{
+		int color = list[i];
+		int x = r - pal[color].r;
+		int y = g - pal[color].g;
+		int z = b - pal[color].b;
+		int dist = x*x + y*y + z*z;
+		if (dist < bestdist)
+		{
+			if (dist == 0)
+				return color;
+
+			bestdist = dist;
+			bestcolor = color;
+		}
+	}
+	return bestcolor;
+}
+
+#ifdef _DEBUG
+//==========================================================================
+//
+// CCMD colormatchertest
+//
+// Checks the cube against a plain BestColor search and times both.
+//
+//==========================================================================
+
+CCMD (colormatchertest)
+{
+	static FRandom pr_cmtest;
+	const int count = argv.argc() > 1 ? MAX (atoi (argv[1]), 1) : 1000000;
+	TArray<DWORD> colors;
+	TArray<BYTE> cubepicks, bestpicks;
+	cycle_t cubetime, besttime;
+	int mismatches = 0;
+
+	colors.Resize (count);
+	cubepicks.Resize (count);
+	bestpicks.Resize (count);
+	for (int i = 0; i < count; ++i)
+	{
+		colors[i] = pr_cmtest.GenRand32() & 0xFFFFFF;
+	}
+
+	cubetime.Reset();
+	cubetime.Clock();
+	for (int i = 0; i < count; ++i)
+	{
+		cubepicks[i] = ColorMatcher.Pick (PalEntry(colors[i]));
+	}
+	cubetime.Unclock();
+
+	besttime.Reset();
+	besttime.Clock();
+	for (int i = 0; i < count; ++i)
+	{
+		PalEntry pe = colors[i];
+		bestpicks[i] = (BYTE)BestColor ((uint32 *)GPalette.BaseColors, pe.r, pe.g, pe.b);
+	}
+	besttime.Unclock();
+
+	for (int i = 0; i < count; ++i)
+	{
+		if (cubepicks[i] != bestpicks[i])
+		{
+			mismatches++;
+		}
+	}
+	Printf ("%d colors: cube %.2f ms, BestColor %.2f ms, %d mismatches\n",
+		count, cubetime.TimeMS(), besttime.TimeMS(), mismatches);
 }
+#endif
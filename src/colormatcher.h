@@ -34,6 +34,10 @@
 #ifndef __COLORMATCHER_H__
 #define __COLORMATCHER_H__
 
+#include <memory>
+
+struct FColorCube;
+
 class FColorMatcher
 {
 public:
@@ -52,6 +56,7 @@ public:
 
 private:
 	const PalEntry *Pal;
+	std::shared_ptr<FColorCube> Cube;
 };
 
 extern FColorMatcher ColorMatcher;
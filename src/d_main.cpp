@@ -73,6 +73,7 @@
 #include "st_stuff.h"
 #include "am_map.h"
 #include "p_setup.h"
+#include "p_preload.h"
 #include "r_utility.h"
 #include "r_sky.h"
 #include "d_main.h"
@@ -109,6 +110,9 @@
 #include "p_local.h"
 #include "autosegs.h"
 #include "fragglescript/t_fs.h"
+#include "g_benchmark.h"
+#include "profiler.h"
+#include "jobqueue.h"
 
 EXTERN_CVAR(Bool, hud_althud)
 void DrawHUD();
@@ -975,7 +979,10 @@ void D_DoomLoop ()
 	r_NoInterpolate = true;
 	Page = Advisory = NULL;
 
-	vid_cursor.Callback();
+	// A benchmark has no window, so it doesn't talk to the OS for input
+	// or the mouse cursor either.
+	if (!benchmarking) vid_cursor.Callback();
+	FProfileZone::SetThreadName("Game");
 
 	for (;;)
 	{
@@ -985,33 +992,38 @@ void D_DoomLoop ()
 			if (gametic > lasttic)
 			{
 				lasttic = gametic;
-				I_StartFrame ();
+				if (!benchmarking) I_StartFrame ();
 			}
 			
 			// process one or more tics
 			if (singletics)
 			{
-				I_StartTic ();
+				if (!benchmarking) I_StartTic ();
 				D_ProcessEvents ();
 				G_BuildTiccmd (&netcmds[consoleplayer][maketic%BACKUPTICS]);
 				if (advancedemo)
 					D_DoAdvanceDemo ();
 				C_Ticker ();
 				M_Ticker ();
+				if (benchmarking)
+					G_BenchmarkStartTic ();
 				G_Ticker ();
 				// [RH] Use the consoleplayer's camera to update sounds
 				S_UpdateSounds (players[consoleplayer].camera);	// move positional sounds
 				gametic++;
 				maketic++;
 				GC::CheckGC ();
+				if (benchmarking)
+					G_BenchmarkEndTic ();
 				Net_NewMakeTic ();
 			}
 			else
 			{
 				TryRunTics (); // will run at least one tic
 			}
+			FJobQueue::ReportFailures ();
 			// Update display, next frame, with current state.
-			I_StartTic ();
+			if (!benchmarking) I_StartTic ();
 			D_Display ();
 			if (wantToRestart)
 			{
@@ -2254,6 +2266,13 @@ void D_DoomMain (void)
 		Printf("\n");
 	}
 
+	v = Args->CheckValue("-benchmark");
+	if (v != NULL)
+	{
+		const char *tics = Args->CheckValue("-benchtics");
+		G_SetupBenchmark(v, tics != NULL ? atoi(tics) : 0);
+	}
+
 	if (Args->CheckParm("-hashfiles"))
 	{
 		const char *filename = "fileinfo.txt";
@@ -2579,7 +2598,16 @@ void D_DoomMain (void)
 				throw CNoRunExit();
 			}
 
-			V_Init2();
+			if (!benchmarking)
+			{
+				V_Init2();
+			}
+			else
+			{
+				// Nothing gets drawn, so keep the placeholder screen V_Init
+				// made and never open a window or set a video mode.
+				C_NewModeAdjust();
+			}
 			UpdateJoystickMenu(NULL);
 
 			v = Args->CheckValue ("-loadgame");
@@ -2670,6 +2698,8 @@ void D_DoomMain (void)
 		D_ErrorCleanup ();
 		P_FreeLevelData();
 		P_FreeExtraLevelData();
+		P_FinishPreload();				// the preload holds lumps of the files about to be closed
+		P_ReleasePreload();
 
 		M_SaveDefaults(NULL);			// save config before the restart
 
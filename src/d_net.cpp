@@ -63,6 +63,7 @@
 #include "r_utility.h"
 #include "a_keys.h"
 #include "intermission/intermission.h"
+#include "profiler.h"
 
 EXTERN_CVAR (Int, disableautosave)
 EXTERN_CVAR (Int, autosavecount)
@@ -935,6 +936,7 @@ int gametime;
 
 void NetUpdate (void)
 {
+	FProfileZone zone("NetUpdate");
 	int		lowtic;
 	int 	nowtime;
 	int 	newtics;
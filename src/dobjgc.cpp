@@ -64,6 +64,7 @@
 #include "a_sharedglobal.h"
 #include "sbar.h"
 #include "stats.h"
+#include "profiler.h"
 #include "c_dispatch.h"
 #include "p_acs.h"
 #include "s_sndseq.h"
@@ -139,6 +140,8 @@ extern DThinker *NextToThink;
 
 // PUBLIC DATA DEFINITIONS -------------------------------------------------
 
+cycle_t GCCycles;
+
 namespace GC
 {
 size_t AllocBytes;
@@ -484,8 +487,10 @@ static size_t SingleStep()
 
 void Step()
 {
+	FProfileZone zone("GC::Step");
 	size_t lim = (GCSTEPSIZE/100) * StepMul;
 	size_t olim;
+	GCCycles.Clock();
 	if (lim == 0)
 	{
 		lim = (~(size_t)0) / 2;		// no limit
@@ -514,6 +519,7 @@ void Step()
 		SetThreshold();
 	}
 	StepCount++;
+	GCCycles.Unclock();
 }
 
 //==========================================================================
@@ -526,6 +532,7 @@ void Step()
 
 void FullGC()
 {
+	GCCycles.Clock();
 	if (State <= GCS_Propagate)
 	{
 		// Reset sweep mark to sweep all elements (returning them to white)
@@ -545,6 +552,7 @@ void FullGC()
 		SingleStep();
 	}
 	SetThreshold();
+	GCCycles.Unclock();
 }
 
 //==========================================================================
@@ -34,6 +34,8 @@
 
 #include "dthinker.h"
 #include "stats.h"
+#include "profiler.h"
+#include "p_tickstats.h"
 #include "p_local.h"
 #include "statnums.h"
 #include "i_system.h"
@@ -43,7 +45,7 @@
 #include "virtual.h"
 
 
-static cycle_t ThinkCycles;
+cycle_t ThinkCycles;
 extern cycle_t BotSupportCycles;
 extern cycle_t ActionCycles;
 extern int BotWTG;
@@ -459,6 +461,7 @@ void DThinker::DestroyThinkersInList (FThinkerList &list)
 
 void DThinker::RunThinkers ()
 {
+	FProfileZone zone("RunThinkers");
 	int i, count;
 
 	ThinkCycles.Reset();
@@ -484,6 +487,11 @@ void DThinker::RunThinkers ()
 		}
 	} while (count != 0);
 
+	if (TickStatsActive)
+	{
+		P_CountTickStatsTic();
+	}
+
 	ThinkCycles.Unclock();
 }
 
@@ -524,7 +532,22 @@ int DThinker::TickThinkers (FThinkerList *list, FThinkerList *dest)
 
 		if (!(node->ObjectFlags & OF_EuthanizeMe))
 		{ // Only tick thinkers not scheduled for destruction
-			node->CallTick();
+			if (!TickStatsActive)
+			{
+				node->CallTick();
+			}
+			else
+			{
+				PClass *cls = node->GetClass();
+				cycle_t cycles;
+				cycles.Reset();
+				cycles.Clock();
+				node->CallTick();
+				cycles.Unclock();
+				FClassTickStats &stats = P_GetClassTickStats(cls);
+				stats.TickTime += cycles.TimeMS();
+				stats.Ticks++;
+			}
 			node->ObjectFlags &= ~OF_JustSpawned;
 			GC::CheckGC();
 		}
@@ -0,0 +1,249 @@
+/*
+** g_benchmark.cpp
+**
+** Headless playsim timing for demos and scripted runs
+**
+**---------------------------------------------------------------------------
+** Copyright 2016 The ZDoom Team
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+** 3. The name of the author may not be used to endorse or promote products
+**    derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+** OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+** INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+** NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+** THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**---------------------------------------------------------------------------
+**
+*/
+
+#include <stdio.h>
+
+#include "doomstat.h"
+#include "c_dispatch.h"
+#include "g_benchmark.h"
+#include "g_level.h"
+#include "i_system.h"
+#include "m_argv.h"
+#include "stats.h"
+#include "templates.h"
+
+extern cycle_t ThinkCycles, ActionCycles, SightCycles, ACSCycles, GCCycles, VMCycles;
+extern bool nodrawers, noblit;
+extern bool singletics;
+
+//==========================================================================
+//
+// With -benchmark <file> the game runs without drawing anything, as fast
+// as the playsim allows, and logs how long every tic took and where that
+// time went. The run is either a demo (-playdemo or -timedemo) or the
+// first -benchtics tics of whatever the command line starts, with console
+// scripts providing any input. The log is written as CSV, or as JSON if
+// the file name ends in .json.
+//
+// The columns overlap: thinkers include ACS scripts and action functions,
+// action functions include the scripted code they run (the VM column),
+// and all of those include the sight checks they make.
+//
+//==========================================================================
+
+bool benchmarking;
+
+struct FBenchmarkTic
+{
+	int Tic;
+	int MapTime;
+	double Total;
+	double Thinkers;
+	double Actions;
+	double Sight;
+	double ACS;
+	double VM;
+	double GC;
+};
+
+static FString BenchmarkFile;
+static int BenchmarkTics;
+static int StartMapTime;
+static cycle_t TicCycles;
+static TArray<FBenchmarkTic> BenchmarkLog;
+static bool BenchmarkDone, BenchmarkWritten;
+
+static void G_WriteBenchmark ();
+
+//==========================================================================
+//
+// G_SetupBenchmark
+//
+// Called from D_DoomMain before the sound code is initialized.
+//
+//==========================================================================
+
+void G_SetupBenchmark (const char *filename, int tics)
+{
+	benchmarking = true;
+	BenchmarkFile = filename;
+	BenchmarkTics = MAX(tics, 0);
+	BenchmarkLog.Clear();
+	BenchmarkDone = BenchmarkWritten = false;
+
+	nodrawers = true;
+	noblit = true;
+	singletics = true;
+	if (!Args->CheckParm("-nosound"))
+	{
+		Args->AppendArg("-nosound");
+	}
+	atterm (G_WriteBenchmark);
+}
+
+//==========================================================================
+//
+// G_BenchmarkStartTic
+//
+//==========================================================================
+
+void G_BenchmarkStartTic ()
+{
+	ACSCycles.Reset();
+	VMCycles.Reset();
+	GCCycles.Reset();
+	TicCycles.Reset();
+	StartMapTime = gamestate == GS_LEVEL ? level.maptime : -1;
+	TicCycles.Clock();
+}
+
+//==========================================================================
+//
+// G_BenchmarkEndTic
+//
+// Only tics that actually ran the level are logged. Once the benchmark is
+// finished, this quits the same way the console's quit command does, from
+// the main loop rather than from the middle of the tic that finished it.
+//
+//==========================================================================
+
+void G_BenchmarkEndTic ()
+{
+	TicCycles.Unclock();
+
+	if (BenchmarkDone)
+	{
+		C_DoCommand("quit");
+		return;
+	}
+	if (gamestate != GS_LEVEL || StartMapTime < 0 || level.maptime == StartMapTime)
+	{
+		return;
+	}
+
+	FBenchmarkTic tic;
+	tic.Tic = gametic;
+	tic.MapTime = level.maptime;
+	tic.Total = TicCycles.TimeMS();
+	tic.Thinkers = ThinkCycles.TimeMS();
+	tic.Actions = ActionCycles.TimeMS();
+	tic.Sight = SightCycles.TimeMS();
+	tic.ACS = ACSCycles.TimeMS();
+	tic.VM = VMCycles.TimeMS();
+	tic.GC = GCCycles.TimeMS();
+	BenchmarkLog.Push(tic);
+
+	if (BenchmarkTics > 0 && (int)BenchmarkLog.Size() >= BenchmarkTics)
+	{
+		G_FinishBenchmark();
+		C_DoCommand("quit");
+	}
+}
+
+//==========================================================================
+//
+// G_WriteBenchmark
+//
+//==========================================================================
+
+static void G_WriteBenchmark ()
+{
+	if (!benchmarking || BenchmarkWritten)
+	{
+		return;
+	}
+	BenchmarkWritten = true;
+
+	FILE *f = fopen(BenchmarkFile, "w");
+	if (f == NULL)
+	{
+		Printf("Could not write benchmark log %s\n", BenchmarkFile.GetChars());
+		return;
+	}
+
+	bool json = BenchmarkFile.Len() >= 5 && !stricmp(BenchmarkFile.GetChars() + BenchmarkFile.Len() - 5, ".json");
+	double total = 0, worst = 0;
+
+	if (json)
+	{
+		fprintf(f, "{\n\t\"map\": \"%s\",\n\t\"tics\": [\n", level.MapName.GetChars());
+	}
+	else
+	{
+		fprintf(f, "tic,maptime,total_ms,thinkers_ms,actions_ms,sight_ms,acs_ms,vm_ms,gc_ms\n");
+	}
+	for (unsigned i = 0; i < BenchmarkLog.Size(); ++i)
+	{
+		const FBenchmarkTic &t = BenchmarkLog[i];
+		if (json)
+		{
+			fprintf(f, "\t\t{ \"tic\": %d, \"maptime\": %d, \"total\": %.4f, \"thinkers\": %.4f, \"actions\": %.4f, \"sight\": %.4f, \"acs\": %.4f, \"vm\": %.4f, \"gc\": %.4f }%s\n",
+				t.Tic, t.MapTime, t.Total, t.Thinkers, t.Actions, t.Sight, t.ACS, t.VM, t.GC,
+				i + 1 < BenchmarkLog.Size() ? "," : "");
+		}
+		else
+		{
+			fprintf(f, "%d,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+				t.Tic, t.MapTime, t.Total, t.Thinkers, t.Actions, t.Sight, t.ACS, t.VM, t.GC);
+		}
+		total += t.Total;
+		worst = MAX(worst, t.Total);
+	}
+	if (json)
+	{
+		fprintf(f, "\t]\n}\n");
+	}
+	fclose(f);
+
+	Printf("Benchmark: %u tics in %.1f ms (%.3f ms average, %.3f ms worst), written to %s\n",
+		BenchmarkLog.Size(), total, BenchmarkLog.Size() > 0 ? total / BenchmarkLog.Size() : 0.,
+		worst, BenchmarkFile.GetChars());
+}
+
+//==========================================================================
+//
+// G_FinishBenchmark
+//
+// Writes the log and has the game quit at the end of the current tic.
+// Called when the demo or the tic budget runs out; quitting by any other
+// means still writes the log.
+//
+//==========================================================================
+
+void G_FinishBenchmark ()
+{
+	G_WriteBenchmark();
+	BenchmarkDone = true;
+}
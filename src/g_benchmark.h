@@ -0,0 +1,11 @@
+#ifndef __G_BENCHMARK_H
+#define __G_BENCHMARK_H
+
+extern bool benchmarking;
+
+void G_SetupBenchmark (const char *filename, int tics);
+void G_BenchmarkStartTic ();
+void G_BenchmarkEndTic ();
+void G_FinishBenchmark ();
+
+#endif
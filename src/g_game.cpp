@@ -91,6 +91,8 @@
 #include <zlib.h>
 
 #include "g_hub.h"
+#include "p_preload.h"
+#include "g_benchmark.h"
 
 
 static FRandom pr_dmspawn ("DMSpawn");
@@ -1213,10 +1215,12 @@ void G_Ticker ()
 
 	case GS_INTERMISSION:
 		WI_Ticker ();
+		P_PreloadTicker ();
 		break;
 
 	case GS_FINALE:
 		F_Ticker ();
+		P_PreloadTicker ();
 		break;
 
 	case GS_DEMOSCREEN:
@@ -2819,8 +2823,8 @@ void G_DoPlayDemo (void)
 //
 void G_TimeDemo (const char* name)
 {
-	nodrawers = !!Args->CheckParm ("-nodraw");
-	noblit = !!Args->CheckParm ("-noblit");
+	nodrawers = benchmarking || !!Args->CheckParm ("-nodraw");
+	noblit = benchmarking || !!Args->CheckParm ("-noblit");
 	timingdemo = true;
 	singletics = true;
 
@@ -2854,6 +2858,11 @@ bool G_CheckDemoStatus (void)
 		if (timingdemo)
 			endtime = I_GetTime (false) - starttime;
 
+		if (benchmarking)
+		{
+			G_FinishBenchmark ();
+		}
+
 		C_RestoreCVars ();		// [RH] Restore cvars demo might have changed
 		M_Free (demobuffer);
 		demobuffer = NULL;
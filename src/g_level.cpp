@@ -88,6 +88,7 @@
 #include "gi.h"
 
 #include "g_hub.h"
+#include "p_preload.h"
 
 #include <string.h>
 
@@ -888,6 +889,7 @@ void G_DoCompleted (void)
 //	if (statcopy)
 //		memcpy (statcopy, &wminfo, sizeof(wminfo));
 
+	P_StartPreload (nextlevel);
 	WI_Start (&wminfo);
 }
 
@@ -925,6 +927,8 @@ void G_DoLoadLevel (int position, bool autosave)
 	gamestate_t oldgs = gamestate;
 	int i;
 
+	P_FinishPreload ();
+
 	if (NextSkill >= 0)
 	{
 		UCVarValue val;
@@ -1005,6 +1009,7 @@ void G_DoLoadLevel (int position, bool autosave)
 
 	level.maptime = 0;
 	P_SetupLevel (level.MapName, position);
+	P_ReleasePreload ();
 
 	AM_LevelInit();
 
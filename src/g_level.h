@@ -223,6 +223,7 @@ enum ELevelFlags : unsigned int
 	
 	// More flags!
 	LEVEL3_FORCEFAKECONTRAST	= 0x00000001,	// forces fake contrast even with fog enabled
+	LEVEL3_FLOWFIELDS			= 0x00000002,	// monsters chasing players follow shared sector flow fields
 };
 
 
@@ -54,6 +54,7 @@
 #include "thingdef.h"
 #include "d_player.h"
 #include "doomerrors.h"
+#include "p_tickstats.h"
 
 extern void LoadActors ();
 extern void InitBotStuff();
@@ -73,6 +74,12 @@ bool FState::CallAction(AActor *self, AActor *stateowner, FStateParamInfo *info,
 {
 	if (ActionFunc != NULL)
 	{
+		cycle_t classcycles;
+		if (TickStatsActive)
+		{
+			classcycles.Reset();
+			classcycles.Clock();
+		}
 		ActionCycles.Clock();
 
 		VMValue params[3] = { self, stateowner, VMValue(info, ATAG_GENERIC) };
@@ -119,6 +126,13 @@ bool FState::CallAction(AActor *self, AActor *stateowner, FStateParamInfo *info,
 		}
 
 		ActionCycles.Unclock();
+		if (TickStatsActive && self != NULL)
+		{
+			classcycles.Unclock();
+			FClassTickStats &stats = P_GetClassTickStats(self->GetClass());
+			stats.ActionTime += classcycles.TimeMS();
+			stats.Actions++;
+		}
 		return true;
 	}
 	else
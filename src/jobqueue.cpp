@@ -0,0 +1,274 @@
+/*
+** jobqueue.cpp
+** Worker thread pool for loading and setup code
+**
+**---------------------------------------------------------------------------
+** Copyright 2016 The ZDoom Team
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+** 3. The name of the author may not be used to endorse or promote products
+**    derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+** OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+** INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+** NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+** THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**---------------------------------------------------------------------------
+**
+*/
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <exception>
+#include <string>
+#include "doomtype.h"
+#include "doomerrors.h"
+#include "v_text.h"
+#include "jobqueue.h"
+
+//==========================================================================
+//
+// The pool itself. Threads are only started when the first job is queued.
+//
+//==========================================================================
+
+class FJobPool
+{
+public:
+	std::mutex Mutex;
+	std::condition_variable Signal;
+	std::deque<std::function<void()>> Jobs;
+	std::vector<std::thread> Threads;
+	std::vector<std::string> Failures;
+	bool Shutdown = false;
+
+	static FJobPool *Instance()
+	{
+		static FJobPool pool;
+		return &pool;
+	}
+
+	int NumWorkers()
+	{
+		int num = (int)std::thread::hardware_concurrency() - 1;
+		return num < 1 ? 1 : num;
+	}
+
+	void StartThreads();
+	void WorkerMain();
+
+	~FJobPool()
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		Shutdown = true;
+		lock.unlock();
+		Signal.notify_all();
+		for (auto &thread : Threads)
+		{
+			thread.join();
+		}
+	}
+};
+
+static thread_local bool InWorkerThread;
+
+void FJobPool::StartThreads()
+{
+	// Must be called with the mutex held.
+	if (!Threads.empty())
+		return;
+
+	int num = NumWorkers();
+	for (int i = 0; i < num; i++)
+	{
+		Threads.push_back(std::thread([this]() { WorkerMain(); }));
+	}
+}
+
+void FJobPool::WorkerMain()
+{
+	InWorkerThread = true;
+	while (true)
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		Signal.wait(lock, [this]() { return Shutdown || !Jobs.empty(); });
+		if (Jobs.empty())
+			break;
+		std::function<void()> job = std::move(Jobs.front());
+		Jobs.pop_front();
+		lock.unlock();
+
+		std::string failure;
+		try
+		{
+			job();
+		}
+		catch (CDoomError &err)
+		{
+			failure = err.GetMessage() != NULL ? err.GetMessage() : "unknown error";
+		}
+		catch (std::exception &err)
+		{
+			failure = err.what();
+		}
+		catch (...)
+		{
+			failure = "unknown error";
+		}
+		if (!failure.empty())
+		{
+			lock.lock();
+			Failures.push_back(std::move(failure));
+		}
+	}
+}
+
+//==========================================================================
+//
+// FJobQueue :: Run
+//
+//==========================================================================
+
+void FJobQueue::Run(std::function<void()> job)
+{
+	FJobPool *pool = FJobPool::Instance();
+	std::unique_lock<std::mutex> lock(pool->Mutex);
+	pool->StartThreads();
+	pool->Jobs.push_back(std::move(job));
+	lock.unlock();
+	pool->Signal.notify_one();
+}
+
+//==========================================================================
+//
+// FJobQueue :: ReportFailures
+//
+//==========================================================================
+
+void FJobQueue::ReportFailures()
+{
+	FJobPool *pool = FJobPool::Instance();
+	std::vector<std::string> failures;
+	{
+		std::lock_guard<std::mutex> lock(pool->Mutex);
+		if (pool->Failures.empty())
+		{
+			return;
+		}
+		failures.swap(pool->Failures);
+	}
+	for (auto &failure : failures)
+	{
+		Printf(TEXTCOLOR_RED "Background job failed: %s\n", failure.c_str());
+	}
+}
+
+//==========================================================================
+//
+// FJobQueue :: ParallelFor
+//
+// The calling thread works on the range as well, so this may safely be
+// used from within a job without deadlocking the pool.
+//
+//==========================================================================
+
+void FJobQueue::ParallelFor(int count, const std::function<void(int)> &body)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+	if (count == 1)
+	{
+		body(0);
+		return;
+	}
+
+	struct FState
+	{
+		std::atomic<int> Next;
+		std::atomic<int> Done;
+		std::mutex Mutex;
+		std::condition_variable Finished;
+		std::exception_ptr Error;
+	};
+	auto state = std::make_shared<FState>();
+	state->Next = 0;
+	state->Done = 0;
+
+	const std::function<void(int)> *bodyp = &body;
+	auto work = [state, bodyp, count]()
+	{
+		int finished = 0;
+		int i;
+		while ((i = state->Next++) < count)
+		{
+			try
+			{
+				(*bodyp)(i);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(state->Mutex);
+				if (!state->Error) state->Error = std::current_exception();
+			}
+			finished++;
+		}
+		if (finished > 0 && (state->Done += finished) == count)
+		{
+			std::lock_guard<std::mutex> lock(state->Mutex);
+			state->Finished.notify_all();
+		}
+	};
+
+	int helpers = NumThreads() - 1;
+	if (helpers > count - 1) helpers = count - 1;
+	for (int i = 0; i < helpers; i++)
+	{
+		Run(work);
+	}
+	work();
+
+	std::unique_lock<std::mutex> lock(state->Mutex);
+	state->Finished.wait(lock, [&]() { return state->Done == count; });
+	if (state->Error)
+	{
+		std::rethrow_exception(state->Error);
+	}
+}
+
+//==========================================================================
+//
+// FJobQueue :: NumThreads
+//
+//==========================================================================
+
+int FJobQueue::NumThreads()
+{
+	return FJobPool::Instance()->NumWorkers() + 1;
+}
+
+bool FJobQueue::IsWorkerThread()
+{
+	return InWorkerThread;
+}
@@ -0,0 +1,69 @@
+/*
+** jobqueue.h
+** Worker thread pool for loading and setup code
+**
+**---------------------------------------------------------------------------
+** Copyright 2016 The ZDoom Team
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+** 3. The name of the author may not be used to endorse or promote products
+**    derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+** OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+** INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+** NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+** THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**---------------------------------------------------------------------------
+**
+*/
+
+#ifndef __JOBQUEUE_H
+#define __JOBQUEUE_H
+
+#include <functional>
+
+// Jobs run on worker threads, so they must not touch the console, the
+// playsim or anything else that is only safe to use from the main thread.
+// They must also not rely on the file system's shared readers; read the
+// data on the main thread and hand it over instead. M_Malloc and the
+// containers built on it (TArray, TMap) keep the garbage collector's
+// allocation count, which is not thread safe, so jobs allocate with new
+// or the standard containers.
+
+class FJobQueue
+{
+public:
+	// Queues a job and returns immediately. If the job throws, the error is
+	// kept for ReportFailures.
+	static void Run(std::function<void()> job);
+
+	// Prints the errors of failed jobs. Must be called from the main thread.
+	static void ReportFailures();
+
+	// Calls body(0) .. body(count-1) on the workers and the calling thread and
+	// returns once all of them have finished. The first exception thrown by any
+	// of them is rethrown here.
+	static void ParallelFor(int count, const std::function<void(int)> &body);
+
+	// Number of threads ParallelFor can use, including the caller.
+	static int NumThreads();
+
+	static bool IsWorkerThread();
+};
+
+#endif
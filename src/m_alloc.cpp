@@ -44,6 +44,7 @@
 
 #include "i_system.h"
 #include "dobject.h"
+#include "resourcefiles/resourcefile.h"
 
 #ifndef _MSC_VER
 #define _NORMAL_BLOCK			0
@@ -63,6 +64,8 @@
 void *M_Malloc(size_t size)
 {
 	void *block = malloc(size);
+	if (block == NULL && FResourceLump::ReleaseUnusedCaches(size) > 0)
+		block = malloc(size);
 
 	if (block == NULL)
 		I_FatalError("Could not malloc %zu bytes", size);
@@ -78,6 +81,8 @@ void *M_Realloc(void *memblock, size_t size)
 		GC::AllocBytes -= _msize(memblock);
 	}
 	void *block = realloc(memblock, size);
+	if (block == NULL && FResourceLump::ReleaseUnusedCaches(size) > 0)
+		block = realloc(memblock, size);
 	if (block == NULL)
 	{
 		I_FatalError("Could not realloc %zu bytes", size);
@@ -89,6 +94,8 @@ void *M_Realloc(void *memblock, size_t size)
 void *M_Malloc(size_t size)
 {
 	void *block = malloc(size+sizeof(size_t));
+	if (block == NULL && FResourceLump::ReleaseUnusedCaches(size) > 0)
+		block = malloc(size+sizeof(size_t));
 
 	if (block == NULL)
 		I_FatalError("Could not malloc %zu bytes", size);
@@ -111,6 +118,8 @@ void *M_Realloc(void *memblock, size_t size)
 		GC::AllocBytes -= _msize(memblock);
 	}
 	void *block = realloc(((size_t*) memblock)-1, size+sizeof(size_t));
+	if (block == NULL && FResourceLump::ReleaseUnusedCaches(size) > 0)
+		block = realloc(((size_t*) memblock)-1, size+sizeof(size_t));
 	if (block == NULL)
 	{
 		I_FatalError("Could not realloc %zu bytes", size);
@@ -133,6 +142,8 @@ void *M_Realloc(void *memblock, size_t size)
 void *M_Malloc_Dbg(size_t size, const char *file, int lineno)
 {
 	void *block = _malloc_dbg(size, _NORMAL_BLOCK, file, lineno);
+	if (block == NULL && FResourceLump::ReleaseUnusedCaches(size) > 0)
+		block = _malloc_dbg(size, _NORMAL_BLOCK, file, lineno);
 
 	if (block == NULL)
 		I_FatalError("Could not malloc %zu bytes", size);
@@ -148,6 +159,8 @@ void *M_Realloc_Dbg(void *memblock, size_t size, const char *file, int lineno)
 		GC::AllocBytes -= _msize(memblock);
 	}
 	void *block = _realloc_dbg(memblock, size, _NORMAL_BLOCK, file, lineno);
+	if (block == NULL && FResourceLump::ReleaseUnusedCaches(size) > 0)
+		block = _realloc_dbg(memblock, size, _NORMAL_BLOCK, file, lineno);
 	if (block == NULL)
 	{
 		I_FatalError("Could not realloc %zu bytes", size);
@@ -159,6 +172,8 @@ void *M_Realloc_Dbg(void *memblock, size_t size, const char *file, int lineno)
 void *M_Malloc_Dbg(size_t size, const char *file, int lineno)
 {
 	void *block = _malloc_dbg(size+sizeof(size_t), _NORMAL_BLOCK, file, lineno);
+	if (block == NULL && FResourceLump::ReleaseUnusedCaches(size) > 0)
+		block = _malloc_dbg(size+sizeof(size_t), _NORMAL_BLOCK, file, lineno);
 
 	if (block == NULL)
 		I_FatalError("Could not malloc %zu bytes", size);
@@ -181,6 +196,8 @@ void *M_Realloc_Dbg(void *memblock, size_t size, const char *file, int lineno)
 		GC::AllocBytes -= _msize(memblock);
 	}
 	void *block = _realloc_dbg(((size_t*) memblock)-1, size+sizeof(size_t), _NORMAL_BLOCK, file, lineno);
+	if (block == NULL && FResourceLump::ReleaseUnusedCaches(size) > 0)
+		block = _realloc_dbg(((size_t*) memblock)-1, size+sizeof(size_t), _NORMAL_BLOCK, file, lineno);
 
 	if (block == NULL)
 	{
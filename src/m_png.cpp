@@ -37,6 +37,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <zlib.h>
+#include <vector>
 #ifdef _MSC_VER
 #include <malloc.h>		// for alloca()
 #endif
@@ -49,6 +50,7 @@
 #include "m_png.h"
 #include "templates.h"
 #include "files.h"
+#include "x86.h"
 
 // MACROS ------------------------------------------------------------------
 
@@ -698,6 +700,125 @@ bool M_ReadIDAT (FileReader *file, BYTE *buffer, int width, int height, int pitc
 	return true;
 }
 
+//==========================================================================
+//
+// M_ReadIDATRows
+//
+// Decodes a non-interlaced image one row at a time, so the caller can
+// convert it straight into its final layout without a full-size
+// temporary buffer.
+//
+//==========================================================================
+
+bool M_ReadIDATRows (FileReader *file, int width, int height, BYTE bitdepth, BYTE colortype,
+					 unsigned int chunklen, void (*rowfunc)(void *userdata, int y, const BYTE *row), void *userdata)
+{
+	Byte chunkbuffer[4096];
+	z_stream stream;
+	int err;
+	int y;
+	bool lastIDAT;
+	int bytesPerRowIn;
+	int bytesPerPixel;
+
+	switch (colortype)
+	{
+	case 2:		bytesPerPixel = 3;		break;		// RGB
+	case 4:		bytesPerPixel = 2;		break;		// LA
+	case 6:		bytesPerPixel = 4;		break;		// RGBA
+	default:	bytesPerPixel = 1;		break;
+	}
+
+	switch (bitdepth)
+	{
+	case 8:		bytesPerRowIn = width * bytesPerPixel;	break;
+	case 4:		bytesPerRowIn = (width+1)/2;			break;
+	case 2:		bytesPerRowIn = (width+3)/4;			break;
+	case 1:		bytesPerRowIn = (width+7)/8;			break;
+	default:	return false;
+	}
+
+	// One line of filtered input, two lines of unfiltered output and
+	// space for unpacking low bit depth lines.
+	// This may run on a worker thread, so no TArray here.
+	std::vector<Byte> buffer(1 + bytesPerRowIn * 3 + width);
+	Byte *inputLine = &buffer[0];
+	Byte *prev = inputLine + 1 + bytesPerRowIn;
+	Byte *curr = prev + bytesPerRowIn;
+	Byte *unpacked = curr + bytesPerRowIn;
+	memset (prev, 0, bytesPerRowIn);
+
+	stream.next_in = Z_NULL;
+	stream.avail_in = 0;
+	stream.zalloc = Z_NULL;
+	stream.zfree = Z_NULL;
+	err = inflateInit (&stream);
+	if (err != Z_OK)
+	{
+		return false;
+	}
+	lastIDAT = false;
+	y = 0;
+	stream.next_out = inputLine;
+	stream.avail_out = bytesPerRowIn + 1;
+
+	while (err != Z_STREAM_END && y < height)
+	{
+		if (stream.avail_in == 0 && chunklen > 0)
+		{
+			stream.next_in = chunkbuffer;
+			stream.avail_in = (uInt)file->Read (chunkbuffer, MIN<long>(chunklen,sizeof(chunkbuffer)));
+			chunklen -= stream.avail_in;
+		}
+
+		err = inflate (&stream, Z_SYNC_FLUSH);
+		if (err != Z_OK && err != Z_STREAM_END)
+		{ // something unexpected happened
+			inflateEnd (&stream);
+			return false;
+		}
+
+		if (stream.avail_out == 0)
+		{
+			UnfilterRow (bytesPerRowIn, curr, inputLine, prev, bytesPerPixel);
+			if (bitdepth < 8)
+			{
+				UnpackPixels (width, bytesPerRowIn, bitdepth, curr, unpacked, colortype == 0);
+				rowfunc (userdata, y, unpacked);
+			}
+			else
+			{
+				rowfunc (userdata, y, curr);
+			}
+			std::swap (prev, curr);
+			y++;
+			stream.next_out = inputLine;
+			stream.avail_out = bytesPerRowIn + 1;
+		}
+
+		if (chunklen == 0 && !lastIDAT)
+		{
+			DWORD x[3];
+
+			if (file->Read (x, 12) != 12)
+			{
+				lastIDAT = true;
+			}
+			else if (x[2] != MAKE_ID('I','D','A','T'))
+			{
+				lastIDAT = true;
+			}
+			else
+			{
+				chunklen = BigLong((unsigned int)x[1]);
+			}
+		}
+	}
+
+	inflateEnd (&stream);
+	return true;
+}
+
 // PRIVATE CODE ------------------------------------------------------------
 
 
@@ -1076,6 +1197,13 @@ void UnfilterRow (int width, BYTE *dest, BYTE *row, BYTE *prev, int bpp)
 {
 	int x;
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__i386__) || defined(__amd64__)
+	if (CPU.bSSE2 && UnfilterRow_SSE2 (width, dest, row, prev, bpp))
+	{
+		return;
+	}
+#endif
+
 	switch (*row++)
 	{
 	case 1:		// Sub
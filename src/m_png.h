@@ -111,6 +111,12 @@ bool M_GetPNGText (PNGHandle *png, const char *keyword, char *buffer, size_t buf
 bool M_ReadIDAT (FileReader *file, BYTE *buffer, int width, int height, int pitch,
 				 BYTE bitdepth, BYTE colortype, BYTE interlace, unsigned int idatlen);
 
+// Same as M_ReadIDAT, but each row is passed to rowfunc as soon as it has
+// been decoded instead of storing the entire image. Rows with less than 8
+// bits per pixel are unpacked to one byte per pixel. Non-interlaced only.
+bool M_ReadIDATRows (FileReader *file, int width, int height, BYTE bitdepth, BYTE colortype,
+				 unsigned int idatlen, void (*rowfunc)(void *userdata, int y, const BYTE *row), void *userdata);
+
 
 class FTexture;
 
@@ -50,12 +50,27 @@
 #include "tarray.h"
 #include "m_bbox.h"
 #include "c_console.h"
+#include "c_cvars.h"
+#include "c_dispatch.h"
 #include "r_state.h"
+#include "stats.h"
+#include "jobqueue.h"
+
+#include <atomic>
 
 const int MaxSegs = 64;
 const int SplitCost = 8;
 const int AAPreference = 16;
 
+// Below this many segs times candidates, starting threads costs more than
+// scoring the candidates on one.
+const unsigned int ParallelSplitterWork = 1 << 16;
+
+// Smaller sets are not worth lining up for the batched classifier.
+const unsigned int MinBatchSegs = 32;
+
+CVAR(Bool, nodebuild_multithreaded, true, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
+
 #if 0
 #define D(x) x
 #else
@@ -67,6 +82,7 @@ FNodeBuilder::FNodeBuilder(FLevel &level)
 {
 	VertexMap = NULL;
 	OldVertexTable = NULL;
+	BatchClassify = false;
 }
 
 FNodeBuilder::FNodeBuilder (FLevel &level,
@@ -74,6 +90,7 @@ FNodeBuilder::FNodeBuilder (FLevel &level,
 							bool makeGLNodes)
 	: Level(level), GLNodes(makeGLNodes), SegsStuffed(0)
 {
+	BatchClassify = false;
 	VertexMap = new FVertexMap (*this, Level.MinX, Level.MinY, Level.MaxX, Level.MaxY);
 	FindUsedVertices (Level.Vertices, Level.NumVertices);
 	MakeSegsFromSides ();
@@ -436,7 +453,23 @@ bool FNodeBuilder::ShoveSegBehind (DWORD set, node_t &node, DWORD seg, DWORD mat
 		node.dx = -node.dx;
 		node.dy = -node.dy;
 	}
-	return Heuristic (node, set, false) > 0;
+	return Heuristic (node, set, false, Touched, Colinear) > 0;
+}
+
+// Returns how many threads SelectSplitter should score its candidates on.
+static int SplitterThreads (unsigned int candidates, unsigned int segs)
+{
+#ifdef BACKPATCH
+	// ClassifyLineBackpatch patches its caller on first use, which is not
+	// safe to do from several threads at once.
+	return 1;
+#else
+	if (!nodebuild_multithreaded || candidates < 2 || double(candidates) * segs < ParallelSplitterWork)
+	{
+		return 1;
+	}
+	return clamp<int> (FJobQueue::NumThreads(), 1, MIN<int> (candidates, 16));
+#endif
 }
 
 // Splitters are chosen to coincide with segs in the given set. To reduce the
@@ -453,6 +486,7 @@ int FNodeBuilder::SelectSplitter (DWORD set, node_t &node, DWORD &splitseg, int
 	DWORD bestseg;
 	DWORD seg;
 	bool nosplitters = false;
+	unsigned int segsInSet = 0;
 
 	bestvalue = 0;
 	bestseg = DWORD_MAX;
@@ -464,6 +498,10 @@ int FNodeBuilder::SelectSplitter (DWORD set, node_t &node, DWORD &splitseg, int
 
 	D(Printf (PRINT_LOG, "Processing set %d\n", set));
 
+	// Pick out the candidates first. Scoring them does not change anything,
+	// so they can be scored in any order and on any thread, as long as the
+	// best one is then chosen in the original order.
+	SplitterCandidates.Clear();
 	while (seg != DWORD_MAX)
 	{
 		FPrivSeg *pseg = &Segs[seg];
@@ -481,31 +519,81 @@ int FNodeBuilder::SelectSplitter (DWORD set, node_t &node, DWORD &splitseg, int
 				}
 
 				stepleft = step;
-				SetNodeFromSeg (node, pseg);
+				SplitterCandidates.Push (seg);
+			}
+		}
 
-				int value = Heuristic (node, set, nosplit);
+		segsInSet++;
+		seg = pseg->next;
+	}
 
-				D(Printf (PRINT_LOG, "Seg %5d, ld %d (%5d,%5d)-(%5d,%5d) scores %d\n", seg, Segs[seg].linedef, node.x>>16, node.y>>16,
-					(node.x+node.dx)>>16, (node.y+node.dy)>>16, value));
+	unsigned int count = SplitterCandidates.Size();
+	int numthreads = SplitterThreads (count, segsInSet);
 
-				if (value > bestvalue)
-				{
-					bestvalue = value;
-					bestseg = seg;
-				}
-				else if (value < 0)
-				{
-					nosplitters = true;
-				}
-			}
+	// Line up the set's vertices for the batched classifier, if there
+	// is one and the set is big enough to make it worth it.
+	BatchClassify = false;
+#ifdef NODEBUILD_AVX2
+	if (CPU.bAVX2 && count > 1 && segsInSet >= MinBatchSegs)
+	{
+		SetX1.Resize (segsInSet);
+		SetY1.Resize (segsInSet);
+		SetX2.Resize (segsInSet);
+		SetY2.Resize (segsInSet);
+		unsigned int i = 0;
+		for (seg = set; seg != DWORD_MAX; seg = Segs[seg].next, ++i)
+		{
+			const FPrivVert &v1 = Vertices[Segs[seg].v1];
+			const FPrivVert &v2 = Vertices[Segs[seg].v2];
+			SetX1[i] = v1.x;
+			SetY1[i] = v1.y;
+			SetX2[i] = v2.x;
+			SetY2[i] = v2.y;
+		}
+		BatchClassify = true;
+	}
+#endif
+
+	SplitterScores.Resize (count);
+	if (numthreads > 1)
+	{
+		ScoreSplitters (set, nosplit, numthreads, segsInSet);
+	}
+	else
+	{
+		TArray<signed char> sides;
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			SetNodeFromSeg (node, &Segs[SplitterCandidates[i]]);
+			SplitterScores[i] = Heuristic (node, set, nosplit, Touched, Colinear, BatchClassify ? &sides : NULL);
 		}
+	}
+	BatchClassify = false;
 
-		seg = pseg->next;
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		int value = SplitterScores[i];
+
+		D(Printf (PRINT_LOG, "Seg %5d, ld %d scores %d\n", SplitterCandidates[i], Segs[SplitterCandidates[i]].linedef, value));
+
+		if (value > bestvalue)
+		{
+			bestvalue = value;
+			bestseg = SplitterCandidates[i];
+		}
+		else if (value < 0)
+		{
+			nosplitters = true;
+		}
 	}
 
 	if (bestseg == DWORD_MAX)
 	{ // No lines split any others into two sets, so this is a convex region.
 	D(Printf (PRINT_LOG, "set %d, step %d, nosplit %d has no good splitter (%d)\n", set, step, nosplit, nosplitters));
+		if (count > 0)
+		{ // Leave the node as the last candidate, like always.
+			SetNodeFromSeg (node, &Segs[SplitterCandidates[count - 1]]);
+		}
 		return nosplitters ? -1 : 0;
 	}
 
@@ -516,13 +604,61 @@ int FNodeBuilder::SelectSplitter (DWORD set, node_t &node, DWORD &splitseg, int
 	return 1;
 }
 
+// Scores SplitterCandidates into SplitterScores on the job queue. Each
+// thread takes the next unscored candidate until none are left.
+void FNodeBuilder::ScoreSplitters (DWORD set, bool nosplit, int numthreads, unsigned int segsInSet)
+{
+	// A splitter cannot touch more loops than there are segs in the set,
+	// and the batched classifier needs one side per seg, so with this much
+	// room reserved nothing gets reallocated while scoring.
+	if (SplitterScratch.Size() < (unsigned int)numthreads)
+	{
+		SplitterScratch.Resize (numthreads);
+	}
+	for (int t = 0; t < numthreads; ++t)
+	{
+		FSplitterScratch &scratch = SplitterScratch[t];
+		scratch.Touched.Clear ();
+		scratch.Touched.Grow (segsInSet);
+		scratch.Colinear.Clear ();
+		scratch.Colinear.Grow (segsInSet);
+		scratch.Sides.Clear ();
+		scratch.Sides.Grow (segsInSet);
+	}
+
+	std::atomic<unsigned int> next (0);
+	FJobQueue::ParallelFor (numthreads, [&](int t)
+	{
+		FSplitterScratch &scratch = SplitterScratch[t];
+		node_t node;
+		unsigned int i;
+
+		while ((i = next++) < SplitterCandidates.Size())
+		{
+			SetNodeFromSeg (node, &Segs[SplitterCandidates[i]]);
+			SplitterScores[i] = Heuristic (node, set, nosplit, scratch.Touched, scratch.Colinear, BatchClassify ? &scratch.Sides : NULL);
+		}
+	});
+}
+
 // Given a splitter (node), returns a score based on how "good" the resulting
 // split in a set of segs is. Higher scores are better. -1 means this splitter
 // splits something it shouldn't and will only be returned if honorNoSplit is
 // true. A score of 0 means that the splitter does not split any of the segs
 // in the set.
 
-int FNodeBuilder::Heuristic (node_t &node, DWORD set, bool honorNoSplit)
+// Runs the batched classifier over the set lined up by SelectSplitter.
+void FNodeBuilder::ClassifySet (node_t &node, TArray<signed char> &sides)
+{
+	sides.Resize (SetX1.Size());
+#ifdef NODEBUILD_AVX2
+	ClassifyLinesAVX2 (node, &SetX1[0], &SetY1[0], &SetX2[0], &SetY2[0], SetX1.Size(), &sides[0]);
+#else
+	memset (&sides[0], CLASSIFY_SLOW, sides.Size());
+#endif
+}
+
+int FNodeBuilder::Heuristic (node_t &node, DWORD set, bool honorNoSplit, TArray<int> &touched, TArray<int> &colinear, TArray<signed char> *sides)
 {
 	// Set the initial score above 0 so that near vertex anti-weighting is less likely to produce a negative score.
 	int score = 1000000;
@@ -537,8 +673,15 @@ int FNodeBuilder::Heuristic (node_t &node, DWORD set, bool honorNoSplit)
 	unsigned int max, m2, p, q;
 	double frac;
 
-	Touched.Clear ();
-	Colinear.Clear ();
+	unsigned int lane = 0;
+
+	touched.Clear ();
+	colinear.Clear ();
+
+	if (sides != NULL)
+	{
+		ClassifySet (node, *sides);
+	}
 
 	while (i != DWORD_MAX)
 	{
@@ -548,10 +691,22 @@ int FNodeBuilder::Heuristic (node_t &node, DWORD set, bool honorNoSplit)
 		{
 			side = 1;
 		}
+		else if (sides != NULL && (*sides)[lane] != CLASSIFY_SLOW)
+		{
+			side = (*sides)[lane];
+			switch (side)
+			{
+			case 0:							sidev[0] = sidev[1] = -1;				break;
+			case 1:							sidev[0] = sidev[1] = 1;				break;
+			case CLASSIFY_SPLIT_BACKFRONT:	sidev[0] = 1;	sidev[1] = -1;			break;
+			default:						sidev[0] = -1;	sidev[1] = 1;	side = -1;	break;
+			}
+		}
 		else
 		{
 			side = ClassifyLine (node, &Vertices[test->v1], &Vertices[test->v2], sidev);
 		}
+		lane++;
 		switch (side)
 		{
 		case 0:	// Seg is on only one side of the partition
@@ -564,32 +719,32 @@ int FNodeBuilder::Heuristic (node_t &node, DWORD set, bool honorNoSplit)
 			{
 				if ((sidev[0] | sidev[1]) != 0)
 				{
-					max = Touched.Size();
+					max = touched.Size();
 					for (p = 0; p < max; ++p)
 					{
-						if (Touched[p] == test->loopnum)
+						if (touched[p] == test->loopnum)
 						{
 							break;
 						}
 					}
 					if (p == max)
 					{
-						Touched.Push (test->loopnum);
+						touched.Push (test->loopnum);
 					}
 				}
 				else
 				{
-					max = Colinear.Size();
+					max = colinear.Size();
 					for (p = 0; p < max; ++p)
 					{
-						if (Colinear[p] == test->loopnum)
+						if (colinear[p] == test->loopnum)
 						{
 							break;
 						}
 					}
 					if (p == max)
 					{
-						Colinear.Push (test->loopnum);
+						colinear.Push (test->loopnum);
 					}
 				}
 			}
@@ -706,8 +861,8 @@ int FNodeBuilder::Heuristic (node_t &node, DWORD set, bool honorNoSplit)
 	// seg of that sector must be crossing the container's corner and does not
 	// actually split the container.
 
-	max = Touched.Size ();
-	m2 = Colinear.Size ();
+	max = touched.Size ();
+	m2 = colinear.Size ();
 
 	// If honorNoSplit is false, then both these lists will be empty.
 
@@ -720,10 +875,10 @@ int FNodeBuilder::Heuristic (node_t &node, DWORD set, bool honorNoSplit)
 
 	for (p = 0; p < max; ++p)
 	{
-		int look = Touched[p];
+		int look = touched[p];
 		for (q = 0; q < m2; ++q)
 		{
-			if (look == Colinear[q])
+			if (look == colinear[q])
 			{
 				break;
 			}
@@ -1063,6 +1218,115 @@ void FNodeBuilder::PrintSet (int l, DWORD set)
 	Printf (PRINT_LOG, "*\n");
 }
 
+#ifdef _DEBUG
+//===========================================================================
+//
+// CCMD classifytest
+//
+// Classifies every line of the current level against a number of the
+// level's lines, once with ClassifyLine2 and once with the batched
+// classifier, and compares the times and the results. Lanes the batched
+// classifier leaves to the scalar code are counted but not timed again.
+//
+//===========================================================================
+
+CCMD(classifytest)
+{
+	if (numlines == 0)
+	{
+		Printf("No level loaded\n");
+		return;
+	}
+
+	int count = 256;
+	if (argv.argc() > 1)
+	{
+		count = MAX(1, atoi(argv[1]));
+	}
+
+	TArray<FSimpleVert> v1, v2;
+	TArray<fixed_t> x1, y1, x2, y2;
+	TArray<signed char> sides;
+	v1.Resize(numlines);
+	v2.Resize(numlines);
+	x1.Resize(numlines);
+	y1.Resize(numlines);
+	x2.Resize(numlines);
+	y2.Resize(numlines);
+	sides.Resize(numlines);
+	for (int i = 0; i < numlines; ++i)
+	{
+		x1[i] = v1[i].x = lines[i].v1->fixX();
+		y1[i] = v1[i].y = lines[i].v1->fixY();
+		x2[i] = v2[i].x = lines[i].v2->fixX();
+		y2[i] = v2[i].y = lines[i].v2->fixY();
+	}
+
+	cycle_t scalartime, batchtime;
+	unsigned int fast = 0, mismatches = 0;
+	TArray<signed char> expect;
+	expect.Resize(numlines);
+
+	scalartime.Reset();
+	batchtime.Reset();
+	for (int n = 0; n < count; ++n)
+	{
+		const line_t *splitter = &lines[(unsigned)n * 7919u % (unsigned)numlines];
+		node_t node;
+		node.x = splitter->v1->fixX();
+		node.y = splitter->v1->fixY();
+		node.dx = splitter->v2->fixX() - node.x;
+		node.dy = splitter->v2->fixY() - node.y;
+		if (node.dx == 0 && node.dy == 0)
+		{
+			continue;
+		}
+
+		scalartime.Clock();
+		for (int i = 0; i < numlines; ++i)
+		{
+			int sidev[2];
+			int side = ClassifyLine2(node, &v1[i], &v2[i], sidev);
+			if (side == -1)
+			{
+				side = sidev[0] == 1 ? CLASSIFY_SPLIT_BACKFRONT : CLASSIFY_SPLIT_FRONTBACK;
+			}
+			expect[i] = side;
+		}
+		scalartime.Unclock();
+
+#ifdef NODEBUILD_AVX2
+		if (CPU.bAVX2)
+		{
+			batchtime.Clock();
+			ClassifyLinesAVX2(node, &x1[0], &y1[0], &x2[0], &y2[0], numlines, &sides[0]);
+			batchtime.Unclock();
+		}
+		else
+#endif
+		{
+			memset(&sides[0], CLASSIFY_SLOW, numlines);
+		}
+
+		for (int i = 0; i < numlines; ++i)
+		{
+			if (sides[i] != CLASSIFY_SLOW)
+			{
+				fast++;
+				if (sides[i] != expect[i])
+				{
+					mismatches++;
+				}
+			}
+		}
+	}
+
+	Printf("%d splitters x %d lines: scalar %.3f ms, batched %.3f ms, %u resolved in batch%s\n",
+		count, numlines, scalartime.TimeMS(), batchtime.TimeMS(), fast,
+		mismatches != 0 ? ", MISMATCH" : "");
+}
+#endif
+
 
 
 #ifdef BACKPATCH
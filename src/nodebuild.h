@@ -53,9 +53,21 @@ struct FSimpleVert
 	fixed_t x, y;
 };
 
+// Results of the batched classifiers besides 0 (front) and 1 (back)
+enum
+{
+	CLASSIFY_SPLIT_BACKFRONT = -1,	// Cut, with v1 behind the splitter
+	CLASSIFY_SPLIT_FRONTBACK = -2,	// Cut, with v1 in front of the splitter
+	CLASSIFY_SLOW = 2				// Too close to call; use ClassifyLine
+};
+
 extern "C"
 {
 	int ClassifyLine2 (node_t &node, const FSimpleVert *v1, const FSimpleVert *v2, int sidev[2]);
+#ifdef NODEBUILD_AVX2
+	void ClassifyLinesAVX2 (node_t &node, const fixed_t *x1, const fixed_t *y1,
+		const fixed_t *x2, const fixed_t *y2, int count, signed char *sides);
+#endif
 #ifndef DISABLE_SSE
 	int ClassifyLineSSE1 (node_t &node, const FSimpleVert *v1, const FSimpleVert *v2, int sidev[2]);
 	int ClassifyLineSSE2 (node_t &node, const FSimpleVert *v1, const FSimpleVert *v2, int sidev[2]);
@@ -245,6 +257,19 @@ private:
 
 	TArray<int> Touched;	// Loops a splitter touches on a vertex
 	TArray<int> Colinear;	// Loops with edges colinear to a splitter
+	TArray<DWORD> SplitterCandidates;	// Segs SelectSplitter wants scored
+	TArray<int> SplitterScores;			// Heuristic() for each candidate
+	TArray<fixed_t> SetX1, SetY1, SetX2, SetY2;	// The scored set's vertices, for batched classifying
+	bool BatchClassify;					// SetX1 etc. are valid for the set being scored
+
+	// Work space for one thread scoring splitters. It is allocated on the
+	// calling thread, since TArray must not allocate on the workers.
+	struct FSplitterScratch
+	{
+		TArray<int> Touched, Colinear;
+		TArray<signed char> Sides;
+	};
+	TArray<FSplitterScratch> SplitterScratch;
 	FEventTree Events;		// Vertices intersected by the current splitter
 
 	TArray<FSplitSharer> SplitSharers;	// Segs colinear with the current splitter
@@ -273,9 +298,11 @@ private:
 	bool CheckSubsector (DWORD set, node_t &node, DWORD &splitseg);
 	bool CheckSubsectorOverlappingSegs (DWORD set, node_t &node, DWORD &splitseg);
 	bool ShoveSegBehind (DWORD set, node_t &node, DWORD seg, DWORD mate);	int SelectSplitter (DWORD set, node_t &node, DWORD &splitseg, int step, bool nosplit);
+	void ScoreSplitters (DWORD set, bool nosplit, int numthreads, unsigned int segsInSet);
 	void SplitSegs (DWORD set, node_t &node, DWORD splitseg, DWORD &outset0, DWORD &outset1, unsigned int &count0, unsigned int &count1);
 	DWORD SplitSeg (DWORD segnum, int splitvert, int v1InFront);
-	int Heuristic (node_t &node, DWORD set, bool honorNoSplit);
+	int Heuristic (node_t &node, DWORD set, bool honorNoSplit, TArray<int> &touched, TArray<int> &colinear, TArray<signed char> *sides = NULL);
+	void ClassifySet (node_t &node, TArray<signed char> &sides);
 
 	// Returns:
 	//	0 = seg is in front
@@ -0,0 +1,76 @@
+#ifdef NODEBUILD_AVX2
+
+#include <immintrin.h>
+
+#include "doomtype.h"
+#include "nodebuild.h"
+
+#define FAR_ENOUGH 17179869184.f		// 4<<32
+
+// Classifies count segs against one splitter, four at a time. The segs'
+// vertices come in separate x1/y1/x2/y2 arrays. Only segs that lie well
+// away from the splitter at both ends are decided here; those are the
+// vast majority. Everything else gets CLASSIFY_SLOW and must be passed
+// through ClassifyLine by the caller.
+//
+// The side numbers are computed with the same double operations in the
+// same order as ClassifyLine2, so the answers are identical. This file
+// must not be compiled with FMA enabled, or the compiler could fuse them.
+
+extern "C" void ClassifyLinesAVX2 (node_t &node, const fixed_t *x1, const fixed_t *y1,
+	const fixed_t *x2, const fixed_t *y2, int count, signed char *sides)
+{
+	const __m256d d_x1 = _mm256_set1_pd (double(node.x));
+	const __m256d d_y1 = _mm256_set1_pd (double(node.y));
+	const __m256d d_dx = _mm256_set1_pd (double(node.dx));
+	const __m256d d_dy = _mm256_set1_pd (double(node.dy));
+	const __m256d nfar = _mm256_set1_pd (-FAR_ENOUGH);
+	const __m256d pfar = _mm256_set1_pd (FAR_ENOUGH);
+	int i;
+
+	for (i = 0; i + 4 <= count; i += 4)
+	{
+		__m256d d_xv1 = _mm256_cvtepi32_pd (_mm_loadu_si128 ((const __m128i *)(x1 + i)));
+		__m256d d_yv1 = _mm256_cvtepi32_pd (_mm_loadu_si128 ((const __m128i *)(y1 + i)));
+		__m256d d_xv2 = _mm256_cvtepi32_pd (_mm_loadu_si128 ((const __m128i *)(x2 + i)));
+		__m256d d_yv2 = _mm256_cvtepi32_pd (_mm_loadu_si128 ((const __m128i *)(y2 + i)));
+
+		__m256d s_num1 = _mm256_sub_pd (
+			_mm256_mul_pd (_mm256_sub_pd (d_y1, d_yv1), d_dx),
+			_mm256_mul_pd (_mm256_sub_pd (d_x1, d_xv1), d_dy));
+		__m256d s_num2 = _mm256_sub_pd (
+			_mm256_mul_pd (_mm256_sub_pd (d_y1, d_yv2), d_dx),
+			_mm256_mul_pd (_mm256_sub_pd (d_x1, d_xv2), d_dy));
+
+		int back1 = _mm256_movemask_pd (_mm256_cmp_pd (s_num1, nfar, _CMP_LE_OQ));
+		int front1 = _mm256_movemask_pd (_mm256_cmp_pd (s_num1, pfar, _CMP_GE_OQ));
+		int back2 = _mm256_movemask_pd (_mm256_cmp_pd (s_num2, nfar, _CMP_LE_OQ));
+		int front2 = _mm256_movemask_pd (_mm256_cmp_pd (s_num2, pfar, _CMP_GE_OQ));
+
+		for (int j = 0; j < 4; ++j)
+		{
+			int bit = 1 << j;
+			signed char side;
+
+			if (back1 & bit)
+			{
+				side = (back2 & bit) ? 1 : (front2 & bit) ? CLASSIFY_SPLIT_BACKFRONT : CLASSIFY_SLOW;
+			}
+			else if (front1 & bit)
+			{
+				side = (front2 & bit) ? 0 : (back2 & bit) ? CLASSIFY_SPLIT_FRONTBACK : CLASSIFY_SLOW;
+			}
+			else
+			{
+				side = CLASSIFY_SLOW;
+			}
+			sides[i + j] = side;
+		}
+	}
+	for (; i < count; ++i)
+	{
+		sides[i] = CLASSIFY_SLOW;
+	}
+}
+
+#endif
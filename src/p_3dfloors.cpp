@@ -411,17 +411,36 @@ bool P_CheckFor3DCeilingHit(AActor * mo, double z)
 // This function sorts the ffloors by height and creates the lightlists 
 // that the given sector uses to light floors/ceilings/walls according to the 3D floors.
 //
+// The sort is done top to bottom and each step only depends on the floors
+// above it. So every step is recorded, and when only some of the floors
+// have moved since the last call, everything above the highest of them
+// is kept and only the rest is sorted and split again.
+//
 //==========================================================================
 
+static bool SameSortStep(const F3DFloorSortStep &a, const F3DFloorSortStep &b)
+{
+	return a.pick == b.pick && a.top == b.top && a.bottom == b.bottom && a.flags == b.flags;
+}
+
+static F3DFloor *NewDynamic3DFloor(TArray<F3DFloor*> &spare)
+{
+	F3DFloor *dyn;
+	if (!spare.Pop(dyn))
+	{
+		dyn = new F3DFloor;
+	}
+	return dyn;
+}
+
 void P_Recalculate3DFloors(sector_t * sector)
 {
 	F3DFloor *		rover;
 	F3DFloor *		pick;
-	unsigned		pickindex;
 	F3DFloor *		clipped=NULL;
 	F3DFloor *		solid=NULL;
 	double			solid_bottom=0;
-	double			clipped_top;
+	double			clipped_top=0;
 	double			clipped_bottom=0;
 	double			maxheight, minheight;
 	unsigned		i, j;
@@ -430,154 +449,204 @@ void P_Recalculate3DFloors(sector_t * sector)
 
 	TArray<F3DFloor*> & ffloors=sector->e->XFloor.ffloors;
 	TArray<lightlist_t> & lightlist = sector->e->XFloor.lightlist;
+	TArray<F3DFloorSortStep> & steps = sector->e->XFloor.sortsteps;
 
 	// Sort the floors top to bottom for quicker access here and later
 	// Translucent and swimmable floors are split if they overlap with solid ones.
 	if (ffloors.Size()>1)
 	{
-		TArray<F3DFloor*> oldlist;
-		
-		oldlist = ffloors;
-		ffloors.Clear();
-
-		// first delete the old dynamic stuff
-		for(i=0;i<oldlist.Size();i++)
+		static TArray<F3DFloorSortStep> sorted;
+		static TArray<F3DFloor*> spare;
+
+		// Collect the real floors in their current order, which is the
+		// order of the last sort. Floors of equal height keep that order,
+		// and only floors that moved need to be shifted.
+		sorted.Clear();
+		for(i=0;i<ffloors.Size();i++)
 		{
-			F3DFloor * rover=oldlist[i];
-
-			if (rover->flags&FF_DYNAMIC)
+			rover=ffloors[i];
+			if (rover->flags&FF_DYNAMIC) continue;
+
+			F3DFloorSortStep step;
+			step.pick = rover;
+			step.top = rover->top.plane->ZatPoint(sector->centerspot);
+			step.bottom = rover->bottom.plane->ZatPoint(sector->centerspot);
+			step.flags = rover->flags;
+			if (step.flags&FF_CLIPPED)
 			{
-				delete rover;
-				oldlist.Delete(i);
-				i--;
-				continue;
+				step.flags&=~FF_CLIPPED;
+				step.flags|=FF_EXISTS;
 			}
-			if (rover->flags&FF_CLIPPED)
+			for (j = sorted.Size(); j > 0 && sorted[j-1].top < step.top; j--)
 			{
-				rover->flags&=~FF_CLIPPED;
-				rover->flags|=FF_EXISTS;
 			}
+			sorted.Insert(j, step);
 		}
 
-		while (oldlist.Size())
+		// Find the first step that differs from the last sort.
+		unsigned first = 0;
+		unsigned oldcount = steps.Size() > 0 ? steps.Size() - 1 : 0;
+		while (first < oldcount && first < sorted.Size() && SameSortStep(steps[first], sorted[first]))
 		{
-			pick=oldlist[0];
-			double height=pick->top.plane->ZatPoint(sector->centerspot);
+			first++;
+		}
 
-			// find highest starting ffloor - intersections are not supported!
-			pickindex=0;
-			for (j=1;j<oldlist.Size();j++)
+		if (steps.Size() == 0 || first < sorted.Size() || first < oldcount || steps[first].outstart != ffloors.Size())
+		{
+			unsigned outstart = 0;
+			if (steps.Size() > 0)
 			{
-				double h2=oldlist[j]->top.plane->ZatPoint(sector->centerspot);
-
-				if (h2>height)
+				const F3DFloorSortStep &resume = steps[first];
+				outstart = resume.outstart;
+				solid = resume.solid;
+				solid_bottom = resume.solid_bottom;
+				clipped = resume.clipped;
+				clipped_top = resume.clipped_top;
+				clipped_bottom = resume.clipped_bottom;
+				if (clipped != NULL)
 				{
-					pick=oldlist[j];
-					pickindex=j;
-					height=h2;
+					clipped->flags = resume.clippedflags;
 				}
 			}
 
-			oldlist.Delete(pickindex);
-			double pick_bottom=pick->bottom.plane->ZatPoint(sector->centerspot);
-
-			if (pick->flags & FF_THISINSIDE)
+			// The dynamic floors below the kept part are recycled.
+			for (i = outstart; i < ffloors.Size(); i++)
 			{
-				// These have the floor higher than the ceiling and cannot be processed
-				// by the clipping code below.
-				ffloors.Push(pick);
+				if (ffloors[i]->flags&FF_DYNAMIC)
+				{
+					spare.Push(ffloors[i]);
+				}
 			}
-			else if ((pick->flags&(FF_SWIMMABLE|FF_TRANSLUCENT) || (!(pick->flags&FF_RENDERALL))) && pick->flags&FF_EXISTS)
+			ffloors.Resize(outstart);
+			steps.Resize(first);
+
+			for (unsigned k = first; k <= sorted.Size(); k++)
 			{
-				// We must check if this nonsolid segment gets clipped from the top by another 3D floor
-				if (solid != NULL && solid_bottom < height)
+				F3DFloorSortStep record = {};
+
+				if (k < sorted.Size()) record = sorted[k];
+				record.outstart = ffloors.Size();
+				record.solid = solid;
+				record.solid_bottom = solid_bottom;
+				record.clipped = clipped;
+				record.clipped_top = clipped_top;
+				record.clipped_bottom = clipped_bottom;
+				record.clippedflags = clipped != NULL ? clipped->flags : 0;
+				steps.Push(record);
+				if (k == sorted.Size()) break;
+
+				pick = sorted[k].pick;
+				pick->flags = sorted[k].flags;
+				double height = sorted[k].top;
+				double pick_bottom = sorted[k].bottom;
+
+				if (pick->flags & FF_THISINSIDE)
 				{
+					// These have the floor higher than the ceiling and cannot be processed
+					// by the clipping code below.
 					ffloors.Push(pick);
-					if (solid_bottom < pick_bottom)
+				}
+				else if ((pick->flags&(FF_SWIMMABLE|FF_TRANSLUCENT) || (!(pick->flags&FF_RENDERALL))) && pick->flags&FF_EXISTS)
+				{
+					// We must check if this nonsolid segment gets clipped from the top by another 3D floor
+					if (solid != NULL && solid_bottom < height)
 					{
-						// this one is fully covered
-						pick->flags|=FF_CLIPPED;
-						pick->flags&=~FF_EXISTS;
+						ffloors.Push(pick);
+						if (solid_bottom < pick_bottom)
+						{
+							// this one is fully covered
+							pick->flags|=FF_CLIPPED;
+							pick->flags&=~FF_EXISTS;
+						}
+						else
+						{
+							F3DFloor * dyn=NewDynamic3DFloor(spare);
+							*dyn=*pick;
+							pick->flags|=FF_CLIPPED;
+							pick->flags&=~FF_EXISTS;
+							dyn->flags|=FF_DYNAMIC;
+							dyn->top.copyPlane(&solid->bottom);
+							ffloors.Push(dyn);
+
+							clipped = dyn;
+							clipped_top = solid_bottom;
+							clipped_bottom = pick_bottom;
+						}
 					}
-					else
+					else if (pick_bottom > height)	// do not allow inverted planes
 					{
-						F3DFloor * dyn=new F3DFloor;
-						*dyn=*pick;
-						pick->flags|=FF_CLIPPED;
-						pick->flags&=~FF_EXISTS;
-						dyn->flags|=FF_DYNAMIC;
-						dyn->top.copyPlane(&solid->bottom);
+						F3DFloor * dyn = NewDynamic3DFloor(spare);
+						*dyn = *pick;
+						pick->flags |= FF_CLIPPED;
+						pick->flags &= ~FF_EXISTS;
+						dyn->flags |= FF_DYNAMIC;
+						dyn->bottom.copyPlane(&pick->top);
+						ffloors.Push(pick);
 						ffloors.Push(dyn);
-
-						clipped = dyn;
-						clipped_top = solid_bottom;
+					}
+					else
+					{
+						clipped = pick;
+						clipped_top = height;
 						clipped_bottom = pick_bottom;
+						ffloors.Push(pick);
 					}
 				}
-				else if (pick_bottom > height)	// do not allow inverted planes
+				else if (clipped && clipped_bottom<height)
 				{
-					F3DFloor * dyn = new F3DFloor;
-					*dyn = *pick;
-					pick->flags |= FF_CLIPPED;
-					pick->flags &= ~FF_EXISTS;
-					dyn->flags |= FF_DYNAMIC;
+					// translucent floor above must be clipped to this one!
+					F3DFloor * dyn=NewDynamic3DFloor(spare);
+					*dyn=*clipped;
+					clipped->flags|=FF_CLIPPED;
+					clipped->flags&=~FF_EXISTS;
+					dyn->flags|=FF_DYNAMIC;
 					dyn->bottom.copyPlane(&pick->top);
-					ffloors.Push(pick);
 					ffloors.Push(dyn);
-				}
-				else
-				{
-					clipped = pick;
-					clipped_top = height;
-					clipped_bottom = pick_bottom;
 					ffloors.Push(pick);
-				}
-			}
-			else if (clipped && clipped_bottom<height)
-			{
-				// translucent floor above must be clipped to this one!
-				F3DFloor * dyn=new F3DFloor;
-				*dyn=*clipped;
-				clipped->flags|=FF_CLIPPED;
-				clipped->flags&=~FF_EXISTS;
-				dyn->flags|=FF_DYNAMIC;
-				dyn->bottom.copyPlane(&pick->top);
-				ffloors.Push(dyn);
-				ffloors.Push(pick);
-
-				if (pick_bottom<=clipped_bottom)
-				{
-					clipped=NULL;
+
+					if (pick_bottom<=clipped_bottom)
+					{
+						clipped=NULL;
+					}
+					else
+					{
+						// the translucent part extends below the clipper
+						dyn=NewDynamic3DFloor(spare);
+						*dyn=*clipped;
+						dyn->flags|=FF_DYNAMIC|FF_EXISTS;
+						dyn->top.copyPlane(&pick->bottom);
+						ffloors.Push(dyn);
+						clipped = dyn;
+						clipped_top = pick_bottom;
+					}
+					solid = pick;
+					solid_bottom = pick_bottom;
 				}
 				else
 				{
-					// the translucent part extends below the clipper
-					dyn=new F3DFloor;
-					*dyn=*clipped;
-					dyn->flags|=FF_DYNAMIC|FF_EXISTS;
-					dyn->top.copyPlane(&pick->bottom);
-					ffloors.Push(dyn);
-					clipped = dyn;
-					clipped_top = pick_bottom;
+					clipped = NULL;
+					if (solid == NULL || solid_bottom > pick_bottom)
+					{
+						// only if this one is lower
+						solid = pick;
+						solid_bottom = pick_bottom;
+					}
+					ffloors.Push(pick);
+
 				}
-				solid = pick;
-				solid_bottom = pick_bottom;
 			}
-			else
-			{
-				clipped = NULL;
-				if (solid == NULL || solid_bottom > pick_bottom)
-				{
-					// only if this one is lower
-					solid = pick;
-					solid_bottom = pick_bottom;
-				}
-				ffloors.Push(pick);
 
+			for (i = 0; i < spare.Size(); i++)
+			{
+				delete spare[i];
 			}
-
+			spare.Clear();
 		}
 	}
+	else
+	{
+		steps.Clear();
+	}
 
 	// having the floors sorted makes this routine significantly simpler
 	// Only some overlapping cases with FF_DOUBLESHADOW might create anomalies
@@ -979,6 +1048,8 @@ int	P_Find3DFloor(sector_t * sec, const DVector3 &pos, bool above, bool floor, d
 }
 
 #include "c_dispatch.h"
+#include "m_random.h"
+#include "stats.h"
 
 
 CCMD (dump3df)
@@ -1003,3 +1074,113 @@ CCMD (dump3df)
 		}
 	}
 }
+
+#ifdef _DEBUG
+//==========================================================================
+//
+// CCMD xfloortest
+//
+// Moves random 3D floors of the current level up and down and times
+// P_Recalculate3DFloors for the sectors they are in, once continuing from
+// the last sort and once sorting from scratch. Both must give the same
+// floor and light lists.
+//
+//==========================================================================
+
+static FRandom pr_xfloortest;
+
+static void Get3DFloorSignature(sector_t *sector, TArray<void *> &sig)
+{
+	TArray<F3DFloor*> &ffloors = sector->e->XFloor.ffloors;
+	TArray<lightlist_t> &lightlist = sector->e->XFloor.lightlist;
+
+	sig.Clear();
+	for (unsigned i = 0; i < ffloors.Size(); i++)
+	{
+		sig.Push(ffloors[i]->master);
+		sig.Push(ffloors[i]->top.plane);
+		sig.Push(ffloors[i]->bottom.plane);
+		sig.Push((void *)(size_t)ffloors[i]->flags);
+	}
+	for (unsigned i = 0; i < lightlist.Size(); i++)
+	{
+		sig.Push(lightlist[i].caster != NULL ? lightlist[i].caster->master : NULL);
+		sig.Push(lightlist[i].p_lightlevel);
+		sig.Push((void *)(size_t)lightlist[i].flags);
+	}
+}
+
+CCMD(xfloortest)
+{
+	TArray<sector_t *> stacked;
+	for (int i = 0; i < numsectors; i++)
+	{
+		if (sectors[i].e->XFloor.ffloors.Size() > 1)
+		{
+			stacked.Push(&sectors[i]);
+		}
+	}
+	if (stacked.Size() == 0)
+	{
+		Printf("No sectors with more than one 3D floor\n");
+		return;
+	}
+
+	int count = 10000;
+	if (argv.argc() > 1)
+	{
+		count = MAX(1, atoi(argv[1]));
+	}
+
+	TMap<secplane_t *, double> moved;
+	TArray<void *> sig1, sig2;
+	cycle_t inctime, fulltime;
+	int mismatches = 0;
+
+	inctime.Reset();
+	fulltime.Reset();
+	for (int n = 0; n < count; n++)
+	{
+		sector_t *sec = stacked[pr_xfloortest() % stacked.Size()];
+		TArray<F3DFloor*> &ffloors = sec->e->XFloor.ffloors;
+		F3DFloor *rover = ffloors[pr_xfloortest() % ffloors.Size()];
+		secplane_t *plane = (pr_xfloortest() & 1) ? rover->top.plane : rover->bottom.plane;
+
+		if (moved.CheckKey(plane) == NULL)
+		{
+			moved[plane] = plane->fD();
+		}
+		plane->ChangeHeight((pr_xfloortest() & 1) ? 8 : -8);
+
+		inctime.Clock();
+		P_Recalculate3DFloors(sec);
+		inctime.Unclock();
+		Get3DFloorSignature(sec, sig1);
+
+		sec->e->XFloor.sortsteps.Clear();
+		fulltime.Clock();
+		P_Recalculate3DFloors(sec);
+		fulltime.Unclock();
+		Get3DFloorSignature(sec, sig2);
+
+		if (sig1.Size() != sig2.Size() || (sig1.Size() > 0 && memcmp(&sig1[0], &sig2[0], sig1.Size() * sizeof(void *))))
+		{
+			mismatches++;
+		}
+	}
+
+	TMap<secplane_t *, double>::Iterator it(moved);
+	TMap<secplane_t *, double>::Pair *pair;
+	while (it.NextPair(pair))
+	{
+		pair->Key->setD(pair->Value);
+	}
+	for (unsigned i = 0; i < stacked.Size(); i++)
+	{
+		P_Recalculate3DFloors(stacked[i]);
+	}
+
+	Printf("%d moves in %u sectors: continued %.3f ms, from scratch %.3f ms%s\n", count, stacked.Size(),
+		inctime.TimeMS(), fulltime.TimeMS(), mismatches ? ", MISMATCH" : "");
+}
+#endif
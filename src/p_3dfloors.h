@@ -106,6 +106,24 @@ struct F3DFloor
 
 
 
+// One step of the sort in P_Recalculate3DFloors: the 3D floor that was
+// picked, the values it was picked with, and the clipping state before it
+// was processed. A later call keeps everything before the first step
+// whose floor has moved and only redoes the rest.
+struct F3DFloorSortStep
+{
+	F3DFloor *			pick;			// NULL for the entry after the last step
+	double				top, bottom;
+	unsigned int		flags;			// flags of pick before clipping
+	unsigned int		outstart;		// size of the sorted list before this step
+	F3DFloor *			solid;
+	double				solid_bottom;
+	F3DFloor *			clipped;
+	double				clipped_top, clipped_bottom;
+	unsigned int		clippedflags;	// flags of clipped before this step
+};
+
+
 struct lightlist_t
 {
 	secplane_t				plane;
@@ -85,10 +85,12 @@
 #include "a_pickups.h"
 #include "a_armor.h"
 #include "a_ammo.h"
+#include "stats.h"
 
 extern FILE *Logfile;
 
 FRandom pr_acs ("ACS");
+cycle_t ACSCycles;
 
 // I imagine this much stack space is probably overkill, but it could
 // potentially get used with recursive functions.
@@ -2958,12 +2960,14 @@ void DACSThinker::Tick ()
 {
 	DLevelScript *script = Scripts;
 
+	ACSCycles.Clock();
 	while (script)
 	{
 		DLevelScript *next = script->next;
 		script->RunScript ();
 		script = next;
 	}
+	ACSCycles.Unclock();
 
 //	GlobalACSStrings.Clear();
 
@@ -1281,6 +1281,7 @@ DEFINE_ACTION_FUNCTION(AActor, A_Explode)
 
 	if (nails)
 	{
+		FTraceBlockCache tracecache;
 		DAngle ang;
 		for (int i = 0; i < nails; i++)
 		{
@@ -1645,6 +1646,7 @@ DEFINE_ACTION_FUNCTION(AActor, A_CustomBulletAttack)
 		if (pufftype == nullptr) pufftype = PClass::FindActor(NAME_BulletPuff);
 
 		S_Sound (self, CHAN_WEAPON, self->AttackSound, 1, ATTN_NORM);
+		FTraceBlockCache tracecache;
 		for (i = 0; i < numbullets; i++)
 		{
 			DAngle angle = bangle;
@@ -1932,6 +1934,7 @@ DEFINE_ACTION_FUNCTION(AStateProvider, A_FireBullets)
 	{
 		if (numbullets < 0)
 			numbullets = 1;
+		FTraceBlockCache tracecache;
 		for (i = 0; i < numbullets; i++)
 		{
 			DAngle angle = bangle;
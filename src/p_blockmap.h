@@ -2,17 +2,20 @@
 #define __P_BLOCKMAP_H
 
 #include "doomtype.h"
+#include "tarray.h"
 
 class AActor;
 
 // [RH] Like msecnode_t, but for the blockmap
+// The blocks themselves only hold plain actor lists (see blocklinks). These
+// nodes remember which blocks an actor was put into so it can be taken out
+// of them again.
 struct FBlockNode
 {
 	AActor *Me;						// actor this node references
 	int BlockIndex;					// index into blocklinks for the block this node is in
+	unsigned Index;					// position of Me in that block's list
 	int Group;						// portal group this link belongs to (can be different than the actor's own group
-	FBlockNode **PrevActor;			// previous actor in this block
-	FBlockNode *NextActor;			// next actor in this block
 	FBlockNode **PrevBlock;			// previous block this actor is in
 	FBlockNode *NextBlock;			// next block this actor is in
 
@@ -29,7 +32,38 @@ extern int				bmapwidth;
 extern int				bmapheight; 	// in mapblocks
 extern double			bmaporgx;
 extern double			bmaporgy;		// origin of block map
-extern FBlockNode**		blocklinks; 	// for thing chains
+extern TArray<AActor *>*	blocklinks; 	// for thing lists, unordered
+
+// A packed copy of every block's line list with each line's bounding box
+// in separate arrays, so that FBlockLinesIterator can test several lines
+// against a box at once. The boxes are rounded outwards to floats, which
+// means a line that touches a box always passes. Polyobject lines move, so
+// they always pass as well. Every block is padded to a multiple of four
+// entries with boxes that never pass.
+//
+// Each entry also has the line's equation, NormX * x + NormY * y = Dist
+// with a unit normal, so that long diagonal lines whose bounding box
+// covers the box but which pass far from it are skipped, too. Lines
+// without a direction and polyobject lines get a zero normal and Dist,
+// which always passes.
+struct FBlockLineTable
+{
+	TArray<int> Start;			// first entry of each block, plus one past the end
+	TArray<float> Left, Right, Bottom, Top;
+	TArray<float> NormX, NormY, Dist;
+	TArray<int> Line;
+};
+
+extern FBlockLineTable*	blocklinetable;
+
+void P_BuildBlockLineTable ();
+void P_FreeBlockLineTable ();
+
+// Takes a node's actor out of its block's list, moving the block's last
+// actor into its place. P_RestoreToBlock undoes that if nothing else
+// changed the list in between.
+void P_RemoveFromBlock (FBlockNode *node);
+void P_RestoreToBlock (FBlockNode *node);
 
 inline int GetBlockX(double xpos)
 {
@@ -52,6 +52,7 @@
 #include "p_checkposition.h"
 #include "math/cmath.h"
 #include "a_ammo.h"
+#include "p_flowfield.h"
 
 #include "gi.h"
 
@@ -988,13 +989,16 @@ void P_NewChaseDir(AActor * actor)
 	{
 		delta = actor->Vec2To(actor->target);
 
-		if (!(actor->flags6 & MF6_NOFEAR))
+		if (!(actor->flags6 & MF6_NOFEAR) &&
+			((actor->target->player != NULL && (actor->target->player->cheats & CF_FRIGHTENING)) || 
+			 (actor->flags4 & MF4_FRIGHTENED)))
 		{
-			if ((actor->target->player != NULL && (actor->target->player->cheats & CF_FRIGHTENING)) || 
-				(actor->flags4 & MF4_FRIGHTENED))
-			{
-				delta = -delta;
-			}
+			delta = -delta;
+		}
+		else
+		{
+			// Head for the next doorway toward the player instead of straight at them.
+			P_GetFlowFieldDelta(actor, actor->target, delta);
 		}
 	}
 	else
@@ -1430,13 +1434,13 @@ DEFINE_ACTION_FUNCTION(AActor, LookForMonsters)
 AActor *LookForTIDInBlock (AActor *lookee, int index, void *extparams)
 {
 	FLookExParams *params = (FLookExParams *)extparams;
-	FBlockNode *block;
+	TArray<AActor *> &list = blocklinks[index];
 	AActor *link;
 	AActor *other;
 	
-	for (block = blocklinks[index]; block != NULL; block = block->NextActor)
+	for (int i = list.Size() - 1; i >= 0; --i)
 	{
-		link = block->Me;
+		link = list[i];
 
         if (!(link->flags & MF_SHOOTABLE))
 			continue;			// not shootable (observer or dead)
@@ -1608,14 +1612,14 @@ DEFINE_ACTION_FUNCTION(AActor, LookForTID)
 
 AActor *LookForEnemiesInBlock (AActor *lookee, int index, void *extparam)
 {
-	FBlockNode *block;
+	TArray<AActor *> &list = blocklinks[index];
 	AActor *link;
 	AActor *other;
 	FLookExParams *params = (FLookExParams *)extparam;
 	
-	for (block = blocklinks[index]; block != NULL; block = block->NextActor)
+	for (int i = list.Size() - 1; i >= 0; --i)
 	{
-		link = block->Me;
+		link = list[i];
 
         if (!(link->flags & MF_SHOOTABLE))
 			continue;			// not shootable (observer or dead)
@@ -0,0 +1,341 @@
+/*
+** p_flowfield.cpp
+**
+** Shared sector flow fields that lead chasing monsters toward players
+**
+**---------------------------------------------------------------------------
+** Copyright 2016 The ZDoom Team
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+** 3. The name of the author may not be used to endorse or promote products
+**    derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+** OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+** INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+** NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+** THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**---------------------------------------------------------------------------
+**
+*/
+
+
+#include <queue>
+#include <vector>
+
+#include "doomdata.h"
+#include "doomstat.h"
+#include "d_player.h"
+#include "g_level.h"
+#include "p_flowfield.h"
+#include "p_local.h"
+#include "r_defs.h"
+#include "r_state.h"
+#include "c_cvars.h"
+#include "c_dispatch.h"
+
+//==========================================================================
+//
+// For every player there is one field over the level's sectors that tells
+// a monster which line to head for next to get closer to that player. It
+// is only a hint for P_NewChaseDir: the usual movement probes still decide
+// where the monster actually goes, they just start out with a direction
+// that leads around walls instead of into them. This changes monster
+// movement, so it is only used when the map or the server asks for it.
+//
+//==========================================================================
+
+CVAR(Bool, sv_flowfields, false, CVAR_SERVERINFO)
+
+enum
+{
+	FLOW_MAXSTEP = 24,			// same as the default MaxStepHeight and MaxDropOffHeight
+	FLOW_MINOPENING = 32,
+};
+
+struct FFlowField
+{
+	sector_t *Target;
+	int Generation;
+	TArray<int> NextLine;		// line to walk toward from each sector, or -1
+};
+
+static FFlowField FlowFields[MAXPLAYERS];
+static int FlowFieldBuilds;
+static int FlowFieldHits;
+
+// Whether each two-sided line can be walked through, as of the last
+// check. Once the first field is built, moving sectors and changed line
+// flags update this, and only a line that actually changed its state
+// bumps FlowGeneration and makes the fields get rebuilt. A door or lift
+// in motion only does that twice, not on every tic.
+static TArray<BYTE> LinePassable;
+static int FlowGeneration;
+
+//==========================================================================
+//
+// P_FlowFieldsEnabled
+//
+//==========================================================================
+
+bool P_FlowFieldsEnabled()
+{
+	return sv_flowfields || (level.flags3 & LEVEL3_FLOWFIELDS);
+}
+
+//==========================================================================
+//
+// CanWalkThrough
+//
+// Can a monster in sector 'from' get into sector 'to' through this line?
+// Closed doors count as open if monsters may use the line.
+//
+//==========================================================================
+
+static bool CanWalkThrough(const line_t *ld, const sector_t *from, const sector_t *to)
+{
+	if (ld->flags & (ML_BLOCKING | ML_BLOCKMONSTERS | ML_BLOCKEVERYTHING))
+	{
+		return false;
+	}
+	if (ld->isLinePortal())
+	{
+		return false;
+	}
+
+	DVector2 mid = ld->v1->fPos() + ld->Delta() / 2;
+	double fromfloor = from->floorplane.ZatPoint(mid);
+	double tofloor = to->floorplane.ZatPoint(mid);
+
+	if (tofloor - fromfloor > FLOW_MAXSTEP || fromfloor - tofloor > FLOW_MAXSTEP)
+	{
+		return false;
+	}
+
+	double top = MIN(from->ceilingplane.ZatPoint(mid), to->ceilingplane.ZatPoint(mid));
+	if (top - MAX(fromfloor, tofloor) < FLOW_MINOPENING)
+	{
+		bool door = ld->special != 0 && ((ld->activation & SPAC_MUse) ||
+			((ld->activation & SPAC_Use) && (ld->flags & ML_MONSTERSCANACTIVATE)));
+		if (!door)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// CheckLine
+//
+// Updates a line's entry in LinePassable and returns true if it changed.
+// CanWalkThrough gives the same answer both ways, so one check will do.
+//
+//==========================================================================
+
+static bool CheckLine(const line_t *ld)
+{
+	BYTE passable = ld->backsector != NULL && ld->frontsector != ld->backsector &&
+		CanWalkThrough(ld, ld->frontsector, ld->backsector);
+	BYTE &old = LinePassable[int(ld - lines)];
+
+	if (old != passable)
+	{
+		old = passable;
+		return true;
+	}
+	return false;
+}
+
+//==========================================================================
+//
+// P_FlowFieldLineChanged
+// P_FlowFieldSectorChanged
+//
+// To be called when a line's flags or a sector's heights were changed.
+//
+//==========================================================================
+
+void P_FlowFieldLineChanged(line_t *ld)
+{
+	if (LinePassable.Size() == (unsigned)numlines && CheckLine(ld))
+	{
+		FlowGeneration++;
+	}
+}
+
+void P_FlowFieldSectorChanged(sector_t *sec)
+{
+	if (LinePassable.Size() == (unsigned)numlines)
+	{
+		bool changed = false;
+
+		for (int i = 0; i < sec->linecount; ++i)
+		{
+			changed |= CheckLine(sec->lines[i]);
+		}
+		if (changed)
+		{
+			FlowGeneration++;
+		}
+	}
+}
+
+//==========================================================================
+//
+// BuildFlowField
+//
+// Dijkstra over the sector graph, starting at the target's sector. The
+// cost of crossing a line is the distance from one sector's center to the
+// line's middle and on to the other sector's center.
+//
+//==========================================================================
+
+static void BuildFlowField(FFlowField &field, sector_t *target)
+{
+	typedef std::pair<double, int> Entry;
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > open;
+	TArray<double> cost;
+
+	cost.Resize(numsectors);
+	field.NextLine.Resize(numsectors);
+	for (int i = 0; i < numsectors; ++i)
+	{
+		cost[i] = -1;
+		field.NextLine[i] = -1;
+	}
+
+	if (LinePassable.Size() != (unsigned)numlines)
+	{
+		LinePassable.Resize(numlines);
+		for (int i = 0; i < numlines; ++i)
+		{
+			LinePassable[i] = 0xff;
+			CheckLine(&lines[i]);
+		}
+	}
+
+	cost[target->sectornum] = 0;
+	open.push(Entry(0., target->sectornum));
+
+	while (!open.empty())
+	{
+		Entry e = open.top();
+		open.pop();
+
+		sector_t *sec = &sectors[e.second];
+		if (e.first > cost[e.second])
+		{
+			continue;
+		}
+
+		for (int i = 0; i < sec->linecount; ++i)
+		{
+			line_t *ld = sec->lines[i];
+			if (!LinePassable[int(ld - lines)])
+			{
+				continue;
+			}
+			sector_t *other = ld->frontsector == sec ? ld->backsector : ld->frontsector;
+
+			DVector2 mid = ld->v1->fPos() + ld->Delta() / 2;
+			double c = e.first + (sec->centerspot - mid).Length() + (other->centerspot - mid).Length();
+			double &oc = cost[other->sectornum];
+
+			if (oc < 0 || c < oc)
+			{
+				oc = c;
+				field.NextLine[other->sectornum] = int(ld - lines);
+				open.push(Entry(c, other->sectornum));
+			}
+		}
+	}
+
+	field.Target = target;
+	field.Generation = FlowGeneration;
+	FlowFieldBuilds++;
+}
+
+//==========================================================================
+//
+// P_GetFlowFieldDelta
+//
+// If the target is a player in another sector, points delta at the middle
+// of the line the actor should head for instead. Returns false when the
+// field has no advice and delta was left alone.
+//
+//==========================================================================
+
+bool P_GetFlowFieldDelta(AActor *actor, AActor *target, DVector2 &delta)
+{
+	if (!P_FlowFieldsEnabled() || target->player == NULL || numsectors == 0)
+	{
+		return false;
+	}
+
+	sector_t *from = actor->Sector;
+	sector_t *to = target->Sector;
+	if (from == to || from->PortalGroup != to->PortalGroup)
+	{
+		return false;
+	}
+
+	FFlowField &field = FlowFields[target->player - players];
+	if (field.Target != to || field.Generation != FlowGeneration || field.NextLine.Size() != (unsigned)numsectors)
+	{
+		BuildFlowField(field, to);
+	}
+
+	int next = field.NextLine[from->sectornum];
+	if (next < 0)
+	{
+		return false;
+	}
+
+	line_t *ld = &lines[next];
+	delta = ld->v1->fPos() + ld->Delta() / 2 - actor->Pos().XY();
+	if (delta.isZero())
+	{
+		return false;
+	}
+	FlowFieldHits++;
+	return true;
+}
+
+//==========================================================================
+//
+// P_ClearFlowFields
+//
+//==========================================================================
+
+void P_ClearFlowFields()
+{
+	for (auto &field : FlowFields)
+	{
+		field.Target = NULL;
+		field.NextLine.Clear();
+	}
+	LinePassable.Clear();
+}
+
+ADD_STAT(flowfields)
+{
+	FString out;
+	out.Format("Flow fields %s, %d builds, %d hints", P_FlowFieldsEnabled() ? "on" : "off", FlowFieldBuilds, FlowFieldHits);
+	return out;
+}
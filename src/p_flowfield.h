@@ -0,0 +1,16 @@
+#ifndef __P_FLOWFIELD_H
+#define __P_FLOWFIELD_H
+
+#include "vectors.h"
+
+class AActor;
+struct line_t;
+struct sector_t;
+
+bool P_FlowFieldsEnabled();
+bool P_GetFlowFieldDelta(AActor *actor, AActor *target, DVector2 &delta);
+void P_ClearFlowFields();
+void P_FlowFieldLineChanged(line_t *ld);
+void P_FlowFieldSectorChanged(sector_t *sec);
+
+#endif
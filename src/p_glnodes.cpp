@@ -67,6 +67,8 @@
 #include "m_misc.h"
 #include "r_utility.h"
 #include "cmdlib.h"
+#include "p_subsectorgrid.h"
+#include "p_levelcache.h"
 
 void P_GetPolySpots (MapData * lump, TArray<FNodeBuilder::FPolyStart> &spots, TArray<FNodeBuilder::FPolyStart> &anchors);
 
@@ -74,8 +76,6 @@ CVAR(Bool, gl_cachenodes, true, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
 CVAR(Float, gl_cachetime, 0.6f, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
 
 void P_LoadZNodes (FileReader &dalump, DWORD id);
-static bool CheckCachedNodes(MapData *map);
-static void CreateCachedNodes(MapData *map);
 
 
 // fixed 32 bit gl_vert format v2.0+ (glBsp 1.91)
@@ -844,7 +844,7 @@ static int FindGLNodesInFile(FResourceFile * f, const char * label)
 //
 //==========================================================================
 
-bool P_LoadGLNodes(MapData * map)
+bool P_LoadGLNodes(MapData * map, const int **oldvertextable)
 {
 	if (map->MapLumps[ML_GLZNODES].Reader && map->MapLumps[ML_GLZNODES].Reader->GetLength() != 0)
 	{
@@ -890,7 +890,7 @@ bool P_LoadGLNodes(MapData * map)
 		}
 	}
 
-	if (!CheckCachedNodes(map))
+	if (!P_LoadCachedNodes(true, oldvertextable))
 	{
 		FileReader *gwalumps[4] = { NULL, NULL, NULL, NULL };
 		char path[256];
@@ -966,10 +966,11 @@ bool P_LoadGLNodes(MapData * map)
 //
 //==========================================================================
 
-bool P_CheckNodes(MapData * map, bool rebuilt, int buildtime)
+bool P_CheckNodes(MapData * map, bool rebuilt, int buildtime, const int **oldvertextable)
 {
 	bool ret = false;
 	bool loaded = false;
+	int numoldvertexes = numvertexes;
 
 	// If the map loading code has performed a node rebuild we don't need to check for it again.
 	if (!rebuilt && !P_CheckForGLNodes())
@@ -989,7 +990,7 @@ bool P_CheckNodes(MapData * map, bool rebuilt, int buildtime)
 		numsegs = 0;
 
 		// Try to load GL nodes (cached or GWA)
-		loaded = P_LoadGLNodes(map);
+		loaded = P_LoadGLNodes(map, oldvertextable);
 		if (!loaded)
 		{
 			// none found - we have to build new ones!
@@ -1015,10 +1016,15 @@ bool P_CheckNodes(MapData * map, bool rebuilt, int buildtime)
 			endTime = I_FPSTime ();
 			DPrintf (DMSG_NOTIFY, "BSP generation took %.3f sec (%d segs)\n", (endTime - startTime) * 0.001, numsegs);
 			buildtime = endTime - startTime;
+
+			// The nodes being replaced came with the map, so its vertices
+			// were still in their original order and there is no table yet.
+			*oldvertextable = builder.GetOldVertexTable();
 		}
 	}
 
-	if (!loaded)
+	// Nodes built by P_SetupLevel are cached there.
+	if (!loaded && !rebuilt)
 	{
 #ifdef DEBUG
 		// Building nodes in debug is much slower so let's cache them only if cachetime is 0
@@ -1027,7 +1033,7 @@ bool P_CheckNodes(MapData * map, bool rebuilt, int buildtime)
 		if (level.maptype != MAPTYPE_BUILD && gl_cachenodes && buildtime/1000.f >= gl_cachetime)
 		{
 			DPrintf(DMSG_NOTIFY, "Caching nodes\n");
-			CreateCachedNodes(map);
+			P_CacheNodes(true, *oldvertextable, numoldvertexes);
 		}
 		else
 		{
@@ -1049,93 +1055,61 @@ bool P_CheckNodes(MapData * map, bool rebuilt, int buildtime)
 //
 // Node caching
 //
+// Built nodes are stored in the level cache together with the line vertex
+// indices they were built for and the old vertex table that vertex height
+// slopes need. Both are checked against the nodes' vertices on loading.
+//
 //==========================================================================
 
-typedef TArray<BYTE> MemFile;
-
-
-static FString CreateCacheName(MapData *map, bool create)
-{
-	FString path = M_GetCachePath(create);
-	FString lumpname = Wads.GetLumpFullPath(map->lumpnum);
-	int separator = lumpname.IndexOf(':');
-	path << '/' << lumpname.Left(separator);
-	if (create) CreatePath(path);
-
-	lumpname.ReplaceChars('/', '%');
-	path << '/' << lumpname.Right(lumpname.Len() - separator - 1) << ".gzc";
-	return path;
-}
-
-static void WriteByte(MemFile &f, BYTE b)
-{
-	f.Push(b);
-}
-
-static void WriteWord(MemFile &f, WORD b)
-{
-	int v = f.Reserve(2);
-	f[v] = (BYTE)b;
-	f[v+1] = (BYTE)(b>>8);
-}
-
-static void WriteLong(MemFile &f, DWORD b)
-{
-	int v = f.Reserve(4);
-	f[v] = (BYTE)b;
-	f[v+1] = (BYTE)(b>>8);
-	f[v+2] = (BYTE)(b>>16);
-	f[v+3] = (BYTE)(b>>24);
-}
-
-static void CreateCachedNodes(MapData *map)
+void P_CacheNodes(bool gl, const int *oldvertextable, int numoldvertexes)
 {
-	MemFile ZNodes;
+	TArray<BYTE> ZNodes;
+	FLevelCacheWriter nw(ZNodes);
 
-	WriteLong(ZNodes, 0);
-	WriteLong(ZNodes, numvertexes);
+	nw.Long(0);
+	nw.Long(numvertexes);
 	for(int i=0;i<numvertexes;i++)
 	{
-		WriteLong(ZNodes, vertexes[i].fixX());
-		WriteLong(ZNodes, vertexes[i].fixY());
+		nw.Long(vertexes[i].fixX());
+		nw.Long(vertexes[i].fixY());
 	}
 
-	WriteLong(ZNodes, numsubsectors);
+	nw.Long(numsubsectors);
 	for(int i=0;i<numsubsectors;i++)
 	{
-		WriteLong(ZNodes, subsectors[i].numlines);
+		nw.Long(subsectors[i].numlines);
 	}
 
-	WriteLong(ZNodes, numsegs);
+	nw.Long(numsegs);
 	for(int i=0;i<numsegs;i++)
 	{
-		WriteLong(ZNodes, DWORD(segs[i].v1 - vertexes));
-		if (glsegextras != NULL) WriteLong(ZNodes, DWORD(glsegextras[i].PartnerSeg));
-		else WriteLong(ZNodes, 0);
+		nw.Long(DWORD(segs[i].v1 - vertexes));
+		if (glsegextras != NULL) nw.Long(DWORD(glsegextras[i].PartnerSeg));
+		else nw.Long(0);
 		if (segs[i].linedef)
 		{
-			WriteLong(ZNodes, DWORD(segs[i].linedef - lines));
-			WriteByte(ZNodes, segs[i].sidedef == segs[i].linedef->sidedef[0]? 0:1);
+			nw.Long(DWORD(segs[i].linedef - lines));
+			nw.Byte(segs[i].sidedef == segs[i].linedef->sidedef[0]? 0:1);
 		}
 		else
 		{
-			WriteLong(ZNodes, 0xffffffffu);
-			WriteByte(ZNodes, 0);
+			nw.Long(0xffffffffu);
+			nw.Byte(0);
 		}
 	}
 
-	WriteLong(ZNodes, numnodes);
+	nw.Long(numnodes);
 	for(int i=0;i<numnodes;i++)
 	{
-		WriteLong(ZNodes, nodes[i].x);
-		WriteLong(ZNodes, nodes[i].y);
-		WriteLong(ZNodes, nodes[i].dx);
-		WriteLong(ZNodes, nodes[i].dy);
+		nw.Long(nodes[i].x);
+		nw.Long(nodes[i].y);
+		nw.Long(nodes[i].dx);
+		nw.Long(nodes[i].dy);
 		for (int j = 0; j < 2; ++j)
 		{
 			for (int k = 0; k < 4; ++k)
 			{
-				WriteWord(ZNodes, (short)nodes[i].bbox[j][k]);
+				nw.Word((short)nodes[i].bbox[j][k]);
 			}
 		}
 
@@ -1150,94 +1124,87 @@ static void CreateCachedNodes(MapData *map)
 			{
 				child = DWORD((node_t *)nodes[i].children[j] - nodes);
 			}
-			WriteLong(ZNodes, child);
+			nw.Long(child);
 		}
 	}
 
-	uLongf outlen = ZNodes.Size();
-	BYTE *compressed;
-	int offset = numlines * 8 + 12 + 16;
-	int r;
-	do
-	{
-		compressed = new Bytef[outlen + offset];
-		r = compress (compressed + offset, &outlen, &ZNodes[0], ZNodes.Size());
-		if (r == Z_BUF_ERROR)
-		{
-			delete[] compressed;
-			outlen += 1024;
-		}
-	} 
-	while (r == Z_BUF_ERROR);
-
-	memcpy(compressed, "CACH", 4);
-	DWORD len = LittleLong(numlines);
-	memcpy(compressed+4, &len, 4);
-	map->GetChecksum(compressed+8);
+	FLevelCacheWriter w(P_NewLevelCacheSection(LCACHE_Nodes));
+	w.Byte(gl);
+	w.Long(numlines);
 	for(int i=0;i<numlines;i++)
 	{
-		DWORD ndx[2] = {LittleLong(DWORD(lines[i].v1 - vertexes)), LittleLong(DWORD(lines[i].v2 - vertexes)) };
-		memcpy(compressed+8+16+8*i, ndx, 8);
+		w.Long(DWORD(lines[i].v1 - vertexes));
+		w.Long(DWORD(lines[i].v2 - vertexes));
 	}
-	memcpy(compressed + offset - 4, "ZGL3", 4);
-
-	FString path = CreateCacheName(map, true);
-	FILE *f = fopen(path, "wb");
-
-	if (f != NULL)
+	w.Long(oldvertextable != NULL ? numoldvertexes : 0);
+	for (int i = 0; oldvertextable != NULL && i < numoldvertexes; i++)
 	{
-		if (fwrite(compressed, outlen+offset, 1, f) != 1)
-		{
-			Printf("Error saving nodes to file %s\n", path.GetChars());
-		}
-
-		fclose(f);
+		w.Long(oldvertextable[i]);
 	}
-	else
+	w.Long(ZNodes.Size());
+	for (unsigned i = 0; i < ZNodes.Size(); i++)
 	{
-		Printf("Cannot open nodes file %s for writing\n", path.GetChars());
+		w.Byte(ZNodes[i]);
 	}
-
-	delete [] compressed;
 }
 
+//==========================================================================
+//
+// P_LoadCachedNodes
+//
+// Only accepts nodes of the requested kind. If oldvertextable is not NULL
+// it receives a copy of the cached table, or NULL if there was none.
+//
+//==========================================================================
 
-static bool CheckCachedNodes(MapData *map)
+bool P_LoadCachedNodes(bool gl, const int **oldvertextable)
 {
-	char magic[4] = {0,0,0,0};
-	BYTE md5[16];
-	BYTE md5map[16];
-	DWORD numlin;
-	DWORD *verts = NULL;
-
-	FString path = CreateCacheName(map, false);
-	FILE *f = fopen(path, "rb");
-	if (f == NULL) return false;
+	const TArray<BYTE> *section = P_FindLevelCacheSection(LCACHE_Nodes);
+	if (section == NULL) return false;
 
-	if (fread(magic, 1, 4, f) != 4) goto errorout;
-	if (memcmp(magic, "CACH", 4))  goto errorout;
+	FLevelCacheReader r(*section);
+	if ((r.Byte() != 0) != gl) return false;
+	if (r.Long() != (DWORD)numlines) return false;
 
-	if (fread(&numlin, 4, 1, f) != 1) goto errorout; 
-	numlin = LittleLong(numlin);
-	if ((int)numlin != numlines) goto errorout;
-
-	if (fread(md5, 1, 16, f) != 16) goto errorout;
-	map->GetChecksum(md5map);
-	if (memcmp(md5, md5map, 16)) goto errorout;
-
-	verts = new DWORD[numlin * 8];
-	if (fread(verts, 8, numlin, f) != numlin) goto errorout;
-
-	if (fread(magic, 1, 4, f) != 4) goto errorout;
-	if (memcmp(magic, "ZGL2", 4) && memcmp(magic, "ZGL3", 4))  goto errorout;
+	TArray<DWORD> verts;
+	verts.Resize(numlines * 2);
+	for(int i=0;i<numlines*2;i++)
+	{
+		verts[i] = r.Long();
+	}
 
+	// The old vertex table maps the map's vertices to the ones the nodes
+	// come with, so it must cover exactly the vertices the map has.
+	DWORD numold = r.Long();
+	if (numold != 0 && numold != (DWORD)numvertexes) return false;
+	TArray<DWORD> oldtable(numold);
+	for (DWORD i = 0; i < numold; i++)
+	{
+		oldtable.Push(r.Long());
+	}
+	DWORD zlen = r.Long();
+	const BYTE *zdata = r.Bytes(zlen);
+	if (r.HasFailed() || zlen < 8) return false;
+
+	// Nothing may index past the vertices the nodes come with. Check this
+	// before loading them, since that replaces the vertex array.
+	DWORD orgverts, newverts;
+	MemoryReader hr((const char *)zdata, 8);
+	hr >> orgverts >> newverts;
+	QWORD numnewverts = QWORD(orgverts) + newverts;
+	for (int i = 0; i < numlines * 2; i++)
+	{
+		if (verts[i] >= numnewverts) return false;
+	}
+	for (DWORD i = 0; i < numold; i++)
+	{
+		if (oldtable[i] >= numnewverts) return false;
+	}
 
 	try
 	{
-		long pos = ftell(f);
-		FileReader fr(f);
-		fr.Seek(pos, SEEK_SET);
-		P_LoadZNodes (fr, MAKE_ID(magic[0],magic[1],magic[2],magic[3]));
+		MemoryReader fr((const char *)zdata, zlen);
+		P_LoadZNodes (fr, MAKE_ID('X','G','L','3'));
 	}
 	catch (CRecoverableError &error)
 	{
@@ -1258,26 +1225,29 @@ static bool CheckCachedNodes(MapData *map)
 			delete[] nodes;
 			nodes = NULL;
 		}
-		goto errorout;
+		return false;
 	}
 
 	for(int i=0;i<numlines;i++)
 	{
-		lines[i].v1 = &vertexes[LittleLong(verts[i*2])];
-		lines[i].v2 = &vertexes[LittleLong(verts[i*2+1])];
+		lines[i].v1 = &vertexes[verts[i*2]];
+		lines[i].v2 = &vertexes[verts[i*2+1]];
 	}
-	delete [] verts;
-
-	fclose(f);
-	return true;
 
-errorout:
-	if (verts != NULL)
+	if (oldvertextable != NULL)
 	{
-		delete[] verts;
+		*oldvertextable = NULL;
+		if (numold > 0)
+		{
+			int *table = new int[numold];
+			for (DWORD i = 0; i < numold; i++)
+			{
+				table[i] = oldtable[i];
+			}
+			*oldvertextable = table;
+		}
 	}
-	fclose(f);
-	return false;
+	return true;
 }
 
 CCMD(clearnodecache)
@@ -1338,14 +1308,18 @@ subsector_t *P_PointInSubsector (double x, double y)
 	node_t *node;
 	int side;
 
+	fixed_t xx = FLOAT2FIXED(x);
+	fixed_t yy = FLOAT2FIXED(y);
+
+	if (GameSubsectorGrid.IsBuilt())
+		return GameSubsectorGrid.PointInSubsector(xx, yy);
+
 	// single subsector is a special case
 	if (numgamenodes == 0)
 		return gamesubsectors;
 				
 	node = gamenodes + numgamenodes - 1;
 
-	fixed_t xx = FLOAT2FIXED(x);
-	fixed_t yy = FLOAT2FIXED(y);
 	do
 	{
 		side = R_PointOnSide (xx, yy, node);
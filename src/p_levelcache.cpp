@@ -0,0 +1,491 @@
+/*
+** p_levelcache.cpp
+**
+** Per-map cache of derived level data
+**
+**---------------------------------------------------------------------------
+** Copyright 2016 The ZDoom Team
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+** 3. The name of the author may not be used to endorse or promote products
+**    derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+** OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+** INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+** NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+** THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**---------------------------------------------------------------------------
+**
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "doomtype.h"
+#include "p_levelcache.h"
+#include "p_setup.h"
+#include "r_state.h"
+#include "w_wad.h"
+#include "c_cvars.h"
+#include "cmdlib.h"
+#include "m_misc.h"
+#include "m_swap.h"
+#include "jobqueue.h"
+
+CVAR(Bool, levelcache, true, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
+CVAR(Int, levelcache_minlines, 2000, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
+
+// Bump this whenever the layout of any section changes.
+static const DWORD LEVELCACHE_VERSION = 1;
+
+static const char LevelCacheMagic[4] = { 'Z','L','V','C' };
+
+struct FLevelCacheHeader
+{
+	char Magic[4];
+	DWORD Version;
+	BYTE Checksum[16];
+	DWORD NumVertexes;
+	DWORD NumLines;
+	DWORD NumSides;
+	DWORD NumSectors;
+	DWORD BodySize;
+};
+
+static bool CacheOpen;
+static bool CacheDirty;
+static FString CachePath;
+static FLevelCacheHeader CacheHeader;
+static TMap<DWORD, TArray<BYTE> > CacheSections;
+
+//==========================================================================
+//
+// FLevelCacheWriter
+//
+//==========================================================================
+
+void FLevelCacheWriter::Word(WORD w)
+{
+	unsigned int v = Data.Reserve(2);
+	Data[v] = (BYTE)w;
+	Data[v+1] = (BYTE)(w >> 8);
+}
+
+void FLevelCacheWriter::Long(DWORD l)
+{
+	unsigned int v = Data.Reserve(4);
+	Data[v] = (BYTE)l;
+	Data[v+1] = (BYTE)(l >> 8);
+	Data[v+2] = (BYTE)(l >> 16);
+	Data[v+3] = (BYTE)(l >> 24);
+}
+
+void FLevelCacheWriter::Double(double d)
+{
+	QWORD q;
+	memcpy(&q, &d, 8);
+	Long(DWORD(q));
+	Long(DWORD(q >> 32));
+}
+
+//==========================================================================
+//
+// FLevelCacheReader
+//
+//==========================================================================
+
+const BYTE *FLevelCacheReader::Bytes(unsigned int len)
+{
+	if (Failed || (size_t)(End - Pos) < len)
+	{
+		Failed = true;
+		return NULL;
+	}
+	const BYTE *p = Pos;
+	Pos += len;
+	return p;
+}
+
+BYTE FLevelCacheReader::Byte()
+{
+	const BYTE *p = Bytes(1);
+	return p != NULL ? p[0] : 0;
+}
+
+WORD FLevelCacheReader::Word()
+{
+	const BYTE *p = Bytes(2);
+	return p != NULL ? WORD(p[0] | (p[1] << 8)) : 0;
+}
+
+DWORD FLevelCacheReader::Long()
+{
+	const BYTE *p = Bytes(4);
+	return p != NULL ? DWORD(p[0] | (p[1] << 8) | (p[2] << 16) | ((DWORD)p[3] << 24)) : 0;
+}
+
+double FLevelCacheReader::Double()
+{
+	QWORD q = Long();
+	q |= QWORD(Long()) << 32;
+	double d;
+	memcpy(&d, &q, 8);
+	return d;
+}
+
+//==========================================================================
+//
+// P_LevelCachePath
+//
+// <cache dir>/<resource file>/<map lump path>.zlc
+//
+//==========================================================================
+
+FString P_LevelCachePath(int lumpnum, bool create)
+{
+	FString path = M_GetCachePath(create);
+	FString lumpname = Wads.GetLumpFullPath(lumpnum);
+	int separator = lumpname.IndexOf(':');
+	path << '/' << lumpname.Left(separator);
+	if (create) CreatePath(path);
+
+	lumpname.ReplaceChars('/', '%');
+	path << '/' << lumpname.Right(lumpname.Len() - separator - 1) << ".zlc";
+	return path;
+}
+
+FString P_LevelCachePath(MapData *map, bool create)
+{
+	return P_LevelCachePath(map->lumpnum, create);
+}
+
+//==========================================================================
+//
+// LoadLevelCacheFile
+//
+// Reads the header and the uncompressed body of a cache file without
+// checking whether it belongs to any particular map. This touches
+// nothing but the file and standard containers, so it may run on a
+// worker thread.
+//
+//==========================================================================
+
+static bool LoadLevelCacheFile(const char *path, FLevelCacheHeader &header, std::vector<BYTE> &body)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+	{
+		return false;
+	}
+
+	bool ok = false;
+	if (fread(&header, sizeof(header), 1, f) == 1)
+	{
+		long start = ftell(f);
+		fseek(f, 0, SEEK_END);
+		long compressedsize = ftell(f) - start;
+		fseek(f, start, SEEK_SET);
+
+		// Deflate cannot do better than about 1:1032, so a larger body size
+		// means the header is broken. Don't allocate for it.
+		DWORD bodysize = LittleLong(header.BodySize);
+		if (compressedsize > 0 && bodysize > 0 && bodysize / 1032 <= (unsigned long)compressedsize)
+		{
+			std::vector<BYTE> compressed(compressedsize);
+			body.resize(bodysize);
+			uLongf outsize = bodysize;
+			ok = fread(compressed.data(), compressedsize, 1, f) == 1 &&
+				uncompress(body.data(), &outsize, compressed.data(), compressedsize) == Z_OK &&
+				outsize == bodysize;
+		}
+	}
+	fclose(f);
+	return ok;
+}
+
+//==========================================================================
+//
+// ReadLevelCache
+//
+// Loads all sections from the cache file if it belongs to this exact map.
+//
+//==========================================================================
+
+static bool ReadLevelCache(const FLevelCacheHeader &header, const std::vector<BYTE> &body)
+{
+	if (memcmp(header.Magic, LevelCacheMagic, 4) != 0 ||
+		LittleLong(header.Version) != LEVELCACHE_VERSION ||
+		memcmp(header.Checksum, CacheHeader.Checksum, 16) != 0 ||
+		LittleLong(header.NumVertexes) != CacheHeader.NumVertexes ||
+		LittleLong(header.NumLines) != CacheHeader.NumLines ||
+		LittleLong(header.NumSides) != CacheHeader.NumSides ||
+		LittleLong(header.NumSectors) != CacheHeader.NumSectors)
+	{
+		return false;
+	}
+
+	FLevelCacheReader reader(body.data(), body.size());
+	while (!reader.AtEnd())
+	{
+		DWORD id = reader.Long();
+		DWORD len = reader.Long();
+		const BYTE *data = reader.Bytes(len);
+		if (reader.HasFailed())
+		{
+			CacheSections.Clear();
+			return false;
+		}
+		TArray<BYTE> &section = CacheSections[id];
+		section.Resize(len);
+		if (len > 0) memcpy(&section[0], data, len);
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// P_PreloadLevelCache
+//
+// Starts reading the cache file for the given map lump in the background
+// so that P_OpenLevelCache only has to pick up the result.
+//
+//==========================================================================
+
+struct FLevelCachePreload
+{
+	std::string Path;
+	FLevelCacheHeader Header;
+	std::vector<BYTE> Body;
+	bool Loaded;
+	bool Done;
+};
+
+static std::mutex PreloadMutex;
+static std::condition_variable PreloadDone;
+static std::shared_ptr<FLevelCachePreload> Preload;
+
+void P_PreloadLevelCache(int lumpnum)
+{
+	if (!levelcache || lumpnum < 0)
+	{
+		return;
+	}
+
+	auto preload = std::make_shared<FLevelCachePreload>();
+	preload->Path = P_LevelCachePath(lumpnum, false).GetChars();
+	preload->Loaded = false;
+	preload->Done = false;
+	{
+		std::lock_guard<std::mutex> lock(PreloadMutex);
+		Preload = preload;
+	}
+
+	FJobQueue::Run([preload]()
+	{
+		bool loaded = false;
+		try
+		{
+			loaded = LoadLevelCacheFile(preload->Path.c_str(), preload->Header, preload->Body);
+		}
+		catch (...)
+		{
+		}
+		std::lock_guard<std::mutex> lock(PreloadMutex);
+		preload->Loaded = loaded;
+		preload->Done = true;
+		PreloadDone.notify_all();
+	});
+}
+
+//==========================================================================
+//
+// P_OpenLevelCache
+//
+// Must be called once the map's own vertexes, lines, sides and sectors
+// have been loaded, before anything is built from them.
+//
+//==========================================================================
+
+void P_OpenLevelCache(MapData *map)
+{
+	P_CloseLevelCache();
+
+	std::shared_ptr<FLevelCachePreload> preload;
+	{
+		std::unique_lock<std::mutex> lock(PreloadMutex);
+		preload = Preload;
+		Preload.reset();
+		if (preload != NULL)
+		{
+			PreloadDone.wait(lock, [&]() { return preload->Done; });
+		}
+	}
+
+	if (!levelcache)
+	{
+		return;
+	}
+
+	CacheOpen = true;
+	memcpy(CacheHeader.Magic, LevelCacheMagic, 4);
+	CacheHeader.Version = LEVELCACHE_VERSION;
+	map->GetChecksum(CacheHeader.Checksum);
+	CacheHeader.NumVertexes = numvertexes;
+	CacheHeader.NumLines = numlines;
+	CacheHeader.NumSides = numsides;
+	CacheHeader.NumSectors = numsectors;
+	CachePath = P_LevelCachePath(map, false);
+
+	FLevelCacheHeader header;
+	std::vector<BYTE> body;
+	bool loaded;
+	if (preload != NULL && preload->Path == CachePath.GetChars())
+	{
+		header = preload->Header;
+		body = std::move(preload->Body);
+		loaded = preload->Loaded;
+	}
+	else
+	{
+		loaded = LoadLevelCacheFile(CachePath, header, body);
+	}
+
+	if (loaded && !ReadLevelCache(header, body))
+	{
+		DPrintf(DMSG_NOTIFY, "Discarding level cache %s\n", CachePath.GetChars());
+	}
+}
+
+//==========================================================================
+//
+// P_CloseLevelCache
+//
+// Writes the cache back if any section was replaced during this load.
+//
+//==========================================================================
+
+void P_CloseLevelCache()
+{
+	if (CacheOpen && CacheDirty)
+	{
+		TArray<BYTE> body;
+		FLevelCacheWriter writer(body);
+		TMapIterator<DWORD, TArray<BYTE> > it(CacheSections);
+		TMap<DWORD, TArray<BYTE> >::Pair *pair;
+
+		while (it.NextPair(pair))
+		{
+			writer.Long(pair->Key);
+			writer.Long(pair->Value.Size());
+			if (pair->Value.Size() > 0)
+			{
+				unsigned int pos = body.Reserve(pair->Value.Size());
+				memcpy(&body[pos], &pair->Value[0], pair->Value.Size());
+			}
+		}
+
+		uLongf outlen = compressBound(body.Size());
+		TArray<BYTE> compressed;
+		compressed.Resize(outlen);
+		if (body.Size() > 0 && compress(&compressed[0], &outlen, &body[0], body.Size()) == Z_OK)
+		{
+			FLevelCacheHeader header = CacheHeader;
+			header.Version = LittleLong(header.Version);
+			header.NumVertexes = LittleLong(header.NumVertexes);
+			header.NumLines = LittleLong(header.NumLines);
+			header.NumSides = LittleLong(header.NumSides);
+			header.NumSectors = LittleLong(header.NumSectors);
+			header.BodySize = LittleLong(body.Size());
+
+			// Make sure the directory exists before writing.
+			FString dir = CachePath.Left(CachePath.LastIndexOf('/'));
+			CreatePath(dir);
+
+			FILE *f = fopen(CachePath, "wb");
+			if (f != NULL)
+			{
+				if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+					fwrite(&compressed[0], outlen, 1, f) != 1)
+				{
+					Printf("Error saving level cache to file %s\n", CachePath.GetChars());
+				}
+				fclose(f);
+			}
+			else
+			{
+				Printf("Cannot open level cache file %s for writing\n", CachePath.GetChars());
+			}
+		}
+	}
+	CacheOpen = false;
+	CacheDirty = false;
+	CachePath = "";
+	CacheSections.Clear();
+}
+
+//==========================================================================
+//
+// P_WantLevelCache
+//
+// Whether derived data should be stored for this map at all. Small maps
+// are not worth the disk access.
+//
+//==========================================================================
+
+bool P_WantLevelCache()
+{
+	return CacheOpen && (int)CacheHeader.NumLines >= levelcache_minlines;
+}
+
+//==========================================================================
+//
+// P_FindLevelCacheSection
+//
+//==========================================================================
+
+const TArray<BYTE> *P_FindLevelCacheSection(DWORD id)
+{
+	if (!CacheOpen)
+	{
+		return NULL;
+	}
+	return CacheSections.CheckKey(id);
+}
+
+//==========================================================================
+//
+// P_NewLevelCacheSection
+//
+// Returns an empty section to be filled, replacing any old one. Sections
+// stored while no cache is open are discarded.
+//
+//==========================================================================
+
+TArray<BYTE> &P_NewLevelCacheSection(DWORD id)
+{
+	TArray<BYTE> &section = CacheSections[id];
+	section.Clear();
+	CacheDirty = true;
+	return section;
+}
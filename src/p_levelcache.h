@@ -0,0 +1,80 @@
+#ifndef __P_LEVELCACHE_H
+#define __P_LEVELCACHE_H
+
+#include "doomtype.h"
+#include "doomdef.h"
+#include "tarray.h"
+#include "zstring.h"
+
+struct MapData;
+
+//==========================================================================
+//
+// One file per map in the cache directory that holds everything derived
+// from the map data that is expensive to recompute: built nodes, the
+// generated blockmap, sector line lists, sound zones and slopes. The file
+// is tied to the map's checksum, so any change to the map data discards it.
+//
+// Each piece of data lives in its own section. A section that fails its
+// own validation is simply rebuilt and replaced.
+//
+//==========================================================================
+
+enum
+{
+	LCACHE_Nodes		= MAKE_ID('N','O','D','E'),
+	LCACHE_BlockMap		= MAKE_ID('B','M','A','P'),
+	LCACHE_SectorLines	= MAKE_ID('S','L','I','N'),
+	LCACHE_Zones		= MAKE_ID('Z','O','N','E'),
+	LCACHE_Slopes		= MAKE_ID('S','L','O','P'),
+};
+
+// Writes one section's data. All values are stored little endian.
+class FLevelCacheWriter
+{
+public:
+	FLevelCacheWriter(TArray<BYTE> &data) : Data(data) {}
+
+	void Byte(BYTE b) { Data.Push(b); }
+	void Word(WORD w);
+	void Long(DWORD l);
+	void Double(double d);
+
+private:
+	TArray<BYTE> &Data;
+};
+
+// Reads one section's data. Reading past the end returns zeros and
+// sets the failed flag instead of throwing.
+class FLevelCacheReader
+{
+public:
+	FLevelCacheReader(const TArray<BYTE> &data)
+		: Pos(data.Size() > 0 ? &data[0] : NULL), End(Pos + data.Size()), Failed(false) {}
+	FLevelCacheReader(const BYTE *data, size_t len)
+		: Pos(data), End(data + len), Failed(false) {}
+
+	BYTE Byte();
+	WORD Word();
+	DWORD Long();
+	double Double();
+	const BYTE *Bytes(unsigned int len);	// Skips len bytes and returns a pointer to them
+
+	bool HasFailed() const { return Failed; }
+	bool AtEnd() const { return Pos == End; }
+
+private:
+	const BYTE *Pos, *End;
+	bool Failed;
+};
+
+void P_OpenLevelCache(MapData *map);
+void P_CloseLevelCache();
+bool P_WantLevelCache();
+const TArray<BYTE> *P_FindLevelCacheSection(DWORD id);
+TArray<BYTE> &P_NewLevelCacheSection(DWORD id);
+FString P_LevelCachePath(MapData *map, bool create);
+FString P_LevelCachePath(int lumpnum, bool create);
+void P_PreloadLevelCache(int lumpnum);
+
+#endif
@@ -61,6 +61,7 @@
 #include "r_data/colormaps.h"
 #include "fragglescript/t_fs.h"
 #include "p_spec.h"
+#include "p_flowfield.h"
 
 // Remaps EE sector change types to Generic_Floor values. According to the Eternity Wiki:
 /*
@@ -2724,6 +2725,7 @@ FUNC(LS_Line_SetBlocking)
 	while ((line = itr.Next()) >= 0)
 	{
 		lines[line].flags = (lines[line].flags & ~clearflags) | setflags;
+		P_FlowFieldLineChanged(&lines[line]);
 	}
 	return true;
 }
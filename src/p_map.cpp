@@ -63,6 +63,8 @@
 #include "r_data/r_translate.h"
 #include "g_level.h"
 #include "r_sky.h"
+#include "p_tickstats.h"
+#include "p_flowfield.h"
 
 CVAR(Bool, cl_bloodsplats, true, CVAR_ARCHIVE)
 CVAR(Int, sv_smartaim, 0, CVAR_ARCHIVE | CVAR_SERVERINFO)
@@ -261,7 +263,7 @@ void P_FindFloorCeiling(AActor *actor, int flags)
 	validcount++;
 
 	FPortalGroupArray grouplist;
-	FMultiBlockLinesIterator mit(grouplist, actor);
+	FMultiBlockLinesIterator mit(grouplist, actor, -1, true);
 	FMultiBlockLinesIterator::CheckResult cres;
 
 	// if we already have a valid floor/ceiling sector within the current sector, 
@@ -354,7 +356,7 @@ bool	P_TeleportMove(AActor* thing, const DVector3 &pos, bool telefrag, bool modi
 	sector_t *sector = P_PointInSector(pos);
 
 	FPortalGroupArray grouplist;
-	FMultiBlockLinesIterator mit(grouplist, pos.X, pos.Y, pos.Z, thing->Height, thing->radius, sector);
+	FMultiBlockLinesIterator mit(grouplist, pos.X, pos.Y, pos.Z, thing->Height, thing->radius, sector, true);
 	FMultiBlockLinesIterator::CheckResult cres;
 
 	while (mit.Next(&cres))
@@ -1768,7 +1770,7 @@ bool P_CheckPosition(AActor *thing, const DVector2 &pos, FCheckPosition &tm, boo
 	spechit.Clear();
 	portalhit.Clear();
 
-	FMultiBlockLinesIterator it(pcheck, pos.X, pos.Y, thing->Z(), thing->Height, thing->radius, newsec);
+	FMultiBlockLinesIterator it(pcheck, pos.X, pos.Y, thing->Z(), thing->Height, thing->radius, newsec, true);
 	FMultiBlockLinesIterator::CheckResult lcres;
 
 	double thingdropoffz = tm.floorz;
@@ -2119,6 +2121,11 @@ bool P_TryMove(AActor *thing, const DVector2 &pos,
 	sector_t*	oldsec = thing->Sector;	// [RH] for sector actions
 	sector_t*	newsec;
 
+	if (TickStatsActive)
+	{
+		P_GetClassTickStats(thing->GetClass()).TryMoves++;
+	}
+
 	tm.floatok = false;
 	tm.portalstep = false;
 	oldz = thing->Z();
@@ -5475,6 +5482,10 @@ int P_RadiusAttack(AActor *bombspot, AActor *bombsource, int bombdamage, int bom
 		bombsource = bombspot;
 	}
 
+	// Only things that would take damage get a sight check, but those all
+	// start at the same spot, so let them share the blockmap lines they read.
+	FTraceBlockCache tracecache;
+
 	int count = 0;
 	while ((it.Next(&cres)))
 	{
@@ -5689,6 +5700,93 @@ TArray<AActor *> intersectors;
 
 EXTERN_CVAR(Int, cl_bloodtype)
 
+//=============================================================================
+//
+// P_QuickAdjustFloorCeil
+//
+// Most things sitting in a moving sector are items, corpses and scenery
+// that touch no lines and cannot interact with anything around them. For
+// those P_CheckPosition reduces to reading the sector's planes, so do
+// just that. Returns false if the thing needs the full check.
+//
+//=============================================================================
+
+static bool P_QuickAdjustFloorCeil(AActor *thing, bool &isgood)
+{
+	// Anything that PIT_CheckThing could do something with or for.
+	if (thing->player != NULL ||
+		(thing->flags & (MF_SOLID | MF_MISSILE | MF_PICKUP | MF_SKULLFLY)) ||
+		(thing->flags2 & MF2_BLASTED) ||
+		(thing->flags3 & MF3_ISMONSTER) ||
+		(thing->flags4 & MF4_ACTLIKEBRIDGE) ||
+		(thing->flags6 & MF6_BLOCKEDBYSOLIDACTORS) ||
+		(thing->BounceFlags & BOUNCE_MBF) ||
+		thing->IsNoClip2())
+	{
+		return false;
+	}
+
+	DVector2 pos = thing->Pos();
+	sector_t *sec = P_PointInSector(pos);
+
+	if (sec->e->XFloor.ffloors.Size() != 0 ||
+		!sec->PortalBlocksMovement(sector_t::ceiling) ||
+		!sec->PortalBlocksMovement(sector_t::floor))
+	{
+		return false;
+	}
+
+	FBoundingBox box(pos.X, pos.Y, thing->radius);
+	FBlockLinesIterator lit(box);
+	line_t *ld;
+
+	while ((ld = lit.Next()))
+	{
+		if (ld->isLinePortal() || (box.inRange(ld) && box.BoxOnLineSide(ld) == -1))
+		{
+			return false;
+		}
+	}
+
+	// A non-solid thing still pushes pushable things it overlaps.
+	if (!(thing->flags2 & MF2_CANNOTPUSH))
+	{
+		FBlockThingsIterator tit(box);
+		AActor *other;
+
+		while ((other = tit.Next()))
+		{
+			if (other != thing && (other->flags2 & MF2_PUSHABLE))
+			{
+				return false;
+			}
+		}
+	}
+
+	// This is what P_CheckPosition ends up with for such a thing.
+	thing->floorz = thing->dropoffz = sec->floorplane.ZatPoint(pos);
+	thing->ceilingz = sec->ceilingplane.ZatPoint(pos);
+	thing->floorpic = sec->GetTexture(sector_t::floor);
+	thing->floorterrain = sec->GetTerrain(sector_t::floor);
+	thing->floorsector = sec;
+	thing->ceilingpic = sec->GetTexture(sector_t::ceiling);
+	thing->ceilingsector = sec;
+	thing->BlockingLine = NULL;
+	validcount++;
+
+	if (thing->flags & MF_NOCLIP)
+	{
+		isgood = true;
+		return true;
+	}
+	thing->BlockingMobj = NULL;
+	spechit.Clear();
+	portalhit.Clear();
+	validcount++;
+	isgood = thing->ceilingz - thing->floorz >= thing->Height;
+	return true;
+}
+
 //=============================================================================
 //
 // P_AdjustFloorCeil
@@ -5699,6 +5797,12 @@ bool P_AdjustFloorCeil(AActor *thing, FChangePosition *cpos)
 {
 	ActorFlags2 flags2 = thing->flags2 & MF2_PASSMOBJ;
 	FCheckPosition tm;
+	bool isgood;
+
+	if (P_QuickAdjustFloorCeil(thing, isgood))
+	{
+		return isgood;
+	}
 
 	if ((thing->flags2 & MF2_PASSMOBJ) && (thing->flags3 & MF3_ISMONSTER))
 	{
@@ -5713,7 +5817,7 @@ bool P_AdjustFloorCeil(AActor *thing, FChangePosition *cpos)
 		thing->flags2 |= MF2_PASSMOBJ;
 	}
 
-	bool isgood = P_CheckPosition(thing, thing->Pos(), tm);
+	isgood = P_CheckPosition(thing, thing->Pos(), tm);
 	if (!(thing->flags4 & MF4_ACTLIKEBRIDGE))
 	{
 		thing->floorz = tm.floorz;
@@ -6230,6 +6334,8 @@ bool P_ChangeSector(sector_t *sector, int crunch, double amt, int floorOrCeil, b
 	void(*iterator2)(AActor *, FChangePosition *) = NULL;
 	msecnode_t *n;
 
+	P_FlowFieldSectorChanged(sector);
+
 	cpos.nofit = false;
 	cpos.crushchange = crunch;
 	cpos.moveamt = fabs(amt);
@@ -27,6 +27,10 @@
 
 
 #include <stdlib.h>
+#include <math.h>
+#if defined(__amd64__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
 
 
 #include "m_bbox.h"
@@ -44,6 +48,9 @@
 #include "r_state.h"
 #include "templates.h"
 #include "po_man.h"
+#include "c_dispatch.h"
+#include "m_random.h"
+#include "stats.h"
 
 sector_t *P_PointInSectorBuggy(double x, double y);
 int P_VanillaPointOnDivlineSide(double x, double y, const divline_t* line);
@@ -294,11 +301,7 @@ void AActor::UnlinkFromWorld (FLinkContext *ctx)
 
 		while (block != NULL)
 		{
-			if (block->NextActor != NULL)
-			{
-				block->NextActor->PrevActor = block->PrevActor;
-			}
-			*(block->PrevActor) = block->NextActor;
+			P_RemoveFromBlock(block);
 			FBlockNode *next = block->NextBlock;
 			block->Release ();
 			block = next;
@@ -501,16 +504,10 @@ void AActor::LinkToWorld(FLinkContext *ctx, bool spawningmapthing, sector_t *sec
 				{
 					for (int x = x1; x <= x2; ++x)
 					{
-						FBlockNode **link = &blocklinks[y*bmapwidth + x];
 						FBlockNode *node = FBlockNode::Create(this, x, y, this->Sector->PortalGroup);
 
 						// Link in to block
-						if ((node->NextActor = *link) != NULL)
-						{
-							(*link)->PrevActor = &node->NextActor;
-						}
-						node->PrevActor = link;
-						*link = node;
+						node->Index = blocklinks[node->BlockIndex].Push(this);
 
 						// Link in to actor
 						node->PrevBlock = alink;
@@ -577,8 +574,6 @@ FBlockNode *FBlockNode::Create (AActor *who, int x, int y, int group)
 	}
 	block->BlockIndex = x + y*bmapwidth;
 	block->Me = who;
-	block->NextActor = NULL;
-	block->PrevActor = NULL;
 	block->PrevBlock = NULL;
 	block->NextBlock = NULL;
 	return block;
@@ -590,6 +585,89 @@ void FBlockNode::Release ()
 	FreeBlocks = this;
 }
 
+//===========================================================================
+//
+// FindBlockNode
+//
+// Returns the node that put an actor at the given position of a block.
+// An actor can be in the same block more than once if it is linked
+// through a portal, so the block index alone is not enough.
+//
+//===========================================================================
+
+static FBlockNode *FindBlockNode (AActor *actor, int block, unsigned index)
+{
+	for (FBlockNode *node = actor->BlockNode; node != NULL; node = node->NextBlock)
+	{
+		if (node->BlockIndex == block && node->Index == index)
+		{
+			return node;
+		}
+	}
+	assert(false && "blocklinks entry without a matching node");
+	return NULL;
+}
+
+//===========================================================================
+//
+// P_RemoveFromBlock
+//
+// The removed actor's place is taken by the block's last one. That
+// changes the order in which the block's actors are found, but the
+// result is still fully determined by the order things were linked and
+// unlinked in, which is all that demos and netgames need.
+//
+//===========================================================================
+
+void P_RemoveFromBlock (FBlockNode *node)
+{
+	if (blocklinks == NULL)
+	{
+		return;
+	}
+
+	TArray<AActor *> &list = blocklinks[node->BlockIndex];
+	unsigned last = list.Size() - 1;
+
+	if (node->Index != last)
+	{
+		AActor *moved = list[last];
+		FBlockNode *movednode = FindBlockNode(moved, node->BlockIndex, last);
+
+		list[node->Index] = moved;
+		if (movednode != NULL) movednode->Index = node->Index;
+	}
+	list.Pop();
+}
+
+//===========================================================================
+//
+// P_RestoreToBlock
+//
+// Puts an actor back where P_RemoveFromBlock took it from, so that the
+// block's order is as if it had never been removed.
+//
+//===========================================================================
+
+void P_RestoreToBlock (FBlockNode *node)
+{
+	TArray<AActor *> &list = blocklinks[node->BlockIndex];
+
+	if (node->Index < list.Size())
+	{
+		AActor *moved = list[node->Index];
+		FBlockNode *movednode = FindBlockNode(moved, node->BlockIndex, node->Index);
+		unsigned last = list.Push(moved);
+
+		if (movednode != NULL) movednode->Index = last;
+		list[node->Index] = node->Me;
+	}
+	else
+	{
+		node->Index = list.Push(node->Me);
+	}
+}
+
 //
 // BLOCK MAP ITERATORS
 // For each line/thing in the given mapblock,
@@ -606,9 +684,178 @@ void FBlockNode::Release ()
 //===========================================================================
 extern polyblock_t **PolyBlockMap;
 
+FBlockLineTable *blocklinetable;
+
+//===========================================================================
+//
+// Rounds outwards to the nearest float
+//
+//===========================================================================
+
+static inline float FloatBelow(double v)
+{
+	float f = (float)v;
+	return f > v ? nextafterf(f, -FLT_MAX) : f;
+}
+
+static inline float FloatAbove(double v)
+{
+	float f = (float)v;
+	return f < v ? nextafterf(f, FLT_MAX) : f;
+}
+
+//===========================================================================
+//
+// P_BuildBlockLineTable
+//
+// Must be called after the polyobjects have been spawned.
+//
+//===========================================================================
+
+void P_BuildBlockLineTable()
+{
+	P_FreeBlockLineTable();
+
+	TArray<BYTE> polylines;
+	polylines.Resize(numlines);
+	if (numlines > 0) memset(&polylines[0], 0, numlines);
+	for (int i = 0; i < po_NumPolyobjs; ++i)
+	{
+		for (auto ld : polyobjs[i].Linedefs)
+		{
+			polylines[int(ld - lines)] = 1;
+		}
+	}
+
+	FBlockLineTable *table = new FBlockLineTable;
+	int count = bmapwidth * bmapheight;
+
+	table->Start.Resize(count + 1);
+	for (int i = 0; i < count; ++i)
+	{
+		table->Start[i] = table->Line.Size();
+
+		// There is an extra entry at the beginning of every block.
+		for (int *list = blockmaplump + blockmap[i] + 1; *list != -1; list++)
+		{
+			line_t *ld = &lines[*list];
+
+			table->Line.Push(*list);
+			if (polylines[*list])
+			{
+				table->Left.Push(-FLT_MAX);
+				table->Right.Push(FLT_MAX);
+				table->Bottom.Push(-FLT_MAX);
+				table->Top.Push(FLT_MAX);
+				table->NormX.Push(0);
+				table->NormY.Push(0);
+				table->Dist.Push(0);
+			}
+			else
+			{
+				table->Left.Push(FloatBelow(ld->bbox[BOXLEFT]));
+				table->Right.Push(FloatAbove(ld->bbox[BOXRIGHT]));
+				table->Bottom.Push(FloatBelow(ld->bbox[BOXBOTTOM]));
+				table->Top.Push(FloatAbove(ld->bbox[BOXTOP]));
+
+				DVector2 delta = ld->Delta();
+				double len = delta.Length();
+				if (len > 0)
+				{
+					double nx = -delta.Y / len, ny = delta.X / len;
+					table->NormX.Push((float)nx);
+					table->NormY.Push((float)ny);
+					table->Dist.Push((float)(nx * ld->v1->fX() + ny * ld->v1->fY()));
+				}
+				else
+				{
+					table->NormX.Push(0);
+					table->NormY.Push(0);
+					table->Dist.Push(0);
+				}
+			}
+		}
+		while (table->Line.Size() & 3)
+		{
+			table->Line.Push(0);
+			table->Left.Push(FLT_MAX);
+			table->Right.Push(-FLT_MAX);
+			table->Bottom.Push(FLT_MAX);
+			table->Top.Push(-FLT_MAX);
+			table->NormX.Push(0);
+			table->NormY.Push(0);
+			table->Dist.Push(0);
+		}
+	}
+	table->Start[count] = table->Line.Size();
+	blocklinetable = table;
+}
+
+void P_FreeBlockLineTable()
+{
+	if (blocklinetable != NULL)
+	{
+		delete blocklinetable;
+		blocklinetable = NULL;
+	}
+}
+
+//===========================================================================
+//
+// BoxLineMask
+//
+// Tests four table entries against a box, returning one bit for each
+// that may touch it. A line passes if its bounding box overlaps the box
+// and the line comes no farther from the box's center than the box's
+// reach along the line's normal. ext holds the center and the half
+// extents of the box, which include a margin for the float math.
+//
+//===========================================================================
+
+static inline unsigned BoxLineMask(const FBlockLineTable *table, int pos, const float *box, const float *ext)
+{
+#if defined(__amd64__) || defined(_M_X64)
+	__m128 pass = _mm_and_ps(
+		_mm_and_ps(
+			_mm_cmplt_ps(_mm_set1_ps(box[BOXLEFT]), _mm_loadu_ps(&table->Right[pos])),
+			_mm_cmpgt_ps(_mm_set1_ps(box[BOXRIGHT]), _mm_loadu_ps(&table->Left[pos]))),
+		_mm_and_ps(
+			_mm_cmpgt_ps(_mm_set1_ps(box[BOXTOP]), _mm_loadu_ps(&table->Bottom[pos])),
+			_mm_cmplt_ps(_mm_set1_ps(box[BOXBOTTOM]), _mm_loadu_ps(&table->Top[pos]))));
+
+	__m128 signbit = _mm_set1_ps(-0.f);
+	__m128 nx = _mm_loadu_ps(&table->NormX[pos]);
+	__m128 ny = _mm_loadu_ps(&table->NormY[pos]);
+	__m128 dist = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_set1_ps(ext[0])), _mm_mul_ps(ny, _mm_set1_ps(ext[1]))),
+		_mm_loadu_ps(&table->Dist[pos]));
+	__m128 reach = _mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signbit, nx), _mm_set1_ps(ext[2])),
+		_mm_mul_ps(_mm_andnot_ps(signbit, ny), _mm_set1_ps(ext[3])));
+	pass = _mm_and_ps(pass, _mm_cmple_ps(_mm_andnot_ps(signbit, dist), reach));
+	return _mm_movemask_ps(pass);
+#else
+	unsigned mask = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (box[BOXLEFT] < table->Right[pos + i] && box[BOXRIGHT] > table->Left[pos + i] &&
+			box[BOXTOP] > table->Bottom[pos + i] && box[BOXBOTTOM] < table->Top[pos + i])
+		{
+			float nx = table->NormX[pos + i], ny = table->NormY[pos + i];
+			float dist = nx * ext[0] + ny * ext[1] - table->Dist[pos + i];
+			if (fabsf(dist) <= fabsf(nx) * ext[2] + fabsf(ny) * ext[3])
+			{
+				mask |= 1 << i;
+			}
+		}
+	}
+	return mask;
+#endif
+}
+
 FBlockLinesIterator::FBlockLinesIterator(int _minx, int _miny, int _maxx, int _maxy, bool keepvalidcount)
 {
+	filtered = false;
 	if (!keepvalidcount) validcount++;
+
 	minx = _minx;
 	maxx = _maxx;
 	miny = _miny;
@@ -628,9 +875,51 @@ void FBlockLinesIterator::init(const FBoundingBox &box)
 
 FBlockLinesIterator::FBlockLinesIterator(const FBoundingBox &box)
 {
+	filtered = false;
 	init(box);
 }
 
+//===========================================================================
+//
+// FBlockLinesIterator :: SetBoxFilter
+//
+// Lets the iterator skip lines that cannot touch the box. Takes effect
+// with the next init.
+//
+//===========================================================================
+
+// Slack for the line test in BoxLineMask. Float rounding in the line
+// equations stays well below this for any coordinates a map can have.
+static const double LINE_FILTER_MARGIN = 1.;
+
+// Set by blocklinetest to time the bounding box test alone.
+#ifdef _DEBUG
+static bool NoLineFilter;
+#else
+static const bool NoLineFilter = false;
+#endif
+
+void FBlockLinesIterator::SetBoxFilter(const FBoundingBox &box)
+{
+	filtered = blocklinetable != NULL;
+	filterbox[BOXLEFT] = FloatBelow(box.Left());
+	filterbox[BOXRIGHT] = FloatAbove(box.Right());
+	filterbox[BOXBOTTOM] = FloatBelow(box.Bottom());
+	filterbox[BOXTOP] = FloatAbove(box.Top());
+
+	filterext[0] = float((box.Left() + box.Right()) / 2);
+	filterext[1] = float((box.Bottom() + box.Top()) / 2);
+	if (NoLineFilter)
+	{
+		filterext[2] = filterext[3] = 1e30f;
+	}
+	else
+	{
+		filterext[2] = FloatAbove((box.Right() - box.Left()) / 2 + LINE_FILTER_MARGIN);
+		filterext[3] = FloatAbove((box.Top() - box.Bottom()) / 2 + LINE_FILTER_MARGIN);
+	}
+}
+
 //===========================================================================
 //
 // FBlockLinesIterator :: StartBlock
@@ -647,16 +936,28 @@ void FBlockLinesIterator::StartBlock(int x, int y)
 		polyLink = PolyBlockMap? PolyBlockMap[offset] : NULL;
 		polyIndex = 0;
 
-		// There is an extra entry at the beginning of every block.
-		// Apparently, id had originally intended for it to be used
-		// to keep track of things, but the final code does not do that.
-		list = blockmaplump + *(blockmap + offset) + 1;
+		if (filtered)
+		{
+			tablepos = blocklinetable->Start[offset];
+			tableend = blocklinetable->Start[offset + 1];
+			chunkmask = 0;
+			list = NULL;
+		}
+		else
+		{
+			// There is an extra entry at the beginning of every block.
+			// Apparently, id had originally intended for it to be used
+			// to keep track of things, but the final code does not do that.
+			list = blockmaplump + *(blockmap + offset) + 1;
+		}
 	}
 	else
 	{
 		// invalid block
 		list = NULL;
 		polyLink = NULL;
+		tablepos = tableend = 0;
+		chunkmask = 0;
 	}
 }
 
@@ -705,7 +1006,29 @@ line_t *FBlockLinesIterator::Next()
 			else polyLink = polyLink->next;
 		}
 
-		if (list != NULL)
+		if (filtered)
+		{
+			while (chunkmask != 0 || tablepos < tableend)
+			{
+				if (chunkmask == 0)
+				{
+					chunk = tablepos;
+					chunkmask = BoxLineMask(blocklinetable, chunk, filterbox, filterext);
+					tablepos += 4;
+					continue;
+				}
+				int i = (chunkmask & 1) ? 0 : (chunkmask & 2) ? 1 : (chunkmask & 4) ? 2 : 3;
+				chunkmask &= chunkmask - 1;
+
+				line_t *ld = &lines[blocklinetable->Line[chunk + i]];
+				if (ld->validcount != validcount)
+				{
+					ld->validcount = validcount;
+					return ld;
+				}
+			}
+		}
+		else if (list != NULL)
 		{
 			while (*list != -1)
 			{
@@ -737,8 +1060,8 @@ line_t *FBlockLinesIterator::Next()
 //
 //===========================================================================
 
-FMultiBlockLinesIterator::FMultiBlockLinesIterator(FPortalGroupArray &check, AActor *origin, double checkradius)
-	: checklist(check)
+FMultiBlockLinesIterator::FMultiBlockLinesIterator(FPortalGroupArray &check, AActor *origin, double checkradius, bool _boxfilter)
+	: checklist(check), boxfilter(_boxfilter)
 {
 	checkpoint = origin->Pos();
 	if (!check.inited) P_CollectConnectedGroups(origin->Sector->PortalGroup, checkpoint, origin->Top(), checkradius, checklist);
@@ -748,8 +1071,8 @@ FMultiBlockLinesIterator::FMultiBlockLinesIterator(FPortalGroupArray &check, AAc
 	Reset();
 }
 
-FMultiBlockLinesIterator::FMultiBlockLinesIterator(FPortalGroupArray &check, double checkx, double checky, double checkz, double checkh, double checkradius, sector_t *newsec)
-	: checklist(check)
+FMultiBlockLinesIterator::FMultiBlockLinesIterator(FPortalGroupArray &check, double checkx, double checky, double checkz, double checkh, double checkradius, sector_t *newsec, bool _boxfilter)
+	: checklist(check), boxfilter(_boxfilter)
 {
 	checkpoint = { checkx, checky, checkz };
 	if (newsec == NULL)	newsec = P_PointInSector(checkx, checky);
@@ -876,6 +1199,7 @@ void FMultiBlockLinesIterator::startIteratorForGroup(int group)
 	offset.Y += checkpoint.Y;
 	cursector = group == startsector->PortalGroup ? startsector : P_PointInSector(offset);
 	bbox.setBox(offset.X, offset.Y, checkpoint.Z);
+	if (boxfilter) blockIterator.SetBoxFilter(bbox);
 	blockIterator.init(bbox);
 }
 
@@ -893,29 +1217,103 @@ void FMultiBlockLinesIterator::Reset()
 	startIteratorForGroup(basegroup);
 }
 
+#ifdef _DEBUG
+//===========================================================================
+//
+// CCMD blocklinetest
+//
+// Times line collection for random boxes around the map without the packed
+// block line table, with its bounding box test alone and with the line
+// test added, and checks that all of them find the same lines.
+//
+//===========================================================================
+
+static FRandom pr_bltest;
+
+CCMD(blocklinetest)
+{
+	if (blocklinetable == NULL || bmapwidth == 0 || bmapheight == 0)
+	{
+		Printf("No level loaded\n");
+		return;
+	}
+
+	int count = 100000;
+	if (argv.argc() > 1)
+	{
+		count = MAX(1, atoi(argv[1]));
+	}
+
+	TArray<DVector3> spots;
+	spots.Resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		spots[i].X = bmaporgx + (pr_bltest.GenRand32() % (bmapwidth * MAPBLOCKUNITS));
+		spots[i].Y = bmaporgy + (pr_bltest.GenRand32() % (bmapheight * MAPBLOCKUNITS));
+		spots[i].Z = 16 + (pr_bltest() % 48);
+	}
+
+	cycle_t time[3];
+	unsigned hits[3] = { 0, 0, 0 };
+	unsigned sums[3] = { 0, 0, 0 };
+	unsigned returned[3] = { 0, 0, 0 };
+
+	for (int pass = 0; pass < 3; ++pass)
+	{
+		NoLineFilter = pass == 1;
+		time[pass].Reset();
+		time[pass].Clock();
+		for (int i = 0; i < count; ++i)
+		{
+			FPortalGroupArray groups;
+			FMultiBlockLinesIterator it(groups, spots[i].X, spots[i].Y, 0, 56, spots[i].Z, NULL, pass != 0);
+			FMultiBlockLinesIterator::CheckResult cres;
+
+			while (it.Next(&cres))
+			{
+				returned[pass]++;
+				if (it.Box().inRange(cres.line) && it.Box().BoxOnLineSide(cres.line) == -1)
+				{
+					hits[pass]++;
+					sums[pass] = sums[pass] * 31 + unsigned(cres.line - lines);
+				}
+			}
+		}
+		time[pass].Unclock();
+	}
+	NoLineFilter = false;
+
+	Printf("%d boxes: %u lines touched, unfiltered %.3f ms (%u lines), box test %.3f ms (%u lines), line test %.3f ms (%u lines)%s\n",
+		count, hits[0], time[0].TimeMS(), returned[0], time[1].TimeMS(), returned[1], time[2].TimeMS(), returned[2],
+		(hits[0] != hits[1] || sums[0] != sums[1] || hits[0] != hits[2] || sums[0] != sums[2]) ? ", MISMATCH" : "");
+}
+#endif
+
 //===========================================================================
 //
 // FBlockThingsIterator :: FBlockThingsIterator
 //
 //===========================================================================
 
+static int UsedBlockStamps;			// one bit for each of AActor::BlockStamps
+static QWORD LastBlockStamp;
+
 FBlockThingsIterator::FBlockThingsIterator()
-: DynHash(0)
 {
 	minx = maxx = 0;
 	miny = maxy = 0;
-	ClearHash();
-	block = NULL;
+	ClearChecked();
+	block = -1;
+	entry = 0;
 }
 
 FBlockThingsIterator::FBlockThingsIterator(int _minx, int _miny, int _maxx, int _maxy)
-: DynHash(0)
 {
 	minx = _minx;
 	maxx = _maxx;
 	miny = _miny;
 	maxy = _maxy;
-	ClearHash();
+	ClearChecked();
 	Reset();
 }
 
@@ -925,21 +1323,96 @@ void FBlockThingsIterator::init(const FBoundingBox &box)
 	miny = GetBlockY(box.Bottom());
 	maxx = GetBlockX(box.Right());
 	minx = GetBlockX(box.Left());
-	ClearHash();
+	ClearChecked();
 	Reset();
 }
 
 //===========================================================================
 //
-// FBlockThingsIterator :: ClearHash
+// FBlockThingsIterator :: FStampSlot :: Acquire
+//
+// Iterators are routinely nested, e.g. when something that was found
+// gets damaged and moves, so each active one needs its own stamp slot.
 //
 //===========================================================================
 
-void FBlockThingsIterator::ClearHash()
+bool FBlockThingsIterator::FStampSlot::Acquire()
 {
-	memset(Buckets, -1, sizeof(Buckets));
-	NumFixedHash = 0;
-	DynHash.Clear();
+	for (int i = 0; i < NUM_BLOCKSTAMPS; ++i)
+	{
+		if (!(UsedBlockStamps & (1 << i)))
+		{
+			UsedBlockStamps |= 1 << i;
+			Index = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+void FBlockThingsIterator::FStampSlot::Release()
+{
+	if (Index >= 0)
+	{
+		UsedBlockStamps &= ~(1 << Index);
+		Index = -1;
+	}
+}
+
+//===========================================================================
+//
+// FBlockThingsIterator :: ClearChecked
+//
+//===========================================================================
+
+void FBlockThingsIterator::ClearChecked()
+{
+	Slot.Release();
+	Searching = false;
+	Checked.Clear();
+	Visited.Clear();
+}
+
+//===========================================================================
+//
+// FBlockThingsIterator :: WasReturned
+//
+// Checks if an actor was returned before and marks it as returned.
+// Actors in several blocks are only returned once per search. All others
+// can be returned again from another block if they moved there, but not
+// twice from the same one when removals rearrange it during the visit.
+//
+//===========================================================================
+
+bool FBlockThingsIterator::WasReturned(AActor *me, bool spanning)
+{
+	if (!Searching)
+	{
+		Searching = true;
+		Slot.Acquire();
+		SearchStamp = ++LastBlockStamp;
+	}
+	if (*Slot >= 0)
+	{
+		FBlockStamp &stamp = me->BlockStamps[*Slot];
+
+		if (stamp.Visit == VisitStamp || (spanning && stamp.Search == SearchStamp))
+		{
+			return true;
+		}
+		stamp.Visit = VisitStamp;
+		if (spanning) stamp.Search = SearchStamp;
+	}
+	else
+	{
+		if (Visited.Find(me) < Visited.Size() || (spanning && Checked.Find(me) < Checked.Size()))
+		{
+			return true;
+		}
+		Visited.Push(me);
+		if (spanning) Checked.Push(me);
+	}
+	return false;
 }
 
 //===========================================================================
@@ -952,14 +1425,18 @@ void FBlockThingsIterator::StartBlock(int x, int y)
 { 
 	curx = x; 
 	cury = y; 
+	VisitStamp = ++LastBlockStamp;
+	Visited.Clear();
 	if (x >= 0 && y >= 0 && x < bmapwidth && y <bmapheight)
 	{
-		block = blocklinks[y*bmapwidth + x];
+		block = y*bmapwidth + x;
+		entry = blocklinks[block].Size();
 	}
 	else
 	{
 		// invalid block
-		block = NULL;
+		block = -1;
+		entry = 0;
 	}
 }
 
@@ -980,72 +1457,48 @@ void FBlockThingsIterator::SwitchBlock(int x, int y)
 //
 // FBlockThingsIterator :: Next
 //
+// A block's actors are checked from the end of its list backwards, so
+// whatever gets linked while the block is being checked is not seen.
+//
 //===========================================================================
 
 AActor *FBlockThingsIterator::Next(bool centeronly)
 {
 	for (;;)
 	{
-		while (block != NULL)
+		if (block >= 0)
 		{
-			AActor *me = block->Me;
-			FBlockNode *mynode = block;
-			HashEntry *entry;
-			int i;
-
-			block = block->NextActor;
-			// Don't recheck things that were already checked
-			if (mynode->NextBlock == NULL && mynode->PrevBlock == &me->BlockNode)
-			{ // This actor doesn't span blocks, so we know it can only ever be checked once.
-				return me;
-			}
-			if (centeronly)
+			TArray<AActor *> &list = blocklinks[block];
+
+			if (entry > (int)list.Size())
 			{
-				// Block boundaries for compatibility mode
-				double blockleft = (curx * MAPBLOCKUNITS) + bmaporgx;
-				double blockright = blockleft + MAPBLOCKUNITS;
-				double blockbottom = (cury * MAPBLOCKUNITS) + bmaporgy;
-				double blocktop = blockbottom + MAPBLOCKUNITS;
-
-				// only return actors with the center in this block
-				if (me->X() >= blockleft && me->X() < blockright &&
-					me->Y() >= blockbottom && me->Y() < blocktop)
-				{
-					return me;
-				}
+				entry = list.Size();
 			}
-			else
+			while (entry > 0)
 			{
-				size_t hash = ((size_t)me >> 3) % countof(Buckets);
-				for (i = Buckets[hash]; i >= 0; )
+				AActor *me = list[--entry];
+				bool spanning = me->BlockNode == NULL || me->BlockNode->NextBlock != NULL;
+
+				if (spanning && centeronly)
 				{
-					entry = GetHashEntry(i);
-					if (entry->Actor == me)
-					{ // I've already been checked. Skip to the next actor.
-						break;
-					}
-					i = entry->Next;
-				}
-				if (i < 0)
-				{ // Add me to the hash table and return me.
-					if (NumFixedHash < (int)countof(FixedHash))
-					{
-						entry = &FixedHash[NumFixedHash];
-						entry->Next = Buckets[hash];
-						Buckets[hash] = NumFixedHash++;
-					}
-					else
+					// Block boundaries for compatibility mode
+					double blockleft = (curx * MAPBLOCKUNITS) + bmaporgx;
+					double blockright = blockleft + MAPBLOCKUNITS;
+					double blockbottom = (cury * MAPBLOCKUNITS) + bmaporgy;
+					double blocktop = blockbottom + MAPBLOCKUNITS;
+
+					// only return actors with the center in this block
+					if (!(me->X() >= blockleft && me->X() < blockright &&
+						me->Y() >= blockbottom && me->Y() < blocktop))
 					{
-						if (DynHash.Size() == 0)
-						{
-							DynHash.Grow(50);
-						}
-						i = DynHash.Reserve(1);
-						entry = &DynHash[i];
-						entry->Next = Buckets[hash];
-						Buckets[hash] = i + countof(FixedHash);
+						continue;
 					}
-					entry->Actor = me;
+					spanning = false;
+				}
+
+				// Don't recheck things that were already checked
+				if (!WasReturned(me, spanning))
+				{
 					return me;
 				}
 			}
@@ -1233,6 +1686,64 @@ DEFINE_FIELD_NAMED(DBlockThingsIterator, cres.thing, thing);
 DEFINE_FIELD_NAMED(DBlockThingsIterator, cres.Position, position);
 DEFINE_FIELD_NAMED(DBlockThingsIterator, cres.portalflags, portalflags);
 
+//===========================================================================
+//
+// FTraceBlockCache
+//
+// Only the outermost cache is active, nested ones just use it.
+//
+//===========================================================================
+
+FTraceBlockCache *FTraceBlockCache::Active;
+
+FTraceBlockCache::FTraceBlockCache()
+{
+	if (Active == NULL)
+	{
+		Active = this;
+	}
+}
+
+FTraceBlockCache::~FTraceBlockCache()
+{
+	if (Active == this)
+	{
+		Active = NULL;
+	}
+}
+
+//===========================================================================
+//
+// FTraceBlockCache :: GetBlock
+//
+// Returns the static lines of a block in blockmap order, gathering them
+// on first use.
+//
+//===========================================================================
+
+const FTraceBlockCache::CachedLine *FTraceBlockCache::GetBlock(int offset)
+{
+	unsigned *start = Blocks.CheckKey(offset);
+
+	if (start == NULL)
+	{
+		unsigned index = Lines.Size();
+		Blocks[offset] = index;
+
+		// skip the extra entry at the beginning of every block
+		for (int *list = blockmaplump + blockmap[offset] + 1; *list != -1; list++)
+		{
+			line_t *ld = &lines[*list];
+			CachedLine cl = { ld, ld->v1->fX(), ld->v1->fY(), ld->v2->fX(), ld->v2->fY(), ld->Delta().X, ld->Delta().Y };
+			Lines.Push(cl);
+		}
+		CachedLine end = { NULL };
+		Lines.Push(end);
+		return &Lines[index];
+	}
+	return &Lines[*start];
+}
+
 //===========================================================================
 //
 // FPathTraverse :: Intercepts
@@ -1256,6 +1767,41 @@ TArray<intercept_t> FPathTraverse::intercepts(128);
 
 void FPathTraverse::AddLineIntercepts(int bx, int by)
 {
+	if (FTraceBlockCache::Active != NULL && bx >= 0 && by >= 0 && bx < bmapwidth && by < bmapheight)
+	{
+		int offset = by*bmapwidth + bx;
+
+		// Blocks with polyobjects take the regular path.
+		if (PolyBlockMap == NULL || PolyBlockMap[offset] == NULL)
+		{
+			for (const FTraceBlockCache::CachedLine *cl = FTraceBlockCache::Active->GetBlock(offset); cl->line != NULL; cl++)
+			{
+				line_t *ld = cl->line;
+				if (ld->validcount == validcount) continue;
+				ld->validcount = validcount;
+
+				int s1 = P_PointOnDivlineSide(cl->x1, cl->y1, &trace);
+				int s2 = P_PointOnDivlineSide(cl->x2, cl->y2, &trace);
+
+				if (s1 == s2) continue;	// line isn't crossed
+
+				divline_t dl = { cl->x1, cl->y1, cl->dx, cl->dy };
+				double frac = P_InterceptVector(&trace, &dl);
+
+				if (frac < Startfrac || frac > 1.) continue;	// behind source or beyond end point
+
+				intercept_t newintercept;
+
+				newintercept.frac = frac;
+				newintercept.isaline = true;
+				newintercept.done = false;
+				newintercept.d.line = ld;
+				intercepts.Push(newintercept);
+			}
+			return;
+		}
+	}
+
 	FBlockLinesIterator it(bx, by, bx, by, true);
 	line_t *ld;
 
@@ -1871,23 +2417,24 @@ static AActor *RoughBlockCheck (AActor *mo, int index, void *param)
 {
 	BlockCheckInfo *info = (BlockCheckInfo *)param;
 
-	FBlockNode *link;
+	TArray<AActor *> &list = blocklinks[index];
 
-	for (link = blocklinks[index]; link != NULL; link = link->NextActor)
+	for (int i = list.Size() - 1; i >= 0; --i)
 	{
-		if (link->Me != mo)
+		AActor *link = list[i];
+		if (link != mo)
 		{
-			if (info->onlyseekable && !mo->CanSeek(link->Me))
+			if (info->onlyseekable && !mo->CanSeek(link))
 			{
 				continue;
 			}
-			if (info->frontonly && P_PointOnDivlineSide(link->Me->X(), link->Me->Y(), &info->frontline) != 0)
+			if (info->frontonly && P_PointOnDivlineSide(link->X(), link->Y(), &info->frontline) != 0)
 			{
 				continue;
 			}
-			if (mo->IsOkayToAttack (link->Me))
+			if (mo->IsOkayToAttack (link))
 			{
-				return link->Me;
+				return link;
 			}
 		}
 	}
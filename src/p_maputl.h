@@ -211,10 +211,19 @@ class FBlockLinesIterator
 	int polyIndex;
 	int *list;
 
+	// Set when only lines touching a box are wanted. See FBlockLineTable.
+	bool filtered;
+	float filterbox[4];
+	float filterext[4];			// center and half size of the box for the line test
+	int tablepos, tableend;
+	int chunk;
+	unsigned chunkmask;
+
 	void StartBlock(int x, int y);
 
-	FBlockLinesIterator() {}
+	FBlockLinesIterator() : filtered(false) {}
 	void init(const FBoundingBox &box);
+	void SetBoxFilter(const FBoundingBox &box);
 public:
 	FBlockLinesIterator(int minx, int miny, int maxx, int maxy, bool keepvalidcount = false);
 	FBlockLinesIterator(const FBoundingBox &box);
@@ -234,6 +243,7 @@ class FMultiBlockLinesIterator
 	short index;
 	bool continueup;
 	bool continuedown;
+	bool boxfilter;
 	FBlockLinesIterator blockIterator;
 	FBoundingBox bbox;
 
@@ -250,8 +260,9 @@ public:
 		int portalflags;
 	};
 
-	FMultiBlockLinesIterator(FPortalGroupArray &check, AActor *origin, double checkradius = -1);
-	FMultiBlockLinesIterator(FPortalGroupArray &check, double checkx, double checky, double checkz, double checkh, double checkradius, sector_t *newsec);
+	// With boxfilter set, lines that cannot touch Box() may be skipped.
+	FMultiBlockLinesIterator(FPortalGroupArray &check, AActor *origin, double checkradius = -1, bool boxfilter = false);
+	FMultiBlockLinesIterator(FPortalGroupArray &check, double checkx, double checky, double checkz, double checkh, double checkradius, sector_t *newsec, bool boxfilter = false);
 
 	bool Next(CheckResult *item);
 	void Reset();
@@ -278,29 +289,48 @@ class FBlockThingsIterator
 
 	int curx, cury;
 
-	FBlockNode *block;
-
-	int Buckets[32];
+	int block;		// index into blocklinks, or -1 if outside the map
+	int entry;		// the block's actors are checked from this index downward
 
-	struct HashEntry
+	// Owns one of AActor::BlockStamps from the first Next of a search
+	// until the next search starts or the iterator goes away.
+	class FStampSlot
 	{
-		AActor *Actor;
-		int Next;
+		int Index = -1;
+
+	public:
+		FStampSlot() = default;
+		FStampSlot(const FStampSlot &) = delete;
+		FStampSlot &operator=(const FStampSlot &) = delete;
+		~FStampSlot() { Release(); }
+
+		bool Acquire();
+		void Release();
+		int operator*() const { return Index; }
 	};
-	HashEntry FixedHash[10];
-	int NumFixedHash;
-	TArray<HashEntry> DynHash;
 
-	HashEntry *GetHashEntry(int i) { return i < (int)countof(FixedHash) ? &FixedHash[i] : &DynHash[i - countof(FixedHash)]; }
+	// Actors that were already returned are recognized by having this
+	// iterator's stamps in their BlockStamps[*Slot]. If too many iterators
+	// are active, they are put into Checked and Visited instead.
+	FStampSlot Slot;
+	bool Searching;
+	QWORD SearchStamp;
+	QWORD VisitStamp;
+	TArray<AActor *> Checked;
+	TArray<AActor *> Visited;
 
 	void StartBlock(int x, int y);
 	void SwitchBlock(int x, int y);
-	void ClearHash();
+	void ClearChecked();
+	bool WasReturned(AActor *me, bool spanning);
 
 	// The following is only for use in the path traverser 
 	// and therefore declared private.
 	FBlockThingsIterator();
 
+	FBlockThingsIterator(const FBlockThingsIterator &) = delete;
+	FBlockThingsIterator &operator=(const FBlockThingsIterator &) = delete;
+
 	friend class FPathTraverse;
 	friend class FMultiBlockThingsIterator;
 
@@ -348,6 +378,45 @@ public:
 
 
 
+//============================================================================
+//
+// While one of these exists, FPathTraverse and the sight checker keep the
+// static blockmap lines of every block they visit in one compact array,
+// with the coordinates they need copied in. Traces fired in quick
+// succession around one spot, like the pellets of a shotgun blast or the
+// sight checks of an explosion, then read each block only once. Actors
+// and polyobject lines can change between traces, so those are always
+// checked live. Results are exactly the same as without a cache.
+//
+//============================================================================
+
+class FTraceBlockCache
+{
+	friend class FPathTraverse;
+	friend class SightCheck;
+
+	struct CachedLine
+	{
+		line_t *line;		// NULL ends a block
+		double x1, y1;
+		double x2, y2;
+		double dx, dy;
+	};
+
+	TMap<int, unsigned> Blocks;		// block offset -> index into Lines
+	TArray<CachedLine> Lines;
+
+	static FTraceBlockCache *Active;
+
+	const CachedLine *GetBlock(int offset);
+
+public:
+	FTraceBlockCache();
+	~FTraceBlockCache();
+	FTraceBlockCache(const FTraceBlockCache &) = delete;
+	FTraceBlockCache &operator=(const FTraceBlockCache &) = delete;
+};
+
 class FPathTraverse
 {
 protected:
@@ -72,6 +72,7 @@
 #include "a_armor.h"
 #include "a_ammo.h"
 #include "a_health.h"
+#include "p_tickstats.h"
 
 // MACROS ------------------------------------------------------------------
 
@@ -4508,6 +4509,11 @@ AActor *AActor::StaticSpawn (PClassActor *type, const DVector3 &pos, replace_t a
 	
 	actor = static_cast<AActor *>(const_cast<PClassActor *>(type)->CreateNew ());
 
+	if (TickStatsActive)
+	{
+		P_GetClassTickStats(type).Spawns++;
+	}
+
 	// Set default dialogue
 	actor->ConversationRoot = GetConversation(actor->GetClass()->TypeName);
 	if (actor->ConversationRoot != -1)
@@ -0,0 +1,845 @@
+/*
+** p_preload.cpp
+**
+** Background loading of the next map during the intermission
+**
+**---------------------------------------------------------------------------
+** Copyright 2016 The ZDoom Team
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+** 3. The name of the author may not be used to endorse or promote products
+**    derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+** OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+** INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+** NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+** THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**---------------------------------------------------------------------------
+**
+** The preload runs in stages, a few milliseconds per tic:
+**
+** 1. The map's lumps are read. Deflated, bzip2 and LZMA lumps are
+**    decompressed on the job queue and handed to the lump cache when done.
+** 2. If all of the map is in memory now, its sidedefs, sectors and things
+**    are scanned on the job queue for the textures and actor types they use.
+** 3. Compressed texture source lumps are decompressed like the map lumps,
+**    then the renderer precaches the textures.
+** 4. The same for the sounds of the actor types found.
+**
+** All reads from the resource files happen on the main thread, since their
+** readers are shared with the rest of the engine; the job queue only
+** decompresses and scans the copies it is given.
+**
+** The preload holds a reference to every lump cache it fills until the
+** level has been set up, so nothing it loads is freed before the level
+** load gets to use it, whatever lumpcache_size is. preload_size limits how
+** much that may be. Lumps that would not fit, or could only be decompressed
+** on the main thread, are not read at all.
+**
+** Texture conversion and sound loading use the renderer's and the sound
+** system's state, so they only run on the main thread. Everything that
+** is loaded ends up in the caches the level load looks in anyway, so
+** nothing changes if the preload does not finish or guesses wrong.
+**
+*/
+
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "doomtype.h"
+#include "doomerrors.h"
+#include "p_preload.h"
+#include "p_setup.h"
+#include "p_levelcache.h"
+#include "g_level.h"
+#include "info.h"
+#include "actor.h"
+#include "w_wad.h"
+#include "resourcefiles/resourcefile.h"
+#include "textures/textures.h"
+#include "r_renderer.h"
+#include "r_state.h"
+#include "r_data/sprites.h"
+#include "s_sound.h"
+#include "sound/i_sound.h"
+#include "c_cvars.h"
+#include "i_system.h"
+#include "jobqueue.h"
+#include "templates.h"
+#include "stats.h"
+
+CVAR(Bool, preload_nextlevel, true, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
+CVAR(Int, preload_size, 64, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)	// megabytes
+
+// Time the preload may take from each tic, in milliseconds.
+static const unsigned int PRELOAD_TIC_TIME = 5;
+
+enum EPreloadStage
+{
+	PRE_Idle,
+	PRE_MapLumps,
+	PRE_Scan,
+	PRE_TextureLumps,
+	PRE_Textures,
+	PRE_SoundLumps,
+	PRE_Sounds,
+	PRE_Done
+};
+
+struct FPreloadLump
+{
+	int Lump;
+	FCompressedBuffer Raw;
+	char *Data;
+	bool Done;
+};
+
+struct FPreloadScan
+{
+	bool IsText;
+	bool HasBehavior;
+	std::vector<char> TextMap, Sides, Sectors, Things;
+
+	std::vector<std::string> Walls, Flats;
+	std::vector<int> ThingTypes;
+	bool Done;
+};
+
+static std::mutex PreloadMutex;
+static std::condition_variable PreloadDone;
+
+static EPreloadStage Stage;
+static FString PreloadMap;
+static TArray<int> LumpQueue;
+static unsigned int NextLump;
+static bool WarmStoredLumps;
+static size_t PreloadedBytes;
+static bool LumpsMissed;				// a queued lump is not in memory
+static TArray<int> HeldLumps;			// lump caches kept until P_ReleasePreload
+static std::vector<std::shared_ptr<FPreloadLump>> PendingLumps;
+static std::shared_ptr<FPreloadScan> Scan;
+static TArray<int> PreloadTextures;
+static TArray<BYTE> TextureHits;
+static TArray<int> PreloadSounds;
+static TArray<int> SoundLumps;
+static unsigned int NextItem;
+static cycle_t PreloadTime;
+
+//==========================================================================
+//
+// NextUDMFToken
+//
+// A minimal tokenizer for TEXTMAP that knows just enough to find the
+// blocks and their assignments. Returns 0 at the end, 'i' for names and
+// numbers, 's' for strings and the character itself for anything else.
+//
+//==========================================================================
+
+static bool IsUDMFNameChar(char c)
+{
+	return isalnum((unsigned char)c) || c == '_' || c == '-' || c == '+' || c == '.';
+}
+
+static int NextUDMFToken(const char *&p, const char *end, std::string &token)
+{
+	for (;;)
+	{
+		while (p < end && isspace((unsigned char)*p)) p++;
+		if (p + 1 < end && p[0] == '/' && p[1] == '/')
+		{
+			while (p < end && *p != '\n') p++;
+		}
+		else if (p + 1 < end && p[0] == '/' && p[1] == '*')
+		{
+			for (p += 2; p + 1 < end && !(p[0] == '*' && p[1] == '/'); p++) {}
+			p = MIN(p + 2, end);
+		}
+		else break;
+	}
+	if (p >= end)
+	{
+		return 0;
+	}
+	if (*p == '"')
+	{
+		token.clear();
+		for (p++; p < end && *p != '"'; p++)
+		{
+			if (*p == '\\' && p + 1 < end) p++;
+			token += *p;
+		}
+		if (p < end) p++;
+		return 's';
+	}
+	if (IsUDMFNameChar(*p))
+	{
+		const char *start = p;
+		while (p < end && IsUDMFNameChar(*p)) p++;
+		token.assign(start, p);
+		return 'i';
+	}
+	return *p++;
+}
+
+//==========================================================================
+//
+// ScanTextMap
+//
+//==========================================================================
+
+static void ScanTextMap(const std::vector<char> &textmap, FPreloadScan &scan)
+{
+	const char *p = textmap.data();
+	const char *end = p + textmap.size();
+	std::string token, block, key;
+	int kind;
+
+	while ((kind = NextUDMFToken(p, end, token)) != 0)
+	{
+		if (kind == '}')
+		{
+			block.clear();
+		}
+		else if (kind == 'i')
+		{
+			key = token;
+			kind = NextUDMFToken(p, end, token);
+			if (kind == '{')
+			{
+				block = key;
+			}
+			else if (kind == '=')
+			{
+				kind = NextUDMFToken(p, end, token);
+				if (block.empty() || token == "-")
+				{
+					continue;
+				}
+				const char *b = block.c_str(), *k = key.c_str();
+				if (!stricmp(b, "sidedef") &&
+					(!stricmp(k, "texturetop") || !stricmp(k, "texturemiddle") || !stricmp(k, "texturebottom")))
+				{
+					scan.Walls.push_back(token);
+				}
+				else if (!stricmp(b, "sector") && (!stricmp(k, "texturefloor") || !stricmp(k, "textureceiling")))
+				{
+					scan.Flats.push_back(token);
+				}
+				else if (!stricmp(b, "thing") && !stricmp(k, "type"))
+				{
+					scan.ThingTypes.push_back(atoi(token.c_str()));
+				}
+			}
+		}
+	}
+}
+
+//==========================================================================
+//
+// ScanBinaryMap
+//
+// Reads the names straight from the raw lumps, so the layouts below
+// must match mapsidedef_t, mapsector_t, mapthing_t and mapthinghexen_t.
+//
+//==========================================================================
+
+static void PushLumpName(std::vector<std::string> &names, const char *name)
+{
+	size_t len = strnlen(name, 8);
+	if (len > 0 && !(len == 1 && name[0] == '-'))
+	{
+		names.push_back(std::string(name, len));
+	}
+}
+
+static void ScanBinaryMap(FPreloadScan &scan)
+{
+	for (size_t i = 0; i + 30 <= scan.Sides.size(); i += 30)
+	{
+		PushLumpName(scan.Walls, &scan.Sides[i + 4]);
+		PushLumpName(scan.Walls, &scan.Sides[i + 12]);
+		PushLumpName(scan.Walls, &scan.Sides[i + 20]);
+	}
+	for (size_t i = 0; i + 26 <= scan.Sectors.size(); i += 26)
+	{
+		PushLumpName(scan.Flats, &scan.Sectors[i + 4]);
+		PushLumpName(scan.Flats, &scan.Sectors[i + 12]);
+	}
+	size_t size = scan.HasBehavior ? 20 : 10;
+	size_t offset = scan.HasBehavior ? 10 : 6;
+	for (size_t i = 0; i + size <= scan.Things.size(); i += size)
+	{
+		const BYTE *type = (const BYTE *)&scan.Things[i + offset];
+		scan.ThingTypes.push_back((SWORD)(type[0] | (type[1] << 8)));
+	}
+}
+
+template<class T> static void SortUnique(std::vector<T> &list)
+{
+	std::sort(list.begin(), list.end());
+	list.erase(std::unique(list.begin(), list.end()), list.end());
+}
+
+//==========================================================================
+//
+// StartScan
+//
+// Copies the lumps that name textures and things out of the map and
+// scans them on the job queue.
+//
+//==========================================================================
+
+static void StartScan()
+{
+	MapData *map = NULL;
+	try
+	{
+		map = P_OpenMapData(PreloadMap, true);
+	}
+	catch (CRecoverableError &)
+	{
+		map = NULL;
+	}
+	if (map == NULL)
+	{
+		return;
+	}
+
+	auto scan = std::make_shared<FPreloadScan>();
+	scan->IsText = map->isText;
+	scan->HasBehavior = map->HasBehavior;
+	scan->Done = false;
+
+	auto copylump = [&](unsigned int index, std::vector<char> &data)
+	{
+		data.resize(map->Size(index));
+		if (data.size() > 0) map->Read(index, data.data(), (int)data.size());
+	};
+	if (map->isText)
+	{
+		copylump(ML_TEXTMAP, scan->TextMap);
+	}
+	else
+	{
+		copylump(ML_SIDEDEFS, scan->Sides);
+		copylump(ML_SECTORS, scan->Sectors);
+		copylump(ML_THINGS, scan->Things);
+	}
+	P_PreloadLevelCache(map->lumpnum);
+	delete map;
+
+	Scan = scan;
+	FJobQueue::Run([scan]()
+	{
+		try
+		{
+			if (scan->IsText) ScanTextMap(scan->TextMap, *scan);
+			else ScanBinaryMap(*scan);
+			SortUnique(scan->Walls);
+			SortUnique(scan->Flats);
+			SortUnique(scan->ThingTypes);
+		}
+		catch (...)
+		{
+		}
+		std::lock_guard<std::mutex> lock(PreloadMutex);
+		scan->Done = true;
+		PreloadDone.notify_all();
+	});
+}
+
+//==========================================================================
+//
+// QueueLumps
+//
+// Sets the lumps for the next lump stage. If stored is false, only lumps
+// that have to be decompressed are read ahead; the rest is read directly
+// from the file when it is needed and gains nothing from the cache.
+//
+//==========================================================================
+
+static void QueueLumps(const TArray<int> &lumps, bool stored)
+{
+	LumpQueue = lumps;
+	NextLump = 0;
+	WarmStoredLumps = stored;
+	LumpsMissed = false;
+}
+
+//==========================================================================
+//
+// FinishLumps
+//
+// Hands all decompressed lumps to the lump cache and keeps hold of them.
+//
+//==========================================================================
+
+static void FinishLumps(bool wait)
+{
+	std::vector<std::shared_ptr<FPreloadLump>> finished;
+	{
+		std::unique_lock<std::mutex> lock(PreloadMutex);
+		for (size_t i = 0; i < PendingLumps.size(); )
+		{
+			std::shared_ptr<FPreloadLump> pending = PendingLumps[i];
+			if (wait) PreloadDone.wait(lock, [&]() { return pending->Done; });
+			if (pending->Done)
+			{
+				finished.push_back(pending);
+				PendingLumps.erase(PendingLumps.begin() + i);
+			}
+			else i++;
+		}
+	}
+	for (auto &pending : finished)
+	{
+		if (pending->Data == NULL)
+		{
+			LumpsMissed = true;
+		}
+		else if (Wads.AdoptLumpCache(pending->Lump, pending->Data))
+		{
+			HeldLumps.Push(pending->Lump);
+		}
+		else
+		{ // Something else loaded it in the meantime.
+			delete[] pending->Data;
+			if (Wads.HoldLumpCache(pending->Lump, false)) HeldLumps.Push(pending->Lump);
+		}
+	}
+}
+
+//==========================================================================
+//
+// PumpLumps
+//
+// Returns true once every queued lump has been loaded.
+//
+//==========================================================================
+
+static bool PumpLumps(unsigned int deadline)
+{
+	size_t budget = size_t(MAX<int>(*preload_size, 0)) << 20;
+
+	FinishLumps(false);
+	while (NextLump < LumpQueue.Size() && PendingLumps.size() < (size_t)FJobQueue::NumThreads() && I_MSTime() < deadline)
+	{
+		int lump = LumpQueue[NextLump++];
+		size_t size = Wads.LumpLength(lump);
+
+		if (size == 0)
+		{
+			continue;
+		}
+		if (Wads.IsLumpCached(lump))
+		{ // Only needs to stay where it is.
+			if (Wads.HoldLumpCache(lump, false))
+			{
+				HeldLumps.Push(lump);
+				PreloadedBytes += size;
+			}
+			continue;
+		}
+		if (PreloadedBytes + size > budget || Wads.LumpNeedsMainThread(lump))
+		{
+			LumpsMissed = true;
+			continue;
+		}
+
+		auto pending = std::make_shared<FPreloadLump>();
+		pending->Lump = lump;
+		pending->Data = NULL;
+		pending->Done = false;
+		if (!Wads.ReadCompressedLump(lump, pending->Raw))
+		{
+			// The level load opens the map's lumps through the lump cache,
+			// but textures and sounds read stored lumps straight from the file.
+			if (WarmStoredLumps && Wads.HoldLumpCache(lump, true))
+			{
+				HeldLumps.Push(lump);
+				PreloadedBytes += size;
+			}
+			else
+			{
+				LumpsMissed |= WarmStoredLumps;
+			}
+			continue;
+		}
+		PreloadedBytes += size;
+
+		{
+			std::lock_guard<std::mutex> lock(PreloadMutex);
+			PendingLumps.push_back(pending);
+		}
+		FJobQueue::Run([pending]()
+		{
+			// This neither throws nor prints. Any error is reported when
+			// the level load reads the lump itself.
+			char *data = new (std::nothrow) char[pending->Raw.mSize];
+			if (data != NULL && !pending->Raw.TryDecompress(data))
+			{
+				delete[] data;
+				data = NULL;
+			}
+			pending->Raw.Clean();
+
+			std::lock_guard<std::mutex> lock(PreloadMutex);
+			pending->Data = data;
+			pending->Done = true;
+			PreloadDone.notify_all();
+		});
+	}
+	return NextLump >= LumpQueue.Size() && PendingLumps.size() == 0;
+}
+
+//==========================================================================
+//
+// CollectTextures
+//
+// Finds the textures the scan turned up plus the ones the level's
+// MAPINFO entry names, much like P_PrecacheLevel does once it is loaded.
+//
+//==========================================================================
+
+static void CollectTextures(level_info_t *info, TArray<PClassActor *> &classes, TArray<int> &lumps)
+{
+	const int flags = FTextureManager::TEXMAN_Overridable | FTextureManager::TEXMAN_TryAny;
+
+	TextureHits.Resize(TexMan.NumTextures());
+	memset(&TextureHits[0], 0, TextureHits.Size());
+
+	auto hit = [&](const char *name, int usetype, int hitflag)
+	{
+		FTextureID tex = TexMan.CheckForTexture(name, usetype, flags);
+		if (tex.Exists()) TextureHits[tex.GetIndex()] |= hitflag;
+	};
+	for (auto &name : Scan->Walls) hit(name.c_str(), FTexture::TEX_Wall, FTextureManager::HIT_Wall);
+	for (auto &name : Scan->Flats) hit(name.c_str(), FTexture::TEX_Flat, FTextureManager::HIT_Flat);
+	if (info != NULL)
+	{
+		if (info->SkyPic1.IsNotEmpty()) hit(info->SkyPic1, FTexture::TEX_Wall, FTextureManager::HIT_Sky);
+		if (info->SkyPic2.IsNotEmpty()) hit(info->SkyPic2, FTexture::TEX_Wall, FTextureManager::HIT_Sky);
+		for (unsigned i = 0; i < info->PrecacheTextures.Size(); i++)
+		{
+			hit(info->PrecacheTextures[i], FTexture::TEX_Wall, FTextureManager::HIT_Wall);
+		}
+	}
+
+	for (auto cls : classes)
+	{
+		for (int i = 0; i < cls->NumOwnedStates; i++)
+		{
+			unsigned int sprite = cls->OwnedStates[i].sprite;
+			if (sprite >= sprites.Size()) continue;
+
+			for (int j = 0; j < sprites[sprite].numframes; j++)
+			{
+				const spriteframe_t *frame = &SpriteFrames[sprites[sprite].spriteframes + j];
+				for (int k = 0; k < 16; k++)
+				{
+					if (frame->Texture[k].isValid())
+					{
+						TextureHits[frame->Texture[k].GetIndex()] |= FTextureManager::HIT_Sprite;
+					}
+				}
+			}
+		}
+	}
+
+	// Composite textures are built from patches that are often shared
+	// between many of them, so each patch is only queued once.
+	PreloadTextures.Clear();
+	for (unsigned i = 0; i < TextureHits.Size(); i++)
+	{
+		if (TextureHits[i] != 0)
+		{
+			PreloadTextures.Push(i);
+			TexMan.ByIndex(i)->GetPatchLumps(lumps);
+		}
+	}
+	if (lumps.Size() > 0)
+	{
+		std::sort(&lumps[0], &lumps[0] + lumps.Size());
+		lumps.Resize(unsigned(std::unique(&lumps[0], &lumps[0] + lumps.Size()) - &lumps[0]));
+	}
+}
+
+//==========================================================================
+//
+// CollectSounds
+//
+// Marks the sounds of all classes the same way S_PrecacheLevel does and
+// restores the marks afterwards, since they belong to the current level.
+//
+//==========================================================================
+
+static void CollectSounds(level_info_t *info, TArray<PClassActor *> &classes, TArray<int> &lumps)
+{
+	TArray<bool> used;
+
+	PreloadSounds.Clear();
+	if (GSnd == NULL || GSnd->IsNull())
+	{
+		return;
+	}
+
+	used.Resize(S_sfx.Size());
+	for (unsigned i = 0; i < S_sfx.Size(); i++)
+	{
+		used[i] = S_sfx[i].bUsed;
+		S_sfx[i].bUsed = false;
+	}
+	for (auto cls : classes)
+	{
+		GetDefaultByType(cls)->MarkPrecacheSounds();
+	}
+	if (info != NULL)
+	{
+		for (unsigned i = 0; i < info->PrecacheSounds.Size(); i++)
+		{
+			info->PrecacheSounds[i].MarkUsed();
+		}
+	}
+	for (unsigned i = 1; i < S_sfx.Size(); i++)
+	{
+		sfxinfo_t *sfx = &S_sfx[i];
+		if (sfx->bUsed && !sfx->data.isValid())
+		{
+			PreloadSounds.Push(i);
+			if (!sfx->bRandomHeader && sfx->link == sfxinfo_t::NO_LINK && sfx->lumpnum >= 0)
+			{
+				lumps.Push(sfx->lumpnum);
+			}
+		}
+	}
+	for (unsigned i = 0; i < S_sfx.Size(); i++)
+	{
+		S_sfx[i].bUsed = used[i];
+	}
+}
+
+//==========================================================================
+//
+// FinishScan
+//
+// Turns the scan's names and editor numbers into textures and sounds.
+//
+//==========================================================================
+
+static void FinishScan()
+{
+	level_info_t *info = FindLevelInfo(PreloadMap, false);
+	TArray<PClassActor *> classes;
+	TArray<int> texturelumps;
+
+	for (int type : Scan->ThingTypes)
+	{
+		FDoomEdEntry *entry = DoomEdMap.CheckKey(type);
+		if (entry != NULL && entry->Type != NULL) classes.Push(entry->Type);
+	}
+	if (info != NULL)
+	{
+		for (unsigned i = 0; i < info->PrecacheClasses.Size(); i++)
+		{
+			PClassActor *cls = PClass::FindActor(info->PrecacheClasses[i]);
+			if (cls != NULL) classes.Push(cls);
+		}
+	}
+
+	CollectTextures(info, classes, texturelumps);
+	CollectSounds(info, classes, SoundLumps);
+	QueueLumps(texturelumps, false);
+	Scan.reset();
+}
+
+//==========================================================================
+//
+// RunStage
+//
+// Returns false when the current stage has to wait for the job queue.
+//
+//==========================================================================
+
+static bool RunStage(unsigned int deadline)
+{
+	switch (Stage)
+	{
+	case PRE_MapLumps:
+		if (!PumpLumps(deadline)) return false;
+		// Opening a map that is not all in memory would read or
+		// decompress the rest of it right here.
+		if (!LumpsMissed) StartScan();
+		Stage = Scan != NULL ? PRE_Scan : PRE_Done;
+		return true;
+
+	case PRE_Scan:
+		{
+			std::lock_guard<std::mutex> lock(PreloadMutex);
+			if (!Scan->Done) return false;
+		}
+		FinishScan();
+		Stage = PRE_TextureLumps;
+		return true;
+
+	case PRE_TextureLumps:
+	case PRE_SoundLumps:
+		if (!PumpLumps(deadline)) return false;
+		Stage = Stage == PRE_TextureLumps ? PRE_Textures : PRE_Sounds;
+		NextItem = 0;
+		return true;
+
+	case PRE_Textures:
+		while (NextItem < PreloadTextures.Size() && I_MSTime() < deadline)
+		{
+			int index = PreloadTextures[NextItem++];
+			Renderer->PrecacheTexture(TexMan.ByIndex(index), TextureHits[index]);
+		}
+		if (NextItem < PreloadTextures.Size()) return false;
+		QueueLumps(SoundLumps, false);
+		Stage = PRE_SoundLumps;
+		return true;
+
+	case PRE_Sounds:
+		while (NextItem < PreloadSounds.Size() && I_MSTime() < deadline)
+		{
+			S_CacheSound(&S_sfx[PreloadSounds[NextItem++]]);
+		}
+		if (NextItem < PreloadSounds.Size()) return false;
+		Stage = PRE_Done;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+//==========================================================================
+//
+// P_StartPreload
+//
+//==========================================================================
+
+void P_StartPreload(const char *mapname)
+{
+	TArray<int> lumps;
+
+	P_FinishPreload();
+	P_ReleasePreload();
+	if (!preload_nextlevel || mapname == NULL || !strncmp(mapname, "enDSeQ", 6))
+	{
+		return;
+	}
+
+	P_GetMapLumps(mapname, lumps);
+	if (lumps.Size() == 0)
+	{
+		return;
+	}
+	PreloadMap = mapname;
+	PreloadedBytes = 0;
+	PreloadTime.Reset();
+	QueueLumps(lumps, true);
+	Stage = PRE_MapLumps;
+}
+
+//==========================================================================
+//
+// P_PreloadTicker
+//
+//==========================================================================
+
+void P_PreloadTicker()
+{
+	if (Stage == PRE_Idle || Stage == PRE_Done)
+	{
+		return;
+	}
+
+	unsigned int deadline = I_MSTime() + PRELOAD_TIC_TIME;
+	PreloadTime.Clock();
+	while (RunStage(deadline) && Stage != PRE_Done && I_MSTime() < deadline)
+	{
+	}
+	PreloadTime.Unclock();
+}
+
+//==========================================================================
+//
+// P_FinishPreload
+//
+// Called before the level is loaded. Whatever has not been loaded yet
+// is left for the level load; only the jobs that are still running are
+// waited for so that their results are not lost.
+//
+//==========================================================================
+
+void P_FinishPreload()
+{
+	if (Stage == PRE_Idle)
+	{
+		return;
+	}
+	FinishLumps(true);
+	if (Scan != NULL)
+	{
+		std::unique_lock<std::mutex> lock(PreloadMutex);
+		PreloadDone.wait(lock, [&]() { return Scan->Done; });
+	}
+	Scan.reset();
+	LumpQueue.Clear();
+	PreloadTextures.Clear();
+	TextureHits.Clear();
+	PreloadSounds.Clear();
+	SoundLumps.Clear();
+	Stage = PRE_Idle;
+}
+
+//==========================================================================
+//
+// P_ReleasePreload
+//
+// Called once the level has been set up. Drops the references that kept
+// the preloaded lumps in memory; what happens to them now is up to
+// lumpcache_size.
+//
+//==========================================================================
+
+void P_ReleasePreload()
+{
+	for (unsigned i = 0; i < HeldLumps.Size(); i++)
+	{
+		Wads.ReleaseLumpCache(HeldLumps[i]);
+	}
+	HeldLumps.Clear();
+}
+
+ADD_STAT(preload)
+{
+	static const char *const stagenames[] = { "idle", "map lumps", "scan", "texture lumps", "textures", "sound lumps", "sounds", "done" };
+	FString out;
+	out.Format("Preload %s: %s, %zu KB in %u lumps held, %u pending, %.2f ms", PreloadMap.GetChars(), stagenames[Stage],
+		(PreloadedBytes + 1023) >> 10, HeldLumps.Size(), (unsigned)PendingLumps.size(), PreloadTime.TimeMS());
+	return out;
+}
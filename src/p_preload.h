@@ -0,0 +1,13 @@
+#ifndef __P_PRELOAD_H
+#define __P_PRELOAD_H
+
+// Loads the next map's data while the intermission is showing so that
+// the level change itself finds most of it in memory already. All of
+// this runs alongside the intermission and never touches the playsim.
+
+void P_StartPreload(const char *mapname);
+void P_PreloadTicker();
+void P_FinishPreload();
+void P_ReleasePreload();	// after the level has been set up
+
+#endif
@@ -78,12 +78,14 @@
 #endif
 
 #include "fragglescript/t_fs.h"
+#include "p_subsectorgrid.h"
+#include "p_flowfield.h"
+#include "p_levelcache.h"
 
 #define MISSING_TEXTURE_WARN_LIMIT		20
 
-void P_SpawnSlopeMakers (FMapThing *firstmt, FMapThing *lastmt, const int *oldvertextable);
+void P_SetupSlopes (FMapThing *firstmt, FMapThing *lastmt, const int *oldvertextable, cycle_t *times);
 void P_SetSlopes ();
-void P_CopySlopes();
 void BloodCrypt (void *data, int key, int len);
 void P_ClearUDMFKeys();
 
@@ -98,6 +100,8 @@ extern int numinterpolations;
 extern unsigned int R_OldBlend;
 
 EXTERN_CVAR(Bool, am_textured)
+EXTERN_CVAR(Bool, gl_cachenodes)
+EXTERN_CVAR(Float, gl_cachetime)
 
 CVAR (Bool, genblockmap, false, CVAR_SERVERINFO|CVAR_GLOBALCONFIG);
 CVAR (Bool, gennodes, false, CVAR_SERVERINFO|CVAR_GLOBALCONFIG);
@@ -176,7 +180,7 @@ int				*blockmaplump;	// offsets in blockmap are from here
 double	 		bmaporgx;		// origin of block map
 double	 		bmaporgy;
 
-FBlockNode**	blocklinks;		// for thing chains
+TArray<AActor *>*	blocklinks;		// for thing lists
 
 
 // REJECT
@@ -251,6 +255,39 @@ static int GetMapIndex(const char *mapname, int lastindex, const char *lumpname,
 	return -1;	// End of map reached
 }
 
+//===========================================================================
+//
+// FindMapLump
+//
+// Finds the lump a map is stored in. inwad is true if it is the map's
+// header lump inside a WAD, false if it is an embedded map file.
+//
+//===========================================================================
+
+static int FindMapLump(const char *mapname, bool &inwad)
+{
+	FString fmt;
+	int lump_wad;
+	int lump_map;
+	int lump_name = -1;
+
+	// Check for both *.wad and *.map in order to load Build maps
+	// as well. The higher one will take precedence.
+	// Names with more than 8 characters will only be checked as .wad and .map.
+	if (strlen(mapname) <= 8) lump_name = Wads.CheckNumForName(mapname);
+	fmt.Format("maps/%s.wad", mapname);
+	lump_wad = Wads.CheckNumForFullName(fmt);
+	fmt.Format("maps/%s.map", mapname);
+	lump_map = Wads.CheckNumForFullName(fmt);
+
+	inwad = (lump_name > lump_wad && lump_name > lump_map && lump_name != -1);
+	if (inwad)
+	{
+		return lump_name;
+	}
+	return lump_map > lump_wad ? lump_map : lump_wad;
+}
+
 //===========================================================================
 //
 // Opens a map for reading
@@ -276,21 +313,10 @@ MapData *P_OpenMapData(const char * mapname, bool justcheck)
 	}
 	else
 	{
-		FString fmt;
-		int lump_wad;
-		int lump_map;
-		int lump_name = -1;
-		
-		// Check for both *.wad and *.map in order to load Build maps
-		// as well. The higher one will take precedence.
-		// Names with more than 8 characters will only be checked as .wad and .map.
-		if (strlen(mapname) <= 8) lump_name = Wads.CheckNumForName(mapname);
-		fmt.Format("maps/%s.wad", mapname);
-		lump_wad = Wads.CheckNumForFullName(fmt);
-		fmt.Format("maps/%s.map", mapname);
-		lump_map = Wads.CheckNumForFullName(fmt);
-		
-		if (lump_name > lump_wad && lump_name > lump_map && lump_name != -1)
+		bool inwad;
+		int lump_name = FindMapLump(mapname, inwad);
+
+		if (inwad)
 		{
 			int lumpfile = Wads.GetLumpFile(lump_name);
 			int nextfile = Wads.GetLumpFile(lump_name+1);
@@ -406,17 +432,13 @@ MapData *P_OpenMapData(const char * mapname, bool justcheck)
 		}
 		else
 		{
-			if (lump_map > lump_wad)
-			{
-				lump_wad = lump_map;
-			}
-			if (lump_wad == -1)
+			if (lump_name == -1)
 			{
 				delete map;
 				return NULL;
 			}
-			map->lumpnum = lump_wad;
-			map->resource = FResourceFile::OpenResourceFile(Wads.GetLumpFullName(lump_wad), Wads.ReopenLumpNum(lump_wad), true);
+			map->lumpnum = lump_name;
+			map->resource = FResourceFile::OpenResourceFile(Wads.GetLumpFullName(lump_name), Wads.ReopenLumpNum(lump_name), true);
 			wadReader = map->resource->GetReader();
 		}
 	}
@@ -531,6 +553,62 @@ bool P_CheckMapData(const char *mapname)
 	return true;
 }
 
+//===========================================================================
+//
+// P_GetMapLumps
+//
+// Lists the lumps P_OpenMapData reads for this map without opening any
+// of them: the map's own lumps if it is stored directly in a WAD,
+// otherwise the lump holding the embedded map file.
+//
+//===========================================================================
+
+void P_GetMapLumps(const char *mapname, TArray<int> &lumps)
+{
+	bool inwad;
+	int lump_name;
+
+	lumps.Clear();
+	if (!strnicmp(mapname, "file:", 5))
+	{
+		return;
+	}
+
+	lump_name = FindMapLump(mapname, inwad);
+	if (inwad)
+	{
+		int lumpfile = Wads.GetLumpFile(lump_name);
+
+		lumps.Push(lump_name);
+		if (Wads.GetLumpFile(lump_name + 1) != lumpfile || Wads.IsEncryptedFile(lump_name))
+		{
+			return;
+		}
+		if (stricmp(Wads.GetLumpFullName(lump_name + 1), "TEXTMAP") != 0)
+		{
+			int index = 0;
+			for (int i = 1; Wads.GetLumpFile(lump_name + i) == lumpfile; i++)
+			{
+				index = GetMapIndex(mapname, index, Wads.GetLumpFullName(lump_name + i), false);
+				if (index < 0) break;
+				lumps.Push(lump_name + i);
+			}
+		}
+		else
+		{
+			for (int i = 1; Wads.GetLumpFile(lump_name + i) == lumpfile; i++)
+			{
+				lumps.Push(lump_name + i);
+				if (!stricmp(Wads.GetLumpFullName(lump_name + i), "ENDMAP")) break;
+			}
+		}
+	}
+	else if (lump_name != -1)
+	{
+		lumps.Push(lump_name);
+	}
+}
+
 //===========================================================================
 //
 // MapData :: GetChecksum
@@ -806,16 +884,67 @@ void P_FloodZone (sector_t *sec, int zonenum)
 	}
 }
 
+static bool P_LoadCachedZones (int &numzones)
+{
+	const TArray<BYTE> *section = P_FindLevelCacheSection(LCACHE_Zones);
+	if (section == NULL || section->Size() != 8 + (unsigned)numsectors * 2)
+	{
+		return false;
+	}
+
+	FLevelCacheReader r(*section);
+	if (r.Long() != (DWORD)numsectors)
+	{
+		return false;
+	}
+	// Every zone has at least one sector.
+	DWORD count = r.Long();
+	if (count > (DWORD)numsectors)
+	{
+		return false;
+	}
+	numzones = count;
+	for (int i = 0; i < numsectors; ++i)
+	{
+		WORD zone = r.Word();
+		if (zone >= numzones)
+		{
+			return false;
+		}
+		sectors[i].ZoneNumber = zone;
+	}
+	return true;
+}
+
 void P_FloodZones ()
 {
 	int z = 0, i;
 	ReverbContainer *reverb;
 
-	for (i = 0; i < numsectors; ++i)
+	if (!P_LoadCachedZones (z))
 	{
-		if (sectors[i].ZoneNumber == 0xFFFF)
+		z = 0;
+		for (i = 0; i < numsectors; ++i)
 		{
-			P_FloodZone (&sectors[i], z++);
+			sectors[i].ZoneNumber = 0xFFFF;
+		}
+		for (i = 0; i < numsectors; ++i)
+		{
+			if (sectors[i].ZoneNumber == 0xFFFF)
+			{
+				P_FloodZone (&sectors[i], z++);
+			}
+		}
+
+		if (P_WantLevelCache())
+		{
+			FLevelCacheWriter w(P_NewLevelCacheSection(LCACHE_Zones));
+			w.Long(numsectors);
+			w.Long(z);
+			for (i = 0; i < numsectors; ++i)
+			{
+				w.Word(sectors[i].ZoneNumber);
+			}
 		}
 	}
 	Zones.Resize(z);
@@ -2770,6 +2899,8 @@ static void CreatePackedBlockmap (TArray<int> &BlockMap, TArray<int> *blocks, in
 #define BLOCKBITS 7
 #define BLOCKSIZE 128
 
+static bool P_VerifyBlockMap(int count);
+
 static void P_CreateBlockMap ()
 {
 	TArray<int> *BlockLists, *block, *endblock;
@@ -2803,6 +2934,32 @@ static void P_CreateBlockMap ()
 	bmapwidth =	 ((maxx - minx) >> BLOCKBITS) + 1;
 	bmapheight = ((maxy - miny) >> BLOCKBITS) + 1;
 
+	// A cached blockmap is only good if it covers the same area.
+	const TArray<BYTE> *cached = P_FindLevelCacheSection(LCACHE_BlockMap);
+	if (cached != NULL && cached->Size() >= 16 && (cached->Size() & 3) == 0)
+	{
+		FLevelCacheReader r(*cached);
+		if ((int)r.Long() == minx && (int)r.Long() == miny &&
+			(int)r.Long() == bmapwidth && (int)r.Long() == bmapheight)
+		{
+			unsigned int count = cached->Size() / 4;
+			FLevelCacheReader lr(*cached);
+
+			blockmaplump = new int[count];
+			for (unsigned int ii = 0; ii < count; ++ii)
+			{
+				blockmaplump[ii] = (int)lr.Long();
+			}
+			// Trust it no more than a BLOCKMAP lump.
+			if (P_VerifyBlockMap(count))
+			{
+				return;
+			}
+			delete[] blockmaplump;
+			blockmaplump = NULL;
+		}
+	}
+
 	TArray<int> BlockMap (bmapwidth * bmapheight * 3 + 4);
 
 	adder = minx;			BlockMap.Push (adder);
@@ -2937,6 +3094,15 @@ static void P_CreateBlockMap ()
 	{
 		blockmaplump[ii] = BlockMap[ii];
 	}
+
+	if (P_WantLevelCache())
+	{
+		FLevelCacheWriter w(P_NewLevelCacheSection(LCACHE_BlockMap));
+		for (unsigned int ii = 0; ii < BlockMap.Size(); ++ii)
+		{
+			w.Long(BlockMap[ii]);
+		}
+	}
 }
 
 
@@ -3075,8 +3241,7 @@ void P_LoadBlockMap (MapData * map)
 
 	// clear out mobj chains
 	count = bmapwidth*bmapheight;
-	blocklinks = new FBlockNode *[count];
-	memset (blocklinks, 0, count*sizeof(*blocklinks));
+	blocklinks = new TArray<AActor *>[count];
 	blockmap = blockmaplump+4;
 }
 
@@ -3088,6 +3253,115 @@ void P_LoadBlockMap (MapData * map)
 //
 line_t**				linebuffer;
 
+//===========================================================================
+//
+// P_LoadCachedSectorLines
+//
+// Sets up the sector line lists and center spots from the level cache.
+// Nothing is changed unless the whole section checks out.
+//
+//===========================================================================
+
+static bool P_LoadCachedSectorLines()
+{
+	const TArray<BYTE> *section = P_FindLevelCacheSection(LCACHE_SectorLines);
+	if (section == NULL)
+	{
+		return false;
+	}
+
+	FLevelCacheReader r(*section);
+	if (r.Long() != (DWORD)numsectors)
+	{
+		return false;
+	}
+	// A line is in at most two sectors' lists.
+	DWORD total = r.Long();
+	if (total > 2 * (DWORD)numlines || section->Size() != 8 + QWORD(numsectors) * 20 + QWORD(total) * 4)
+	{
+		return false;
+	}
+
+	TArray<int> counts(numsectors);
+	TArray<DVector2> centers(numsectors);
+	QWORD sum = 0;
+	for (int i = 0; i < numsectors; ++i)
+	{
+		DWORD count = r.Long();
+		if (count > total)
+		{
+			return false;
+		}
+		counts.Push(count);
+		double x = r.Double();
+		double y = r.Double();
+		centers.Push(DVector2(x, y));
+		sum += count;
+	}
+	if (sum != total || r.HasFailed())
+	{
+		return false;
+	}
+
+	linebuffer = new line_t *[total];
+	for (DWORD i = 0; i < total; ++i)
+	{
+		DWORD l = r.Long();
+		if (l >= (DWORD)numlines)
+		{
+			delete[] linebuffer;
+			linebuffer = NULL;
+			return false;
+		}
+		linebuffer[i] = &lines[l];
+	}
+
+	line_t **lineb_p = linebuffer;
+	for (int i = 0; i < numsectors; ++i)
+	{
+		sector_t *sector = &sectors[i];
+
+		sector->linecount = counts[i];
+		sector->centerspot = centers[i];
+		if (sector->linecount == 0)
+		{
+			Printf ("Sector %i (tag %i) has no lines\n", i, tagManager.GetFirstSectorTag(sector));
+			// 0 the sector's tag so that no specials can use it
+			tagManager.RemoveSectorTags(i);
+		}
+		else
+		{
+			sector->lines = lineb_p;
+			lineb_p += sector->linecount;
+		}
+	}
+	return true;
+}
+
+//===========================================================================
+//
+// P_CacheSectorLines
+//
+//===========================================================================
+
+static void P_CacheSectorLines(int total)
+{
+	FLevelCacheWriter w(P_NewLevelCacheSection(LCACHE_SectorLines));
+
+	w.Long(numsectors);
+	w.Long(total);
+	for (int i = 0; i < numsectors; ++i)
+	{
+		w.Long(sectors[i].linecount);
+		w.Double(sectors[i].centerspot.X);
+		w.Double(sectors[i].centerspot.Y);
+	}
+	for (int i = 0; i < total; ++i)
+	{
+		w.Long(DWORD(linebuffer[i] - lines));
+	}
+}
+
 static void P_GroupLines (bool buildmap)
 {
 	cycle_t times[16];
@@ -3126,102 +3400,114 @@ static void P_GroupLines (bool buildmap)
 
 	// count number of lines in each sector
 	times[1].Clock();
+	bool cachedlines = P_LoadCachedSectorLines();
 	total = 0;
-	for (i = 0, li = lines; i < numlines; i++, li++)
+	if (!cachedlines)
 	{
-		if (li->frontsector == NULL)
+		for (i = 0, li = lines; i < numlines; i++, li++)
 		{
-			if (!flaggedNoFronts)
+			if (li->frontsector == NULL)
 			{
-				flaggedNoFronts = true;
-				Printf ("The following lines do not have a front sidedef:\n");
+				if (!flaggedNoFronts)
+				{
+					flaggedNoFronts = true;
+					Printf ("The following lines do not have a front sidedef:\n");
+				}
+				Printf (" %d\n", i);
+			}
+			else
+			{
+				li->frontsector->linecount++;
+				total++;
 			}
-			Printf (" %d\n", i);
-		}
-		else
-		{
-			li->frontsector->linecount++;
-			total++;
-		}
 
-		if (li->backsector && li->backsector != li->frontsector)
+			if (li->backsector && li->backsector != li->frontsector)
+			{
+				li->backsector->linecount++;
+				total++;
+			}
+		}
+		if (flaggedNoFronts)
 		{
-			li->backsector->linecount++;
-			total++;
+			I_Error ("You need to fix these lines to play this map.\n");
 		}
 	}
-	if (flaggedNoFronts)
-	{
-		I_Error ("You need to fix these lines to play this map.\n");
-	}
 	times[1].Unclock();
 
 	// build line tables for each sector
 	times[3].Clock();
-	linebuffer = new line_t *[total];
-	line_t **lineb_p = linebuffer;
-	linesDoneInEachSector = new int[numsectors];
-	memset (linesDoneInEachSector, 0, sizeof(int)*numsectors);
-
-	for (sector = sectors, i = 0; i < numsectors; i++, sector++)
+	if (!cachedlines)
 	{
-		if (sector->linecount == 0)
-		{
-			Printf ("Sector %i (tag %i) has no lines\n", i, tagManager.GetFirstSectorTag(sector));
-			// 0 the sector's tag so that no specials can use it
-			tagManager.RemoveSectorTags(i);
-		}
-		else
-		{
-			sector->lines = lineb_p;
-			lineb_p += sector->linecount;
-		}
-	}
+		linebuffer = new line_t *[total];
+		line_t **lineb_p = linebuffer;
+		linesDoneInEachSector = new int[numsectors];
+		memset (linesDoneInEachSector, 0, sizeof(int)*numsectors);
 
-	for (i = numlines, li = lines; i > 0; --i, ++li)
-	{
-		if (li->frontsector != NULL)
+		for (sector = sectors, i = 0; i < numsectors; i++, sector++)
 		{
-			li->frontsector->lines[linesDoneInEachSector[li->frontsector - sectors]++] = li;
-		}
-		if (li->backsector != NULL && li->backsector != li->frontsector)
-		{
-			li->backsector->lines[linesDoneInEachSector[li->backsector - sectors]++] = li;
+			if (sector->linecount == 0)
+			{
+				Printf ("Sector %i (tag %i) has no lines\n", i, tagManager.GetFirstSectorTag(sector));
+				// 0 the sector's tag so that no specials can use it
+				tagManager.RemoveSectorTags(i);
+			}
+			else
+			{
+				sector->lines = lineb_p;
+				lineb_p += sector->linecount;
+			}
 		}
-	}
 
-	for (i = 0, sector = sectors; i < numsectors; ++i, ++sector)
-	{
-		if (linesDoneInEachSector[i] != sector->linecount)
+		for (i = numlines, li = lines; i > 0; --i, ++li)
 		{
-			I_Error("P_GroupLines: miscounted");
+			if (li->frontsector != NULL)
+			{
+				li->frontsector->lines[linesDoneInEachSector[li->frontsector - sectors]++] = li;
+			}
+			if (li->backsector != NULL && li->backsector != li->frontsector)
+			{
+				li->backsector->lines[linesDoneInEachSector[li->backsector - sectors]++] = li;
+			}
 		}
-		if (sector->linecount > 3)
+
+		for (i = 0, sector = sectors; i < numsectors; ++i, ++sector)
 		{
-			bbox.ClearBox();
-			for (j = 0; j < sector->linecount; ++j)
+			if (linesDoneInEachSector[i] != sector->linecount)
 			{
-				li = sector->lines[j];
-				bbox.AddToBox(li->v1->fPos());
-				bbox.AddToBox(li->v2->fPos());
+				I_Error("P_GroupLines: miscounted");
 			}
+			if (sector->linecount > 3)
+			{
+				bbox.ClearBox();
+				for (j = 0; j < sector->linecount; ++j)
+				{
+					li = sector->lines[j];
+					bbox.AddToBox(li->v1->fPos());
+					bbox.AddToBox(li->v2->fPos());
+				}
 
-			// set the center to the middle of the bounding box
-			sector->centerspot.X = (bbox.Right() + bbox.Left()) / 2;
-			sector->centerspot.Y = (bbox.Top() + bbox.Bottom()) / 2;
-		}
-		else if (sector->linecount > 0)
-		{
-			// For triangular sectors the above does not calculate good points unless the longest of the triangle's lines is perfectly horizontal and vertical
-			DVector2 pos = { 0,0 };
-			for (int i = 0; i < sector->linecount; i++)
+				// set the center to the middle of the bounding box
+				sector->centerspot.X = (bbox.Right() + bbox.Left()) / 2;
+				sector->centerspot.Y = (bbox.Top() + bbox.Bottom()) / 2;
+			}
+			else if (sector->linecount > 0)
 			{
-				pos += sector->lines[i]->v1->fPos() + sector->lines[i]->v2->fPos();
+				// For triangular sectors the above does not calculate good points unless the longest of the triangle's lines is perfectly horizontal and vertical
+				DVector2 pos = { 0,0 };
+				for (int i = 0; i < sector->linecount; i++)
+				{
+					pos += sector->lines[i]->v1->fPos() + sector->lines[i]->v2->fPos();
+				}
+				sector->centerspot = pos / (2 * sector->linecount);
 			}
-			sector->centerspot = pos / (2 * sector->linecount);
+		}
+		delete[] linesDoneInEachSector;
+
+		if (P_WantLevelCache())
+		{
+			P_CacheSectorLines(total);
 		}
 	}
-	delete[] linesDoneInEachSector;
 	times[3].Unclock();
 
 	// [RH] Moved this here
@@ -3470,6 +3756,8 @@ void P_FreeLevelData ()
 		sectors = NULL;
 	}
 	numsectors = 0;
+	P_FreeSubsectorGrids();
+	P_ClearFlowFields();
 	if (gamenodes != NULL && gamenodes != nodes)
 	{
 		delete[] gamenodes;
@@ -3510,6 +3798,7 @@ void P_FreeLevelData ()
 	}
 	numsides = 0;
 
+	P_FreeBlockLineTable();
 	if (blockmaplump != NULL)
 	{
 		delete[] blockmaplump;
@@ -3594,7 +3883,7 @@ void P_FreeExtraLevelData()
 // [RH] position indicates the start spot to spawn at
 void P_SetupLevel (const char *lumpname, int position)
 {
-	cycle_t times[20];
+	cycle_t times[21];
 	FMapThing *buildthings;
 	int numbuildthings;
 	int i;
@@ -3818,6 +4107,15 @@ void P_SetupLevel (const char *lumpname, int position)
 		ForceNodeBuild = true;
 		level.maptype = MAPTYPE_BUILD;
 	}
+
+	if (!buildmap)
+	{
+		P_OpenLevelCache(map);
+	}
+	else
+	{
+		P_CloseLevelCache();
+	}
 	bool reloop = false;
 
 	if (!ForceNodeBuild)
@@ -3915,7 +4213,7 @@ void P_SetupLevel (const char *lumpname, int position)
 		// If loading the regular nodes failed try GL nodes before considering a rebuild
 		if (ForceNodeBuild)
 		{
-			if (P_LoadGLNodes(map)) 
+			if (P_LoadGLNodes(map, &oldvertextable))
 			{
 				ForceNodeBuild = false;
 				reloop = true;
@@ -3931,29 +4229,42 @@ void P_SetupLevel (const char *lumpname, int position)
 	{
 		BuildGLNodes = RequireGLNodes || multiplayer || demoplayback || demorecording || genglnodes;
 
-		startTime = I_FPSTime ();
-		TArray<FNodeBuilder::FPolyStart> polyspots, anchors;
-		P_GetPolySpots (map, polyspots, anchors);
-		FNodeBuilder::FLevel leveldata =
+		if (P_LoadCachedNodes(BuildGLNodes, &oldvertextable))
 		{
-			vertexes, numvertexes,
-			sides, numsides,
-			lines, numlines,
-			0, 0, 0, 0
-		};
-		leveldata.FindMapBounds ();
-		// We need GL nodes if am_textured is on.
-		// In case a sync critical game mode is started, also build GL nodes to avoid problems
-		// if the different machines' am_textured setting differs.
-		FNodeBuilder builder (leveldata, polyspots, anchors, BuildGLNodes);
-		delete[] vertexes;
-		builder.Extract (nodes, numnodes,
-			segs, glsegextras, numsegs,
-			subsectors, numsubsectors,
-			vertexes, numvertexes);
-		endTime = I_FPSTime ();
-		DPrintf (DMSG_NOTIFY, "BSP generation took %.3f sec (%d segs)\n", (endTime - startTime) * 0.001, numsegs);
-		oldvertextable = builder.GetOldVertexTable();
+			DPrintf (DMSG_NOTIFY, "Using cached nodes\n");
+		}
+		else
+		{
+			int numoldvertexes = numvertexes;
+			startTime = I_FPSTime ();
+			TArray<FNodeBuilder::FPolyStart> polyspots, anchors;
+			P_GetPolySpots (map, polyspots, anchors);
+			FNodeBuilder::FLevel leveldata =
+			{
+				vertexes, numvertexes,
+				sides, numsides,
+				lines, numlines,
+				0, 0, 0, 0
+			};
+			leveldata.FindMapBounds ();
+			// We need GL nodes if am_textured is on.
+			// In case a sync critical game mode is started, also build GL nodes to avoid problems
+			// if the different machines' am_textured setting differs.
+			FNodeBuilder builder (leveldata, polyspots, anchors, BuildGLNodes);
+			delete[] vertexes;
+			builder.Extract (nodes, numnodes,
+				segs, glsegextras, numsegs,
+				subsectors, numsubsectors,
+				vertexes, numvertexes);
+			endTime = I_FPSTime ();
+			DPrintf (DMSG_NOTIFY, "BSP generation took %.3f sec (%d segs)\n", (endTime - startTime) * 0.001, numsegs);
+			oldvertextable = builder.GetOldVertexTable();
+
+			if (level.maptype != MAPTYPE_BUILD && gl_cachenodes && (endTime - startTime) / 1000.f >= gl_cachetime)
+			{
+				P_CacheNodes(BuildGLNodes, oldvertextable, numoldvertexes);
+			}
+		}
 		reloop = true;
 	}
 	else
@@ -3999,7 +4310,7 @@ void P_SetupLevel (const char *lumpname, int position)
 		// If the original nodes being loaded are not GL nodes they will be kept around for
 		// use in P_PointInSubsector to avoid problems with maps that depend on the specific
 		// nodes they were built with (P:AR E1M3 is a good example for a map where this is the case.)
-		reloop |= P_CheckNodes(map, BuildGLNodes, endTime - startTime);
+		reloop |= P_CheckNodes(map, BuildGLNodes, endTime - startTime, &oldvertextable);
 		hasglnodes = true;
 	}
 	else
@@ -4007,6 +4318,8 @@ void P_SetupLevel (const char *lumpname, int position)
 		hasglnodes = P_CheckForGLNodes();
 	}
 
+	P_BuildSubsectorGrids();
+
 	times[10].Clock();
 	P_LoadBlockMap (map);
 	times[10].Unclock();
@@ -4042,8 +4355,7 @@ void P_SetupLevel (const char *lumpname, int position)
 	if (!buildmap)
 	{
 		// [RH] Spawn slope creating things first.
-		P_SpawnSlopeMakers (&MapThingsConverted[0], &MapThingsConverted[MapThingsConverted.Size()], oldvertextable);
-		P_CopySlopes();
+		P_SetupSlopes (&MapThingsConverted[0], &MapThingsConverted[MapThingsConverted.Size()], oldvertextable, &times[18]);
 
 		// Spawn 3d floors - must be done before spawning things so it can't be done in P_SpawnSpecials
 		P_Spawn3DFloors();
@@ -4071,6 +4383,7 @@ void P_SetupLevel (const char *lumpname, int position)
 		}
 		delete[] buildthings;
 	}
+	P_CloseLevelCache();
 	delete map;
 	if (oldvertextable != NULL)
 	{
@@ -4087,6 +4400,7 @@ void P_SetupLevel (const char *lumpname, int position)
 	if (reloop) P_LoopSidedefs (false);
 	PO_Init ();				// Initialize the polyobjs
 	P_FinalizePortals();	// finalize line portals after polyobjects have been initialized. This info is needed for properly flagging them.
+	P_BuildBlockLineTable();
 	times[16].Unclock();
 
 	assert(sidetemp != NULL);
@@ -4167,7 +4481,7 @@ void P_SetupLevel (const char *lumpname, int position)
 	if (showloadtimes)
 	{
 		Printf ("---Total load times---\n");
-		for (i = 0; i < 18; ++i)
+		for (i = 0; i < 21; ++i)
 		{
 			static const char *timenames[] =
 			{
@@ -4188,7 +4502,10 @@ void P_SetupLevel (const char *lumpname, int position)
 				"load things",
 				"translate teleports",
 				"init polys",
-				"precache"
+				"precache",
+				"slope things",
+				"vertex slopes",
+				"copy slopes"
 			};
 			Printf ("Time%3d:%9.4f ms (%s)\n", i, times[i].TimeMS(), timenames[i]);
 		}
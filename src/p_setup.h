@@ -96,6 +96,7 @@ struct MapData
 
 MapData * P_OpenMapData(const char * mapname, bool justcheck);
 bool P_CheckMapData(const char * mapname);
+void P_GetMapLumps(const char *mapname, TArray<int> &lumps);
 
 
 // NOT called by W_Ticker. Fixme. [RH] Is that bad?
@@ -121,8 +122,10 @@ int P_TranslateSectorSpecial (int);
 int GetUDMFInt(int type, int index, const char *key);
 double GetUDMFFloat(int type, int index, const char *key);
 
-bool P_LoadGLNodes(MapData * map);
-bool P_CheckNodes(MapData * map, bool rebuilt, int buildtime);
+bool P_LoadGLNodes(MapData * map, const int **oldvertextable);
+bool P_CheckNodes(MapData * map, bool rebuilt, int buildtime, const int **oldvertextable);
+bool P_LoadCachedNodes(bool gl, const int **oldvertextable);
+void P_CacheNodes(bool gl, const int *oldvertextable, int numoldvertexes);
 bool P_CheckForGLNodes();
 void P_SetRenderSector();
 
@@ -45,7 +45,7 @@ This uses specialized forms of the maputils routines for optimized performance
 
 // Performance meters
 static int sightcounts[6];
-static cycle_t SightCycles;
+cycle_t SightCycles;
 static cycle_t MaxSightCycles;
 
 enum
@@ -104,6 +104,8 @@ class SightCheck
 	void P_SightOpening(SightOpening &open, const line_t *linedef, double x, double y);
 	bool PTR_SightTraverse (intercept_t *in);
 	bool P_SightCheckLine (line_t *ld);
+	bool P_SightCheckCachedLine (const FTraceBlockCache::CachedLine *cl);
+	bool P_SightAddLine (line_t *ld);
 	int P_SightBlockLinesIterator (int x, int y);
 	bool P_SightTraverseIntercepts ();
 
@@ -389,7 +391,55 @@ bool SightCheck::P_SightCheckLine (line_t *ld)
 	{
 		return true;		// line isn't crossed
 	}
+	return P_SightAddLine (ld);
+}
+
+/*
+==================
+=
+= P_SightCheckCachedLine
+=
+= Same as above for a line from an FTraceBlockCache
+=
+===================
+*/
+
+bool SightCheck::P_SightCheckCachedLine (const FTraceBlockCache::CachedLine *cl)
+{
+	line_t *ld = cl->line;
+
+	if (ld->validcount == validcount)
+	{
+		return true;
+	}
+	ld->validcount = validcount;
+	if (P_PointOnDivlineSide (cl->x1, cl->y1, &Trace) ==
+		P_PointOnDivlineSide (cl->x2, cl->y2, &Trace))
+	{
+		return true;		// line isn't crossed
+	}
+	divline_t dl = { cl->x1, cl->y1, cl->dx, cl->dy };
+	if (P_PointOnDivlineSide (Trace.x, Trace.y, &dl) ==
+		P_PointOnDivlineSide (Trace.x+Trace.dx, Trace.y+Trace.dy, &dl))
+	{
+		return true;		// line isn't crossed
+	}
+	return P_SightAddLine (ld);
+}
 
+/*
+==================
+=
+= P_SightAddLine
+=
+= Stores a crossed line for later intersection testing unless it
+= blocks sight outright.
+=
+===================
+*/
+
+bool SightCheck::P_SightAddLine (line_t *ld)
+{
 	// try to early out the check
 	if (!ld->backsector || !(ld->flags & ML_TWOSIDED) || (ld->flags & ML_BLOCKSIGHT))
 		return false;	// stop checking
@@ -478,6 +528,19 @@ int SightCheck::P_SightBlockLinesIterator (int x, int y)
 		polyLink = polyLink->next;
 	}
 
+	if (FTraceBlockCache::Active != NULL)
+	{
+		for (const FTraceBlockCache::CachedLine *cl = FTraceBlockCache::Active->GetBlock(offset); cl->line != NULL; cl++)
+		{
+			if (!P_SightCheckCachedLine (cl))
+			{
+				if (!portalfound) return 0;
+				else res = -1;
+			}
+		}
+		return res;
+	}
+
 	offset = *(blockmap + offset);
 
 	for (list = blockmaplump + offset + 1; *list != -1; list++)
@@ -32,12 +32,62 @@
 **
 */
 
+#include <algorithm>
+#include <vector>
+
 #include "doomtype.h"
 #include "p_local.h"
 #include "cmdlib.h"
 #include "p_lnspec.h"
 #include "p_maputl.h"
 #include "p_spec.h"
+#include "p_levelcache.h"
+#include "m_crc32.h"
+#include "c_cvars.h"
+#include "templates.h"
+#include "stats.h"
+#include "jobqueue.h"
+
+// Below this many sectors or lines, handing the work to the job queue
+// costs more than doing it on one thread.
+const int ParallelSlopeWork = 2048;
+
+CVAR(Bool, slopes_multithreaded, true, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
+
+//===========================================================================
+//
+// SlopeParallelFor
+//
+// Calls work(i) for every i in [0, count). Each call must only write data
+// that belongs to i, so the result is the same no matter how the calls
+// are spread over the threads.
+//
+//===========================================================================
+
+template<class Func> static void SlopeParallelFor(int count, Func work)
+{
+	if (!slopes_multithreaded || count < ParallelSlopeWork || FJobQueue::NumThreads() <= 1)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			work(i);
+		}
+		return;
+	}
+
+	// Hand out the work in small runs so the job queue is not asked for
+	// every single item.
+	const int RunSize = 64;
+	FJobQueue::ParallelFor((count + RunSize - 1) / RunSize, [&](int run)
+	{
+		int first = run * RunSize;
+		int last = MIN(first + RunSize, count);
+		for (int i = first; i < last; i++)
+		{
+			work(i);
+		}
+	});
+}
 
 //===========================================================================
 //
@@ -247,32 +297,60 @@ void P_VavoomSlope(sector_t * sec, int id, const DVector3 &pos, int which)
 //
 //==========================================================================
 
+struct FVertexSpot
+{
+	double x, y;
+	int index;
+
+	bool operator< (const FVertexSpot &other) const
+	{
+		return x < other.x || (x == other.x && y < other.y);
+	}
+};
+
 static void P_SetSlopesFromVertexHeights(FMapThing *firstmt, FMapThing *lastmt, const int *oldvertextable)
 {
 	TMap<int, double> vt_heights[2];
 	FMapThing *mt;
 	bool vt_found = false;
 
+	// Vertex height things are matched to vertices by their exact position,
+	// so sort the vertices by position once instead of checking all of them
+	// for every thing. Things are still applied in order, so if several
+	// things sit on the same vertex the last one wins, as it always did.
+	std::vector<FVertexSpot> spots;
+
 	for (mt = firstmt; mt < lastmt; ++mt)
 	{
 		if (mt->info != NULL && mt->info->Type == NULL)
 		{
 			if (mt->info->Special == SMT_VertexFloorZ || mt->info->Special == SMT_VertexCeilingZ)
 			{
-				for (int i = 0; i < numvertexes; i++)
+				if (spots.empty())
 				{
-					if (vertexes[i].fX() == mt->pos.X && vertexes[i].fY() == mt->pos.Y)
+					spots.resize(numvertexes);
+					for (int i = 0; i < numvertexes; i++)
 					{
-						if (mt->info->Special == SMT_VertexFloorZ)
-						{
-							vt_heights[0][i] = mt->pos.Z;
-						}
-						else
-						{
-							vt_heights[1][i] = mt->pos.Z;
-						}
-						vt_found = true;
+						spots[i].x = vertexes[i].fX();
+						spots[i].y = vertexes[i].fY();
+						spots[i].index = i;
 					}
+					std::sort(spots.begin(), spots.end());
+				}
+
+				FVertexSpot key = { mt->pos.X, mt->pos.Y, 0 };
+				auto range = std::equal_range(spots.begin(), spots.end(), key);
+				for (auto spot = range.first; spot != range.second; ++spot)
+				{
+					if (mt->info->Special == SMT_VertexFloorZ)
+					{
+						vt_heights[0][spot->index] = mt->pos.Z;
+					}
+					else
+					{
+						vt_heights[1][spot->index] = mt->pos.Z;
+					}
+					vt_found = true;
 				}
 				mt->EdNum = 0;
 			}
@@ -303,10 +381,12 @@ static void P_SetSlopesFromVertexHeights(FMapThing *firstmt, FMapThing *lastmt,
 
 	if (vt_found)
 	{
-		for (int i = 0; i < numsectors; i++)
+		// Every sector only reads the vertex heights and sets its own planes,
+		// so the sectors can be done in any order.
+		SlopeParallelFor(numsectors, [&](int i)
 		{
 			sector_t *sec = &sectors[i];
-			if (sec->linecount != 3) continue;	// only works with triangular sectors
+			if (sec->linecount != 3) return;	// only works with triangular sectors
 
 			DVector3 vt1, vt2, vt3, cross;
 			DVector3 vec1, vec2;
@@ -365,7 +445,7 @@ static void P_SetSlopesFromVertexHeights(FMapThing *firstmt, FMapThing *lastmt,
 				double dist = -cross[0] * vertexes[vi3].fX() - cross[1] * vertexes[vi3].fY() - cross[2] * vt3.Z;
 				plane->set(cross[0], cross[1], cross[2], dist);
 			}
-		}
+		});
 	}
 }
 
@@ -427,8 +507,6 @@ void P_SpawnSlopeMakers (FMapThing *firstmt, FMapThing *lastmt, const int *oldve
 			mt->EdNum = 0;
 		}
 	}
-
-	P_SetSlopesFromVertexHeights(firstmt, lastmt, oldvertextable);
 }
 
 
@@ -445,9 +523,23 @@ void P_SpawnSlopeMakers (FMapThing *firstmt, FMapThing *lastmt, const int *oldve
 // If (which & 1), sets floor.
 // If (which & 2), sets ceiling.
 //
+// The new plane is returned in align instead of being set, so that
+// several lines can be worked out at once. Returns false if the plane
+// is to be left alone.
+//
 //===========================================================================
 
-static void P_AlignPlane(sector_t *sec, line_t *line, int which)
+struct FPlaneAlign
+{
+	sector_t *sec;
+	line_t *line;
+	int which;
+	bool valid;
+	DVector3 normal;
+	double dist;
+};
+
+static bool P_AlignPlane(sector_t *sec, line_t *line, int which, FPlaneAlign &align)
 {
 	sector_t *refsec;
 	double bestdist;
@@ -456,7 +548,7 @@ static void P_AlignPlane(sector_t *sec, line_t *line, int which)
 	line_t **probe;
 
 	if (line->backsector == NULL)
-		return;
+		return false;
 
 	// Find furthest vertex from the reference line. It, along with the two ends
 	// of the line, will define the plane.
@@ -484,10 +576,8 @@ static void P_AlignPlane(sector_t *sec, line_t *line, int which)
 
 	DVector3 p, v1, v2, cross;
 
-	secplane_t *srcplane;
 	double srcheight, destheight;
 
-	srcplane = (which == 0) ? &sec->floorplane : &sec->ceilingplane;
 	srcheight = (which == 0) ? sec->GetPlaneTexZ(sector_t::floor) : sec->GetPlaneTexZ(sector_t::ceiling);
 	destheight = (which == 0) ? refsec->GetPlaneTexZ(sector_t::floor) : refsec->GetPlaneTexZ(sector_t::ceiling);
 
@@ -509,8 +599,9 @@ static void P_AlignPlane(sector_t *sec, line_t *line, int which)
 		cross = -cross;
 	}
 
-	double dist = -cross[0] * line->v1->fX() - cross[1] * line->v1->fY() - cross[2] * destheight;
-	srcplane->set(cross[0], cross[1], cross[2], dist);
+	align.normal = cross;
+	align.dist = -cross[0] * line->v1->fX() - cross[1] * line->v1->fY() - cross[2] * destheight;
+	return true;
 }
 
 //===========================================================================
@@ -521,6 +612,7 @@ static void P_AlignPlane(sector_t *sec, line_t *line, int which)
 
 void P_SetSlopes ()
 {
+	TArray<FPlaneAlign> aligns;
 	int i, s;
 
 	for (i = 0; i < numlines; i++)
@@ -541,14 +633,38 @@ void P_SetSlopes ()
 					if (s == 1 && bits == 0)
 						bits = (lines[i].args[0] >> 2) & 3;
 
+					FPlaneAlign align = { NULL, lines + i, s, false };
+
 					if (bits == 1)			// align front side to back
-						P_AlignPlane (lines[i].frontsector, lines + i, s);
+						align.sec = lines[i].frontsector;
 					else if (bits == 2)		// align back side to front
-						P_AlignPlane (lines[i].backsector, lines + i, s);
+						align.sec = lines[i].backsector;
+					else
+						continue;
+					aligns.Push(align);
 				}
 			}
 		}
 	}
+
+	// An aligned plane only depends on the vertices and the sectors' texture
+	// heights, neither of which aligning changes. So all of them can be
+	// worked out at once, as long as they are set in the original order
+	// for the cases where more than one line aligns the same plane.
+	SlopeParallelFor(aligns.Size(), [&](int i)
+	{
+		aligns[i].valid = P_AlignPlane(aligns[i].sec, aligns[i].line, aligns[i].which, aligns[i]);
+	});
+
+	for (unsigned int j = 0; j < aligns.Size(); j++)
+	{
+		const FPlaneAlign &align = aligns[j];
+		if (align.valid)
+		{
+			secplane_t *plane = (align.which == 0) ? &align.sec->floorplane : &align.sec->ceilingplane;
+			plane->set(align.normal.X, align.normal.Y, align.normal.Z, align.dist);
+		}
+	}
 }
 
 //===========================================================================
@@ -599,3 +715,153 @@ void P_CopySlopes()
 		}
 	}
 }
+
+//===========================================================================
+//
+// SlopeCacheKey
+//
+// Everything outside the map data that slope setup depends on: which
+// things are slope things, the vertices the map's vertex heights end up
+// on, the translated line specials and the sector planes as they are
+// before slope things are applied.
+//
+//===========================================================================
+
+static DWORD SlopeCacheKey(FMapThing *firstmt, FMapThing *lastmt, const int *oldvertextable)
+{
+	DWORD crc = 0;
+
+	for (FMapThing *mt = firstmt; mt < lastmt; ++mt)
+	{
+		int special = (mt->info != NULL && mt->info->Type == NULL) ? mt->info->Special : 0;
+		crc = AddCRC32(crc, (const BYTE *)&special, sizeof(special));
+	}
+
+	// Rebuilt nodes can reorder the vertices.
+	for (int i = 0; i < numvertexdatas; i++)
+	{
+		int ii = oldvertextable == NULL ? i : oldvertextable[i];
+		crc = AddCRC32(crc, (const BYTE *)&ii, sizeof(ii));
+	}
+
+	for (int i = 0; i < numlines; i++)
+	{
+		crc = AddCRC32(crc, (const BYTE *)&lines[i].special, sizeof(lines[i].special));
+		crc = AddCRC32(crc, (const BYTE *)lines[i].args, sizeof(lines[i].args));
+	}
+	for (int i = 0; i < numsectors; i++)
+	{
+		const secplane_t &f = sectors[i].floorplane;
+		const secplane_t &c = sectors[i].ceilingplane;
+		double planes[10] =
+		{
+			f.Normal().X, f.Normal().Y, f.Normal().Z, f.fD(),
+			c.Normal().X, c.Normal().Y, c.Normal().Z, c.fD(),
+			sectors[i].GetPlaneTexZ(sector_t::floor), sectors[i].GetPlaneTexZ(sector_t::ceiling)
+		};
+		crc = AddCRC32(crc, (const BYTE *)planes, sizeof(planes));
+	}
+	return crc;
+}
+
+//===========================================================================
+//
+// LoadCachedSlopes
+//
+// Restores the sector planes and repeats the side effects slope setup
+// has on the map things, lines and vertex data.
+//
+//===========================================================================
+
+static bool LoadCachedSlopes(DWORD key, FMapThing *firstmt, FMapThing *lastmt)
+{
+	const TArray<BYTE> *section = P_FindLevelCacheSection(LCACHE_Slopes);
+	if (section == NULL) return false;
+
+	FLevelCacheReader r(*section);
+	if (r.Long() != key || r.Long() != (DWORD)numsectors) return false;
+	if (section->Size() != 8 + numsectors * 8 * sizeof(double)) return false;
+
+	for (int i = 0; i < numsectors; i++)
+	{
+		for (int j = 0; j < 2; j++)
+		{
+			double a = r.Double();
+			double b = r.Double();
+			double c = r.Double();
+			double d = r.Double();
+			(j == 0 ? sectors[i].floorplane : sectors[i].ceilingplane).set(a, b, c, d);
+		}
+	}
+
+	for (FMapThing *mt = firstmt; mt < lastmt; ++mt)
+	{
+		if (mt->info != NULL && mt->info->Type == NULL &&
+			(mt->info->Special >= SMT_SlopeFloorPointLine && mt->info->Special <= SMT_VertexCeilingZ))
+		{
+			mt->EdNum = 0;
+		}
+	}
+	for (int i = 0; i < numlines; i++)
+	{
+		if (lines[i].special == Plane_Copy)
+		{
+			lines[i].special = 0;
+		}
+	}
+	delete[] vertexdatas;
+	vertexdatas = NULL;
+	numvertexdatas = 0;
+	return true;
+}
+
+//===========================================================================
+//
+// P_SetupSlopes
+//
+// Runs P_SpawnSlopeMakers and P_CopySlopes, or takes their result from
+// the level cache. times gets the time spent on slope things, vertex
+// heights and copied slopes, for showloadtimes.
+//
+//===========================================================================
+
+void P_SetupSlopes(FMapThing *firstmt, FMapThing *lastmt, const int *oldvertextable, cycle_t *times)
+{
+	DWORD key = SlopeCacheKey(firstmt, lastmt, oldvertextable);
+
+	if (LoadCachedSlopes(key, firstmt, lastmt))
+	{
+		return;
+	}
+
+	times[0].Clock();
+	P_SpawnSlopeMakers(firstmt, lastmt, oldvertextable);
+	times[0].Unclock();
+
+	times[1].Clock();
+	P_SetSlopesFromVertexHeights(firstmt, lastmt, oldvertextable);
+	times[1].Unclock();
+
+	times[2].Clock();
+	P_CopySlopes();
+	times[2].Unclock();
+
+	if (P_WantLevelCache())
+	{
+		FLevelCacheWriter w(P_NewLevelCacheSection(LCACHE_Slopes));
+		w.Long(key);
+		w.Long(numsectors);
+		for (int i = 0; i < numsectors; i++)
+		{
+			for (int j = 0; j < 2; j++)
+			{
+				const secplane_t &plane = j == 0 ? sectors[i].floorplane : sectors[i].ceilingplane;
+				DVector3 normal = plane.Normal();
+				w.Double(normal.X);
+				w.Double(normal.Y);
+				w.Double(normal.Z);
+				w.Double(plane.fD());
+			}
+		}
+	}
+}
@@ -0,0 +1,329 @@
+/*
+** p_subsectorgrid.cpp
+**
+** Grid-accelerated point-in-subsector lookup
+**
+**---------------------------------------------------------------------------
+** Copyright 2016 The ZDoom Team
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+** 3. The name of the author may not be used to endorse or promote products
+**    derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+** OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+** INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+** NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+** THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**---------------------------------------------------------------------------
+**
+*/
+
+
+#include "doomtype.h"
+#include "p_subsectorgrid.h"
+#include "r_defs.h"
+#include "r_state.h"
+#include "r_utility.h"
+#include "m_random.h"
+#include "c_dispatch.h"
+#include "stats.h"
+#include "templates.h"
+
+extern node_t *gamenodes;
+extern int numgamenodes;
+extern subsector_t *gamesubsectors;
+
+FSubsectorGrid GameSubsectorGrid;
+FSubsectorGrid RenderSubsectorGrid;
+
+static FRandom pr_pistest;
+
+enum
+{
+	MIN_CELL_SHIFT = FRACBITS + 7,		// 128 map units
+	MAX_GRID_CELLS = 65536
+};
+
+//==========================================================================
+//
+// RegionSide
+//
+// Returns the side of the node's partition line that every point in the
+// given fixed point rectangle (inclusive) lies on, or -1 if the rectangle
+// straddles the line. The test is done the same way as R_PointOnSide,
+// so any point inside the rectangle gets the same answer from it.
+//
+//==========================================================================
+
+static int RegionSide(const node_t *node, SQWORD x1, SQWORD y1, SQWORD x2, SQWORD y2)
+{
+	int side = -1;
+
+	for (int i = 0; i < 4; ++i)
+	{
+		SQWORD dy = ((i & 1) ? y2 : y1) - node->y;
+		SQWORD dx = node->x - ((i & 2) ? x2 : x1);
+
+		// R_PointOnSide computes these in 32 bits. If they do not fit,
+		// some point in here would wrap around, so let the BSP decide.
+		if (dy != (int)dy || dx != (int)dx)
+		{
+			return -1;
+		}
+		int s = DMulScale32((int)dy, node->dx, (int)dx, node->dy) > 0;
+		if (side == -1)
+		{
+			side = s;
+		}
+		else if (side != s)
+		{
+			return -1;
+		}
+	}
+	return side;
+}
+
+//==========================================================================
+//
+// FSubsectorGrid :: Clear
+//
+//==========================================================================
+
+void FSubsectorGrid::Clear()
+{
+	Cells.Clear();
+	Root = NULL;
+	OriginX = OriginY = 0;
+	Width = Height = 0;
+	CellShift = MIN_CELL_SHIFT;
+}
+
+//==========================================================================
+//
+// FSubsectorGrid :: Build
+//
+//==========================================================================
+
+void FSubsectorGrid::Build(node_t *nodes, int numnodes, subsector_t *subsectors)
+{
+	Clear();
+
+	if (subsectors == NULL || (nodes == NULL && numnodes > 0))
+	{
+		return;
+	}
+	// single subsector is a special case
+	if (numnodes == 0)
+	{
+		Root = (BYTE *)subsectors + 1;
+		return;
+	}
+	Root = &nodes[numnodes - 1];
+
+	if (numvertexes == 0)
+	{
+		return;
+	}
+
+	// Points outside the vertex bounds simply start at the root.
+	SQWORD minx = FLOAT2FIXED(vertexes[0].fX()), maxx = minx;
+	SQWORD miny = FLOAT2FIXED(vertexes[0].fY()), maxy = miny;
+	for (int i = 1; i < numvertexes; ++i)
+	{
+		SQWORD x = FLOAT2FIXED(vertexes[i].fX());
+		SQWORD y = FLOAT2FIXED(vertexes[i].fY());
+		minx = MIN(minx, x);	maxx = MAX(maxx, x);
+		miny = MIN(miny, y);	maxy = MAX(maxy, y);
+	}
+
+	while ((((maxx - minx) >> CellShift) + 1) * (((maxy - miny) >> CellShift) + 1) > MAX_GRID_CELLS)
+	{
+		CellShift++;
+	}
+	OriginX = minx;
+	OriginY = miny;
+	Width = int((maxx - minx) >> CellShift) + 1;
+	Height = int((maxy - miny) >> CellShift) + 1;
+	Cells.Resize(Width * Height);
+	Fill(0, 0, Width, Height, Root);
+}
+
+//==========================================================================
+//
+// FSubsectorGrid :: Fill
+//
+// Walks down the tree for as long as the whole block of cells stays on one
+// side of each partition line, then either stores the node reached or
+// splits the block into quarters and continues with each of them.
+//
+//==========================================================================
+
+void FSubsectorGrid::Fill(int x1, int y1, int x2, int y2, void *node)
+{
+	SQWORD fx1 = OriginX + ((SQWORD)x1 << CellShift);
+	SQWORD fy1 = OriginY + ((SQWORD)y1 << CellShift);
+	SQWORD fx2 = OriginX + ((SQWORD)x2 << CellShift) - 1;
+	SQWORD fy2 = OriginY + ((SQWORD)y2 << CellShift) - 1;
+
+	while (!((size_t)node & 1))
+	{
+		node_t *bsp = (node_t *)node;
+		int side = RegionSide(bsp, fx1, fy1, fx2, fy2);
+		if (side < 0)
+		{
+			break;
+		}
+		node = bsp->children[side];
+	}
+
+	if (((size_t)node & 1) || (x2 - x1 == 1 && y2 - y1 == 1))
+	{
+		for (int y = y1; y < y2; ++y)
+		{
+			for (int x = x1; x < x2; ++x)
+			{
+				Cells[y * Width + x] = node;
+			}
+		}
+		return;
+	}
+
+	int mx = (x1 + x2) >> 1;
+	int my = (y1 + y2) >> 1;
+
+	if (x2 - x1 == 1)
+	{
+		Fill(x1, y1, x2, my, node);
+		Fill(x1, my, x2, y2, node);
+	}
+	else if (y2 - y1 == 1)
+	{
+		Fill(x1, y1, mx, y2, node);
+		Fill(mx, y1, x2, y2, node);
+	}
+	else
+	{
+		Fill(x1, y1, mx, my, node);
+		Fill(mx, y1, x2, my, node);
+		Fill(x1, my, mx, y2, node);
+		Fill(mx, my, x2, y2, node);
+	}
+}
+
+//==========================================================================
+//
+// FSubsectorGrid :: Descend
+//
+//==========================================================================
+
+subsector_t *FSubsectorGrid::Descend(void *node, fixed_t x, fixed_t y)
+{
+	while (!((size_t)node & 1))
+	{
+		node_t *bsp = (node_t *)node;
+		node = bsp->children[R_PointOnSide(x, y, bsp)];
+	}
+	return (subsector_t *)((BYTE *)node - 1);
+}
+
+//==========================================================================
+//
+// P_BuildSubsectorGrids
+//
+// Called once the game and render nodes are final.
+//
+//==========================================================================
+
+void P_BuildSubsectorGrids()
+{
+	GameSubsectorGrid.Build(gamenodes, numgamenodes, gamesubsectors);
+	RenderSubsectorGrid.Build(nodes, numnodes, subsectors);
+}
+
+void P_FreeSubsectorGrids()
+{
+	GameSubsectorGrid.Clear();
+	RenderSubsectorGrid.Clear();
+}
+
+#ifdef _DEBUG
+//==========================================================================
+//
+// CCMD pointinsectortest
+//
+// Times grid lookups against plain BSP walks over random points inside
+// the map and checks that both always agree.
+//
+//==========================================================================
+
+static void TestGrid(const char *name, const FSubsectorGrid &grid, int count)
+{
+	if (!grid.IsBuilt())
+	{
+		Printf("%s: not built\n", name);
+		return;
+	}
+
+	SQWORD x1, y1, x2, y2;
+	grid.GetBounds(x1, y1, x2, y2);
+
+	TArray<fixed_t> points;
+	points.Resize(count * 2);
+	for (int i = 0; i < count; ++i)
+	{
+		points[i*2] = fixed_t(x1 + SQWORD(((QWORD(pr_pistest.GenRand32()) << 32) | pr_pistest.GenRand32()) % QWORD(x2 - x1)));
+		points[i*2+1] = fixed_t(y1 + SQWORD(((QWORD(pr_pistest.GenRand32()) << 32) | pr_pistest.GenRand32()) % QWORD(y2 - y1)));
+	}
+
+	TArray<subsector_t *> results;
+	results.Resize(count);
+	cycle_t gridtime, bsptime;
+	int mismatches = 0;
+
+	gridtime.Reset();
+	gridtime.Clock();
+	for (int i = 0; i < count; ++i)
+	{
+		results[i] = grid.PointInSubsector(points[i*2], points[i*2+1]);
+	}
+	gridtime.Unclock();
+
+	bsptime.Reset();
+	bsptime.Clock();
+	for (int i = 0; i < count; ++i)
+	{
+		mismatches += results[i] != grid.PointInSubsectorBSP(points[i*2], points[i*2+1]);
+	}
+	bsptime.Unclock();
+
+	Printf("%s: %d points, grid %.3f ms, BSP %.3f ms, %d mismatches\n", name, count,
+		gridtime.TimeMS(), bsptime.TimeMS(), mismatches);
+}
+
+CCMD(pointinsectortest)
+{
+	int count = 1000000;
+
+	if (argv.argc() > 1)
+	{
+		count = MAX(1, atoi(argv[1]));
+	}
+	TestGrid("Game nodes", GameSubsectorGrid, count);
+	TestGrid("Render nodes", RenderSubsectorGrid, count);
+}
+#endif
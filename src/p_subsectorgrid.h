@@ -0,0 +1,72 @@
+#ifndef __P_SUBSECTORGRID_H
+#define __P_SUBSECTORGRID_H
+
+#include "doomtype.h"
+#include "tarray.h"
+
+struct node_t;
+struct subsector_t;
+
+//==========================================================================
+//
+// A uniform grid over the map that remembers, for each cell, the deepest
+// BSP node (or the subsector) that every point in the cell leads to.
+// Point lookups start there instead of at the root, which gives exactly
+// the same result with far fewer node tests.
+//
+//==========================================================================
+
+class FSubsectorGrid
+{
+public:
+	FSubsectorGrid() { Clear(); }
+
+	void Build(node_t *nodes, int numnodes, subsector_t *subsectors);
+	void Clear();
+	bool IsBuilt() const { return Root != NULL; }
+
+	subsector_t *PointInSubsector(fixed_t x, fixed_t y) const
+	{
+		void *node = Root;
+		int cx = int(((SQWORD)x - OriginX) >> CellShift);
+		int cy = int(((SQWORD)y - OriginY) >> CellShift);
+
+		if ((unsigned)cx < (unsigned)Width && (unsigned)cy < (unsigned)Height)
+		{
+			node = Cells[cy * Width + cx];
+		}
+		return Descend(node, x, y);
+	}
+
+	// Plain walk from the root, for comparison.
+	subsector_t *PointInSubsectorBSP(fixed_t x, fixed_t y) const
+	{
+		return Descend(Root, x, y);
+	}
+
+	void GetBounds(SQWORD &x1, SQWORD &y1, SQWORD &x2, SQWORD &y2) const
+	{
+		x1 = OriginX;
+		y1 = OriginY;
+		x2 = OriginX + ((SQWORD)Width << CellShift);
+		y2 = OriginY + ((SQWORD)Height << CellShift);
+	}
+
+private:
+	TArray<void *> Cells;		// node_t *, or subsector_t * with bit 0 set, like node_t::children
+	void *Root;
+	SQWORD OriginX, OriginY;
+	int Width, Height;
+	int CellShift;
+
+	static subsector_t *Descend(void *node, fixed_t x, fixed_t y);
+	void Fill(int x1, int y1, int x2, int y2, void *node);
+};
+
+extern FSubsectorGrid GameSubsectorGrid;
+extern FSubsectorGrid RenderSubsectorGrid;
+
+void P_BuildSubsectorGrids();
+void P_FreeSubsectorGrids();
+
+#endif
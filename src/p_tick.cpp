@@ -35,6 +35,7 @@
 #include "g_level.h"
 #include "r_utility.h"
 #include "p_spec.h"
+#include "profiler.h"
 
 extern gamestate_t wipegamestate;
 
@@ -71,6 +72,7 @@ bool P_CheckTickerPaused ()
 //
 void P_Ticker (void)
 {
+	FProfileZone zone("P_Ticker");
 	int i;
 
 	interpolator.UpdateInterpolations ();
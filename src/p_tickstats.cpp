@@ -0,0 +1,189 @@
+/*
+** p_tickstats.cpp
+**
+** Per-class accounting of thinker and action function cost
+**
+**---------------------------------------------------------------------------
+** Copyright 2016 The ZDoom Team
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+** 3. The name of the author may not be used to endorse or promote products
+**    derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+** OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+** INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+** NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+** THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**---------------------------------------------------------------------------
+**
+*/
+
+#include <algorithm>
+
+#include "doomtype.h"
+#include "dobject.h"
+#include "p_tickstats.h"
+#include "stats.h"
+#include "tarray.h"
+#include "templates.h"
+#include "c_dispatch.h"
+
+bool TickStatsActive;
+
+static TMap<PClass *, FClassTickStats> ClassTickStats;
+static unsigned TickStatsTics;
+
+//==========================================================================
+//
+// P_GetClassTickStats
+//
+//==========================================================================
+
+FClassTickStats &P_GetClassTickStats(PClass *cls)
+{
+	FClassTickStats *stats = ClassTickStats.CheckKey(cls);
+	if (stats == NULL)
+	{
+		stats = &ClassTickStats[cls];
+		memset(stats, 0, sizeof(*stats));
+	}
+	return *stats;
+}
+
+//==========================================================================
+//
+// P_CountTickStatsTic
+//
+// Called once per playsim tic while accounting is on, so totals can be
+// shown as per-tic averages.
+//
+//==========================================================================
+
+void P_CountTickStatsTic()
+{
+	TickStatsTics++;
+}
+
+//==========================================================================
+//
+// GetSortedStats
+//
+//==========================================================================
+
+typedef TMap<PClass *, FClassTickStats>::Pair FClassTickPair;
+
+static void GetSortedStats(TArray<FClassTickPair *> &out)
+{
+	TMapIterator<PClass *, FClassTickStats> it(ClassTickStats);
+	FClassTickPair *pair;
+
+	out.Clear();
+	while (it.NextPair(pair))
+	{
+		out.Push(pair);
+	}
+	if (out.Size() > 1)
+	{
+		std::sort(&out[0], &out[0] + out.Size(), [](FClassTickPair *a, FClassTickPair *b)
+		{
+			return a->Value.TickTime > b->Value.TickTime;
+		});
+	}
+}
+
+//==========================================================================
+//
+// CCMD classticks
+//
+// classticks on|off|reset, or with no argument (or a count) lists the
+// most expensive classes.
+//
+//==========================================================================
+
+CCMD(classticks)
+{
+	if (argv.argc() >= 2 && !stricmp(argv[1], "on"))
+	{
+		TickStatsActive = true;
+		Printf("Class tick accounting on\n");
+		return;
+	}
+	if (argv.argc() >= 2 && !stricmp(argv[1], "off"))
+	{
+		TickStatsActive = false;
+		Printf("Class tick accounting off\n");
+		return;
+	}
+	if (argv.argc() >= 2 && !stricmp(argv[1], "reset"))
+	{
+		ClassTickStats.Clear();
+		TickStatsTics = 0;
+		return;
+	}
+
+	TArray<FClassTickPair *> sorted;
+	unsigned count = argv.argc() >= 2 ? (unsigned)MAX(atoi(argv[1]), 1) : 20;
+	unsigned tics = MAX(TickStatsTics, 1u);
+
+	GetSortedStats(sorted);
+	if (sorted.Size() == 0)
+	{
+		Printf("No class tick data. Use \"classticks on\" to collect some.\n");
+		return;
+	}
+	Printf("Over %u tics:\n%-32s %9s %9s %9s %8s %8s %8s %7s\n", TickStatsTics,
+		"Class", "tick ms", "per tic", "action ms", "ticks", "actions", "trymoves", "spawns");
+	for (unsigned i = 0; i < sorted.Size() && i < count; ++i)
+	{
+		const FClassTickStats &s = sorted[i]->Value;
+		Printf("%-32s %9.3f %9.4f %9.3f %8u %8u %8u %7u\n", sorted[i]->Key->TypeName.GetChars(),
+			s.TickTime, s.TickTime / tics, s.ActionTime, s.Ticks, s.Actions, s.TryMoves, s.Spawns);
+	}
+}
+
+//==========================================================================
+//
+// ADD_STAT classticks
+//
+// The ten most expensive classes, averaged per tic.
+//
+//==========================================================================
+
+ADD_STAT(classticks)
+{
+	FString out;
+
+	if (!TickStatsActive)
+	{
+		out = "Class tick accounting is off. Use \"classticks on\".";
+		return out;
+	}
+
+	TArray<FClassTickPair *> sorted;
+	double tics = MAX(TickStatsTics, 1u);
+
+	GetSortedStats(sorted);
+	for (unsigned i = 0; i < sorted.Size() && i < 10; ++i)
+	{
+		const FClassTickStats &s = sorted[i]->Value;
+		out.AppendFormat("%-24s tick %6.3f ms  action %6.3f ms  moves %6.1f  spawns %5.2f\n",
+			sorted[i]->Key->TypeName.GetChars(), s.TickTime / tics, s.ActionTime / tics,
+			s.TryMoves / tics, s.Spawns / tics);
+	}
+	return out;
+}
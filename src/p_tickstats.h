@@ -0,0 +1,29 @@
+#ifndef __P_TICKSTATS_H
+#define __P_TICKSTATS_H
+
+class PClass;
+
+//==========================================================================
+//
+// Per-class playsim cost, collected only while "classticks on" is in
+// effect. Callers test TickStatsActive before doing anything else, so
+// the accounting costs one branch when it is off.
+//
+//==========================================================================
+
+struct FClassTickStats
+{
+	double TickTime;		// ms spent in Tick(), including everything below
+	double ActionTime;		// ms spent in state action functions
+	unsigned Ticks;
+	unsigned Actions;
+	unsigned TryMoves;
+	unsigned Spawns;
+};
+
+extern bool TickStatsActive;
+
+FClassTickStats &P_GetClassTickStats(PClass *cls);
+void P_CountTickStatsTic();
+
+#endif
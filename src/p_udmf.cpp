@@ -33,6 +33,8 @@
 **
 */
 
+#include <algorithm>
+
 #include "doomstat.h"
 #include "p_setup.h"
 #include "p_lnspec.h"
@@ -48,6 +50,10 @@
 #include "w_wad.h"
 #include "p_tags.h"
 #include "p_terrain.h"
+#include "c_cvars.h"
+#include "c_dispatch.h"
+#include "m_crc32.h"
+#include "stats.h"
 
 //===========================================================================
 //
@@ -132,6 +138,12 @@ extern TArray<int>		linemap;
 
 #define CHECK_N(f) if (!(namespace_bits&(f))) break;
 
+#ifdef _DEBUG
+CVAR(Bool, udmf_fastparse, true, 0)
+#else
+static const bool udmf_fastparse = true;
+#endif
+
 
 //===========================================================================
 //
@@ -188,7 +200,7 @@ void UDMFParserBase::Skip()
 FName UDMFParserBase::ParseKey(bool checkblock, bool *isblock)
 {
 	sc.MustGetString();
-	FName key = sc.String;
+	FName key = UDMFKeyName(sc.String, sc.StringLen);
 	if (checkblock)
 	{
 		if (sc.CheckToken('{'))
@@ -228,6 +240,441 @@ FName UDMFParserBase::ParseKey(bool checkblock, bool *isblock)
 	return key;
 }
 
+//===========================================================================
+//
+// Reads the next 'key = value;' of a block, or its closing brace, in which
+// case it returns false. The results are the same as from ParseKey.
+//
+//===========================================================================
+
+bool UDMFParserBase::ParseBlockKey(FName &key)
+{
+	if (udmf_fastparse)
+	{
+		int res = sc.GetKeyValue(key, parsedString);
+		if (res != FUDMFScanner::KEY_Slow)
+		{
+			return res == FUDMFScanner::KEY_Parsed;
+		}
+	}
+	if (sc.CheckToken('}'))
+	{
+		return false;
+	}
+	key = ParseKey();
+	return true;
+}
+
+//===========================================================================
+//
+// UDMFKeyName
+//
+// Turns key text into a name. Keys that are predefined names are found
+// through a perfect hash over all of them, so the name table and its
+// string compares are only needed for user keys.
+//
+//===========================================================================
+
+static const char *const PredefinedKeys[] =
+{
+#define xx(n) #n,
+#include "namedef.h"
+#undef xx
+};
+
+enum
+{
+	KEYHASH_Buckets = 256,
+	KEYHASH_Slots = 2048,
+};
+
+static bool KeyHashBuilt, KeyHashValid;
+static DWORD KeyHashDisplace[KEYHASH_Buckets];
+static short KeyHashSlots[KEYHASH_Slots];
+
+static inline QWORD HashKey(const char *text, size_t len)
+{
+	QWORD hash = 14695981039346656037ull;
+	for (size_t i = 0; i < len; ++i)
+	{
+		BYTE c = text[i];
+		if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+		hash = (hash ^ c) * 1099511628211ull;
+	}
+	return hash ^ (hash >> 29);
+}
+
+static inline unsigned KeySlot(QWORD hash, DWORD displace)
+{
+	DWORD f1 = DWORD(hash >> 16);
+	DWORD f2 = DWORD(hash >> 40) | 1;
+	return (f1 + (displace & 0xffff) * f2 + (displace >> 16)) & (KEYHASH_Slots - 1);
+}
+
+// Hash and displace: buckets are placed largest first, each with the first
+// displacement that puts all of its keys into free slots.
+static void BuildKeyHash()
+{
+	const int numkeys = int(countof(PredefinedKeys));
+	TArray<int> buckets[KEYHASH_Buckets];
+	TArray<QWORD> hashes;
+	int order[KEYHASH_Buckets];
+
+	KeyHashBuilt = true;
+	KeyHashValid = false;
+	memset(KeyHashSlots, 0xff, sizeof(KeyHashSlots));
+	memset(KeyHashDisplace, 0, sizeof(KeyHashDisplace));
+
+	hashes.Resize(numkeys);
+	for (int i = 1; i < numkeys; ++i)	// 0 is None
+	{
+		hashes[i] = HashKey(PredefinedKeys[i], strlen(PredefinedKeys[i]));
+		buckets[hashes[i] & (KEYHASH_Buckets - 1)].Push(i);
+	}
+	for (int i = 0; i < KEYHASH_Buckets; ++i)
+	{
+		order[i] = i;
+	}
+	std::sort(order, order + KEYHASH_Buckets, [&](int a, int b) { return buckets[a].Size() > buckets[b].Size(); });
+
+	for (int i = 0; i < KEYHASH_Buckets; ++i)
+	{
+		TArray<int> &bucket = buckets[order[i]];
+		if (bucket.Size() == 0)
+		{
+			break;
+		}
+		DWORD displace;
+		for (displace = 0; displace < KEYHASH_Slots * KEYHASH_Slots; ++displace)
+		{
+			unsigned j;
+			for (j = 0; j < bucket.Size(); ++j)
+			{
+				unsigned slot = KeySlot(hashes[bucket[j]], displace);
+				if (KeyHashSlots[slot] >= 0)
+				{
+					break;
+				}
+				KeyHashSlots[slot] = bucket[j];
+			}
+			if (j == bucket.Size())
+			{
+				break;
+			}
+			while (j-- > 0)
+			{
+				KeyHashSlots[KeySlot(hashes[bucket[j]], displace)] = -1;
+			}
+		}
+		if (displace == KEYHASH_Slots * KEYHASH_Slots)
+		{
+			return;
+		}
+		KeyHashDisplace[order[i]] = displace;
+	}
+	KeyHashValid = true;
+}
+
+FName UDMFKeyName(const char *text, size_t len)
+{
+	if (!KeyHashBuilt)
+	{
+		BuildKeyHash();
+	}
+	if (KeyHashValid)
+	{
+		QWORD hash = HashKey(text, len);
+		int index = KeyHashSlots[KeySlot(hash, KeyHashDisplace[hash & (KEYHASH_Buckets - 1)])];
+		if (index > 0 && !strnicmp(PredefinedKeys[index], text, len) && PredefinedKeys[index][len] == 0)
+		{
+			return FName(ENamedName(index));
+		}
+	}
+	return FName(text, len, false);
+}
+
+static inline bool IsIdentStart(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static inline bool IsIdentChar(char c)
+{
+	return IsIdentStart(c) || (c >= '0' && c <= '9');
+}
+
+//===========================================================================
+//
+// FUDMFScanner :: SkipSpace
+//
+// Skips whitespace and comments like the token scanner does. Returns false
+// at the end of the text or at anything the shortcut should not deal with.
+//
+//===========================================================================
+
+bool FUDMFScanner::SkipSpace(const char *&p, int &line) const
+{
+	const char *end = ScriptEndPtr;
+
+	while (p < end)
+	{
+		char c = *p;
+		if (c == '\n')
+		{
+			line++;
+			p++;
+		}
+		else if (c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f')
+		{
+			p++;
+		}
+		else if (c == '/' && p + 1 < end && p[1] == '/')
+		{
+			p += 2;
+			while (p < end && *p != '\n') p++;
+		}
+		else if (c == '/' && p + 1 < end && p[1] == '*')
+		{
+			p += 2;
+			for (;;)
+			{
+				if (p + 1 >= end) return false;
+				if (p[0] == '*' && p[1] == '/') break;
+				if (p[0] == '\n') line++;
+				p++;
+			}
+			p += 2;
+		}
+		else
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+//===========================================================================
+//
+// FUDMFScanner :: ReadNumber
+//
+// Reads an unsigned number token at p into Number and Float, exactly as
+// GetToken would. Unsigned constants are left to the regular scanner.
+//
+//===========================================================================
+
+bool FUDMFScanner::ReadNumber(const char *&p)
+{
+	const char *start = p;
+	const char *d = p;
+
+	if (d[0] == '0' && (d[1] == 'x' || d[1] == 'X'))
+	{
+		d += 2;
+		if (!isxdigit((BYTE)*d)) return false;
+		while (isxdigit((BYTE)*d)) d++;
+	}
+	else
+	{
+		while (*d >= '0' && *d <= '9') d++;
+
+		bool isfloat = false;
+		if (*d == '.')
+		{
+			isfloat = d > start || (d[1] >= '0' && d[1] <= '9');
+			if (!isfloat) return false;
+		}
+		else if (d > start && (*d == 'e' || *d == 'E'))
+		{
+			isfloat = (d[1] >= '0' && d[1] <= '9') ||
+				((d[1] == '+' || d[1] == '-') && d[2] >= '0' && d[2] <= '9');
+		}
+		if (d == start && !isfloat) return false;
+
+		if (isfloat)
+		{
+			char *stop;
+			Float = strtod(start, &stop);
+			if (stop == start) return false;
+			p = stop;
+			if (*p == 'f' || *p == 'F') p++;
+			TokenType = TK_FloatConst;
+			return true;
+		}
+	}
+
+	// Integer suffixes
+	for (int i = 0; i < 2 && (*d == 'l' || *d == 'L' || *d == 'u' || *d == 'U'); ++i, ++d)
+	{
+		if (*d == 'u' || *d == 'U') return false;
+	}
+
+	if (start[0] != '0' && d - start <= 9)
+	{
+		int val = 0;
+		for (const char *c = start; *c >= '0' && *c <= '9'; ++c)
+		{
+			val = val * 10 + (*c - '0');
+		}
+		Number = val;
+	}
+	else
+	{
+		Number = strtol(start, NULL, 0);
+	}
+	Float = Number;
+	TokenType = TK_IntConst;
+	p = d;
+	return true;
+}
+
+//===========================================================================
+//
+// FUDMFScanner :: SetLastToken
+//
+// Leaves the scanner as if it had just returned the given one-character
+// token, which is what the regular path ends with.
+//
+//===========================================================================
+
+void FUDMFScanner::SetLastToken(const char *tokpos, int line, char token)
+{
+	ScriptPtr = tokpos + 1;
+	LastGotPtr = tokpos;
+	LastGotLine = line;
+	LastGotToken = true;
+	Line = line;
+	StringBuffer[0] = token;
+	StringBuffer[1] = 0;
+	String = StringBuffer;
+	StringLen = 1;
+	End = false;
+}
+
+//===========================================================================
+//
+// FUDMFScanner :: GetKeyValue
+//
+// The shortcut for ParseBlockKey. The key must be an identifier and the
+// value a number, a string without escapes, true or false. Everything
+// else is left for the regular scanner to read and complain about.
+//
+//===========================================================================
+
+int FUDMFScanner::GetKeyValue(FName &key, FString &strval)
+{
+	if (AlreadyGot || !CMode || StateMode != 0)
+	{
+		return KEY_Slow;
+	}
+
+	const char *p = ScriptPtr;
+	int line = Line;
+
+	if (!SkipSpace(p, line))
+	{
+		return KEY_Slow;
+	}
+	if (*p == '}')
+	{
+		TokenType = '}';
+		SetLastToken(p, line, '}');
+		return KEY_BlockEnd;
+	}
+
+	// The key
+	const char *keystart = p;
+	if (!IsIdentStart(*p))
+	{
+		return KEY_Slow;
+	}
+	while (IsIdentChar(*p)) p++;
+	size_t keylen = p - keystart;
+
+	if (!SkipSpace(p, line) || *p != '=')
+	{
+		return KEY_Slow;
+	}
+	p++;
+	if (!SkipSpace(p, line))
+	{
+		return KEY_Slow;
+	}
+
+	// The value
+	int savedNumber = Number;
+	double savedFloat = Float;
+	int savedToken = TokenType;
+	bool neg = false;
+	const char *valstart = p;
+	const char *strstart = NULL, *strend = NULL;
+
+	Number = 0;
+	Float = 0;
+	if (*p == '"')
+	{
+		strstart = ++p;
+		while (p < ScriptEndPtr && *p != '"' && *p != '\\') p++;
+		if (p >= ScriptEndPtr || *p != '"')
+		{
+			goto slow;
+		}
+		strend = p++;
+		TokenType = TK_StringConst;
+	}
+	else if (IsIdentStart(*p))
+	{
+		while (IsIdentChar(*p)) p++;
+		if (p - valstart == 4 && !strnicmp(valstart, "true", 4))
+		{
+			TokenType = TK_True;
+		}
+		else if (p - valstart == 5 && !strnicmp(valstart, "false", 5))
+		{
+			TokenType = TK_False;
+		}
+		else
+		{
+			goto slow;
+		}
+	}
+	else
+	{
+		if (*p == '-' || *p == '+')
+		{
+			neg = *p == '-';
+			p++;
+		}
+		if (!ReadNumber(p))
+		{
+			goto slow;
+		}
+		if (neg)
+		{
+			Number = -Number;
+			Float = -Float;
+		}
+	}
+
+	if (!SkipSpace(p, line) || *p != ';')
+	{
+		goto slow;
+	}
+
+	if (strstart != NULL)
+	{
+		strval = FString(strstart, strend - strstart);
+	}
+	key = UDMFKeyName(keystart, keylen);
+	SetLastToken(p, line, ';');
+	return KEY_Parsed;
+
+slow:
+	Number = savedNumber;
+	Float = savedFloat;
+	TokenType = savedToken;
+	return KEY_Slow;
+}
+
 //===========================================================================
 //
 // Syntax checks
@@ -477,9 +924,9 @@ public:
 		th->health = 1;
 		th->FloatbobPhase = -1;
 		sc.MustGetToken('{');
-		while (!sc.CheckToken('}'))
+		FName key;
+		while (ParseBlockKey(key))
 		{
-			FName key = ParseKey();
 			switch(key)
 			{
 			case NAME_Id:
@@ -798,9 +1245,9 @@ public:
 		if (level.flags2 & LEVEL2_CHECKSWITCHRANGE) ld->flags |= ML_CHECKSWITCHRANGE;
 
 		sc.MustGetToken('{');
-		while (!sc.CheckToken('}'))
+		FName key;
+		while (ParseBlockKey(key))
 		{
-			FName key = ParseKey();
 
 			// This switch contains all keys of the UDMF base spec
 			switch(key)
@@ -1138,9 +1585,9 @@ public:
 		sd->Index = index;
 
 		sc.MustGetToken('{');
-		while (!sc.CheckToken('}'))
+		FName key;
+		while (ParseBlockKey(key))
 		{
-			FName key = ParseKey();
 			switch(key)
 			{
 			case NAME_Offsetx:
@@ -1316,9 +1763,9 @@ public:
 		sec->movefactor = ORIG_FRICTION_FACTOR;
 
 		sc.MustGetToken('{');
-		while (!sc.CheckToken('}'))
+		FName key;
+		while (ParseBlockKey(key))
 		{
-			FName key = ParseKey();
 			switch(key)
 			{
 			case NAME_Heightfloor:
@@ -1712,9 +2159,9 @@ public:
 
 		sc.MustGetToken('{');
 		double x, y;
-		while (!sc.CheckToken('}'))
+		FName key;
+		while (ParseBlockKey(key))
 		{
-			FName key = ParseKey();
 			switch (key)
 			{
 			case NAME_X:
@@ -2008,3 +2455,92 @@ void P_ParseTextMap(MapData *map, FMissingTextureTracker &missingtex)
 
 	parse.ParseTextMap(map);
 }
+
+#ifdef _DEBUG
+//===========================================================================
+//
+// Reads the current map's TEXTMAP with and without the ParseBlockKey
+// shortcut and checks that both see the same keys and values.
+//
+//===========================================================================
+
+class UDMFLexTest : public UDMFParserBase
+{
+public:
+	DWORD Walk(const char *name, const char *text, int len, bool fast, cycle_t &time)
+	{
+		DWORD crc = 0;
+		bool isblock;
+
+		udmf_fastparse = fast;
+		sc.OpenMem(name, text, len);
+		sc.SetCMode(true);
+		time.Clock();
+		while (sc.GetString())
+		{
+			sc.UnGet();
+			FName key = ParseKey(true, &isblock);
+			crc = AddValue(crc, key);
+			if (isblock)
+			{
+				while (ParseBlockKey(key))
+				{
+					crc = AddValue(crc, key);
+				}
+			}
+		}
+		time.Unclock();
+		sc.Close();
+		return crc;
+	}
+
+private:
+	DWORD AddValue(DWORD crc, FName key)
+	{
+		int vals[3] = { key.GetIndex(), sc.TokenType, sc.Number };
+		crc = AddCRC32(crc, (const BYTE *)vals, sizeof(vals));
+		crc = AddCRC32(crc, (const BYTE *)&sc.Float, sizeof(sc.Float));
+		if (sc.TokenType == TK_StringConst)
+		{
+			crc = AddCRC32(crc, (const BYTE *)parsedString.GetChars(), (unsigned)parsedString.Len());
+		}
+		return crc;
+	}
+};
+
+CCMD(udmflextest)
+{
+	MapData *map = P_OpenMapData(argv.argc() < 2 ? level.MapName.GetChars() : argv[1], true);
+	if (map == NULL)
+	{
+		Printf("Cannot open map\n");
+		return;
+	}
+	if (!map->isText)
+	{
+		Printf("Not a UDMF map\n");
+		delete map;
+		return;
+	}
+
+	int len = map->Size(ML_TEXTMAP);
+	TArray<char> text;
+	text.Resize(len);
+	map->Read(ML_TEXTMAP, &text[0]);
+	FString name = Wads.GetLumpFullName(map->lumpnum);
+	delete map;
+
+	bool oldfast = udmf_fastparse;
+	cycle_t slowtime, fasttime;
+	slowtime.Reset();
+	fasttime.Reset();
+
+	UDMFLexTest test;
+	DWORD slowcrc = test.Walk(name, &text[0], len, false, slowtime);
+	DWORD fastcrc = test.Walk(name, &text[0], len, true, fasttime);
+	udmf_fastparse = oldfast;
+
+	Printf("%d bytes: scanner %.3f ms, shortcut %.3f ms%s\n",
+		len, slowtime.TimeMS(), fasttime.TimeMS(), slowcrc != fastcrc ? ", MISMATCH" : "");
+}
+#endif
@@ -4,16 +4,46 @@
 #include "sc_man.h"
 #include "m_fixed.h"
 
+//==========================================================================
+//
+// A scanner with a shortcut for the 'key = value;' lines that make up
+// nearly all of a UDMF lump. It reads them straight from the script text,
+// without going through the token scanner, and leaves anything unusual
+// to the regular FScanner methods.
+//
+//==========================================================================
+
+class FUDMFScanner : public FScanner
+{
+public:
+	enum
+	{
+		KEY_BlockEnd,	// The closing '}' of the block was consumed
+		KEY_Parsed,		// A key and its value were read
+		KEY_Slow,		// Nothing was consumed; use the regular scanner
+	};
+
+	int GetKeyValue(FName &key, FString &strval);
+
+private:
+	bool SkipSpace(const char *&p, int &line) const;
+	bool ReadNumber(const char *&p);
+	void SetLastToken(const char *tokpos, int line, char token);
+};
+
+FName UDMFKeyName(const char *text, size_t len);
+
 class UDMFParserBase
 {
 protected:
-	FScanner sc;
+	FUDMFScanner sc;
 	FName namespc;
 	int namespace_bits;
 	FString parsedString;
 
 	void Skip();
 	FName ParseKey(bool checkblock = false, bool *isblock = NULL);
+	bool ParseBlockKey(FName &key);
 	int CheckInt(const char *key);
 	double CheckFloat(const char *key);
 	DAngle CheckAngle(const char *key);
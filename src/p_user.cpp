@@ -2846,16 +2846,13 @@ void P_PredictPlayer (player_t *player)
 	}
 
 	// Blockmap ordering also needs to stay the same, so unlink the block nodes
-	// without releasing them. (They will be used again in P_UnpredictPlayer).
+	// without releasing them. They remember where in each block the actor was.
+	// (They will be used again in P_UnpredictPlayer).
 	FBlockNode *block = act->BlockNode;
 
 	while (block != NULL)
 	{
-		if (block->NextActor != NULL)
-		{
-			block->NextActor->PrevActor = block->PrevActor;
-		}
-		*(block->PrevActor) = block->NextActor;
+		P_RemoveFromBlock(block);
 		block = block->NextBlock;
 	}
 	act->BlockNode = NULL;
@@ -3035,17 +3032,16 @@ void P_UnPredictPlayer ()
 			}
 		}
 
-		// Now fix the pointers in the blocknode chain
-		FBlockNode *block = act->BlockNode;
+		// Now put the actor back into its blocks, in the reverse order it was taken out.
+		TArray<FBlockNode *> blocks;
 
-		while (block != NULL)
+		for (FBlockNode *block = act->BlockNode; block != NULL; block = block->NextBlock)
 		{
-			*(block->PrevActor) = block;
-			if (block->NextActor != NULL)
-			{
-				block->NextActor->PrevActor = &block->NextActor;
-			}
-			block = block->NextBlock;
+			blocks.Push(block);
+		}
+		for (i = blocks.Size(); i-- > 0;)
+		{
+			P_RestoreToBlock(blocks[i]);
 		}
 
 		act->InvSel = InvSel;
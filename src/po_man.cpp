@@ -12,6 +12,8 @@
 
 // HEADER FILES ------------------------------------------------------------
 
+#include <algorithm>
+
 #include "doomdef.h"
 #include "p_local.h"
 #include "i_system.h"
@@ -32,6 +34,9 @@
 #include "p_maputl.h"
 #include "r_utility.h"
 #include "p_blockmap.h"
+#include "c_dispatch.h"
+#include "stats.h"
+#include "m_crc32.h"
 
 // MACROS ------------------------------------------------------------------
 
@@ -143,7 +148,7 @@ static void DoMovePolyobj (FPolyObj *po, const DVector2 & move);
 static void InitSegLists ();
 static void KillSegLists ();
 static FPolyNode *NewPolyNode();
-static void FreePolyNode();
+static void FreePolyNode(FPolyNode *node);
 static void ReleaseAllPolyNodes();
 
 // EXTERNAL DATA DECLARATIONS ----------------------------------------------
@@ -161,6 +166,13 @@ polyspawns_t *polyspawns; // [RH] Let P_SpawnMapThings() find our thingies for u
 
 static TArray<SDWORD> KnownPolySides;
 static FPolyNode *FreePolyNodes;
+#ifdef _DEBUG
+static bool NoPolyShortcuts;		// set by polylinktest
+#else
+static const bool NoPolyShortcuts = false;
+#endif
+
+static const double POLY_EPSILON = 0.3125;
 
 // CODE --------------------------------------------------------------------
 
@@ -942,21 +954,12 @@ void FPolyObj::CalcCenter()
 bool FPolyObj::MovePolyobj (const DVector2 &pos, bool force)
 {
 	FBoundingBox oldbounds = Bounds;
-	UnLinkPolyobj ();
+	bool unlinked = false;
 	DoMovePolyobj (pos);
 
 	if (!force)
 	{
-		bool blocked = false;
-
-		for(unsigned i=0;i < Sidedefs.Size(); i++)
-		{
-			if (CheckMobjBlocking(Sidedefs[i]))
-			{
-				blocked = true;
-			}
-		}
-		if (blocked)
+		if (CheckBlockingMobjs(unlinked))
 		{
 			DoMovePolyobj (-pos);
 			LinkPolyobj();
@@ -965,7 +968,14 @@ bool FPolyObj::MovePolyobj (const DVector2 &pos, bool force)
 	}
 	StartSpot.pos += pos;
 	CenterSpot.pos += pos;
-	LinkPolyobj ();
+	if (unlinked)
+	{
+		LinkPolyobj ();
+	}
+	else
+	{
+		RelinkPolyobj ();
+	}
 	ClearSubsectorLinks();
 	RecalcActorFloorCeil(Bounds | oldbounds);
 	return true;
@@ -1019,13 +1029,11 @@ static void RotatePt (DAngle an, DVector2 &out, const DVector2 &start)
 bool FPolyObj::RotatePolyobj (DAngle angle, bool fromsave)
 {
 	DAngle an;
-	bool blocked;
+	bool unlinked = false;
 	FBoundingBox oldbounds = Bounds;
 
 	an = Angle + angle;
 
-	UnLinkPolyobj();
-
 	for(unsigned i=0;i < Vertices.Size(); i++)
 	{
 		PrevPts[i].pos = Vertices[i]->fPos();
@@ -1033,21 +1041,13 @@ bool FPolyObj::RotatePolyobj (DAngle angle, bool fromsave)
 		RotatePt(an, torot.pos, StartSpot.pos);
 		Vertices[i]->set(torot.pos.X, torot.pos.Y);
 	}
-	blocked = false;
 	validcount++;
 	UpdateBBox();
 
 	// If we are loading a savegame we do not really want to damage actors and be blocked by them. This can also cause crashes when trying to damage incompletely deserialized player pawns.
 	if (!fromsave)
 	{
-		for (unsigned i = 0; i < Sidedefs.Size(); i++)
-		{
-			if (CheckMobjBlocking(Sidedefs[i]))
-			{
-				blocked = true;
-			}
-		}
-		if (blocked)
+		if (CheckBlockingMobjs(unlinked))
 		{
 			for(unsigned i=0;i < Vertices.Size(); i++)
 			{
@@ -1059,7 +1059,14 @@ bool FPolyObj::RotatePolyobj (DAngle angle, bool fromsave)
 		}
 	}
 	Angle += angle;
-	LinkPolyobj();
+	if (unlinked)
+	{
+		LinkPolyobj();
+	}
+	else
+	{
+		RelinkPolyobj();
+	}
 	ClearSubsectorLinks();
 	RecalcActorFloorCeil(Bounds | oldbounds);
 	return true;
@@ -1100,6 +1107,107 @@ void FPolyObj::UnLinkPolyobj ()
 	}
 }
 
+//==========================================================================
+//
+// CheckBlockingMobjs
+//
+// Runs CheckMobjBlocking on all sides after a move. Usually nothing
+// touches the polyobject, so the solid actors around it are collected
+// once and a side only gets the full check if one of them touches its
+// line. After a full check anything may have moved, so the remaining
+// sides all get the full check too.
+//
+// Nothing before the first full check can see the blockmap, so the
+// polyobject is only unlinked from it at that point. unlinked tells the
+// caller whether that happened.
+//
+//==========================================================================
+
+bool FPolyObj::CheckBlockingMobjs (bool &unlinked)
+{
+	static TArray<AActor *> candidates;
+	bool blocked = false;
+	bool fullcheck = NoPolyShortcuts;
+
+	candidates.Clear();
+	if (!fullcheck && Sidedefs.Size() > 0)
+	{
+		// Every block CheckMobjBlocking could look at for any of the sides.
+		int left = INT_MAX, right = INT_MIN, bottom = INT_MAX, top = INT_MIN;
+		for (unsigned i = 0; i < Sidedefs.Size(); i++)
+		{
+			line_t *ld = Sidedefs[i]->linedef;
+			left = MIN(left, GetBlockX(ld->bbox[BOXLEFT]));
+			right = MAX(right, GetBlockX(ld->bbox[BOXRIGHT]));
+			bottom = MIN(bottom, GetBlockY(ld->bbox[BOXBOTTOM]));
+			top = MAX(top, GetBlockY(ld->bbox[BOXTOP]));
+		}
+		left = clamp(left, 0, bmapwidth - 1);
+		right = clamp(right, 0, bmapwidth - 1);
+		bottom = clamp(bottom, 0, bmapheight - 1);
+		top = clamp(top, 0, bmapheight - 1);
+
+		for (int j = bottom; j <= top; j++)
+		{
+			for (int i = left; i <= right; i++)
+			{
+				TArray<AActor *> &list = blocklinks[j*bmapwidth + i];
+				for (unsigned n = 0; n < list.Size(); n++)
+				{
+					AActor *mobj = list[n];
+					if ((mobj->flags & MF_SOLID) && !(mobj->flags & MF_NOCLIP))
+					{
+						candidates.Push(mobj);
+					}
+				}
+			}
+		}
+		// Actors in more than one block only need to be tested once.
+		if (candidates.Size() > 1)
+		{
+			std::sort(&candidates[0], &candidates[0] + candidates.Size());
+			candidates.Resize(unsigned(std::unique(&candidates[0], &candidates[0] + candidates.Size()) - &candidates[0]));
+		}
+	}
+
+	for (unsigned i = 0; i < Sidedefs.Size(); i++)
+	{
+		if (!fullcheck)
+		{
+			// This is the first test CheckMobjBlocking makes on any actor
+			// that can be blocked. Everything before it has no effect.
+			line_t *ld = Sidedefs[i]->linedef;
+			unsigned j;
+			for (j = 0; j < candidates.Size(); j++)
+			{
+				AActor *mobj = candidates[j];
+				DVector2 pos = mobj->PosRelative(ld);
+				FBoundingBox box(pos.X, pos.Y, mobj->radius);
+
+				if (box.inRange(ld) && box.BoxOnLineSide(ld) == -1)
+				{
+					break;
+				}
+			}
+			if (j == candidates.Size())
+			{
+				continue;
+			}
+			fullcheck = true;
+		}
+		if (!unlinked)
+		{
+			UnLinkPolyobj();
+			unlinked = true;
+		}
+		if (CheckMobjBlocking(Sidedefs[i]))
+		{
+			blocked = true;
+		}
+	}
+	return blocked;
+}
+
 //==========================================================================
 //
 // CheckMobjBlocking
@@ -1109,7 +1217,6 @@ void FPolyObj::UnLinkPolyobj ()
 bool FPolyObj::CheckMobjBlocking (side_t *sd)
 {
 	static TArray<AActor *> checker;
-	FBlockNode *block;
 	AActor *mobj;
 	int i, j, k;
 	int left, right, top, bottom;
@@ -1140,9 +1247,12 @@ bool FPolyObj::CheckMobjBlocking (side_t *sd)
 	{
 		for (i = left; i <= right; i++)
 		{
-			for (block = blocklinks[j+i]; block != NULL; block = block->NextActor)
+			TArray<AActor *> &list = blocklinks[j+i];
+
+			// Checking a thing can move it, which changes the list.
+			for (int n = list.Size() - 1; n >= 0; n = MIN<int>(n, list.Size()) - 1)
 			{
-				mobj = block->Me;
+				mobj = list[n];
 				for (k = (int)checker.Size()-1; k >= 0; --k)
 				{
 					if (checker[k] == mobj)
@@ -1239,9 +1349,108 @@ bool FPolyObj::CheckMobjBlocking (side_t *sd)
 
 void FPolyObj::LinkPolyobj ()
 {
-	polyblock_t **link;
-	polyblock_t *tempLink;
+	CalcBlockBox();
+	// add the polyobj to each blockmap section
+	for(int j = bbox[BOXBOTTOM]*bmapwidth; j <= bbox[BOXTOP]*bmapwidth;
+		j += bmapwidth)
+	{
+		for(int i = bbox[BOXLEFT]; i <= bbox[BOXRIGHT]; i++)
+		{
+			if(i >= 0 && i < bmapwidth && j >= 0 && j < bmapheight*bmapwidth)
+			{
+				LinkToBlock(j+i);
+			}
+			// else, don't link the polyobj, since it's off the map
+		}
+	}
+}
+
+//==========================================================================
+//
+// RelinkPolyobj
+//
+// Does the same as UnLinkPolyobj followed by LinkPolyobj, but only
+// touches the blocks the polyobj enters or leaves, plus those where
+// unlinking and linking again would move it into an earlier free slot.
+//
+//==========================================================================
+
+void FPolyObj::RelinkPolyobj ()
+{
+	int oldbox[4];
+
+	if (NoPolyShortcuts)
+	{
+		UnLinkPolyobj();
+		LinkPolyobj();
+		return;
+	}
+
+	memcpy(oldbox, bbox, sizeof(bbox));
+	CalcBlockBox();
+
+	int left = MAX(0, MIN(oldbox[BOXLEFT], bbox[BOXLEFT]));
+	int right = MIN(bmapwidth - 1, MAX(oldbox[BOXRIGHT], bbox[BOXRIGHT]));
+	int bottom = MAX(0, MIN(oldbox[BOXBOTTOM], bbox[BOXBOTTOM]));
+	int top = MIN(bmapheight - 1, MAX(oldbox[BOXTOP], bbox[BOXTOP]));
+
+	for (int j = bottom; j <= top; j++)
+	{
+		bool oldrow = j >= oldbox[BOXBOTTOM] && j <= oldbox[BOXTOP];
+		bool newrow = j >= bbox[BOXBOTTOM] && j <= bbox[BOXTOP];
 
+		for (int i = left; i <= right; i++)
+		{
+			bool inold = oldrow && i >= oldbox[BOXLEFT] && i <= oldbox[BOXRIGHT];
+			bool innew = newrow && i >= bbox[BOXLEFT] && i <= bbox[BOXRIGHT];
+			polyblock_t *link, *freelink = NULL;
+
+			if (!inold)
+			{
+				if (innew)
+				{
+					LinkToBlock(j*bmapwidth + i);
+				}
+				continue;
+			}
+
+			for (link = PolyBlockMap[j*bmapwidth + i]; link != NULL && link->polyobj != this; link = link->next)
+			{
+				if (link->polyobj == NULL && freelink == NULL)
+				{
+					freelink = link;
+				}
+			}
+			if (!innew)
+			{
+				if (link != NULL)
+				{
+					link->polyobj = NULL;
+				}
+			}
+			else if (link == NULL)
+			{ // polyobj not located in the link cell
+				LinkToBlock(j*bmapwidth + i);
+			}
+			else if (freelink != NULL)
+			{
+				freelink->polyobj = this;
+				link->polyobj = NULL;
+			}
+		}
+	}
+}
+
+//==========================================================================
+//
+// CalcBlockBox
+//
+// Calculates the polyobj's bounds and the blocks they cover.
+//
+//==========================================================================
+
+void FPolyObj::CalcBlockBox ()
+{
 	// calculate the polyobj bbox
 	Bounds.ClearBox();
 	for(unsigned i = 0; i < Sidedefs.Size(); i++)
@@ -1257,47 +1466,49 @@ void FPolyObj::LinkPolyobj ()
 	bbox[BOXLEFT] = GetBlockX(Bounds.Left());
 	bbox[BOXTOP] = GetBlockY(Bounds.Top());
 	bbox[BOXBOTTOM] = GetBlockY(Bounds.Bottom());
-	// add the polyobj to each blockmap section
-	for(int j = bbox[BOXBOTTOM]*bmapwidth; j <= bbox[BOXTOP]*bmapwidth;
-		j += bmapwidth)
+}
+
+//==========================================================================
+//
+// LinkToBlock
+//
+// Puts the polyobj into the first free slot of one blockmap section.
+//
+//==========================================================================
+
+void FPolyObj::LinkToBlock (int index)
+{
+	polyblock_t **link;
+	polyblock_t *tempLink;
+
+	link = &PolyBlockMap[index];
+	if(!(*link))
+	{ // Create a new link at the current block cell
+		*link = new polyblock_t;
+		(*link)->next = NULL;
+		(*link)->prev = NULL;
+		(*link)->polyobj = this;
+		return;
+	}
+	else
 	{
-		for(int i = bbox[BOXLEFT]; i <= bbox[BOXRIGHT]; i++)
+		tempLink = *link;
+		while(tempLink->next != NULL && tempLink->polyobj != NULL)
 		{
-			if(i >= 0 && i < bmapwidth && j >= 0 && j < bmapheight*bmapwidth)
-			{
-				link = &PolyBlockMap[j+i];
-				if(!(*link))
-				{ // Create a new link at the current block cell
-					*link = new polyblock_t;
-					(*link)->next = NULL;
-					(*link)->prev = NULL;
-					(*link)->polyobj = this;
-					continue;
-				}
-				else
-				{
-					tempLink = *link;
-					while(tempLink->next != NULL && tempLink->polyobj != NULL)
-					{
-						tempLink = tempLink->next;
-					}
-				}
-				if(tempLink->polyobj == NULL)
-				{
-					tempLink->polyobj = this;
-					continue;
-				}
-				else
-				{
-					tempLink->next = new polyblock_t;
-					tempLink->next->next = NULL;
-					tempLink->next->prev = tempLink;
-					tempLink->next->polyobj = this;
-				}
-			}
-			// else, don't link the polyobj, since it's off the map
+			tempLink = tempLink->next;
 		}
 	}
+	if(tempLink->polyobj == NULL)
+	{
+		tempLink->polyobj = this;
+	}
+	else
+	{
+		tempLink->next = new polyblock_t;
+		tempLink->next->next = NULL;
+		tempLink->next->prev = tempLink;
+		tempLink->next->polyobj = this;
+	}
 }
 
 //===========================================================================
@@ -1837,7 +2048,7 @@ void FPolyObj::ClearSubsectorLinks()
 		}
 
 		subsectorlinks->state = -1;
-		delete subsectorlinks;
+		FreePolyNode(subsectorlinks);
 		subsectorlinks = next;
 	}
 	subsectorlinks = NULL;
@@ -1957,6 +2168,62 @@ static void AddToBBox(FPolyVertex *v, float bbox[4])
 	}
 }
 
+//==========================================================================
+//
+// CopyPolySegs
+//
+// Unlike assigning the array, this keeps the memory a recycled node
+// already has.
+//
+//==========================================================================
+
+static void CopyPolySegs(TArray<FPolySeg> &dest, const TArray<FPolySeg> &src)
+{
+	dest.Resize(src.Size());
+	for (unsigned i = 0; i < src.Size(); ++i)
+	{
+		dest[i] = src[i];
+	}
+}
+
+//==========================================================================
+//
+// PolyBoxSide
+//
+// Returns the side of a node's partition line a box is on, if it is far
+// enough from it that SplitPoly would put every vertex inside on that
+// side. Otherwise returns -1.
+//
+//==========================================================================
+
+static int PolyBoxSide(const node_t *bsp, const double box[4])
+{
+	double x = FIXED2DBL(bsp->x);
+	double y = FIXED2DBL(bsp->y);
+	double dx = FIXED2DBL(bsp->dx);
+	double dy = FIXED2DBL(bsp->dy);
+
+	// The same product R_PointOnSide tests, which is the partition
+	// distance scaled by the partition length.
+	double c1 = (box[BOXBOTTOM] - y) * dx + (x - box[BOXLEFT]) * dy;
+	double c2 = (box[BOXBOTTOM] - y) * dx + (x - box[BOXRIGHT]) * dy;
+	double c3 = (box[BOXTOP] - y) * dx + (x - box[BOXLEFT]) * dy;
+	double c4 = (box[BOXTOP] - y) * dx + (x - box[BOXRIGHT]) * dy;
+
+	// Leave room for R_PointOnSide's rounding to fixed point.
+	double margin = bsp->len * (POLY_EPSILON + 1) + 2;
+
+	if (MIN(MIN(c1, c2), MIN(c3, c4)) > margin)
+	{
+		return 1;
+	}
+	if (MAX(MAX(c1, c2), MAX(c3, c4)) < -margin)
+	{
+		return 0;
+	}
+	return -1;
+}
+
 //==========================================================================
 //
 // SplitPoly
@@ -1966,7 +2233,6 @@ static void AddToBBox(FPolyVertex *v, float bbox[4])
 static void SplitPoly(FPolyNode *pnode, void *node, float bbox[4])
 {
 	static TArray<FPolySeg> lists[2];
-	static const double POLY_EPSILON = 0.3125;
 
 	if (!((size_t)node & 1))  // Keep going until found a subsector
 	{
@@ -2063,10 +2329,10 @@ static void SplitPoly(FPolyNode *pnode, void *node, float bbox[4])
 			// create the new node 
 			FPolyNode *newnode = NewPolyNode();
 			newnode->poly = pnode->poly;
-			newnode->segs = lists[1];
+			CopyPolySegs(newnode->segs, lists[1]);
 
 			// set segs for original node
-			pnode->segs = lists[0];
+			CopyPolySegs(pnode->segs, lists[0]);
 		
 			// recurse back side
 			SplitPoly(newnode, bsp->children[1], bsp->bbox[1]);
@@ -2112,6 +2378,59 @@ static void SplitPoly(FPolyNode *pnode, void *node, float bbox[4])
 	}
 }
 
+//==========================================================================
+//
+// SplitPolyFromRoot
+//
+// Near the root of the BSP, a polyobject is usually entirely on one side
+// of the partition and SplitPoly just passes every seg down to one child.
+// Those nodes are skipped by only testing the polyobject's bounding box,
+// and the bounding boxes SplitPoly would have grown on the way back up
+// are grown here afterwards.
+//
+//==========================================================================
+
+static void SplitPolyFromRoot(FPolyNode *pnode, float rootbbox[4])
+{
+	static TArray<float *> bboxes;
+	void *node = nodes + numnodes - 1;
+	double box[4] = { -DBL_MAX, DBL_MAX, DBL_MAX, -DBL_MAX };
+
+	for (unsigned i = 0; i < pnode->segs.Size(); ++i)
+	{
+		const FPolySeg &seg = pnode->segs[i];
+		box[BOXTOP] = MAX(box[BOXTOP], MAX(seg.v1.pos.Y, seg.v2.pos.Y));
+		box[BOXBOTTOM] = MIN(box[BOXBOTTOM], MIN(seg.v1.pos.Y, seg.v2.pos.Y));
+		box[BOXLEFT] = MIN(box[BOXLEFT], MIN(seg.v1.pos.X, seg.v2.pos.X));
+		box[BOXRIGHT] = MAX(box[BOXRIGHT], MAX(seg.v1.pos.X, seg.v2.pos.X));
+	}
+
+	bboxes.Clear();
+	bboxes.Push(rootbbox);
+	if (!NoPolyShortcuts && pnode->segs.Size() > 0)
+	{
+		while (!((size_t)node & 1))
+		{
+			node_t *bsp = (node_t *)node;
+			int side = PolyBoxSide(bsp, box);
+
+			if (side < 0)
+			{
+				break;
+			}
+			bboxes.Push(bsp->bbox[side]);
+			node = bsp->children[side];
+		}
+	}
+
+	SplitPoly(pnode, node, bboxes.Last());
+
+	for (unsigned i = bboxes.Size() - 1; i > 0; --i)
+	{
+		AddToBBox(bboxes[i], bboxes[i - 1]);
+	}
+}
+
 //==========================================================================
 //
 // 
@@ -2140,7 +2459,7 @@ void FPolyObj::CreateSubsectorLinks()
 	}
 	if (!(i_compatflags & COMPATF_POLYOBJ))
 	{
-		SplitPoly(node, nodes + numnodes - 1, dummybbox);
+		SplitPolyFromRoot(node, dummybbox);
 	}
 	else
 	{
@@ -2214,7 +2533,7 @@ static FPolyNode *NewPolyNode()
 //
 //==========================================================================
 
-void FreePolyNode(FPolyNode *node)
+static void FreePolyNode(FPolyNode *node)
 {
 	node->segs.Clear();
 	node->pnext = FreePolyNodes;
@@ -2227,7 +2546,7 @@ void FreePolyNode(FPolyNode *node)
 //
 //==========================================================================
 
-void ReleaseAllPolyNodes()
+static void ReleaseAllPolyNodes()
 {
 	FPolyNode *node, *next;
 
@@ -2236,6 +2555,7 @@ void ReleaseAllPolyNodes()
 		next = node->pnext;
 		delete node;
 	}
+	FreePolyNodes = NULL;
 }
 
 //==========================================================================
@@ -2309,3 +2629,93 @@ FPolyObj *FPolyMirrorIterator::NextMirror()
 	CurPoly = nextpoly;
 	return poly;
 }
+
+#ifdef _DEBUG
+//==========================================================================
+//
+// CCMD polylinktest
+//
+// Links every polyobject to its subsectors a number of times, once
+// splitting it from the root of the BSP and once skipping the nodes it
+// does not cross, and compares the time and the result of both.
+//
+//==========================================================================
+
+static DWORD PolyLinkSignature(DWORD crc, FPolyObj *poly)
+{
+	for (FPolyNode *pnode = poly->subsectorlinks; pnode != NULL; pnode = pnode->snext)
+	{
+		int sub = int(pnode->subsector - subsectors);
+		crc = AddCRC32(crc, (const BYTE *)&sub, sizeof(sub));
+		for (unsigned i = 0; i < pnode->segs.Size(); ++i)
+		{
+			const FPolySeg &seg = pnode->segs[i];
+			int side = int(seg.wall - sides);
+			crc = AddCRC32(crc, (const BYTE *)&seg.v1.pos, sizeof(seg.v1.pos));
+			crc = AddCRC32(crc, (const BYTE *)&seg.v2.pos, sizeof(seg.v2.pos));
+			crc = AddCRC32(crc, (const BYTE *)&side, sizeof(side));
+		}
+	}
+	return crc;
+}
+
+CCMD(polylinktest)
+{
+	if (po_NumPolyobjs == 0 || numnodes == 0)
+	{
+		Printf("No polyobjects in this level\n");
+		return;
+	}
+
+	int count = 100;
+	if (argv.argc() > 1)
+	{
+		count = MAX(1, atoi(argv[1]));
+	}
+
+	// SplitPoly grows the node bounding boxes, so both runs have to start
+	// from the same ones to compare them.
+	TArray<float> bboxes;
+	bboxes.Resize(numnodes * 8);
+	for (int i = 0; i < numnodes; ++i)
+	{
+		memcpy(&bboxes[i * 8], nodes[i].bbox, 8 * sizeof(float));
+	}
+
+	cycle_t time[2];
+	DWORD sums[2] = { 0, 0 };
+
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		NoPolyShortcuts = pass == 0;
+		for (int i = 0; i < numnodes; ++i)
+		{
+			memcpy(nodes[i].bbox, &bboxes[i * 8], 8 * sizeof(float));
+		}
+		time[pass].Reset();
+		time[pass].Clock();
+		for (int n = 0; n < count; ++n)
+		{
+			for (int i = 0; i < po_NumPolyobjs; ++i)
+			{
+				polyobjs[i].ClearSubsectorLinks();
+				polyobjs[i].CreateSubsectorLinks();
+			}
+		}
+		time[pass].Unclock();
+
+		for (int i = 0; i < po_NumPolyobjs; ++i)
+		{
+			sums[pass] = PolyLinkSignature(sums[pass], &polyobjs[i]);
+		}
+		for (int i = 0; i < numnodes; ++i)
+		{
+			sums[pass] = AddCRC32(sums[pass], (const BYTE *)nodes[i].bbox, 8 * sizeof(float));
+		}
+	}
+	NoPolyShortcuts = false;
+
+	Printf("%d polyobjects linked %d times: from the root %.3f ms, skipping nodes %.3f ms%s\n", po_NumPolyobjs, count,
+		time[0].TimeMS(), time[1].TimeMS(), sums[0] != sums[1] ? ", MISMATCH" : "");
+}
+#endif
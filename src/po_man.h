@@ -112,7 +112,11 @@ private:
 	void UpdateBBox ();
 	void DoMovePolyobj (const DVector2 &pos);
 	void UnLinkPolyobj ();
+	void RelinkPolyobj ();
+	void CalcBlockBox ();
+	void LinkToBlock (int index);
 	bool CheckMobjBlocking (side_t *sd);
+	bool CheckBlockingMobjs (bool &unlinked);
 
 };
 extern FPolyObj *polyobjs;		// list of all poly-objects on the level
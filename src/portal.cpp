@@ -37,6 +37,7 @@
 */
 
 
+#include <algorithm>
 #include "p_local.h"
 #include "p_blockmap.h"
 #include "p_lnspec.h"
@@ -53,6 +54,8 @@
 #include "p_spec.h"
 #include "p_checkposition.h"
 #include "math/cmath.h"
+#include "m_random.h"
+#include "stats.h"
 
 // simulation recurions maximum
 CVAR(Int, sv_portal_recursions, 4, CVAR_ARCHIVE|CVAR_SERVERINFO)
@@ -97,6 +100,53 @@ struct FPortalBits
 	}
 };
 
+//============================================================================
+//
+// The linked portals a box can touch, per blockmap block
+//
+// Every linked portal's line is moved into the coordinates of each group
+// that has a displacement to the portal's own group, and listed for that
+// group in the blocks it covers there. Each block also has a bit for every
+// group with portals listed in it, so a box away from all portals costs
+// one lookup per block.
+//
+// Portals on polyobjects move, and so do the displacements of their
+// groups. Maps with any of them do not use the table.
+//
+//============================================================================
+
+struct FPortalReachTable
+{
+	struct Entry
+	{
+		int group;			// group whose coordinates the line was moved into
+		unsigned portal;	// index into linkedPortals
+	};
+
+	TArray<unsigned> Start;		// first entry of each block, plus one past the end
+	TArray<Entry> Entries;
+	TArray<DWORD> GroupBits;	// Words per block
+	int Words;
+	unsigned NumPortals;
+	bool Valid;
+
+	void Clear()
+	{
+		Start.Clear();
+		Entries.Clear();
+		GroupBits.Clear();
+		NumPortals = 0;
+		Valid = false;
+	}
+};
+
+static FPortalReachTable PortalReach;
+#ifdef _DEBUG
+static bool NoPortalReach;		// set by portalgrouptest
+#else
+static const bool NoPortalReach = false;
+#endif
+
 //============================================================================
 //
 // BuildBlockmap
@@ -489,6 +539,7 @@ bool P_ChangePortal(line_t *ln, int thisid, int destid)
 void P_ClearPortals()
 {
 	Displacements.Create(1);
+	PortalReach.Clear();
 	linePortals.Clear();
 	linkedPortals.Clear();
 	sectorPortals.Resize(2);
@@ -954,6 +1005,174 @@ static bool ConnectGroups()
 }
 
 
+//============================================================================
+//
+// BuildPortalReachTable
+//
+//============================================================================
+
+static int PortalReachBlock(double pos, double org, int size)
+{
+	double block = floor((pos - org) / MAPBLOCKUNITS);
+	return block < 0 ? 0 : block >= size ? size - 1 : int(block);
+}
+
+static void BuildPortalReachTable()
+{
+	struct BlockEntry
+	{
+		int block;
+		FPortalReachTable::Entry entry;
+	};
+	TArray<BlockEntry> pending;
+
+	PortalReach.Clear();
+	if (linkedPortals.Size() == 0 || bmapwidth <= 0 || bmapheight <= 0)
+	{
+		return;
+	}
+
+	for (unsigned i = 0; i < linkedPortals.Size(); i++)
+	{
+		FLinePortal *port = linkedPortals[i];
+		if ((port->mOrigin->sidedef[0]->Flags & WALLF_POLYOBJ) ||
+			(port->mDestination != NULL && (port->mDestination->sidedef[0]->Flags & WALLF_POLYOBJ)))
+		{
+			return;
+		}
+	}
+
+	for (unsigned i = 0; i < linkedPortals.Size(); i++)
+	{
+		line_t *ld = linkedPortals[i]->mOrigin;
+		int othergroup = ld->frontsector->PortalGroup;
+
+		for (int group = 0; group < Displacements.size; group++)
+		{
+			FDisplacement &disp = Displacements(group, othergroup);
+			if (!disp.isSet) continue;
+
+			// The margin covers the rounding of the box test in P_CollectConnectedGroups.
+			int x1 = PortalReachBlock(ld->bbox[BOXLEFT] - disp.pos.X - 1, bmaporgx, bmapwidth);
+			int x2 = PortalReachBlock(ld->bbox[BOXRIGHT] - disp.pos.X + 1, bmaporgx, bmapwidth);
+			int y1 = PortalReachBlock(ld->bbox[BOXBOTTOM] - disp.pos.Y - 1, bmaporgy, bmapheight);
+			int y2 = PortalReachBlock(ld->bbox[BOXTOP] - disp.pos.Y + 1, bmaporgy, bmapheight);
+
+			for (int y = y1; y <= y2; y++)
+			{
+				for (int x = x1; x <= x2; x++)
+				{
+					BlockEntry be = { y * bmapwidth + x, { group, i } };
+					pending.Push(be);
+				}
+			}
+		}
+	}
+
+	int count = bmapwidth * bmapheight;
+	PortalReach.Words = (Displacements.size + 31) / 32;
+	PortalReach.GroupBits.Resize(count * PortalReach.Words);
+	memset(&PortalReach.GroupBits[0], 0, PortalReach.GroupBits.Size() * sizeof(DWORD));
+	PortalReach.Start.Resize(count + 1);
+	memset(&PortalReach.Start[0], 0, PortalReach.Start.Size() * sizeof(unsigned));
+
+	// Sort the entries by block, keeping portal order within each block.
+	for (unsigned i = 0; i < pending.Size(); i++)
+	{
+		PortalReach.Start[pending[i].block + 1]++;
+	}
+	for (int i = 0; i < count; i++)
+	{
+		PortalReach.Start[i + 1] += PortalReach.Start[i];
+	}
+	TArray<unsigned> next;
+	next.Resize(count);
+	memcpy(&next[0], &PortalReach.Start[0], count * sizeof(unsigned));
+	PortalReach.Entries.Resize(pending.Size());
+	for (unsigned i = 0; i < pending.Size(); i++)
+	{
+		int block = pending[i].block;
+		int group = pending[i].entry.group;
+		PortalReach.Entries[next[block]++] = pending[i].entry;
+		PortalReach.GroupBits[block * PortalReach.Words + (group >> 5)] |= 1u << (group & 31);
+	}
+	PortalReach.NumPortals = linkedPortals.Size();
+	PortalReach.Valid = true;
+}
+
+//============================================================================
+//
+// CollectTouchedPortals
+//
+// Finds the linked portals a box in the start group touches, in the
+// order of linkedPortals.
+//
+//============================================================================
+
+static void CollectTouchedPortals(int startgroup, const DVector3 &position, double checkradius, TArray<FLinePortal*> &found)
+{
+	if (!PortalReach.Valid || NoPortalReach || PortalReach.NumPortals != linkedPortals.Size())
+	{
+		for (unsigned i = 0; i < linkedPortals.Size(); i++)
+		{
+			line_t *ld = linkedPortals[i]->mOrigin;
+			int othergroup = ld->frontsector->PortalGroup;
+			FDisplacement &disp = Displacements(startgroup, othergroup);
+			if (!disp.isSet) continue;	// no connection.
+
+			FBoundingBox box(position.X + disp.pos.X, position.Y + disp.pos.Y, checkradius);
+
+			if (!box.inRange(ld) || box.BoxOnLineSide(linkedPortals[i]->mOrigin) != -1) continue;	// not touched
+			found.Push(linkedPortals[i]);
+		}
+		return;
+	}
+
+	static TArray<unsigned> touched;
+	touched.Clear();
+
+	int x1 = PortalReachBlock(position.X - checkradius, bmaporgx, bmapwidth);
+	int x2 = PortalReachBlock(position.X + checkradius, bmaporgx, bmapwidth);
+	int y1 = PortalReachBlock(position.Y - checkradius, bmaporgy, bmapheight);
+	int y2 = PortalReachBlock(position.Y + checkradius, bmaporgy, bmapheight);
+	DWORD groupbit = 1u << (startgroup & 31);
+
+	for (int y = y1; y <= y2; y++)
+	{
+		for (int x = x1; x <= x2; x++)
+		{
+			int block = y * bmapwidth + x;
+			if (!(PortalReach.GroupBits[block * PortalReach.Words + (startgroup >> 5)] & groupbit)) continue;
+
+			for (unsigned e = PortalReach.Start[block]; e < PortalReach.Start[block + 1]; e++)
+			{
+				const FPortalReachTable::Entry &entry = PortalReach.Entries[e];
+				if (entry.group != startgroup) continue;
+
+				line_t *ld = linkedPortals[entry.portal]->mOrigin;
+				FDisplacement &disp = Displacements(startgroup, ld->frontsector->PortalGroup);
+				FBoundingBox box(position.X + disp.pos.X, position.Y + disp.pos.Y, checkradius);
+
+				if (!box.inRange(ld) || box.BoxOnLineSide(ld) != -1) continue;	// not touched
+				touched.Push(entry.portal);
+			}
+		}
+	}
+
+	// A portal that covers several blocks can be found more than once.
+	if (touched.Size() > 1)
+	{
+		std::sort(&touched[0], &touched[0] + touched.Size());
+	}
+	for (unsigned i = 0; i < touched.Size(); i++)
+	{
+		if (i == 0 || touched[i] != touched[i - 1])
+		{
+			found.Push(linkedPortals[touched[i]]);
+		}
+	}
+}
+
 //============================================================================
 //
 // P_CreateLinkedPortals
@@ -1127,6 +1346,7 @@ void P_CreateLinkedPortals()
 		if (sectors[i].PortalIsLinked(sector_t::floor)) sectors[i].planes[sector_t::floor].Flags |= PLANEF_LINKED;
 		if (sectors[i].PortalIsLinked(sector_t::ceiling)) sectors[i].planes[sector_t::ceiling].Flags |= PLANEF_LINKED;
 	}
+	BuildPortalReachTable();
 	if (linkedPortals.Size() > 0)
 	{
 		// We need to relink all actors that may touch a linked line portal
@@ -1184,18 +1404,7 @@ bool P_CollectConnectedGroups(int startgroup, const DVector3 &position, double u
 		processMask.setBit(thisgroup);
 		//out.Add(thisgroup);
 
-		for (unsigned i = 0; i < linkedPortals.Size(); i++)
-		{
-			line_t *ld = linkedPortals[i]->mOrigin;
-			int othergroup = ld->frontsector->PortalGroup;
-			FDisplacement &disp = Displacements(thisgroup, othergroup);
-			if (!disp.isSet) continue;	// no connection.
-
-			FBoundingBox box(position.X + disp.pos.X, position.Y + disp.pos.Y, checkradius);
-
-			if (!box.inRange(ld) || box.BoxOnLineSide(linkedPortals[i]->mOrigin) != -1) continue;	// not touched
-			foundPortals.Push(linkedPortals[i]);
-		}
+		CollectTouchedPortals(thisgroup, position, checkradius, foundPortals);
 		bool foundone = true;
 		while (foundone)
 		{
@@ -1318,6 +1527,77 @@ CCMD(dumplinktable)
 	}
 }
 
+#ifdef _DEBUG
+//============================================================================
+//
+// Collects the line portal groups for random boxes around the map with and
+// without the per-block portal table and checks that both agree.
+//
+//============================================================================
+
+static FRandom pr_portalgrouptest;
+
+CCMD(portalgrouptest)
+{
+	if (linkedPortals.Size() == 0 || bmapwidth == 0 || bmapheight == 0)
+	{
+		Printf("No linked portals in this level\n");
+		return;
+	}
+	if (!PortalReach.Valid)
+	{
+		Printf("The portal table is not used in this level\n");
+	}
+
+	int count = 100000;
+	if (argv.argc() > 1)
+	{
+		count = MAX(1, atoi(argv[1]));
+	}
+
+	TArray<DVector3> spots;
+	TArray<int> groups;
+	spots.Resize(count);
+	groups.Resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		spots[i].X = bmaporgx + (pr_portalgrouptest.GenRand32() % (bmapwidth * MAPBLOCKUNITS));
+		spots[i].Y = bmaporgy + (pr_portalgrouptest.GenRand32() % (bmapheight * MAPBLOCKUNITS));
+		spots[i].Z = 16 + (pr_portalgrouptest() % 112);
+		groups[i] = P_PointInSector(spots[i].X, spots[i].Y)->PortalGroup;
+	}
+
+	cycle_t time[2];
+	unsigned found[2] = { 0, 0 };
+	unsigned sums[2] = { 0, 0 };
+
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		NoPortalReach = pass == 0;
+		time[pass].Reset();
+		time[pass].Clock();
+		for (int i = 0; i < count; ++i)
+		{
+			FPortalGroupArray check(FPortalGroupArray::PGA_NoSectorPortals);
+			DVector3 pos(spots[i].X, spots[i].Y, 0);
+			if (P_CollectConnectedGroups(groups[i], pos, 56, spots[i].Z, check))
+			{
+				for (unsigned j = 0; j < check.Size(); j++)
+				{
+					found[pass]++;
+					sums[pass] = sums[pass] * 31 + check[j];
+				}
+			}
+		}
+		time[pass].Unclock();
+	}
+	NoPortalReach = false;
+
+	Printf("%d boxes: %u groups found, all portals %.3f ms, portal table %.3f ms%s\n", count, found[0],
+		time[0].TimeMS(), time[1].TimeMS(), (found[0] != found[1] || sums[0] != sums[1]) ? ", MISMATCH" : "");
+}
+#endif
+
 
 
 
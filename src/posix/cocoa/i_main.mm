@@ -46,6 +46,7 @@
 #include "doomerrors.h"
 #include "i_system.h"
 #include "m_argv.h"
+#include "resourcefiles/resourcefile.h"
 #include "s_sound.h"
 #include "st_console.h"
 #include "version.h"
@@ -232,7 +233,11 @@ bool s_restartedFromWADPicker;
 
 void NewFailure()
 {
-	I_FatalError("Failed to allocate memory from system heap");
+	// Returning makes new try again, which only helps if some memory was released.
+	if (FResourceLump::ReleaseUnusedCaches(0) == 0)
+	{
+		I_FatalError("Failed to allocate memory from system heap");
+	}
 }
 
 int OriginalMain(int argc, char** argv)
@@ -60,6 +60,7 @@
 #include "cmdlib.h"
 #include "r_utility.h"
 #include "doomstat.h"
+#include "resourcefiles/resourcefile.h"
 
 // MACROS ------------------------------------------------------------------
 
@@ -133,7 +134,11 @@ void call_terms ()
 
 static void NewFailure ()
 {
-    I_FatalError ("Failed to allocate memory from system heap");
+	// Returning makes new try again, which only helps if some memory was released.
+	if (FResourceLump::ReleaseUnusedCaches (0) == 0)
+	{
+		I_FatalError ("Failed to allocate memory from system heap");
+	}
 }
 
 static int DoomSpecificInfo (char *buffer, char *end)
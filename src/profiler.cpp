@@ -0,0 +1,398 @@
+/*
+** profiler.cpp
+**
+** Scoped zone profiler with Chrome trace output
+**
+**---------------------------------------------------------------------------
+** Copyright 2016 The ZDoom Team
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+** 3. The name of the author may not be used to endorse or promote products
+**    derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+** OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+** INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+** NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+** THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**---------------------------------------------------------------------------
+**
+*/
+
+#include <stdio.h>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "doomtype.h"
+#include "profiler.h"
+#include "templates.h"
+#include "c_dispatch.h"
+
+//==========================================================================
+//
+// Every thread that enters a zone while profiling gets its own ring
+// buffer, so recording a zone never takes a lock. Once a buffer is full
+// the oldest zones are overwritten. The list of buffers is only locked
+// when a thread records its first zone, when it exits and when a trace
+// is written out.
+//
+// Only the owning thread ever writes to a ring or its count. "profile
+// start" just bumps the epoch, and each thread clears its own ring the
+// next time it records something. When a thread exits, its ring is freed
+// and the zones it recorded in the current epoch are kept in a copy that
+// is only as large as it needs to be.
+//
+// A trace should be written when the drawer threads are idle, which is
+// the case whenever console commands run.
+//
+//==========================================================================
+
+enum
+{
+	PROFILE_RINGSIZE = 1 << 16,
+	PROFILE_RINGMASK = PROFILE_RINGSIZE - 1,
+
+	// Zones that were entered before profiling stopped still get recorded
+	// when they end, and may overwrite the oldest entries of a full ring
+	// while it is being written out. Nesting never gets anywhere near this
+	// deep, so skipping that many of the oldest entries is safe.
+	PROFILE_RINGSLACK = 256
+};
+
+struct FProfileEvent
+{
+	const char *Name;
+	int64_t Start;
+	int64_t End;
+};
+
+struct FProfileThread
+{
+	char Name[32];
+	int Id;
+	unsigned Epoch;						// epoch the ring's contents belong to
+	std::atomic<unsigned> Count;		// total events recorded; the ring holds the last PROFILE_RINGSIZE
+	FProfileEvent *Ring;				// NULL once the thread has exited
+	std::vector<FProfileEvent> Retired;	// what was left in the ring when the thread exited
+};
+
+// Frees the calling thread's ring when the thread exits.
+struct FProfileThreadRef
+{
+	FProfileThread *Thread = NULL;
+	~FProfileThreadRef();
+};
+
+std::atomic<bool> ProfilerActive;
+
+static std::atomic<unsigned> ProfileEpoch;
+static std::mutex ProfileThreadsLock;
+static std::vector<FProfileThread *> ProfileThreads;
+static thread_local FProfileThreadRef ThisProfileThread;
+static thread_local const char *ThisThreadName;
+static thread_local int ThisThreadIndex;
+
+//==========================================================================
+//
+// NameProfileThread
+//
+// Threads can be created and named long before anything is profiled, so
+// the name is only put together here. The lock must be held.
+//
+//==========================================================================
+
+static void NameProfileThread(FProfileThread *thread)
+{
+	if (ThisThreadName == NULL)
+	{
+		mysnprintf(thread->Name, countof(thread->Name), "Thread %d", thread->Id);
+	}
+	else if (ThisThreadIndex >= 0)
+	{
+		mysnprintf(thread->Name, countof(thread->Name), "%s %d", ThisThreadName, ThisThreadIndex);
+	}
+	else
+	{
+		mysnprintf(thread->Name, countof(thread->Name), "%s", ThisThreadName);
+	}
+}
+
+//==========================================================================
+//
+// GetProfileThread
+//
+//==========================================================================
+
+static FProfileThread *GetProfileThread()
+{
+	if (ThisProfileThread.Thread == NULL)
+	{
+		FProfileThread *thread = new FProfileThread;
+		thread->Epoch = ProfileEpoch.load(std::memory_order_relaxed);
+		thread->Count = 0;
+		thread->Ring = new FProfileEvent[PROFILE_RINGSIZE];
+
+		std::lock_guard<std::mutex> lock(ProfileThreadsLock);
+		thread->Id = (int)ProfileThreads.size() + 1;
+		NameProfileThread(thread);
+		ProfileThreads.push_back(thread);
+		ThisProfileThread.Thread = thread;
+	}
+	return ThisProfileThread.Thread;
+}
+
+//==========================================================================
+//
+// GetLiveEvents
+//
+// Returns the range of a ring's entries that can be read.
+//
+//==========================================================================
+
+static void GetLiveEvents(const FProfileThread *thread, unsigned &first, unsigned &count)
+{
+	count = thread->Count.load(std::memory_order_acquire);
+	first = count > PROFILE_RINGSIZE - PROFILE_RINGSLACK ? count - (PROFILE_RINGSIZE - PROFILE_RINGSLACK) : 0;
+}
+
+//==========================================================================
+//
+// FProfileThreadRef :: ~FProfileThreadRef
+//
+//==========================================================================
+
+FProfileThreadRef::~FProfileThreadRef()
+{
+	if (Thread != NULL)
+	{
+		std::lock_guard<std::mutex> lock(ProfileThreadsLock);
+		if (Thread->Epoch == ProfileEpoch.load(std::memory_order_relaxed))
+		{
+			unsigned first, count;
+			GetLiveEvents(Thread, first, count);
+			for (unsigned i = first; i < count; ++i)
+			{
+				Thread->Retired.push_back(Thread->Ring[i & PROFILE_RINGMASK]);
+			}
+		}
+		delete[] Thread->Ring;
+		Thread->Ring = NULL;
+	}
+}
+
+//==========================================================================
+//
+// FProfileZone :: SetThreadName
+//
+//==========================================================================
+
+void FProfileZone::SetThreadName(const char *name, int index)
+{
+	ThisThreadName = name;
+	ThisThreadIndex = index;
+	if (ThisProfileThread.Thread != NULL)
+	{
+		std::lock_guard<std::mutex> lock(ProfileThreadsLock);
+		NameProfileThread(ThisProfileThread.Thread);
+	}
+}
+
+//==========================================================================
+//
+// FProfileZone :: Begin
+//
+// Returns the time in microseconds.
+//
+//==========================================================================
+
+int64_t FProfileZone::Begin()
+{
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+//==========================================================================
+//
+// FProfileZone :: End
+//
+//==========================================================================
+
+void FProfileZone::End(const char *name, int64_t start)
+{
+	FProfileThread *thread = GetProfileThread();
+	unsigned epoch = ProfileEpoch.load(std::memory_order_acquire);
+	unsigned count = thread->Count.load(std::memory_order_relaxed);
+
+	if (thread->Epoch != epoch)
+	{
+		thread->Epoch = epoch;
+		count = 0;
+	}
+
+	FProfileEvent &ev = thread->Ring[count & PROFILE_RINGMASK];
+	ev.Name = name;
+	ev.Start = start;
+	ev.End = Begin();
+	thread->Count.store(count + 1, std::memory_order_release);
+}
+
+//==========================================================================
+//
+// WriteJSONString
+//
+//==========================================================================
+
+static void WriteJSONString(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (; *str != 0; ++str)
+	{
+		unsigned char c = *str;
+		if (c == '"' || c == '\\')
+		{
+			fputc('\\', f);
+			fputc(c, f);
+		}
+		else if (c < 0x20)
+		{
+			fprintf(f, "\\u%04x", c);
+		}
+		else
+		{
+			fputc(c, f);
+		}
+	}
+	fputc('"', f);
+}
+
+//==========================================================================
+//
+// WriteProfileTrace
+//
+// Writes everything recorded since the last "profile start" in the JSON
+// trace event format that chrome://tracing and Perfetto read.
+//
+//==========================================================================
+
+static bool WriteProfileTrace(const char *filename)
+{
+	FILE *f = fopen(filename, "w");
+	if (f == NULL)
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(ProfileThreadsLock);
+	unsigned epoch = ProfileEpoch.load(std::memory_order_relaxed);
+	std::vector<std::vector<FProfileEvent>> events(ProfileThreads.size());
+	int64_t base = INT64_MAX;
+
+	for (size_t t = 0; t < ProfileThreads.size(); ++t)
+	{
+		const FProfileThread *thread = ProfileThreads[t];
+		if (thread->Ring == NULL)
+		{
+			events[t] = thread->Retired;
+		}
+		else if (thread->Epoch == epoch)
+		{
+			unsigned first, count;
+			GetLiveEvents(thread, first, count);
+			for (unsigned i = first; i < count; ++i)
+			{
+				events[t].push_back(thread->Ring[i & PROFILE_RINGMASK]);
+			}
+		}
+		for (auto &ev : events[t])
+		{
+			base = MIN(base, ev.Start);
+		}
+	}
+
+	const char *sep = "";
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (size_t t = 0; t < ProfileThreads.size(); ++t)
+	{
+		const FProfileThread *thread = ProfileThreads[t];
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", sep, thread->Id);
+		WriteJSONString(f, thread->Name);
+		fprintf(f, "}}");
+		sep = ",\n";
+
+		for (auto &ev : events[t])
+		{
+			fprintf(f, "%s{\"name\":", sep);
+			WriteJSONString(f, ev.Name);
+			fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+				thread->Id, (long long)(ev.Start - base), (long long)(ev.End - ev.Start));
+		}
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	return true;
+}
+
+//==========================================================================
+//
+// CCMD profile
+//
+// profile start
+// profile stop [filename]
+//
+//==========================================================================
+
+CCMD(profile)
+{
+	if (argv.argc() >= 2 && !stricmp(argv[1], "start"))
+	{
+		ProfilerActive = false;
+		{
+			// Threads that have exited are of no more use now.
+			std::lock_guard<std::mutex> lock(ProfileThreadsLock);
+			for (size_t t = 0; t < ProfileThreads.size(); )
+			{
+				if (ProfileThreads[t]->Ring == NULL)
+				{
+					delete ProfileThreads[t];
+					ProfileThreads.erase(ProfileThreads.begin() + t);
+				}
+				else t++;
+			}
+			ProfileEpoch.fetch_add(1, std::memory_order_release);
+		}
+		ProfilerActive = true;
+		Printf("Profiling started\n");
+	}
+	else if (argv.argc() >= 2 && !stricmp(argv[1], "stop"))
+	{
+		const char *filename = argv.argc() >= 3 ? argv[2] : "profile.json";
+		ProfilerActive = false;
+		if (WriteProfileTrace(filename))
+		{
+			Printf("Profile written to %s\n", filename);
+		}
+		else
+		{
+			Printf("Could not write %s\n", filename);
+		}
+	}
+	else
+	{
+		Printf("Usage: profile start | profile stop [filename]\n");
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef __PROFILER_H
+#define __PROFILER_H
+
+#include <atomic>
+#include <stdint.h>
+
+//==========================================================================
+//
+// FProfileZone
+//
+// Times the scope it is declared in while the profiler is running and
+// records it in a ring buffer that belongs to the calling thread. Zones
+// nest like the scopes they live in. Names must be string literals, since
+// only the pointer is kept. Use "profile start" and "profile stop" in the
+// console to capture a trace.
+//
+//==========================================================================
+
+extern std::atomic<bool> ProfilerActive;
+
+class FProfileZone
+{
+public:
+	FProfileZone(const char *name)
+	{
+		Name = ProfilerActive.load(std::memory_order_relaxed) ? name : NULL;
+		if (Name != NULL)
+		{
+			Start = Begin();
+		}
+	}
+
+	~FProfileZone()
+	{
+		if (Name != NULL)
+		{
+			End(Name, Start);
+		}
+	}
+
+	// Labels the calling thread in exported traces, followed by index
+	// unless that is negative. Only the pointer is kept, like for zones.
+	static void SetThreadName(const char *name, int index = -1);
+
+private:
+	const char *Name;
+	int64_t Start;
+
+	static int64_t Begin();
+	static void End(const char *name, int64_t start);
+};
+
+#endif
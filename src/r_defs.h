@@ -539,6 +539,7 @@ struct extsector_t
 		TDeletingArray<F3DFloor *>		ffloors;		// 3D floors in this sector
 		TArray<lightlist_t>				lightlist;		// 3D light list
 		TArray<sector_t*>				attached;		// 3D floors attached to this sector
+		TArray<F3DFloorSortStep>		sortsteps;		// last sort, see P_Recalculate3DFloors
 	} XFloor;
 };
 
@@ -45,6 +45,7 @@
 #include "c_dispatch.h"
 #include "v_video.h"
 #include "stats.h"
+#include "profiler.h"
 #include "i_video.h"
 #include "i_system.h"
 #include "a_sharedglobal.h"
@@ -829,6 +830,7 @@ void R_SetupBuffer ()
 
 void R_RenderActorView (AActor *actor, bool dontmaplines)
 {
+	FProfileZone zone("R_RenderActorView");
 	WallCycles.Reset();
 	PlaneCycles.Reset();
 	MaskedCycles.Reset();
@@ -45,6 +45,7 @@
 #include "r_local.h"
 #include "r_sky.h"
 #include "stats.h"
+#include "profiler.h"
 
 #include "v_video.h"
 #include "a_sharedglobal.h"
@@ -946,6 +947,7 @@ static void R_DrawSkyStriped (visplane_t *pl)
 
 int R_DrawPlanes ()
 {
+	FProfileZone zone("R_DrawPlanes");
 	visplane_t *pl;
 	int i;
 	int vpcount = 0;
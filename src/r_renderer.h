@@ -31,6 +31,9 @@ struct FRenderer
 	// precache one texture
 	virtual void Precache(BYTE *texhitlist, TMap<PClassActor*, bool> &actorhitlist) = 0;
 
+	// precache one texture, cache being a combination of FTextureManager::HIT_* flags
+	virtual void PrecacheTexture(FTexture *tex, int cache) {}
+
 	// render 3D view
 	virtual void RenderView(player_t *player) = 0;
 
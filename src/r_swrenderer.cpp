@@ -41,6 +41,7 @@
 #include "r_swrenderer.h"
 #include "r_3dfloors.h"
 #include "textures/textures.h"
+#include "textures/asyncdecode.h"
 #include "r_data/voxels.h"
 #include "r_thread.h"
 
@@ -161,11 +162,15 @@ void FSoftwareRenderer::Precache(BYTE *texhitlist, TMap<PClassActor*, bool> &act
 
 void FSoftwareRenderer::RenderView(player_t *player)
 {
+	// Nothing can be using the pixels of last frame's placeholders anymore.
+	FAsyncTextureDecode::FinishAll();
+	FAsyncTextureDecode::BeginView();
 	R_BeginDrawerCommands();
 	R_RenderActorView (player->mo);
 	// [RH] Let cameras draw onto textures that were visible this frame.
 	FCanvasTextureInfo::UpdateAll ();
 	R_EndDrawerCommands();
+	FAsyncTextureDecode::EndView();
 }
 
 //==========================================================================
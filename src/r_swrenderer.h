@@ -9,7 +9,7 @@ struct FSoftwareRenderer : public FRenderer
 	virtual bool UsesColormap() const override;
 
 	// precache one texture
-	void PrecacheTexture(FTexture *tex, int cache);
+	virtual void PrecacheTexture(FTexture *tex, int cache) override;
 	virtual void Precache(BYTE *texhitlist, TMap<PClassActor*, bool> &actorhitlist) override;
 
 	// render 3D view
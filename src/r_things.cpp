@@ -65,6 +65,7 @@
 #include "p_local.h"
 #include "p_maputl.h"
 #include "r_thread.h"
+#include "profiler.h"
 
 EXTERN_CVAR(Bool, st_scale)
 EXTERN_CVAR(Bool, r_shadercolormaps)
@@ -2405,6 +2406,7 @@ void R_DrawHeightPlanes(double height); // kg3D - fake planes
 
 void R_DrawMasked (void)
 {
+	FProfileZone zone("R_DrawMasked");
 	R_CollectPortals();
 	R_SortVisSprites (DrewAVoxel ? sv_compare2d : sv_compare, firstvissprite - vissprites);
 
@@ -32,6 +32,7 @@
 #include "g_game.h"
 #include "g_level.h"
 #include "r_thread.h"
+#include "profiler.h"
 
 CVAR(Bool, r_multithreaded, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);
 
@@ -132,6 +133,7 @@ void DrawerCommandQueue::Finish()
 	[](void *data)
 	{
 		TryCatchData *d = (TryCatchData*)data;
+		FProfileZone zone("DrawerCommands");
 
 		for (int pass = 0; pass < d->queue->num_passes; pass++)
 		{
@@ -197,6 +199,8 @@ void DrawerCommandQueue::StartThreads()
 		thread->num_cores = num_threads;
 		thread->thread = std::thread([=]()
 		{
+			FProfileZone::SetThreadName("Drawer", thread->core);
+
 			int run_id = 0;
 			while (true)
 			{
@@ -224,6 +228,7 @@ void DrawerCommandQueue::StartThreads()
 				[](void *data)
 				{
 					TryCatchData *d = (TryCatchData*)data;
+					FProfileZone zone("DrawerCommands");
 
 					for (int pass = 0; pass < d->queue->num_passes; pass++)
 					{
@@ -59,6 +59,7 @@
 #include "p_local.h"
 #include "p_maputl.h"
 #include "math/cmath.h"
+#include "p_subsectorgrid.h"
 
 
 // EXTERNAL DATA DECLARATIONS ----------------------------------------------
@@ -309,6 +310,9 @@ subsector_t *R_PointInSubsector (fixed_t x, fixed_t y)
 	node_t *node;
 	int side;
 
+	if (RenderSubsectorGrid.IsBuilt())
+		return RenderSubsectorGrid.PointInSubsector(x, y);
+
 	// single subsector is a special case
 	if (numnodes == 0)
 		return subsectors;
@@ -47,6 +47,9 @@
 #include "i_system.h"
 #include "w_wad.h"
 
+#include <mutex>
+#include <vector>
+
 
 
 //-----------------------------------------------------------------------
@@ -120,10 +123,9 @@ struct C7zArchive
 
 	C7zArchive(FileReader *file) : ArchiveStream(file)
 	{
-		if (g_CrcTable[1] == 0)
-		{
-			CrcGenerateTable();
-		}
+		// Archives can be opened on several threads at once.
+		static std::once_flag crcinit;
+		std::call_once(crcinit, []() { CrcGenerateTable(); });
 		file->Seek(0, SEEK_SET);
 		LookToRead_CreateVTable(&LookStream, false);
 		LookStream.realStream = &ArchiveStream.s;
@@ -172,7 +174,7 @@ struct F7ZLump : public FResourceLump
 {
 	int		Position;
 
-	virtual int FillCache();
+	virtual int FillCache(char *&data);
 
 };
 
@@ -259,8 +261,8 @@ bool F7ZFile::Open(bool quiet)
 	Lumps = new F7ZLump[NumLumps];
 
 	F7ZLump *lump_p = Lumps;
-	TArray<UInt16> nameUTF16;
-	TArray<char> nameASCII;
+	std::vector<UInt16> nameUTF16;
+	std::vector<char> nameASCII;
 
 	for (DWORD i = 0; i < NumLumps; ++i)
 	{
@@ -279,8 +281,8 @@ bool F7ZFile::Open(bool quiet)
 			continue;
 		}
 
-		nameUTF16.Resize((unsigned)nameLength);
-		nameASCII.Resize((unsigned)nameLength);
+		nameUTF16.resize(nameLength);
+		nameASCII.resize(nameLength);
 		SzArEx_GetFileNameUtf16(archPtr, i, &nameUTF16[0]);
 		for (size_t c = 0; c < nameLength; ++c)
 		{
@@ -306,10 +308,9 @@ bool F7ZFile::Open(bool quiet)
 	{
 		// Quick check for unsupported compression method
 
-		TArray<char> temp;
-		temp.Resize(Lumps[0].LumpSize);
+		std::vector<char> temp(Lumps[0].LumpSize);
 
-		if (SZ_OK != Archive->Extract(Lumps[0].Position, &temp[0]))
+		if (SZ_OK != Archive->Extract(Lumps[0].Position, temp.data()))
 		{
 			if (!quiet) Printf("\n%s: unsupported 7z/LZMA file!\n", Filename);
 			return false;
@@ -346,11 +347,10 @@ F7ZFile::~F7ZFile()
 //
 //==========================================================================
 
-int F7ZLump::FillCache()
+int F7ZLump::FillCache(char *&data)
 {
-	Cache = new char[LumpSize];
-	static_cast<F7ZFile*>(Owner)->Archive->Extract(Position, Cache);
-	RefCount = 1;
+	data = new char[LumpSize];
+	static_cast<F7ZFile*>(Owner)->Archive->Extract(Position, data);
 	return 1;
 }
 
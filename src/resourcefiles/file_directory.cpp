@@ -51,6 +51,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <time.h>
+#include <vector>
 
 #include "doomtype.h"
 #include "tarray.h"
@@ -70,7 +71,7 @@
 struct FDirectoryLump : public FResourceLump
 {
 	virtual FileReader *NewReader();
-	virtual int FillCache();
+	virtual int FillCache(char *&data);
 
 	FString mFullPath;
 };
@@ -84,7 +85,7 @@ struct FDirectoryLump : public FResourceLump
 
 class FDirectory : public FResourceFile
 {
-	TArray<FDirectoryLump> Lumps;
+	std::vector<FDirectoryLump> Lumps;
 
 	int AddDirectory(const char *dirpath);
 	void AddEntry(const char *fullpath, int size);
@@ -190,9 +191,9 @@ int FDirectory::AddDirectory(const char *dirpath)
 int FDirectory::AddDirectory(const char *dirpath)
 {
 	int count = 0;
-	TArray<FString> scanDirectories;
-	scanDirectories.Push(dirpath);
-	for(unsigned int i = 0;i < scanDirectories.Size();i++)
+	std::vector<FString> scanDirectories;
+	scanDirectories.push_back(dirpath);
+	for(size_t i = 0;i < scanDirectories.size();i++)
 	{
 		DIR* directory = opendir(scanDirectories[i].GetChars());
 		if (directory == NULL)
@@ -214,7 +215,7 @@ int FDirectory::AddDirectory(const char *dirpath)
 
 			if(S_ISDIR(fileStat.st_mode))
 			{
-				scanDirectories.Push(scanDirectories[i] + file->d_name + "/");
+				scanDirectories.push_back(scanDirectories[i] + file->d_name + "/");
 				continue;
 			}
 			AddEntry(scanDirectories[i] + file->d_name, fileStat.st_size);
@@ -286,7 +287,7 @@ bool FDirectory::Open(bool quiet)
 {
 	NumLumps = AddDirectory(Filename);
 	if (!quiet) Printf(", %d lumps\n", NumLumps);
-	PostProcessArchive(&Lumps[0], sizeof(FDirectoryLump));
+	PostProcessArchive(Lumps.data(), sizeof(FDirectoryLump));
 	return true;
 }
 
@@ -298,7 +299,8 @@ bool FDirectory::Open(bool quiet)
 
 void FDirectory::AddEntry(const char *fullpath, int size)
 {
-	FDirectoryLump *lump_p = &Lumps[Lumps.Reserve(1)];
+	Lumps.emplace_back();
+	FDirectoryLump *lump_p = &Lumps.back();
 
 	// Store the full path here so that we can access the file later, even if it is from a filter directory.
 	lump_p->mFullPath = fullpath;
@@ -340,18 +342,17 @@ FileReader *FDirectoryLump::NewReader()
 //
 //==========================================================================
 
-int FDirectoryLump::FillCache()
+int FDirectoryLump::FillCache(char *&data)
 {
-	Cache = new char[LumpSize];
+	data = new char[LumpSize];
 	FileReader *reader = NewReader();
 	if (reader == NULL)
 	{
-		memset(Cache, 0, LumpSize);
+		memset(data, 0, LumpSize);
 		return 0;
 	}
-	reader->Read(Cache, LumpSize);
+	reader->Read(data, LumpSize);
 	delete reader;
-	RefCount = 1;
 	return 1;
 }
 
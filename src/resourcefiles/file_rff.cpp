@@ -76,7 +76,7 @@ struct RFFLump
 struct FRFFLump : public FUncompressedLump
 {
 	virtual FileReader *GetReader();
-	virtual int FillCache();
+	virtual int FillCache(char *&data);
 
 	DWORD		IndexNum;
 
@@ -223,18 +223,18 @@ FileReader *FRFFLump::GetReader()
 //
 //==========================================================================
 
-int FRFFLump::FillCache()
+int FRFFLump::FillCache(char *&data)
 {
-	int res = FUncompressedLump::FillCache();
+	int res = FUncompressedLump::FillCache(data);
 
 	if (Flags & LUMPF_BLOODCRYPT)
 	{
 		int cryptlen = MIN<int> (LumpSize, 256);
-		BYTE *data = (BYTE *)Cache;
+		BYTE *bytes = (BYTE *)data;
 		
 		for (int i = 0; i < cryptlen; ++i)
 		{
-			data[i] ^= i >> 1;
+			bytes[i] ^= i >> 1;
 		}
 	}
 	return res;
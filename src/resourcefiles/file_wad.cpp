@@ -33,6 +33,8 @@
 **
 */
 
+#include <vector>
+
 #include "resourcefile.h"
 #include "cmdlib.h"
 #include "templates.h"
@@ -248,7 +250,7 @@ public:
 		}
 		return NULL;
 	}
-	int FillCache()
+	int FillCache(char *&data)
 	{
 		if(!Compressed)
 		{
@@ -257,24 +259,22 @@ public:
 			if (buffer != NULL)
 			{
 				// This is an in-memory file so the cache can point directly to the file's data.
-				Cache = const_cast<char*>(buffer) + Position;
-				RefCount = -1;
+				data = const_cast<char*>(buffer) + Position;
 				return -1;
 			}
 		}
 
 		Owner->Reader->Seek(Position, SEEK_SET);
-		Cache = new char[LumpSize];
+		data = new char[LumpSize];
 
 		if(Compressed)
 		{
 			FileReaderLZSS lzss(*Owner->Reader);
-			lzss.Read(Cache, LumpSize);
+			lzss.Read(data, LumpSize);
 		}
 		else
-			Owner->Reader->Read(Cache, LumpSize);
+			Owner->Reader->Read(data, LumpSize);
 
-		RefCount = 1;
 		return 1;
 	}
 };
@@ -435,20 +435,20 @@ void FWadFile::SetNamespace(const char *startmarker, const char *endmarker, name
 	bool warned = false;
 	int numstartmarkers = 0, numendmarkers = 0;
 	unsigned int i;
-	TArray<Marker> markers;
+	std::vector<Marker> markers;
 	
 	for(i = 0; i < NumLumps; i++)
 	{
 		if (IsMarker(i, startmarker))
 		{
 			Marker m = { 0, i };
-			markers.Push(m);
+			markers.push_back(m);
 			numstartmarkers++;
 		}
 		else if (IsMarker(i, endmarker))
 		{
 			Marker m = { 1, i };
-			markers.Push(m);
+			markers.push_back(m);
 			numendmarkers++;
 		}
 	}
@@ -464,7 +464,7 @@ void FWadFile::SetNamespace(const char *startmarker, const char *endmarker, name
 		{
 			// We have found no F_START but one or more F_END markers.
 			// mark all lumps before the last F_END marker as potential flats.
-			unsigned int end = markers[markers.Size()-1].index;
+			unsigned int end = markers[markers.size()-1].index;
 			for(unsigned int i = 0; i < end; i++)
 			{
 				if (Lumps[i].LumpSize == 4096)
@@ -480,7 +480,7 @@ void FWadFile::SetNamespace(const char *startmarker, const char *endmarker, name
 	}
 
 	i = 0;
-	while (i < markers.Size())
+	while (i < markers.size())
 	{
 		int start, end;
 		if (markers[i].markertype != 0)
@@ -492,21 +492,21 @@ void FWadFile::SetNamespace(const char *startmarker, const char *endmarker, name
 		start = i++;
 
 		// skip over subsequent x_START markers
-		while (i < markers.Size() && markers[i].markertype == 0)
+		while (i < markers.size() && markers[i].markertype == 0)
 		{
 			Printf(TEXTCOLOR_YELLOW"WARNING: duplicate %s marker found.\n", startmarker);
 			i++;
 			continue;
 		}
 		// same for x_END markers
-		while (i < markers.Size()-1 && (markers[i].markertype == 1 && markers[i+1].markertype == 1))
+		while (i < markers.size()-1 && (markers[i].markertype == 1 && markers[i+1].markertype == 1))
 		{
 			Printf(TEXTCOLOR_YELLOW"WARNING: duplicate %s marker found.\n", endmarker);
 			i++;
 			continue;
 		}
 		// We found a starting marker but no end marker. Ignore this block.
-		if (i >= markers.Size())
+		if (i >= markers.size())
 		{
 			Printf(TEXTCOLOR_YELLOW"WARNING: %s marker without corresponding %s found.\n", startmarker, endmarker);
 			end = NumLumps;
@@ -556,11 +556,14 @@ void FWadFile::SetNamespace(const char *startmarker, const char *endmarker, name
 // they are such a pain, and breaking them like this was done on purpose.
 // This also renames any S_SKINxx lumps to just S_SKIN.
 //
+// The lumps are only marked with ns_firstskin here. Every skin wad gets
+// its own namespace number when it is added to the lump directory, so
+// that the numbering follows the load order.
+//
 //==========================================================================
 
 void FWadFile::SkinHack ()
 {
-	static int namespc = ns_firstskin;
 	bool skinned = false;
 	bool hasmap = false;
 	DWORD i;
@@ -584,9 +587,8 @@ void FWadFile::SkinHack ()
 
 				for (j = 0; j < NumLumps; j++)
 				{
-					Lumps[j].Namespace = namespc;
+					Lumps[j].Namespace = ns_firstskin;
 				}
-				namespc++;
 			}
 		}
 		if ((lump->Name[0] == 'M' &&
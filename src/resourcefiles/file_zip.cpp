@@ -42,9 +42,12 @@
 #include "w_zip.h"
 #include "i_system.h"
 #include "ancientzip.h"
+#include "LzmaDec.h"
 
 #define BUFREADCOMMENT (0x400)
 
+extern ISzAlloc g_Alloc;
+
 //==========================================================================
 //
 // Decompression subroutine
@@ -116,6 +119,62 @@ bool FCompressedBuffer::Decompress(char *destbuffer)
 	return UncompressZipLump(destbuffer, &mr, mMethod, mSize, mCompressedSize, mZipFlags);
 }
 
+//==========================================================================
+//
+// FCompressedBuffer :: TryDecompress
+//
+// Decompresses deflate, bzip2 and LZMA data straight through the
+// libraries, without throwing, printing or allocating GC-counted memory,
+// so it can be used on worker threads. Returns false for anything else
+// and for broken data.
+//
+//==========================================================================
+
+bool FCompressedBuffer::TryDecompress(char *destbuffer)
+{
+	switch (mMethod)
+	{
+	case METHOD_STORED:
+		if (mCompressedSize != mSize) return false;
+		memcpy(destbuffer, mBuffer, mSize);
+		return true;
+
+	case METHOD_DEFLATE:
+	{
+		z_stream stream = {};
+		stream.next_in = (Bytef *)mBuffer;
+		stream.avail_in = mCompressedSize;
+		stream.next_out = (Bytef *)destbuffer;
+		stream.avail_out = mSize;
+		if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) return false;
+		int err = inflate(&stream, Z_FINISH);
+		inflateEnd(&stream);
+		return (err == Z_STREAM_END || err == Z_OK) && stream.avail_out == 0;
+	}
+
+	case METHOD_BZIP2:
+	{
+		unsigned int size = mSize;
+		return BZ2_bzBuffToBuffDecompress(destbuffer, &size, mBuffer, mCompressedSize, 0, 0) == BZ_OK && size == mSize;
+	}
+
+	case METHOD_LZMA:
+	{
+		// Zip's LZMA header: two bytes version, two bytes properties size
+		const Byte *header = (const Byte *)mBuffer;
+		if (mCompressedSize < 4 + LZMA_PROPS_SIZE || header[2] + header[3] * 256 != LZMA_PROPS_SIZE) return false;
+		SizeT outsize = mSize;
+		SizeT insize = mCompressedSize - 4 - LZMA_PROPS_SIZE;
+		ELzmaStatus status;
+		return LzmaDecode((Byte *)destbuffer, &outsize, header + 4 + LZMA_PROPS_SIZE, &insize,
+			header + 4, LZMA_PROPS_SIZE, LZMA_FINISH_ANY, &status, &g_Alloc) == SZ_OK && outsize == mSize;
+	}
+
+	default:
+		return false;
+	}
+}
+
 //-----------------------------------------------------------------------
 //
 // Finds the central directory end record in the end of the file.
@@ -323,6 +382,30 @@ FCompressedBuffer FZipLump::GetRawData()
 	return cbuf;
 }
 
+//==========================================================================
+//
+// IsCompressed
+//
+//==========================================================================
+
+bool FZipLump::IsCompressed() const
+{
+	return Method != METHOD_STORED;
+}
+
+//==========================================================================
+//
+// NeedsMainThread
+//
+// The implode and shrink decoders keep their tables in TArrays.
+//
+//==========================================================================
+
+bool FZipLump::NeedsMainThread() const
+{
+	return Method == METHOD_IMPLODE || Method == METHOD_SHRINK;
+}
+
 //==========================================================================
 //
 // SetLumpAddress
@@ -371,7 +454,7 @@ FileReader *FZipLump::GetReader()
 //
 //==========================================================================
 
-int FZipLump::FillCache()
+int FZipLump::FillCache(char *&data)
 {
 	if (Flags & LUMPFZIP_NEEDFILESTART) SetLumpAddress();
 	const char *buffer;
@@ -379,15 +462,22 @@ int FZipLump::FillCache()
 	if (Method == METHOD_STORED && (buffer = Owner->Reader->GetBuffer()) != NULL)
 	{
 		// This is an in-memory file so the cache can point directly to the file's data.
-		Cache = const_cast<char*>(buffer) + Position;
-		RefCount = -1;
+		data = const_cast<char*>(buffer) + Position;
 		return -1;
 	}
 
 	Owner->Reader->Seek(Position, SEEK_SET);
-	Cache = new char[LumpSize];
-	UncompressZipLump(Cache, Owner->Reader, Method, LumpSize, CompressedSize, GPFlags);
-	RefCount = 1;
+	data = new char[LumpSize];
+	try
+	{
+		UncompressZipLump(data, Owner->Reader, Method, LumpSize, CompressedSize, GPFlags);
+	}
+	catch (...)
+	{
+		delete[] data;
+		data = NULL;
+		throw;
+	}
 	return 1;
 }
 
@@ -23,7 +23,9 @@ struct FZipLump : public FResourceLump
 	unsigned CRC32;
 
 	virtual FileReader *GetReader();
-	virtual int FillCache();
+	virtual int FillCache(char *&data);
+	virtual bool IsCompressed() const;
+	virtual bool NeedsMainThread() const;
 
 private:
 	void SetLumpAddress();
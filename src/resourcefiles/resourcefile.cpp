@@ -41,6 +41,63 @@
 #include "gi.h"
 #include "doomstat.h"
 #include "w_zip.h"
+#include "c_cvars.h"
+#include "c_dispatch.h"
+#include "stats.h"
+#include "templates.h"
+#include "v_text.h"
+
+#include <mutex>
+
+//==========================================================================
+//
+// Lump cache bookkeeping
+//
+// Every cache buffer a lump owns is kept in a list ordered by last use,
+// most recent first. Memory mapped lumps (RefCount == -1) are not in it.
+// Once nothing references a lump any more its cache is kept around for
+// reuse as long as the unreferenced caches stay within lumpcache_size
+// megabytes. Whatever exceeds that is freed starting with the least
+// recently used. The same list is walked when an allocation fails, to
+// give that memory back before giving up.
+//
+// lumpcache_size defaults to 0, which frees a cache as soon as its last
+// reference is gone, just like before there was a list. Retention has to
+// be asked for.
+//
+//==========================================================================
+
+static FResourceLump *CacheHead, *CacheTail;
+static size_t CachedBytes, UnusedBytes;
+static unsigned CachedLumps, UnusedLumps;
+
+// This must survive the static destructors of whatever still has
+// resource files open at exit, so it is never freed. It is recursive
+// because an allocation that fails while it is held releases caches.
+static std::recursive_mutex &CacheLock()
+{
+	static std::recursive_mutex *lock = new std::recursive_mutex;
+	return *lock;
+}
+
+// Stands in for the owner's read lock for lumps without an archive.
+static std::mutex &ExternalReadLock()
+{
+	static std::mutex *lock = new std::mutex;
+	return *lock;
+}
+
+CUSTOM_CVAR(Int, lumpcache_size, 0, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
+{
+	if (self < 0)
+	{
+		self = 0;
+	}
+	else
+	{
+		FResourceLump::ReleaseUnusedCaches(UnusedBytes > (size_t)self << 20 ? UnusedBytes - ((size_t)self << 20) : 0);
+	}
+}
 
 
 //==========================================================================
@@ -78,6 +135,10 @@ FResourceLump::~FResourceLump()
 {
 	if (Cache != NULL && RefCount >= 0)
 	{
+		{
+			std::lock_guard<std::recursive_mutex> lock(CacheLock());
+			UnlinkCache();
+		}
 		delete [] Cache;
 		Cache = NULL;
 	}
@@ -236,40 +297,353 @@ FileReader *FResourceLump::NewReader()
 //
 // Caches a lump's content and increases the reference counter
 //
+// The data is read without the cache lock, so other threads can go on
+// using their lumps meanwhile. The owner's read lock keeps the archive's
+// reader to one thread and makes a second thread that wants the same
+// lump wait for the first one's result.
+//
 //==========================================================================
 
 void *FResourceLump::CacheLump()
 {
+	{
+		std::lock_guard<std::recursive_mutex> lock(CacheLock());
+		if (Cache != NULL || LumpSize <= 0)
+		{
+			return AddCacheRef();
+		}
+	}
+
+	std::lock_guard<std::mutex> readlock(Owner != NULL ? Owner->ReadLock : ExternalReadLock());
+	{
+		std::lock_guard<std::recursive_mutex> lock(CacheLock());
+		if (Cache != NULL)
+		{
+			return AddCacheRef();
+		}
+	}
+
+	char *data = NULL;
+	int refcount = FillCache(data);
+
+	std::lock_guard<std::recursive_mutex> lock(CacheLock());
 	if (Cache != NULL)
 	{
-		if (RefCount > 0) RefCount++;
+		// The preloader adopted a cache for it in the meantime.
+		if (refcount > 0) delete[] data;
+		return AddCacheRef();
+	}
+	Cache = data;
+	RefCount = refcount;
+	if (Cache != NULL && RefCount > 0)
+	{
+		LinkCache();
 	}
-	else if (LumpSize > 0)
+	return Cache;
+}
+
+//==========================================================================
+//
+// Adds a reference to an existing cache. The cache lock must be held.
+//
+//==========================================================================
+
+void *FResourceLump::AddCacheRef()
+{
+	if (Cache != NULL && RefCount >= 0)
 	{
-		FillCache();
+		if (RefCount++ == 0)
+		{
+			UnusedBytes -= LumpSize;
+			UnusedLumps--;
+		}
+		UnlinkCache();
+		LinkCache();
 	}
 	return Cache;
 }
 
 //==========================================================================
 //
-// Decrements reference counter and frees lump if counter reaches 0
+// Decrements reference counter. Once it reaches 0 the cache is either
+// kept for later or freed, depending on lumpcache_size.
 //
 //==========================================================================
 
 int FResourceLump::ReleaseCache()
 {
+	std::lock_guard<std::recursive_mutex> lock(CacheLock());
 	if (LumpSize > 0 && RefCount > 0)
 	{
 		if (--RefCount == 0)
 		{
-			delete [] Cache;
-			Cache = NULL;
+			UnusedBytes += LumpSize;
+			UnusedLumps++;
+			TrimCaches();
 		}
 	}
 	return RefCount;
 }
 
+//==========================================================================
+//
+// Returns true if the lump's data is in memory.
+//
+//==========================================================================
+
+bool FResourceLump::IsCached()
+{
+	std::lock_guard<std::recursive_mutex> lock(CacheLock());
+	return Cache != NULL;
+}
+
+//==========================================================================
+//
+// Makes data, allocated with new[], the lump's cache as if the lump had
+// been cached by the caller, who has to release it again. If the lump
+// already has a cache, nothing happens and the caller keeps data.
+//
+//==========================================================================
+
+bool FResourceLump::AdoptCache(char *data)
+{
+	std::lock_guard<std::recursive_mutex> lock(CacheLock());
+	if (Cache != NULL || LumpSize <= 0)
+	{
+		return false;
+	}
+	Cache = data;
+	RefCount = 1;
+	LinkCache();
+	return true;
+}
+
+//==========================================================================
+//
+// Adds a reference to the lump's cache, reading the lump first if load
+// is set. Returns true if the caller now holds a reference it has to
+// release; lumps that point into an in-memory file never need one.
+//
+//==========================================================================
+
+bool FResourceLump::HoldCache(bool load)
+{
+	if (load)
+	{
+		CacheLump();
+		std::lock_guard<std::recursive_mutex> lock(CacheLock());
+		return Cache != NULL && RefCount > 0;
+	}
+	std::lock_guard<std::recursive_mutex> lock(CacheLock());
+	if (Cache == NULL || RefCount < 0)
+	{
+		return false;
+	}
+	AddCacheRef();
+	return true;
+}
+
+//==========================================================================
+//
+// Inserts this lump's cache at the head of the LRU list.
+// The cache lock must be held.
+//
+//==========================================================================
+
+void FResourceLump::LinkCache()
+{
+	CachePrev = NULL;
+	CacheNext = CacheHead;
+	if (CacheHead != NULL) CacheHead->CachePrev = this;
+	else CacheTail = this;
+	CacheHead = this;
+	CachedBytes += LumpSize;
+	CachedLumps++;
+}
+
+//==========================================================================
+//
+// Removes this lump's cache from the LRU list if it is in there.
+// The cache lock must be held.
+//
+//==========================================================================
+
+void FResourceLump::UnlinkCache()
+{
+	if (CachePrev == NULL && CacheHead != this)
+	{
+		return;
+	}
+	if (CachePrev != NULL) CachePrev->CacheNext = CacheNext;
+	else CacheHead = CacheNext;
+	if (CacheNext != NULL) CacheNext->CachePrev = CachePrev;
+	else CacheTail = CachePrev;
+	CachePrev = CacheNext = NULL;
+	CachedBytes -= LumpSize;
+	CachedLumps--;
+	if (RefCount == 0)
+	{
+		UnusedBytes -= LumpSize;
+		UnusedLumps--;
+	}
+}
+
+//==========================================================================
+//
+// Frees the least recently used unreferenced caches until the rest fit
+// into lumpcache_size. The cache lock must be held.
+//
+//==========================================================================
+
+void FResourceLump::TrimCaches()
+{
+	size_t budget = (size_t)MAX<int>(lumpcache_size, 0) << 20;
+
+	for (FResourceLump *lump = CacheTail; lump != NULL && UnusedBytes > budget; )
+	{
+		FResourceLump *prev = lump->CachePrev;
+		if (lump->RefCount == 0)
+		{
+			lump->UnlinkCache();
+			delete[] lump->Cache;
+			lump->Cache = NULL;
+		}
+		lump = prev;
+	}
+}
+
+//==========================================================================
+//
+// Frees unreferenced caches, least recently used first, until at least
+// the requested amount was released or nothing unreferenced is left.
+// Passing 0 frees all of them. Returns the number of bytes freed.
+//
+// This gets called when the system runs out of memory, from M_Malloc and
+// from the new handler, which can happen while this thread already holds
+// the lock.
+//
+//==========================================================================
+
+size_t FResourceLump::ReleaseUnusedCaches(size_t wanted)
+{
+	std::lock_guard<std::recursive_mutex> lock(CacheLock());
+	size_t freed = 0;
+
+	for (FResourceLump *lump = CacheTail; lump != NULL && (wanted == 0 || freed < wanted); )
+	{
+		FResourceLump *prev = lump->CachePrev;
+		if (lump->RefCount == 0)
+		{
+			freed += lump->LumpSize;
+			lump->UnlinkCache();
+			delete[] lump->Cache;
+			lump->Cache = NULL;
+		}
+		lump = prev;
+	}
+	return freed;
+}
+
+//==========================================================================
+//
+// CCMD lumpcache
+//
+// Lists how much memory cached lumps use, by archive and by namespace.
+// 'lumpcache flush' releases everything that is currently unreferenced.
+//
+//==========================================================================
+
+struct FLumpCacheTally
+{
+	size_t Bytes, UnusedBytes;
+	unsigned Lumps, UnusedLumps;
+};
+
+static void AddToTally(FLumpCacheTally &tally, const FResourceLump *lump)
+{
+	tally.Bytes += lump->LumpSize;
+	tally.Lumps++;
+	if (lump->RefCount == 0)
+	{
+		tally.UnusedBytes += lump->LumpSize;
+		tally.UnusedLumps++;
+	}
+}
+
+static void PrintTally(const char *name, const FLumpCacheTally &tally)
+{
+	Printf("%9zu KB %6u lumps (%zu KB in %u unreferenced) %s\n",
+		(tally.Bytes + 1023) >> 10, tally.Lumps, (tally.UnusedBytes + 1023) >> 10, tally.UnusedLumps, name);
+}
+
+CCMD(lumpcache)
+{
+	static const char *const nsnames[] =
+	{
+		"global", "sprites", "flats", "colormaps", "acslibrary", "textures",
+		"bloodraw", "bloodsfx", "bloodmisc", "voices", "hires", "voxels",
+		"zipdirectory", "sounds", "patches", "graphics", "music",
+	};
+	static_assert(countof(nsnames) == ns_firstskin, "namespace name table is out of date");
+
+	if (argv.argc() > 1 && !stricmp(argv[1], "flush"))
+	{
+		size_t freed = FResourceLump::ReleaseUnusedCaches(0);
+		Printf("Released %zu KB of unreferenced lump caches\n", (freed + 1023) >> 10);
+		return;
+	}
+
+	TArray<const FResourceFile *> files;
+	TArray<FLumpCacheTally> filetallies;
+	FLumpCacheTally nstallies[ns_firstskin + 2] = {};	// + hidden and skins
+	FLumpCacheTally total = {};
+
+	{
+		std::lock_guard<std::recursive_mutex> lock(CacheLock());
+		for (const FResourceLump *lump = CacheHead; lump != NULL; lump = lump->CacheNext)
+		{
+			unsigned i;
+			for (i = 0; i < files.Size() && files[i] != lump->Owner; ++i)
+			{
+			}
+			if (i == files.Size())
+			{
+				files.Push(lump->Owner);
+				filetallies.Push(FLumpCacheTally());
+				memset(&filetallies[i], 0, sizeof(FLumpCacheTally));
+			}
+			AddToTally(filetallies[i], lump);
+
+			int ns = lump->Namespace;
+			AddToTally(nstallies[ns < 0 ? ns_firstskin + 1 : MIN<int>(ns, ns_firstskin)], lump);
+			AddToTally(total, lump);
+		}
+	}
+
+	Printf(TEXTCOLOR_YELLOW "By archive:\n");
+	for (unsigned i = 0; i < files.Size(); ++i)
+	{
+		PrintTally(files[i] != NULL && files[i]->Filename != NULL ? files[i]->Filename : "<unknown>", filetallies[i]);
+	}
+	Printf(TEXTCOLOR_YELLOW "By namespace:\n");
+	for (int i = 0; i < ns_firstskin + 2; ++i)
+	{
+		if (nstallies[i].Lumps > 0)
+		{
+			PrintTally(i < ns_firstskin ? nsnames[i] : i == ns_firstskin ? "skins" : "hidden", nstallies[i]);
+		}
+	}
+	PrintTally("total", total);
+}
+
+ADD_STAT(lumpcache)
+{
+	FString out;
+	out.Format("Lump cache: %u lumps, %zu KB (%u unreferenced, %zu KB, limit %d MB)",
+		CachedLumps, (CachedBytes + 1023) >> 10, UnusedLumps, (UnusedBytes + 1023) >> 10, *lumpcache_size);
+	return out;
+}
+
 //==========================================================================
 //
 // Opens a resource file
@@ -616,22 +990,20 @@ FileReader *FUncompressedLump::GetReader()
 //
 //==========================================================================
 
-int FUncompressedLump::FillCache()
+int FUncompressedLump::FillCache(char *&data)
 {
 	const char * buffer = Owner->Reader->GetBuffer();
 
 	if (buffer != NULL)
 	{
 		// This is an in-memory file so the cache can point directly to the file's data.
-		Cache = const_cast<char*>(buffer) + Position;
-		RefCount = -1;
+		data = const_cast<char*>(buffer) + Position;
 		return -1;
 	}
 
 	Owner->Reader->Seek(Position, SEEK_SET);
-	Cache = new char[LumpSize];
-	Owner->Reader->Read(Cache, LumpSize);
-	RefCount = 1;
+	data = new char[LumpSize];
+	Owner->Reader->Read(data, LumpSize);
 	return 1;
 }
 
@@ -697,20 +1069,19 @@ FExternalLump::~FExternalLump()
 //
 //==========================================================================
 
-int FExternalLump::FillCache()
+int FExternalLump::FillCache(char *&data)
 {
-	Cache = new char[LumpSize];
+	data = new char[LumpSize];
 	FILE *f = fopen(filename, "rb");
 	if (f != NULL)
 	{
-		fread(Cache, 1, LumpSize, f);
+		fread(data, 1, LumpSize, f);
 		fclose(f);
 	}
 	else
 	{
-		memset(Cache, 0, LumpSize);
+		memset(data, 0, LumpSize);
 	}
-	RefCount = 1;
 	return 1;
 }
 
@@ -3,6 +3,7 @@
 #ifndef __RESFILE_H
 #define __RESFILE_H
 
+#include <mutex>
 #include "files.h"
 
 class FResourceFile;
@@ -19,6 +20,7 @@ struct FCompressedBuffer
 	char *mBuffer;
 
 	bool Decompress(char *destbuffer);
+	bool TryDecompress(char *destbuffer);	// safe on any thread, see file_zip.cpp
 	void Clean()
 	{
 		mSize = mCompressedSize = 0;
@@ -49,10 +51,13 @@ struct FResourceLump
 	FResourceFile *	Owner;
 	FTexture *		LinkedTexture;
 	int				Namespace;
+	FResourceLump *	CachePrev;		// Links for the LRU list of allocated caches
+	FResourceLump *	CacheNext;
 
 	FResourceLump()
 	{
 		Cache = NULL;
+		CachePrev = CacheNext = NULL;
 		Owner = NULL;
 		Flags = 0;
 		RefCount = 0;
@@ -69,12 +74,28 @@ struct FResourceLump
 	void LumpNameSetup(FString iname);
 	void CheckEmbedded();
 	virtual FCompressedBuffer GetRawData();
+	virtual bool IsCompressed() const { return false; }	// true if GetRawData returns compressed data
+	virtual bool NeedsMainThread() const { return false; }	// true if reading it allocates GC-counted memory
 
 	void *CacheLump();
 	int ReleaseCache();
+	bool IsCached();
+	bool AdoptCache(char *data);
+	bool HoldCache(bool load);
+
+	static size_t ReleaseUnusedCaches(size_t wanted);
 
 protected:
-	virtual int FillCache() = 0;
+	// Reads the lump into data, either allocated with new[] or pointing
+	// into an in-memory file. Returns the reference count to start with,
+	// -1 for the latter. Runs without the cache lock held.
+	virtual int FillCache(char *&data) = 0;
+
+private:
+	void *AddCacheRef();
+	void LinkCache();
+	void UnlinkCache();
+	static void TrimCaches();
 
 };
 
@@ -83,6 +104,7 @@ class FResourceFile
 public:
 	FileReader *Reader;
 	const char *Filename;
+	std::mutex ReadLock;		// held while a lump is read through Reader
 protected:
 	DWORD NumLumps;
 
@@ -119,7 +141,7 @@ struct FUncompressedLump : public FResourceLump
 	int				Position;
 
 	virtual FileReader *GetReader();
-	virtual int FillCache();
+	virtual int FillCache(char *&data);
 	virtual int GetFileOffset() { return Position; }
 
 };
@@ -146,7 +168,7 @@ struct FExternalLump : public FResourceLump
 
 	FExternalLump(const char *_filename, int filesize = -1);
 	~FExternalLump();
-	virtual int FillCache();
+	virtual int FillCache(char *&data);
 
 };
 
@@ -53,6 +53,7 @@
 #include "serializer.h"
 #include "d_player.h"
 #include "r_state.h"
+#include "profiler.h"
 
 // MACROS ------------------------------------------------------------------
 
@@ -2010,6 +2011,7 @@ void S_RestoreEvictedChannels()
 
 void S_UpdateSounds (AActor *listenactor)
 {
+	FProfileZone zone("S_UpdateSounds");
 	FVector3 pos, vel;
 	SoundListener listener;
 
@@ -35,6 +35,12 @@
 #include <new>
 #include "dobject.h"
 #include "v_text.h"
+#include "stats.h"
+
+// Time spent running scripted code, for -benchmark. Only the outermost
+// call is timed, so nested ones are not counted twice.
+cycle_t VMCycles;
+static int VMCallDepth;
 
 IMPLEMENT_CLASS(VMException, false, false)
 IMPLEMENT_CLASS(VMFunction, true, true)
@@ -455,6 +461,7 @@ int VMFrameStack::Call(VMFunction *func, VMValue *params, int numparams, VMRetur
 {
 	assert(this == &GlobalVMStack);	// why would anyone even want to create a local stack?
 	bool allocated = false;
+	bool timed = false;
 	try
 	{	
 		if (func->Native)
@@ -466,13 +473,21 @@ int VMFrameStack::Call(VMFunction *func, VMValue *params, int numparams, VMRetur
 			AllocFrame(static_cast<VMScriptFunction *>(func));
 			allocated = true;
 			VMFillParams(params, TopFrame(), numparams);
+			timed = true;
+			if (VMCallDepth++ == 0) VMCycles.Clock();
 			int numret = VMExec(this, static_cast<VMScriptFunction *>(func)->Code, results, numresults);
+			if (--VMCallDepth == 0) VMCycles.Unclock();
+			timed = false;
 			PopFrame();
 			return numret;
 		}
 	}
 	catch (VMException *exception)
 	{
+		if (timed && --VMCallDepth == 0)
+		{
+			VMCycles.Unclock();
+		}
 		if (allocated)
 		{
 			PopFrame();
@@ -486,6 +501,10 @@ int VMFrameStack::Call(VMFunction *func, VMValue *params, int numparams, VMRetur
 	}
 	catch (...)
 	{
+		if (timed && --VMCallDepth == 0)
+		{
+			VMCycles.Unclock();
+		}
 		if (allocated)
 		{
 			PopFrame();
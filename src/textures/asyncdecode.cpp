@@ -0,0 +1,197 @@
+/*
+** asyncdecode.cpp
+** Background decoding of large image textures
+**
+**---------------------------------------------------------------------------
+** Copyright 2016 The ZDoom Team
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+** 3. The name of the author may not be used to endorse or promote products
+**    derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+** OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+** INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+** NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+** THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**---------------------------------------------------------------------------
+**
+*/
+
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <vector>
+#include "doomtype.h"
+#include "doomerrors.h"
+#include "c_cvars.h"
+#include "jobqueue.h"
+#include "textures/textures.h"
+#include "textures/asyncdecode.h"
+
+CVAR(Bool, r_asynctextures, true, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
+
+// Smaller images decode fast enough that a placeholder would only flicker.
+enum { ASYNC_MIN_PIXELS = 256*256 };
+
+struct FPendingDecode
+{
+	FTexture *Texture;
+	std::function<void(BYTE *)> Finish;
+	BYTE *Result;
+	std::string Error;
+	bool Done;
+};
+
+static std::mutex PendingMutex;
+static std::condition_variable PendingDone;
+static std::vector<std::shared_ptr<FPendingDecode>> PendingDecodes;
+
+// Lets Cancel skip the lock in the common case. This also keeps texture
+// destructors that run during static destruction away from the mutex.
+static std::atomic<int> NumPending;
+
+int FAsyncTextureDecode::ViewDepth;
+
+//==========================================================================
+//
+// FAsyncTextureDecode :: Wanted
+//
+// Textures used as patches are excluded because the composite would
+// keep the placeholder forever.
+//
+//==========================================================================
+
+bool FAsyncTextureDecode::Wanted(FTexture *tex, int width, int height)
+{
+	return r_asynctextures && ViewDepth > 0 && !tex->bKeepAround &&
+		tex->SourceLump >= 0 && width * height >= ASYNC_MIN_PIXELS;
+}
+
+//==========================================================================
+//
+// FAsyncTextureDecode :: Start
+//
+//==========================================================================
+
+void FAsyncTextureDecode::Start(FTexture *tex, std::function<BYTE *()> decode, std::function<void(BYTE *)> finish)
+{
+	auto pending = std::make_shared<FPendingDecode>();
+	pending->Texture = tex;
+	pending->Finish = std::move(finish);
+	pending->Result = NULL;
+	pending->Done = false;
+	{
+		std::lock_guard<std::mutex> lock(PendingMutex);
+		PendingDecodes.push_back(pending);
+		NumPending++;
+	}
+
+	FJobQueue::Run([pending, decode]()
+	{
+		BYTE *result = NULL;
+		std::string error;
+		try
+		{
+			result = decode();
+		}
+		catch (CDoomError &err)
+		{
+			error = err.GetMessage() != NULL ? err.GetMessage() : "unknown error";
+		}
+		catch (std::exception &err)
+		{
+			error = err.what();
+		}
+		catch (...)
+		{
+			error = "unknown error";
+		}
+		std::lock_guard<std::mutex> lock(PendingMutex);
+		pending->Result = result;
+		pending->Error = std::move(error);
+		pending->Done = true;
+		PendingDone.notify_all();
+	});
+}
+
+//==========================================================================
+//
+// FAsyncTextureDecode :: Cancel
+//
+//==========================================================================
+
+bool FAsyncTextureDecode::Cancel(FTexture *tex)
+{
+	if (NumPending == 0)
+	{
+		return false;
+	}
+	std::unique_lock<std::mutex> lock(PendingMutex);
+	for (size_t i = 0; i < PendingDecodes.size(); i++)
+	{
+		std::shared_ptr<FPendingDecode> pending = PendingDecodes[i];
+		if (pending->Texture == tex)
+		{
+			PendingDone.wait(lock, [&]() { return pending->Done; });
+			delete[] pending->Result;
+			PendingDecodes.erase(PendingDecodes.begin() + i);
+			NumPending--;
+			return true;
+		}
+	}
+	return false;
+}
+
+//==========================================================================
+//
+// FAsyncTextureDecode :: FinishAll
+//
+//==========================================================================
+
+void FAsyncTextureDecode::FinishAll()
+{
+	if (NumPending == 0)
+	{
+		return;
+	}
+	std::vector<std::shared_ptr<FPendingDecode>> finished;
+	{
+		std::lock_guard<std::mutex> lock(PendingMutex);
+		for (size_t i = 0; i < PendingDecodes.size(); )
+		{
+			if (PendingDecodes[i]->Done)
+			{
+				finished.push_back(PendingDecodes[i]);
+				PendingDecodes.erase(PendingDecodes.begin() + i);
+				NumPending--;
+			}
+			else i++;
+		}
+	}
+	for (auto &pending : finished)
+	{
+		if (!pending->Error.empty())
+		{
+			Printf("Background decode of %s failed: %s\n", pending->Texture->Name.GetChars(), pending->Error.c_str());
+		}
+		pending->Finish(pending->Result);
+	}
+	FJobQueue::ReportFailures();
+}
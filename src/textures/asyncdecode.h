@@ -0,0 +1,74 @@
+/*
+** asyncdecode.h
+** Background decoding of large image textures
+**
+**---------------------------------------------------------------------------
+** Copyright 2016 The ZDoom Team
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+** 3. The name of the author may not be used to endorse or promote products
+**    derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+** OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+** INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+** NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+** THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**---------------------------------------------------------------------------
+**
+*/
+
+#ifndef __ASYNCDECODE_H
+#define __ASYNCDECODE_H
+
+#include <functional>
+#include "doomtype.h"
+
+class FTexture;
+
+// Large image textures that are first seen while the software renderer is
+// drawing the view are decoded on a worker thread. The texture shows a
+// placeholder until FinishAll hands it the decoded pixels at the start of
+// a later frame.
+
+class FAsyncTextureDecode
+{
+public:
+	// True if tex should be decoded in the background instead of right now.
+	static bool Wanted(FTexture *tex, int width, int height);
+
+	// decode runs on a worker thread and returns new[]'d pixels or NULL on
+	// failure. finish runs on the main thread with that result.
+	static void Start(FTexture *tex, std::function<BYTE *()> decode, std::function<void(BYTE *)> finish);
+
+	// Waits for a pending decode of tex and throws its result away.
+	// Returns false if there was none.
+	static bool Cancel(FTexture *tex);
+
+	// Delivers all finished decodes. Must only be called when no drawers are running.
+	static void FinishAll();
+
+	// Placeholders are only allowed while drawing the view, since everything
+	// else may keep the pixels around.
+	static void BeginView() { ViewDepth++; }
+	static void EndView() { ViewDepth--; }
+
+private:
+	static int ViewDepth;
+};
+
+#endif
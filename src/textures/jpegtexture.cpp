@@ -46,6 +46,8 @@ extern "C"
 #include "bitmap.h"
 #include "v_video.h"
 #include "textures/textures.h"
+#include "textures/asyncdecode.h"
+#include <memory>
 
 
 struct FLumpSourceMgr : public jpeg_source_mgr
@@ -173,6 +175,16 @@ void JPEG_OutputMessage (j_common_ptr cinfo)
 	Printf (TEXTCOLOR_ORANGE "JPEG failure: %s\n", buffer);
 }
 
+//==========================================================================
+//
+// For decoding on worker threads, which must not print anything
+//
+//==========================================================================
+
+static void JPEG_SilentMessage (j_common_ptr cinfo)
+{
+}
+
 //==========================================================================
 //
 // A JPEG texture
@@ -198,6 +210,8 @@ protected:
 	Span DummySpans[2];
 
 	void MakeTexture ();
+	BYTE *DecodePixels (FileReader *lump, int scaledenom, bool silent);
+	static void ConvertRow (const jpeg_decompress_struct &cinfo, const BYTE *in, BYTE *out, int count, int step);
 
 	friend class FTexture;
 };
@@ -295,6 +309,7 @@ FJPEGTexture::~FJPEGTexture ()
 
 void FJPEGTexture::Unload ()
 {
+	FAsyncTextureDecode::Cancel(this);
 	if (Pixels != NULL)
 	{
 		delete[] Pixels;
@@ -366,95 +381,185 @@ const BYTE *FJPEGTexture::GetPixels ()
 
 void FJPEGTexture::MakeTexture ()
 {
+	if (FAsyncTextureDecode::Wanted(this, Width, Height))
+	{
+		// The worker thread may not use the shared file readers, so the
+		// compressed data is read here and decoded from memory.
+		auto data = std::make_shared<FMemLump>(Wads.ReadLump(SourceLump));
+		MemoryReader reader((const char *)data->GetMem(), (long)data->GetSize());
+
+		// DCT scaling makes a 1/8 size decode much cheaper than the full image,
+		// so that is what is shown until the worker is done.
+		Pixels = DecodePixels(&reader, 8, true);
+		if (Pixels != NULL)
+		{
+			FAsyncTextureDecode::Start(this,
+				[this, data]() -> BYTE *
+				{
+					MemoryReader reader((const char *)data->GetMem(), (long)data->GetSize());
+					return DecodePixels(&reader, 1, true);
+				},
+				[this](BYTE *pixels)
+				{
+					delete[] Pixels;
+					Pixels = pixels;
+					if (Pixels == NULL)
+					{
+						// Decode again on this thread so that the error gets reported.
+						MakeTexture ();
+					}
+				});
+			return;
+		}
+	}
+
 	FWadLump lump = Wads.OpenLumpNum (SourceLump);
+	Pixels = DecodePixels(&lump, 1, false);
+}
+
+//==========================================================================
+//
+// FJPEGTexture :: DecodePixels
+//
+// Returns the image in paletted, column-major form. A scaledenom larger
+// than 1 decodes at reduced resolution and scales that up to full size.
+// If silent is set nothing is printed and NULL is returned on failure,
+// which makes this safe to call from a worker thread.
+//
+//==========================================================================
+
+BYTE *FJPEGTexture::DecodePixels (FileReader *lump, int scaledenom, bool silent)
+{
 	JSAMPLE *buff = NULL;
+	BYTE *small = NULL;
+	BYTE *pixels;
+	bool failed = false;
 
 	jpeg_decompress_struct cinfo;
 	jpeg_error_mgr jerr;
 
-	Pixels = new BYTE[Width * Height];
-	memset (Pixels, 0xBA, Width * Height);
+	pixels = new BYTE[Width * Height];
+	memset (pixels, 0xBA, Width * Height);
 
 	cinfo.err = jpeg_std_error(&jerr);
-	cinfo.err->output_message = JPEG_OutputMessage;
+	cinfo.err->output_message = silent ? JPEG_SilentMessage : JPEG_OutputMessage;
 	cinfo.err->error_exit = JPEG_ErrorExit;
 	jpeg_create_decompress(&cinfo);
 	try
 	{
-		FLumpSourceMgr sourcemgr(&lump, &cinfo);
+		FLumpSourceMgr sourcemgr(lump, &cinfo);
 		jpeg_read_header(&cinfo, TRUE);
 		if (!((cinfo.out_color_space == JCS_RGB && cinfo.num_components == 3) ||
 			  (cinfo.out_color_space == JCS_CMYK && cinfo.num_components == 4) ||
 			  (cinfo.out_color_space == JCS_GRAYSCALE && cinfo.num_components == 1)))
 		{
-			Printf (TEXTCOLOR_ORANGE "Unsupported color format\n");
+			if (!silent) Printf (TEXTCOLOR_ORANGE "Unsupported color format\n");
 			throw -1;
 		}
 
+		cinfo.scale_num = 1;
+		cinfo.scale_denom = scaledenom;
 		jpeg_start_decompress(&cinfo);
 
-		int y = 0;
-		buff = new BYTE[cinfo.output_width * cinfo.output_components];
+		int outwidth = cinfo.output_width;
+		int outheight = cinfo.output_height;
+		bool fullsize = outwidth == Width && outheight == Height;
+		BYTE *dest = fullsize ? pixels : (small = new BYTE[outwidth * outheight]);
+		buff = new BYTE[outwidth * cinfo.output_components];
 
 		while (cinfo.output_scanline < cinfo.output_height)
 		{
-			int num_scanlines = jpeg_read_scanlines(&cinfo, &buff, 1);
-			BYTE *in = buff;
-			BYTE *out = Pixels + y;
-			switch (cinfo.out_color_space)
-			{
-			case JCS_RGB:
-				for (int x = Width; x > 0; --x)
-				{
-					*out = RGB256k.RGB[in[0]>>2][in[1]>>2][in[2]>>2];
-					out += Height;
-					in += 3;
-				}
-				break;
-
-			case JCS_GRAYSCALE:
-				for (int x = Width; x > 0; --x)
-				{
-					*out = GrayMap[in[0]];
-					out += Height;
-					in += 1;
-				}
-				break;
+			int y = cinfo.output_scanline;
+			jpeg_read_scanlines(&cinfo, &buff, 1);
+			ConvertRow (cinfo, buff, dest + y, outwidth, outheight);
+		}
+		jpeg_finish_decompress(&cinfo);
 
-			case JCS_CMYK:
-				// What are you doing using a CMYK image? :)
-				for (int x = Width; x > 0; --x)
+		if (!fullsize)
+		{
+			for (int x = 0; x < Width; ++x)
+			{
+				const BYTE *in = small + (x * outwidth / Width) * outheight;
+				BYTE *out = pixels + x * Height;
+				for (int y = 0; y < Height; ++y)
 				{
-					// To be precise, these calculations should use 255, but
-					// 256 is much faster and virtually indistinguishable.
-					int r = in[3] - (((256-in[0])*in[3]) >> 8);
-					int g = in[3] - (((256-in[1])*in[3]) >> 8);
-					int b = in[3] - (((256-in[2])*in[3]) >> 8);
-					*out = RGB256k.RGB[r >> 2][g >> 2][b >> 2];
-					out += Height;
-					in += 4;
+					*out++ = in[y * outheight / Height];
 				}
-				break;
-
-			default:
-				// The other colorspaces were considered above and discarded,
-				// but GCC will complain without a default for them here.
-				break;
 			}
-			y++;
 		}
-		jpeg_finish_decompress(&cinfo);
-		jpeg_destroy_decompress(&cinfo);
 	}
 	catch (int)
 	{
-		Printf (TEXTCOLOR_ORANGE "   in texture %s\n", Name.GetChars());
-		jpeg_destroy_decompress(&cinfo);
+		if (!silent) Printf (TEXTCOLOR_ORANGE "   in texture %s\n", Name.GetChars());
+		failed = true;
 	}
+	jpeg_destroy_decompress(&cinfo);
 	if (buff != NULL)
 	{
 		delete[] buff;
 	}
+	if (small != NULL)
+	{
+		delete[] small;
+	}
+	if (failed && silent)
+	{
+		delete[] pixels;
+		return NULL;
+	}
+	return pixels;
+}
+
+//==========================================================================
+//
+// FJPEGTexture :: ConvertRow
+//
+// Converts one decoded scanline to the palette, writing every step'th byte.
+//
+//==========================================================================
+
+void FJPEGTexture::ConvertRow (const jpeg_decompress_struct &cinfo, const BYTE *in, BYTE *out, int count, int step)
+{
+	switch (cinfo.out_color_space)
+	{
+	case JCS_RGB:
+		for (int x = count; x > 0; --x)
+		{
+			*out = RGB256k.RGB[in[0]>>2][in[1]>>2][in[2]>>2];
+			out += step;
+			in += 3;
+		}
+		break;
+
+	case JCS_GRAYSCALE:
+		for (int x = count; x > 0; --x)
+		{
+			*out = GrayMap[in[0]];
+			out += step;
+			in += 1;
+		}
+		break;
+
+	case JCS_CMYK:
+		// What are you doing using a CMYK image? :)
+		for (int x = count; x > 0; --x)
+		{
+			// To be precise, these calculations should use 255, but
+			// 256 is much faster and virtually indistinguishable.
+			int r = in[3] - (((256-in[0])*in[3]) >> 8);
+			int g = in[3] - (((256-in[1])*in[3]) >> 8);
+			int b = in[3] - (((256-in[2])*in[3]) >> 8);
+			*out = RGB256k.RGB[r >> 2][g >> 2][b >> 2];
+			out += step;
+			in += 4;
+		}
+		break;
+
+	default:
+		// The other colorspaces were considered above and discarded,
+		// but GCC will complain without a default for them here.
+		break;
+	}
 }
 
 
@@ -34,6 +34,14 @@
 */
 
 #include <ctype.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
 #include "doomtype.h"
 #include "files.h"
 #include "w_wad.h"
@@ -52,6 +60,17 @@
 #include "m_fixed.h"
 #include "textures/textures.h"
 #include "r_data/colormaps.h"
+#include "m_misc.h"
+#include "md5.h"
+#include "c_cvars.h"
+#include "jobqueue.h"
+#include <zlib.h>
+
+// Composited pixels and spans of multipatch textures are stored in the cache
+// directory, so that subsequent runs don't need to composite them again.
+CVAR(Bool, r_cachecomposites, true, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
+// Size limit of the composite cache in MB. The oldest files go first.
+CVAR(Int, r_compositecache_size, 64, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
 
 // On the Alpha, accessing the shorts directly if they aren't aligned on a
 // 4-byte boundary causes unaligned access warnings. Why it does this at
@@ -164,6 +183,7 @@ public:
 
 	int CopyTrueColorPixels(FBitmap *bmp, int x, int y, int rotate, FCopyInfo *inf = NULL);
 	int GetSourceLump() { return DefinitionLump; }
+	void GetPatchLumps(TArray<int> &lumps);
 	FTexture *GetRedirect(bool wantwarped);
 	FTexture *GetRawTexture();
 	void ResolvePatches();
@@ -205,6 +225,10 @@ protected:
 	void MakeTexture ();
 
 private:
+	bool GetCompositeKey(MD5Context &md5);
+	bool ReadCachedComposite(const BYTE *key);
+	void WriteCachedComposite(const BYTE *key);
+
 	void CheckForHacks ();
 	void ParsePatch(FScanner &sc, TexPart & part, TexInit &init);
 };
@@ -474,6 +498,524 @@ BYTE *GetBlendMap(PalEntry blend, BYTE *blendwork)
 	return NULL;
 }
 
+//==========================================================================
+//
+// Composite cache
+//
+// The key of a cached composite is an MD5 over the texture's definition
+// (size and all part parameters) and the identity of every lump that
+// contributes pixels to it: the lump's name, number and size plus the
+// size and modification time of the file that holds it. Any change to a
+// patch file or the definition therefore causes a cache miss instead of
+// stale data, without having to read the patches themselves.
+//
+// Cache files are written on the job queue, and the directory is kept
+// below r_compositecache_size by deleting the oldest files.
+//
+//==========================================================================
+
+struct FCompositeLumpHash
+{
+	BYTE Hash[16];
+	bool Valid;
+	bool Usable;
+};
+
+struct FCompositeFileStamp
+{
+	long long Size;
+	long long Time;
+	bool Valid;
+	bool Exists;
+	bool IsDirectory;
+};
+
+struct FCompositeCacheFile
+{
+	std::string Path;
+	size_t Size;
+	long long Time;
+};
+
+static TArray<FCompositeLumpHash> CompositeLumpHashes;
+static TArray<FCompositeFileStamp> CompositeFileStamps;
+static BYTE CompositePaletteHash[16];
+static bool CompositePaletteHashed;
+static bool CompositePathCreated;
+
+// Shared with the jobs that write cache files.
+static std::mutex CompositeCacheMutex;
+static std::vector<FCompositeCacheFile> CompositeCacheFiles;	// oldest first
+static size_t CompositeCacheBytes;
+static bool CompositeCacheScanned;
+static std::set<std::string> CompositeCacheWrites;				// files being written
+
+enum
+{
+	COMPOSITE_CACHE_VERSION = 2
+};
+
+//==========================================================================
+//
+// Fills in the size and time of a file. Returns false if it doesn't exist.
+//
+//==========================================================================
+
+static bool GetCompositeFileStamp(const char *path, FCompositeFileStamp &stamp)
+{
+	struct stat info;
+	stamp.Valid = true;
+	stamp.Exists = stat(path, &info) == 0;
+	stamp.IsDirectory = stamp.Exists && (info.st_mode & S_IFDIR);
+	stamp.Size = stamp.Exists ? (long long)info.st_size : 0;
+	stamp.Time = stamp.Exists ? (long long)info.st_mtime : 0;
+	return stamp.Exists;
+}
+
+//==========================================================================
+//
+// Patches are shared by many textures so their hashes are only calculated
+// once per lump. Returns NULL if the lump's file cannot be identified.
+//
+//==========================================================================
+
+static const BYTE *GetCompositeLumpHash(int lump)
+{
+	if ((unsigned)lump >= CompositeLumpHashes.Size())
+	{
+		unsigned oldsize = CompositeLumpHashes.Size();
+		CompositeLumpHashes.Resize(MAX(lump + 1, Wads.GetNumLumps()));
+		for (unsigned i = oldsize; i < CompositeLumpHashes.Size(); i++)
+		{
+			CompositeLumpHashes[i].Valid = false;
+		}
+	}
+	FCompositeLumpHash &entry = CompositeLumpHashes[lump];
+	if (!entry.Valid)
+	{
+		int wadnum = Wads.GetLumpFile(lump);
+		if ((unsigned)wadnum >= CompositeFileStamps.Size())
+		{
+			unsigned oldsize = CompositeFileStamps.Size();
+			CompositeFileStamps.Resize(MAX(wadnum + 1, Wads.GetNumWads()));
+			for (unsigned i = oldsize; i < CompositeFileStamps.Size(); i++)
+			{
+				CompositeFileStamps[i].Valid = false;
+			}
+		}
+		const char *filename = Wads.GetWadFullName(wadnum);
+		FCompositeFileStamp stamp = CompositeFileStamps[wadnum];
+		if (!stamp.Valid)
+		{
+			GetCompositeFileStamp(filename, stamp);
+			CompositeFileStamps[wadnum] = stamp;
+		}
+		if (stamp.IsDirectory)
+		{
+			// A directory's time says nothing about the files inside it.
+			FString lumppath = filename;
+			if (lumppath.IsNotEmpty() && lumppath[lumppath.Len() - 1] != '/') lumppath << '/';
+			lumppath << Wads.GetLumpFullName(lump);
+			GetCompositeFileStamp(lumppath, stamp);
+		}
+
+		entry.Valid = true;
+		entry.Usable = stamp.Exists;
+		if (entry.Usable)
+		{
+			long long info[4] = { stamp.Size, stamp.Time, (long long)lump, (long long)Wads.LumpLength(lump) };
+			const char *lumpname = Wads.GetLumpFullName(lump);
+			MD5Context md5;
+			md5.Update((const BYTE *)filename, (unsigned)strlen(filename) + 1);
+			md5.Update((const BYTE *)lumpname, (unsigned)strlen(lumpname) + 1);
+			md5.Update((const BYTE *)info, sizeof(info));
+			md5.Final(entry.Hash);
+		}
+	}
+	return entry.Usable ? entry.Hash : NULL;
+}
+
+//==========================================================================
+//
+// Called by the texture manager when all textures get deleted because
+// neither lump numbers nor the palette are stable across a restart.
+//
+//==========================================================================
+
+void R_FlushCompositeCacheHashes()
+{
+	CompositeLumpHashes.Clear();
+	CompositeFileStamps.Clear();
+	CompositePaletteHashed = false;
+}
+
+static FString CreateCompositeCacheName(const BYTE *key, bool create)
+{
+	FString path = M_GetCachePath(create);
+	path << "/textures";
+	if (create && !CompositePathCreated)
+	{
+		CreatePath(path);
+		CompositePathCreated = true;
+	}
+	path << '/';
+	for (int i = 0; i < 16; i++)
+	{
+		path.AppendFormat("%02x", key[i]);
+	}
+	path << ".ztc";
+	return path;
+}
+
+//==========================================================================
+//
+// Lists the files already in the cache, oldest first, so that the size
+// limit also covers what earlier runs left behind.
+//
+//==========================================================================
+
+static void ScanCompositeCache()
+{
+	TArray<FFileList> list;
+	FString path = M_GetCachePath(false);
+	path << "/textures/";
+
+	CompositeCacheScanned = true;
+	try
+	{
+		ScanDirectory(list, path);
+	}
+	catch (CRecoverableError &)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(CompositeCacheMutex);
+	for (unsigned i = 0; i < list.Size(); i++)
+	{
+		FCompositeFileStamp stamp;
+		if (!list[i].isDirectory && list[i].Filename.Len() > 4 &&
+			!stricmp(list[i].Filename.Right(4), ".ztc") && GetCompositeFileStamp(list[i].Filename, stamp))
+		{
+			CompositeCacheFiles.push_back({ list[i].Filename.GetChars(), (size_t)stamp.Size, stamp.Time });
+			CompositeCacheBytes += (size_t)stamp.Size;
+		}
+	}
+	std::stable_sort(CompositeCacheFiles.begin(), CompositeCacheFiles.end(),
+		[](const FCompositeCacheFile &a, const FCompositeCacheFile &b) { return a.Time < b.Time; });
+}
+
+//==========================================================================
+//
+// Records a newly written file and deletes the oldest ones until the
+// cache fits its limit again. Must be called with the mutex held.
+//
+//==========================================================================
+
+static void AddCompositeCacheFile(const std::string &path, size_t size, size_t limit)
+{
+	for (size_t i = 0; i < CompositeCacheFiles.size(); i++)
+	{
+		if (CompositeCacheFiles[i].Path == path)
+		{
+			CompositeCacheBytes -= CompositeCacheFiles[i].Size;
+			CompositeCacheFiles.erase(CompositeCacheFiles.begin() + i);
+			break;
+		}
+	}
+	CompositeCacheFiles.push_back({ path, size, (long long)time(NULL) });
+	CompositeCacheBytes += size;
+
+	size_t evict = 0;
+	while (CompositeCacheBytes > limit && evict < CompositeCacheFiles.size())
+	{
+		remove(CompositeCacheFiles[evict].Path.c_str());
+		CompositeCacheBytes -= CompositeCacheFiles[evict].Size;
+		evict++;
+	}
+	CompositeCacheFiles.erase(CompositeCacheFiles.begin(), CompositeCacheFiles.begin() + evict);
+}
+
+//==========================================================================
+//
+// FMultiPatchTexture :: GetCompositeKey
+//
+// Returns false if the texture depends on something that cannot be
+// identified by lump contents, like camera or warped textures.
+//
+//==========================================================================
+
+bool FMultiPatchTexture::GetCompositeKey(MD5Context &md5)
+{
+	// Paletted composition and all blend maps depend on the base palette.
+	if (!CompositePaletteHashed)
+	{
+		MD5Context palmd5;
+		palmd5.Update((const BYTE *)GPalette.BaseColors, sizeof(GPalette.BaseColors));
+		palmd5.Final(CompositePaletteHash);
+		CompositePaletteHashed = true;
+	}
+	md5.Update(CompositePaletteHash, 16);
+
+	DWORD header[5] = { (DWORD)Width, (DWORD)Height, (DWORD)HeightBits, (DWORD)bComplex, (DWORD)NumParts };
+	md5.Update((const BYTE *)header, sizeof(header));
+
+	for (int i = 0; i < NumParts; i++)
+	{
+		const TexPart &part = Parts[i];
+		FTexture *tex = part.Texture;
+
+		if (tex->bHasCanvas || tex->bWarped)
+		{
+			return false;
+		}
+
+		DWORD partinfo[8] = { (DWORD)part.OriginX, (DWORD)part.OriginY, part.Rotate, part.op,
+			(DWORD)part.Blend, (DWORD)part.Alpha, (DWORD)tex->GetWidth(), (DWORD)tex->GetHeight() };
+		md5.Update((const BYTE *)partinfo, sizeof(partinfo));
+
+		if (part.Translation != NULL)
+		{
+			md5.Update(part.Translation->Remap, part.Translation->NumEntries);
+			md5.Update((const BYTE *)part.Translation->Palette, part.Translation->NumEntries * sizeof(PalEntry));
+		}
+
+		if (tex->bMultiPatch)
+		{
+			if (!static_cast<FMultiPatchTexture *>(tex)->GetCompositeKey(md5))
+			{
+				return false;
+			}
+		}
+		else
+		{
+			const BYTE *lumphash = tex->GetSourceLump() >= 0 ? GetCompositeLumpHash(tex->GetSourceLump()) : NULL;
+			if (lumphash == NULL)
+			{
+				return false;
+			}
+			md5.Update(lumphash, 16);
+		}
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// FMultiPatchTexture :: ReadCachedComposite
+//
+// Cache file layout (little endian):
+//   "ZTXC", version, key[16], width, height, numpix, numspans, compressed size
+//   followed by the zlib compressed pixels, per-column span offsets and spans.
+//
+//==========================================================================
+
+bool FMultiPatchTexture::ReadCachedComposite(const BYTE *key)
+{
+	FString path = CreateCompositeCacheName(key, false);
+	{
+		std::lock_guard<std::mutex> lock(CompositeCacheMutex);
+		if (CompositeCacheWrites.count(path.GetChars()))
+		{
+			return false;
+		}
+	}
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) return false;
+
+	char magic[4];
+	DWORD header[7];
+	BYTE filekey[16];
+	BYTE *compressed = NULL;
+	BYTE *data = NULL;
+	bool ok = false;
+
+	if (fread(magic, 1, 4, f) == 4 && !memcmp(magic, "ZTXC", 4) &&
+		fread(header, 4, 1, f) == 1 && LittleLong(header[0]) == COMPOSITE_CACHE_VERSION &&
+		fread(filekey, 1, 16, f) == 16 && !memcmp(filekey, key, 16) &&
+		fread(header + 1, 4, 6, f) == 6)
+	{
+		DWORD width = LittleLong(header[1]);
+		DWORD height = LittleLong(header[2]);
+		DWORD numpix = LittleLong(header[3]);
+		DWORD numspans = LittleLong(header[4]);
+		DWORD complen = LittleLong(header[5]);
+		DWORD datalen = LittleLong(header[6]);
+
+		// Every column needs at least its terminator, and no column can
+		// have more spans than every other pixel starting a new one.
+		if (width == (DWORD)Width && height == (DWORD)Height &&
+			numpix == DWORD(Width * Height + (1 << HeightBits) - Height) &&
+			numspans >= (DWORD)Width && numspans <= DWORD(Width * (Height / 2 + 2)) &&
+			datalen == numpix + Width * 4 + numspans * 4 && complen <= compressBound(datalen))
+		{
+			compressed = new BYTE[complen];
+			data = new BYTE[datalen];
+			uLongf outlen = datalen;
+			if (fread(compressed, 1, complen, f) == complen &&
+				uncompress(data, &outlen, compressed, complen) == Z_OK && outlen == datalen)
+			{
+				Pixels = new BYTE[numpix];
+				memcpy(Pixels, data, numpix);
+
+				if (Spans == NULL)
+				{
+					// Rebuild the exact layout CreateSpans produces so that FreeSpans can release it.
+					const DWORD *offsets = (const DWORD *)(data + numpix);
+					const WORD *spandata = (const WORD *)(data + numpix + Width * 4);
+					Span **spans = (Span **)M_Malloc(sizeof(Span*)*Width + sizeof(Span)*numspans);
+					Span *span = (Span *)&spans[Width];
+					for (DWORD i = 0; i < numspans; i++)
+					{
+						span[i].TopOffset = LittleShort(spandata[i * 2]);
+						span[i].Length = LittleShort(spandata[i * 2 + 1]);
+					}
+					ok = true;
+					for (int x = 0; x < Width && ok; x++)
+					{
+						// Each column's list must lie inside the texture, go
+						// downward and end with a terminator inside the block.
+						DWORD ofs = LittleLong(offsets[x]);
+						int top = 0;
+						for (;;)
+						{
+							if (ofs >= numspans)
+							{
+								ok = false;
+								break;
+							}
+							const Span &s = span[ofs++];
+							if (s.Length == 0)
+							{
+								break;
+							}
+							if (s.TopOffset < top || s.TopOffset + s.Length > Height)
+							{
+								ok = false;
+								break;
+							}
+							top = s.TopOffset + s.Length;
+						}
+						if (ok) spans[x] = span + LittleLong(offsets[x]);
+					}
+					if (ok) Spans = spans;
+					else M_Free(spans);
+				}
+				else
+				{
+					ok = true;
+				}
+				if (!ok)
+				{
+					delete[] Pixels;
+					Pixels = NULL;
+				}
+			}
+		}
+	}
+	delete[] compressed;
+	delete[] data;
+	fclose(f);
+	return ok;
+}
+
+//==========================================================================
+//
+// FMultiPatchTexture :: WriteCachedComposite
+//
+// Only copies the data here. Compressing and writing it is left to the
+// job queue so that it does not hold up the renderer.
+//
+//==========================================================================
+
+void FMultiPatchTexture::WriteCachedComposite(const BYTE *key)
+{
+	int numpix = Width * Height + (1 << HeightBits) - Height;
+	size_t limit = size_t(MAX<int>(r_compositecache_size, 0)) << 20;
+
+	if (limit == 0)
+	{
+		return;
+	}
+	if (!CompositeCacheScanned)
+	{
+		ScanCompositeCache();
+	}
+	std::string path = CreateCompositeCacheName(key, true).GetChars();
+	{
+		std::lock_guard<std::mutex> lock(CompositeCacheMutex);
+		if (!CompositeCacheWrites.insert(path).second)
+		{
+			return;
+		}
+	}
+
+	if (Spans == NULL)
+	{
+		// The renderer will ask for them right away anyway.
+		Spans = CreateSpans(Pixels);
+	}
+
+	// All spans are allocated in one block after the column pointers.
+	Span *base = (Span *)&Spans[Width];
+	DWORD numspans = 0;
+	for (int x = 0; x < Width; x++)
+	{
+		const Span *span = Spans[x];
+		while (span->Length != 0) span++;
+		numspans = MAX<DWORD>(numspans, DWORD(span - base) + 1);
+	}
+
+	auto data = std::make_shared<std::vector<BYTE>>(numpix + Width * 4 + numspans * 4);
+	memcpy(data->data(), Pixels, numpix);
+	DWORD *offsets = (DWORD *)(data->data() + numpix);
+	WORD *spandata = (WORD *)(data->data() + numpix + Width * 4);
+	for (int x = 0; x < Width; x++)
+	{
+		offsets[x] = LittleLong(DWORD(Spans[x] - base));
+	}
+	for (DWORD i = 0; i < numspans; i++)
+	{
+		spandata[i * 2] = LittleShort(base[i].TopOffset);
+		spandata[i * 2 + 1] = LittleShort(base[i].Length);
+	}
+
+	std::array<BYTE, 16> filekey;
+	memcpy(filekey.data(), key, 16);
+	DWORD header[7] = { LittleLong(DWORD(COMPOSITE_CACHE_VERSION)), LittleLong(DWORD(Width)), LittleLong(DWORD(Height)),
+		LittleLong(DWORD(numpix)), LittleLong(numspans), 0, LittleLong(DWORD(data->size())) };
+	std::array<DWORD, 7> fileheader;
+	memcpy(fileheader.data(), header, sizeof(header));
+
+	FJobQueue::Run([path, data, filekey, fileheader, limit]() mutable
+	{
+		uLongf complen = compressBound((uLong)data->size());
+		std::vector<BYTE> compressed(complen);
+		bool written = false;
+
+		if (compress(compressed.data(), &complen, data->data(), (uLong)data->size()) == Z_OK)
+		{
+			FILE *f = fopen(path.c_str(), "wb");
+			if (f != NULL)
+			{
+				fileheader[5] = LittleLong(DWORD(complen));
+				written = fwrite("ZTXC", 4, 1, f) == 1 && fwrite(&fileheader[0], 4, 1, f) == 1 &&
+					fwrite(filekey.data(), 16, 1, f) == 1 && fwrite(&fileheader[1], 4, 6, f) == 6 &&
+					fwrite(compressed.data(), complen, 1, f) == 1;
+				written &= fclose(f) == 0;
+				if (!written) remove(path.c_str());
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(CompositeCacheMutex);
+		if (written)
+		{
+			AddCompositeCacheFile(path, 4 + sizeof(fileheader) + 16 + complen, limit);
+		}
+		CompositeCacheWrites.erase(path);
+	});
+}
+
 //==========================================================================
 //
 // FMultiPatchTexture :: MakeTexture
@@ -487,6 +1029,24 @@ void FMultiPatchTexture::MakeTexture ()
 	int numpix = Width * Height + (1 << HeightBits) - Height;
 	BYTE blendwork[256];
 	bool hasTranslucent = false;
+	BYTE cachekey[16];
+	bool usecache = false;
+
+	// Single-patch textures are cheap enough to composite so they are not worth
+	// a cache file of their own.
+	if (r_cachecomposites && (NumParts > 1 || bComplex))
+	{
+		MD5Context md5;
+		usecache = GetCompositeKey(md5);
+		if (usecache)
+		{
+			md5.Final(cachekey);
+			if (ReadCachedComposite(cachekey))
+			{
+				return;
+			}
+		}
+	}
 
 	Pixels = new BYTE[numpix];
 	memset (Pixels, 0, numpix);
@@ -539,6 +1099,10 @@ void FMultiPatchTexture::MakeTexture ()
 		}
 		delete [] buffer;
 	}
+	if (usecache)
+	{
+		WriteCachedComposite(cachekey);
+	}
 }
 
 //===========================================================================
@@ -795,6 +1359,23 @@ FTexture *FMultiPatchTexture::GetRawTexture()
 	return NumParts == 1 ? Parts->Texture : this;
 }
 
+//==========================================================================
+//
+// FMultiPatchTexture :: GetPatchLumps
+//
+//==========================================================================
+
+void FMultiPatchTexture::GetPatchLumps(TArray<int> &lumps)
+{
+	for (int i = 0; i < NumParts; ++i)
+	{
+		if (Parts[i].Texture != NULL)
+		{
+			Parts[i].Texture->GetPatchLumps(lumps);
+		}
+	}
+}
+
 //==========================================================================
 //
 // FMultiPatchTexture :: TexPart :: TexPart
@@ -41,6 +41,8 @@
 #include "bitmap.h"
 #include "v_palette.h"
 #include "textures/textures.h"
+#include "textures/asyncdecode.h"
+#include <memory>
 
 //==========================================================================
 //
@@ -79,10 +81,20 @@ protected:
 	DWORD StartOfIDAT;
 
 	void MakeTexture ();
+	BYTE *DecodePixels (FileReader *lump);
+	void FinishAsyncDecode (BYTE *pixels);
+	static void StoreRow (void *userdata, int y, const BYTE *row);
 
 	friend class FTexture;
 };
 
+// Destination of M_ReadIDATRows when decoding straight into the texture's layout
+struct FPNGRowTarget
+{
+	const FPNGTexture *Texture;
+	BYTE *Pixels;
+};
+
 
 //==========================================================================
 //
@@ -373,6 +385,12 @@ FPNGTexture::~FPNGTexture ()
 
 void FPNGTexture::Unload ()
 {
+	if (FAsyncTextureDecode::Cancel(this) && Spans != NULL)
+	{
+		// These were made for the placeholder.
+		FreeSpans (Spans);
+		Spans = NULL;
+	}
 	if (Pixels != NULL)
 	{
 		delete[] Pixels;
@@ -460,6 +478,24 @@ void FPNGTexture::MakeTexture ()
 {
 	FileReader *lump;
 
+	if (StartOfIDAT != 0 && FAsyncTextureDecode::Wanted(this, Width, Height))
+	{
+		// The worker thread may not use the shared file readers, so the
+		// compressed data is read here and decoded from memory.
+		auto data = std::make_shared<FMemLump>(Wads.ReadLump(SourceLump));
+
+		Pixels = new BYTE[Width*Height];
+		memset (Pixels, bMasked ? 0 : GrayMap[128], Width*Height);
+		FAsyncTextureDecode::Start(this,
+			[this, data]() -> BYTE *
+			{
+				MemoryReader reader((const char *)data->GetMem(), (long)data->GetSize());
+				return DecodePixels(&reader);
+			},
+			[this](BYTE *pixels) { FinishAsyncDecode(pixels); });
+		return;
+	}
+
 	if (SourceLump >= 0)
 	{
 		lump = new FWadLump(Wads.OpenLumpNum(SourceLump));
@@ -469,10 +505,51 @@ void FPNGTexture::MakeTexture ()
 		lump = fr;// new FileReader(SourceFile.GetChars());
 	}
 
-	Pixels = new BYTE[Width*Height];
+	Pixels = DecodePixels(lump);
+	if (lump != fr) delete lump;
+}
+
+//==========================================================================
+//
+// FPNGTexture :: FinishAsyncDecode
+//
+// Replaces the placeholder with the real image.
+//
+//==========================================================================
+
+void FPNGTexture::FinishAsyncDecode (BYTE *pixels)
+{
+	if (Pixels != NULL)
+	{
+		delete[] Pixels;
+	}
+	Pixels = pixels;
+	if (Spans != NULL)
+	{
+		FreeSpans (Spans);
+		Spans = NULL;
+	}
+	if (Pixels == NULL)
+	{
+		MakeTexture ();
+	}
+}
+
+//==========================================================================
+//
+// FPNGTexture :: DecodePixels
+//
+// Returns the image in paletted, column-major form. This must not
+// depend on anything that isn't safe to use from a worker thread.
+//
+//==========================================================================
+
+BYTE *FPNGTexture::DecodePixels (FileReader *lump)
+{
+	BYTE *pixels = new BYTE[Width*Height];
 	if (StartOfIDAT == 0)
 	{
-		memset (Pixels, 0x99, Width*Height);
+		memset (pixels, 0x99, Width*Height);
 	}
 	else
 	{
@@ -481,19 +558,25 @@ void FPNGTexture::MakeTexture ()
 		lump->Read(&len, 4);
 		lump->Read(&id, 4);
 
-		if (ColorType == 0 || ColorType == 3)	/* Grayscale and paletted */
+		if (!Interlace)
 		{
-			M_ReadIDAT (lump, Pixels, Width, Height, Width, BitDepth, ColorType, Interlace, BigLong((unsigned int)len));
+			// Rows are converted into their final place as they are decoded.
+			FPNGRowTarget target = { this, pixels };
+			M_ReadIDATRows (lump, Width, Height, BitDepth, ColorType, BigLong((unsigned int)len), StoreRow, &target);
+		}
+		else if (ColorType == 0 || ColorType == 3)	/* Grayscale and paletted */
+		{
+			M_ReadIDAT (lump, pixels, Width, Height, Width, BitDepth, ColorType, Interlace, BigLong((unsigned int)len));
 
 			if (Width == Height)
 			{
 				if (PaletteMap != NULL)
 				{
-					FlipSquareBlockRemap (Pixels, Width, Height, PaletteMap);
+					FlipSquareBlockRemap (pixels, Width, Height, PaletteMap);
 				}
 				else
 				{
-					FlipSquareBlock (Pixels, Width, Height);
+					FlipSquareBlock (pixels, Width, Height);
 				}
 			}
 			else
@@ -501,14 +584,14 @@ void FPNGTexture::MakeTexture ()
 				BYTE *newpix = new BYTE[Width*Height];
 				if (PaletteMap != NULL)
 				{
-					FlipNonSquareBlockRemap (newpix, Pixels, Width, Height, Width, PaletteMap);
+					FlipNonSquareBlockRemap (newpix, pixels, Width, Height, Width, PaletteMap);
 				}
 				else
 				{
-					FlipNonSquareBlock (newpix, Pixels, Width, Height, Width);
+					FlipNonSquareBlock (newpix, pixels, Width, Height, Width);
 				}
-				BYTE *oldpix = Pixels;
-				Pixels = newpix;
+				BYTE *oldpix = pixels;
+				pixels = newpix;
 				delete[] oldpix;
 			}
 		}
@@ -516,94 +599,98 @@ void FPNGTexture::MakeTexture ()
 		{
 			int bytesPerPixel = ColorType == 2 ? 3 : ColorType == 4 ? 2 : 4;
 			BYTE *tempix = new BYTE[Width * Height * bytesPerPixel];
-			BYTE *in, *out;
-			int x, y, pitch, backstep;
+			int y;
 
 			M_ReadIDAT (lump, tempix, Width, Height, Width*bytesPerPixel, BitDepth, ColorType, Interlace, BigLong((unsigned int)len));
-			in = tempix;
-			out = Pixels;
 
-			// Convert from source format to paletted, column-major.
-			// Formats with alpha maps are reduced to only 1 bit of alpha.
-			switch (ColorType)
+			FPNGRowTarget target = { this, pixels };
+			for (y = 0; y < Height; ++y)
 			{
-			case 2:		// RGB
-				pitch = Width * 3;
-				backstep = Height * pitch - 3;
-				for (x = Width; x > 0; --x)
-				{
-					for (y = Height; y > 0; --y)
-					{
-						if (!HaveTrans)
-						{
-							*out++ = RGB256k.RGB[in[0]>>2][in[1]>>2][in[2]>>2];
-						}
-						else
-						{
-							if (in[0] == NonPaletteTrans[0] &&
-								in[1] == NonPaletteTrans[1] &&
-								in[2] == NonPaletteTrans[2])
-							{
-								*out++ = 0;
-							}
-							else
-							{
-								*out++ = RGB256k.RGB[in[0]>>2][in[1]>>2][in[2]>>2];
-							}
-						}
-						in += pitch;
-					}
-					in -= backstep;
-				}
-				break;
+				StoreRow (&target, y, tempix + y * Width * bytesPerPixel);
+			}
+			delete[] tempix;
+		}
+	}
+	return pixels;
+}
 
-			case 4:		// Grayscale + Alpha
-				pitch = Width * 2;
-				backstep = Height * pitch - 2;
-				if (PaletteMap != NULL)
-				{
-					for (x = Width; x > 0; --x)
-					{
-						for (y = Height; y > 0; --y)
-						{
-							*out++ = in[1] < 128 ? 0 : PaletteMap[in[0]];
-							in += pitch;
-						}
-						in -= backstep;
-					}
-				}
-				else
-				{
-					for (x = Width; x > 0; --x)
-					{
-						for (y = Height; y > 0; --y)
-						{
-							*out++ = in[1] < 128 ? 0 : in[0];
-							in += pitch;
-						}
-						in -= backstep;
-					}
-				}
-				break;
+//==========================================================================
+//
+// FPNGTexture :: StoreRow
+//
+// Converts one decoded row from source format to paletted, column-major.
+// Formats with alpha maps are reduced to only 1 bit of alpha.
+//
+//==========================================================================
 
-			case 6:		// RGB + Alpha
-				pitch = Width * 4;
-				backstep = Height * pitch - 4;
-				for (x = Width; x > 0; --x)
-				{
-					for (y = Height; y > 0; --y)
-					{
-						*out++ = in[3] < 128 ? 0 : RGB256k.RGB[in[0]>>2][in[1]>>2][in[2]>>2];
-						in += pitch;
-					}
-					in -= backstep;
-				}
-				break;
+void FPNGTexture::StoreRow (void *userdata, int y, const BYTE *in)
+{
+	const FPNGRowTarget *target = (const FPNGRowTarget *)userdata;
+	const FPNGTexture *tex = target->Texture;
+	const BYTE *remap = tex->PaletteMap;
+	int height = tex->Height;
+	BYTE *out = target->Pixels + y;
+	int x;
+
+	switch (tex->ColorType)
+	{
+	case 0:		// Grayscale
+	case 3:		// Paletted
+		if (remap != NULL)
+		{
+			for (x = tex->Width; x > 0; --x)
+			{
+				*out = remap[*in++];
+				out += height;
 			}
-			delete[] tempix;
 		}
+		else
+		{
+			for (x = tex->Width; x > 0; --x)
+			{
+				*out = *in++;
+				out += height;
+			}
+		}
+		break;
+
+	case 2:		// RGB
+		for (x = tex->Width; x > 0; --x)
+		{
+			if (tex->HaveTrans &&
+				in[0] == tex->NonPaletteTrans[0] &&
+				in[1] == tex->NonPaletteTrans[1] &&
+				in[2] == tex->NonPaletteTrans[2])
+			{
+				*out = 0;
+			}
+			else
+			{
+				*out = RGB256k.RGB[in[0]>>2][in[1]>>2][in[2]>>2];
+			}
+			out += height;
+			in += 3;
+		}
+		break;
+
+	case 4:		// Grayscale + Alpha
+		for (x = tex->Width; x > 0; --x)
+		{
+			*out = in[1] < 128 ? 0 : remap != NULL ? remap[in[0]] : in[0];
+			out += height;
+			in += 2;
+		}
+		break;
+
+	case 6:		// RGB + Alpha
+		for (x = tex->Width; x > 0; --x)
+		{
+			*out = in[3] < 128 ? 0 : RGB256k.RGB[in[0]>>2][in[1]>>2][in[2]>>2];
+			out += height;
+			in += 4;
+		}
+		break;
 	}
-	if (lump != fr) delete lump;
 }
 
 //===========================================================================
@@ -97,6 +97,7 @@ FTextureManager::~FTextureManager ()
 
 void FTextureManager::DeleteAll()
 {
+	R_FlushCompositeCacheHashes();
 	for (unsigned int i = 0; i < Textures.Size(); ++i)
 	{
 		delete Textures[i].Texture;
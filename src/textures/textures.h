@@ -179,6 +179,7 @@ public:
 	int CopyTrueColorTranslated(FBitmap *bmp, int x, int y, int rotate, FRemapTable *remap, FCopyInfo *inf = NULL);
 	virtual bool UseBasePalette();
 	virtual int GetSourceLump() { return SourceLump; }
+	virtual void GetPatchLumps(TArray<int> &lumps) { if (SourceLump >= 0) lumps.Push(SourceLump); }	// all lumps the pixels are read from
 	virtual FTexture *GetRedirect(bool wantwarped);
 	virtual FTexture *GetRawTexture();		// for FMultiPatchTexture to override
 
@@ -480,6 +481,7 @@ public:
 
 	float GetSpeed() const { return Speed; }
 	int GetSourceLump() { return SourcePic->GetSourceLump(); }
+	void GetPatchLumps(TArray<int> &lumps) { SourcePic->GetPatchLumps(lumps); }
 	void SetSpeed(float fac) { Speed = fac; }
 	FTexture *GetRedirect(bool wantwarped);
 
@@ -532,6 +534,9 @@ public:
 
 extern FTextureManager TexMan;
 
+// Forgets the lump identities the composite cache keys are built from.
+void R_FlushCompositeCacheHashes();
+
 #endif
 
 
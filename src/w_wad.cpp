@@ -41,6 +41,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "doomtype.h"
 #include "m_argv.h"
@@ -57,6 +61,8 @@
 #include "resourcefiles/resourcefile.h"
 #include "md5.h"
 #include "doomstat.h"
+#include "c_console.h"
+#include "jobqueue.h"
 
 // MACROS ------------------------------------------------------------------
 
@@ -86,6 +92,8 @@ FWadCollection Wads;
 
 // PRIVATE DATA DEFINITIONS ------------------------------------------------
 
+static int NextSkinNamespace = ns_firstskin;
+
 // CODE --------------------------------------------------------------------
 
 //==========================================================================
@@ -152,6 +160,40 @@ void FWadCollection::DeleteAll ()
 	Files.Clear();
 }
 
+//==========================================================================
+//
+// An archive that was opened but has not been added to the directory yet.
+// Everything it printed while being opened is held back until then.
+// Whatever MergeFile did not take over is freed with it. This gets filled
+// on worker threads, so it must not use TArray or FString.
+//
+//==========================================================================
+
+struct FWadCollection::FOpenedFile
+{
+	std::string Filename;
+	FResourceLump *DeferredLump = NULL;	// embedded archive that must be opened on the main thread
+	FileReader *Reader = NULL;
+	FResourceFile *ResFile = NULL;
+	std::vector<FCapturedPrint> Output;
+	std::vector<std::unique_ptr<FOpenedFile>> Embedded;
+	std::exception_ptr Error;
+
+	~FOpenedFile()
+	{
+		// Embedded archives read from this one's lumps, so they go first.
+		Embedded.clear();
+		if (ResFile != NULL)
+		{
+			delete ResFile;
+		}
+		else
+		{
+			delete Reader;
+		}
+	}
+};
+
 //==========================================================================
 //
 // W_InitMultipleFiles
@@ -171,10 +213,21 @@ void FWadCollection::InitMultipleFiles (TArray<FString> &filenames)
 	DeleteAll();
 	numfiles = 0;
 
-	for(unsigned i=0;i<filenames.Size(); i++)
+	// Opening an archive is mostly waiting for the disk, so do all of them
+	// at once and add them to the directory in the original order after.
+	TDeletingArray<FOpenedFile *> opened;
+	for (unsigned i = 0; i < filenames.Size(); i++)
+	{
+		opened.Push(new FOpenedFile);
+	}
+	// If one of them fails, the ones after it are freed with the array.
+	FJobQueue::ParallelFor(filenames.Size(), [&](int i)
 	{
-		int baselump = NumLumps;
-		AddFile (filenames[i]);
+		OpenFile(*opened[i], filenames[i], NULL);
+	});
+	for (unsigned i = 0; i < opened.Size(); i++)
+	{
+		MergeFile(*opened[i]);
 	}
 
 	NumLumps = LumpInfo.Size();
@@ -226,49 +279,130 @@ int FWadCollection::AddExternalFile(const char *filename)
 
 void FWadCollection::AddFile (const char *filename, FileReader *wadinfo)
 {
-	int startlump;
-	bool isdir = false;
+	FOpenedFile file;
+
+	OpenFile(file, filename, wadinfo);
+	MergeFile(file);
+}
+
+//==========================================================================
+//
+// FWadCollection :: OpenFile
+//
+// Opens an archive and every archive embedded in it, but doesn't touch
+// the lump directory, so this can run on any thread. Errors are kept
+// for MergeFile to report at the right time.
+//
+//==========================================================================
+
+void FWadCollection::OpenFile (FOpenedFile &file, const char *filename, FileReader *wadinfo)
+{
+	std::vector<FCapturedPrint> *oldcapture = C_CaptureOutput(&file.Output);
 
-	if (wadinfo == NULL)
+	file.Filename = filename;
+	try
 	{
-		// Does this exist? If so, is it a directory?
-		struct stat info;
-		if (stat(filename, &info) != 0)
+		bool isdir = false;
+
+		if (wadinfo == NULL)
 		{
-			Printf(TEXTCOLOR_RED "Could not stat %s\n", filename);
-			PrintLastError();
-			return;
+			// Does this exist? If so, is it a directory?
+			struct stat info;
+			if (stat(filename, &info) != 0)
+			{
+				Printf(TEXTCOLOR_RED "Could not stat %s\n", filename);
+				PrintLastError();
+				C_CaptureOutput(oldcapture);
+				return;
+			}
+			isdir = (info.st_mode & S_IFDIR) != 0;
+
+			if (!isdir)
+			{
+				try
+				{
+					wadinfo = new FileReader(filename);
+				}
+				catch (CRecoverableError &err)
+				{ // Didn't find file
+					Printf (TEXTCOLOR_RED "%s\n", err.GetMessage());
+					PrintLastError ();
+					C_CaptureOutput(oldcapture);
+					return;
+				}
+			}
 		}
-		isdir = (info.st_mode & S_IFDIR) != 0;
+		file.Reader = wadinfo;
+
+		if (!batchrun) Printf (" adding %s", filename);
 
 		if (!isdir)
+			file.ResFile = FResourceFile::OpenResourceFile(filename, wadinfo);
+		else
+			file.ResFile = FResourceFile::OpenDirectory(filename);
+
+		if (file.ResFile != NULL)
 		{
-			try
+			for (DWORD i=0; i < file.ResFile->LumpCount(); i++)
 			{
-				wadinfo = new FileReader(filename);
-			}
-			catch (CRecoverableError &err)
-			{ // Didn't find file
-				Printf (TEXTCOLOR_RED "%s\n", err.GetMessage());
-				PrintLastError ();
-				return;
+				FResourceLump *lump = file.ResFile->GetLump(i);
+				if (lump->Flags & LUMPF_EMBEDDED)
+				{
+					FOpenedFile *sub = new FOpenedFile;
+					file.Embedded.emplace_back(sub);
+					sub->Filename = std::string(filename) + ':' + lump->FullName.GetChars();
+					if (lump->NeedsMainThread() && FJobQueue::IsWorkerThread())
+					{ // MergeFile opens this one when it gets to it.
+						sub->DeferredLump = lump;
+						continue;
+					}
+					OpenFile(*sub, sub->Filename.c_str(), lump->NewReader());
+					if (sub->Error)
+					{ // Nothing after this would have been opened.
+						break;
+					}
+				}
 			}
 		}
 	}
+	catch (...)
+	{
+		file.Error = std::current_exception();
+	}
+	C_CaptureOutput(oldcapture);
+}
+
+//==========================================================================
+//
+// FWadCollection :: MergeFile
+//
+// Adds an opened archive and everything embedded in it to the lump
+// directory, printing whatever they had to say on the way.
+//
+//==========================================================================
+
+void FWadCollection::MergeFile (FOpenedFile &file)
+{
+	if (file.DeferredLump != NULL)
+	{
+		OpenFile(file, file.Filename.c_str(), file.DeferredLump->NewReader());
+		file.DeferredLump = NULL;
+	}
 
-	if (!batchrun) Printf (" adding %s", filename);
-	startlump = NumLumps;
+	FResourceFile *resfile = file.ResFile;
+	FileReader *reader = file.Reader;
+	const char *filename = file.Filename.c_str();
 
-	FResourceFile *resfile;
-	
-	if (!isdir)
-		resfile = FResourceFile::OpenResourceFile(filename, wadinfo);
-	else
-		resfile = FResourceFile::OpenDirectory(filename);
+	C_ReplayOutput(file.Output);
+	if (file.Error)
+	{
+		std::rethrow_exception(file.Error);
+	}
 
 	if (resfile != NULL)
 	{
 		DWORD lumpstart = LumpInfo.Size();
+		int skinnamespace = -1;
 
 		resfile->SetFirstLump(lumpstart);
 		for (DWORD i=0; i < resfile->LumpCount(); i++)
@@ -276,6 +410,11 @@ void FWadCollection::AddFile (const char *filename, FileReader *wadinfo)
 			FResourceLump *lump = resfile->GetLump(i);
 			FWadCollection::LumpRecord *lump_p = &LumpInfo[LumpInfo.Reserve(1)];
 
+			if (lump->Namespace == ns_firstskin)
+			{ // See FWadFile::SkinHack
+				if (skinnamespace < 0) skinnamespace = NextSkinNamespace++;
+				lump->Namespace = skinnamespace;
+			}
 			lump_p->lump = lump;
 			lump_p->wadnum = Files.Size();
 		}
@@ -285,17 +424,12 @@ void FWadCollection::AddFile (const char *filename, FileReader *wadinfo)
 			resfile->FindStrifeTeaserVoices();
 		}
 		Files.Push(resfile);
+		file.ResFile = NULL;
+		file.Reader = NULL;
 
-		for (DWORD i=0; i < resfile->LumpCount(); i++)
+		for (unsigned i = 0; i < file.Embedded.size(); i++)
 		{
-			FResourceLump *lump = resfile->GetLump(i);
-			if (lump->Flags & LUMPF_EMBEDDED)
-			{
-				FString path;
-				path.Format("%s:%s", filename, lump->FullName.GetChars());
-				FileReader *embedded = lump->NewReader();
-				AddFile(path, embedded);
-			}
+			MergeFile(*file.Embedded[i]);
 		}
 
 		if (hashfile)
@@ -304,8 +438,6 @@ void FWadCollection::AddFile (const char *filename, FileReader *wadinfo)
 			char cksumout[33];
 			memset(cksumout, 0, sizeof(cksumout));
 
-			FileReader *reader = wadinfo;
-
 			if (reader != NULL)
 			{
 				MD5Context md5;
@@ -1443,6 +1575,111 @@ bool FWadCollection::IsUncompressedFile(int lump) const
 	return (f != NULL && f->GetFile() != NULL);
 }
 
+//==========================================================================
+//
+// IsLumpCached
+//
+//==========================================================================
+
+bool FWadCollection::IsLumpCached(int lump) const
+{
+	if ((unsigned)lump >= (unsigned)NumLumps)
+	{
+		return false;
+	}
+	return LumpInfo[lump].lump->IsCached();
+}
+
+//==========================================================================
+//
+// ReadCompressedLump
+//
+// Reads the raw data of a compressed lump so that it can be decompressed
+// without touching the lump's file again, e.g. with
+// FCompressedBuffer::TryDecompress on a worker thread. Returns false for
+// lumps that are not stored compressed.
+//
+//==========================================================================
+
+bool FWadCollection::ReadCompressedLump(int lump, FCompressedBuffer &raw)
+{
+	if ((unsigned)lump >= (unsigned)NumLumps || !LumpInfo[lump].lump->IsCompressed())
+	{
+		return false;
+	}
+	raw = LumpInfo[lump].lump->GetRawData();
+	return true;
+}
+
+//==========================================================================
+//
+// LumpNeedsMainThread
+//
+//==========================================================================
+
+bool FWadCollection::LumpNeedsMainThread(int lump) const
+{
+	if ((unsigned)lump >= (unsigned)NumLumps)
+	{
+		return false;
+	}
+	return LumpInfo[lump].lump->NeedsMainThread();
+}
+
+//==========================================================================
+//
+// AdoptLumpCache
+//
+// Makes data, allocated with new[] and holding the lump's full contents,
+// the lump's cache, with a reference held for the caller that has to be
+// dropped with ReleaseLumpCache. Returns false if the lump is cached
+// already, in which case the caller still owns data.
+//
+//==========================================================================
+
+bool FWadCollection::AdoptLumpCache(int lump, char *data)
+{
+	if ((unsigned)lump >= (unsigned)NumLumps)
+	{
+		return false;
+	}
+	return LumpInfo[lump].lump->AdoptCache(data);
+}
+
+//==========================================================================
+//
+// HoldLumpCache
+//
+// Adds a reference to the lump's cache so that it stays in memory no
+// matter what lumpcache_size says. Unless load is set, lumps that are not
+// cached are left alone. Returns true if ReleaseLumpCache has to be
+// called for the lump later.
+//
+//==========================================================================
+
+bool FWadCollection::HoldLumpCache(int lump, bool load)
+{
+	if ((unsigned)lump >= (unsigned)NumLumps)
+	{
+		return false;
+	}
+	return LumpInfo[lump].lump->HoldCache(load);
+}
+
+//==========================================================================
+//
+// ReleaseLumpCache
+//
+//==========================================================================
+
+void FWadCollection::ReleaseLumpCache(int lump)
+{
+	if ((unsigned)lump < (unsigned)NumLumps)
+	{
+		LumpInfo[lump].lump->ReleaseCache();
+	}
+}
+
 //==========================================================================
 //
 // IsEncryptedFile
@@ -29,6 +29,7 @@
 
 class FResourceFile;
 struct FResourceLump;
+struct FCompressedBuffer;
 class FTexture;
 
 struct wadinfo_t
@@ -216,6 +217,12 @@ public:
 
 	bool IsUncompressedFile(int lump) const;
 	bool IsEncryptedFile(int lump) const;
+	bool IsLumpCached(int lump) const;
+	bool LumpNeedsMainThread(int lump) const;					// True if only the main thread may decompress the lump
+	bool ReadCompressedLump(int lump, FCompressedBuffer &raw);	// Reads a compressed lump's raw data for decompression elsewhere
+	bool AdoptLumpCache(int lump, char *data);					// Hands decompressed data from ReadCompressedLump to the lump cache
+	bool HoldLumpCache(int lump, bool load);					// Keeps a lump's cache in memory until ReleaseLumpCache
+	void ReleaseLumpCache(int lump);
 
 	int GetNumLumps () const;
 	int GetNumWads () const;
@@ -242,6 +249,11 @@ protected:
 	void InitHashChains ();								// [RH] Set up the lumpinfo hashing
 
 private:
+	struct FOpenedFile;
+
+	static void OpenFile(FOpenedFile &file, const char *filename, FileReader *wadinfo);
+	void MergeFile(FOpenedFile &file);
+
 	void RenameSprites();
 	void RenameNerve();
 	void FixMacHexen();
@@ -80,6 +80,7 @@
 #include "cmdlib.h"
 #include "g_level.h"
 #include "doomstat.h"
+#include "resourcefiles/resourcefile.h"
 #include "r_utility.h"
 
 #include "stats.h"
@@ -228,6 +229,11 @@ static void call_terms (void)
 #ifdef _MSC_VER
 static int NewFailure (size_t size)
 {
+	// A nonzero return makes new try again.
+	if (FResourceLump::ReleaseUnusedCaches (size) > 0)
+	{
+		return 1;
+	}
 	I_FatalError ("Failed to allocate %d bytes from process heap", size);
 	return 0;
 }
@@ -1,6 +1,7 @@
 #include "doomtype.h"
 #include "doomdef.h"
 #include "x86.h"
+#include <string.h>
 
 extern "C"
 {
@@ -41,9 +42,23 @@ void DumpCPUInfo(const CPUInfo *cpu)
 #endif
 #endif
 
+// Returns the state components the OS saves on context switches. Bits
+// 1 and 2 are the SSE and AVX registers.
+static unsigned int GetXCR0()
+{
+#ifdef _MSC_VER
+	return (unsigned int)_xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ __volatile__(".byte 0x0f, 0x01, 0xd0" : "=a" (eax), "=d" (edx) : "c" (0));
+	return eax;
+#endif
+}
+
 void CheckCPUID(CPUInfo *cpu)
 {
 	int foo[4];
+	unsigned int maxbasic;
 	unsigned int maxext;
 
 	memset(cpu, 0, sizeof(*cpu));
@@ -96,6 +111,7 @@ haveid:
 
 	// Get vendor ID
 	__cpuid(foo, 0);
+	maxbasic = (unsigned int)foo[0];
 	cpu->dwVendorID[0] = foo[1];
 	cpu->dwVendorID[1] = foo[3];
 	cpu->dwVendorID[2] = foo[2];
@@ -132,6 +148,30 @@ haveid:
 		cpu->Model |= (foo[0] >> 12) & 0xF0;
 	}
 
+	if (maxbasic >= 7)
+	{ // Get structured extended feature flags. Function 7 wants ECX = 0.
+#ifdef _MSC_VER
+		__cpuidex(foo, 7, 0);
+#elif defined(__i386__) && defined(__PIC__)
+		__asm__ __volatile__("xchgl\t%%ebx, %1\n\t"
+							 "cpuid\n\t"
+							 "xchgl\t%%ebx, %1\n\t"
+			: "=a" (foo[0]), "=r" (foo[1]), "=c" (foo[2]), "=d" (foo[3])
+			: "a" (7), "c" (0));
+#else
+		__asm__ __volatile__("cpuid" : "=a" (foo[0]), "=b" (foo[1]), "=c" (foo[2]), "=d" (foo[3])
+			: "a" (7), "c" (0));
+#endif
+		cpu->ExtFeatureFlags = foo[1];
+	}
+
+	// AVX instructions fault unless the OS saves the YMM registers.
+	if (!cpu->bOSXSAVE || (GetXCR0() & 6) != 6)
+	{
+		cpu->bAVX = false;
+		cpu->bAVX2 = false;
+	}
+
 	// Check for extended functions.
 	__cpuid(foo, 0x80000000);
 	maxext = (unsigned int)foo[0];
@@ -221,6 +261,8 @@ void DumpCPUInfo(const CPUInfo *cpu)
 		if (cpu->bSSSE3)		Printf(" SSSE3");
 		if (cpu->bSSE41)		Printf(" SSE4.1");
 		if (cpu->bSSE42)		Printf(" SSE4.2");
+		if (cpu->bAVX)			Printf(" AVX");
+		if (cpu->bAVX2)			Printf(" AVX2");
 		if (cpu->b3DNow)		Printf(" 3DNow!");
 		if (cpu->b3DNowPlus)	Printf(" 3DNow!+");
 		Printf ("\n");
@@ -348,4 +390,110 @@ void DoBlending_SSE2(const PalEntry *from, PalEntry *to, int count, int r, int g
 		}
 	}
 }
+//==========================================================================
+//
+// UnfilterRow_SSE2
+//
+// SSE2 versions of the PNG row filters. Up works on 16 bytes at a time.
+// Sub, Average and Paeth depend on the previous pixel so they can only
+// process one whole pixel at a time, which is only worthwhile for 3 and 4
+// bytes per pixel. Returns false if the row must be handled by the scalar
+// version.
+//
+//==========================================================================
+
+static inline __m128i LoadPixel_SSE2(const BYTE *p, int bpp)
+{
+	int v = 0;
+	memcpy(&v, p, bpp);
+	return _mm_cvtsi32_si128(v);
+}
+
+static inline void StorePixel_SSE2(BYTE *p, __m128i v, int bpp)
+{
+	int i = _mm_cvtsi128_si32(v);
+	memcpy(p, &i, bpp);
+}
+
+static inline __m128i Abs16_SSE2(__m128i x)
+{
+	__m128i neg = _mm_cmplt_epi16(x, _mm_setzero_si128());
+	return _mm_add_epi16(_mm_xor_si128(x, neg), _mm_srli_epi16(neg, 15));
+}
+
+static inline __m128i Select_SSE2(__m128i cond, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(cond, a), _mm_andnot_si128(cond, b));
+}
+
+bool UnfilterRow_SSE2(int width, BYTE *dest, const BYTE *row, const BYTE *prev, int bpp)
+{
+	int filter = *row++;
+	int x;
+
+	if (filter == 2)		// Up
+	{
+		for (x = 0; x + 16 <= width; x += 16)
+		{
+			__m128i r = _mm_loadu_si128((const __m128i *)(row + x));
+			__m128i p = _mm_loadu_si128((const __m128i *)(prev + x));
+			_mm_storeu_si128((__m128i *)(dest + x), _mm_add_epi8(r, p));
+		}
+		for (; x < width; x++)
+		{
+			dest[x] = row[x] + prev[x];
+		}
+		return true;
+	}
+	if (filter < 1 || filter > 4 || (bpp != 3 && bpp != 4) || width % bpp != 0)
+	{
+		return false;
+	}
+
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = zero;	// left pixel
+	__m128i c = zero;	// upper left pixel
+
+	switch (filter)
+	{
+	case 1:		// Sub
+		for (x = 0; x < width; x += bpp)
+		{
+			a = _mm_add_epi8(a, LoadPixel_SSE2(row + x, bpp));
+			StorePixel_SSE2(dest + x, a, bpp);
+		}
+		break;
+
+	case 3:		// Average
+		for (x = 0; x < width; x += bpp)
+		{
+			__m128i b = LoadPixel_SSE2(prev + x, bpp);
+			// _mm_avg_epu8 rounds up, PNG wants the sum truncated.
+			__m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+			a = _mm_add_epi8(avg, LoadPixel_SSE2(row + x, bpp));
+			StorePixel_SSE2(dest + x, a, bpp);
+		}
+		break;
+
+	case 4:		// Paeth
+		for (x = 0; x < width; x += bpp)
+		{
+			__m128i b = _mm_unpacklo_epi8(LoadPixel_SSE2(prev + x, bpp), zero);
+			__m128i pa = _mm_sub_epi16(b, c);
+			__m128i pb = _mm_sub_epi16(a, c);
+			__m128i pc = Abs16_SSE2(_mm_add_epi16(pa, pb));
+			pa = Abs16_SSE2(pa);
+			pb = Abs16_SSE2(pb);
+			__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+			__m128i pred = Select_SSE2(_mm_cmpeq_epi16(pa, smallest), a,
+				Select_SSE2(_mm_cmpeq_epi16(pb, smallest), b, c));
+			__m128i d = _mm_add_epi8(_mm_packus_epi16(pred, pred), LoadPixel_SSE2(row + x, bpp));
+			StorePixel_SSE2(dest + x, d, bpp);
+			a = _mm_unpacklo_epi8(d, zero);
+			c = b;
+		}
+		break;
+	}
+	return true;
+}
 #endif
@@ -3,7 +3,7 @@
 
 #include "basictypes.h"
 
-struct CPUInfo	// 92 bytes
+struct CPUInfo	// 96 bytes
 {
 	union
 	{
@@ -36,7 +36,10 @@ struct CPUInfo	// 92 bytes
 			uint32 DontCare1a:9;
 			uint32 bSSE41:1;
 			uint32 bSSE42:1;
-			uint32 DontCare2a:11;
+			uint32 DontCare2a:6;
+			uint32 bOSXSAVE:1;
+			uint32 bAVX:1;		// Cleared if the OS does not save AVX state
+			uint32 DontCare2b:3;
 
 			uint32 bFPU:1;
 			uint32 bVME:1;
@@ -97,6 +100,17 @@ struct CPUInfo	// 92 bytes
 		};
 		uint32 AMD_DataL1Info;
 	};
+
+	union
+	{
+		struct
+		{
+			uint32 DontCare5:5;
+			uint32 bAVX2:1;		// Cleared if the OS does not save AVX state
+			uint32 DontCare5a:26;
+		};
+		uint32 ExtFeatureFlags;	// CPUID function 7, EBX
+	};
 };
 
 
@@ -106,6 +120,7 @@ struct PalEntry;
 void CheckCPUID (CPUInfo *cpu);
 void DumpCPUInfo (const CPUInfo *cpu);
 void DoBlending_SSE2(const PalEntry *from, PalEntry *to, int count, int r, int g, int b, int a);
+bool UnfilterRow_SSE2(int width, BYTE *dest, const BYTE *row, const BYTE *prev, int bpp);
 
 #endif
 
@@ -43,7 +43,7 @@ FNullStringData FString::NullString =
 {
 	0,			// Length of string
 	2,			// Size of character buffer
-	2,			// RefCount; it must never be modified, so keep it above 1 user at all times
+	2,			// RefCount; never modified, see FStringData::AddRef
 	"\0"
 };
 
@@ -66,7 +66,6 @@ FString::FString (const char *copyStr)
 {
 	if (copyStr == NULL || *copyStr == '\0')
 	{
-		NullString.RefCount++;
 		Chars = &NullString.Nothing[0];
 	}
 	else
@@ -87,7 +86,6 @@ FString::FString (char oneChar)
 {
 	if (oneChar == '\0')
 	{
-		NullString.RefCount++;
 		Chars = &NullString.Nothing[0];
 	}
 	else
@@ -220,7 +218,6 @@ FString &FString::operator = (const char *copyStr)
 		if (copyStr == NULL || *copyStr == '\0')
 		{
 			Data()->Release();
-			NullString.RefCount++;
 			Chars = &NullString.Nothing[0];
 		}
 		else
@@ -362,7 +359,6 @@ FString &FString::CopyCStrPart(const char *tail, size_t tailLen)
 	else
 	{
 		Data()->Release();
-		NullString.RefCount++;
 		Chars = &NullString.Nothing[0];
 	}
 	return *this;
@@ -373,7 +369,6 @@ void FString::Truncate(long newlen)
 	if (newlen <= 0)
 	{
 		Data()->Release();
-		NullString.RefCount++;
 		Chars = &NullString.Nothing[0];
 	}
 	else if (newlen < (long)Len())
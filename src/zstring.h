@@ -82,28 +82,8 @@ struct FStringData
 		return (const char *)(this + 1);
 	}
 
-	char *AddRef()
-	{
-		if (RefCount < 0)
-		{
-			return (char *)(MakeCopy() + 1);
-		}
-		else
-		{
-			RefCount++;
-			return (char *)(this + 1);
-		}
-	}
-
-	void Release()
-	{
-		assert (RefCount != 0);
-
-		if (--RefCount <= 0)
-		{
-			Dealloc();
-		}
-	}
+	char *AddRef();
+	void Release();
 
 	FStringData *MakeCopy();
 
@@ -127,7 +107,7 @@ enum ELumpNum
 class FString
 {
 public:
-	FString () : Chars(&NullString.Nothing[0]) { NullString.RefCount++; }
+	FString () : Chars(&NullString.Nothing[0]) {}
 
 	// Copy constructors
 	FString (const FString &other) { AttachToOther (other); }
@@ -380,6 +360,36 @@ public:
 private:
 };
 
+// The null string is shared by every empty FString on every thread, so its
+// reference count is left alone instead of being updated without a lock.
+// It is never freed.
+inline char *FStringData::AddRef()
+{
+	if (RefCount < 0)
+	{
+		return (char *)(MakeCopy() + 1);
+	}
+	else
+	{
+		if (this != (FStringData *)&FString::NullString) RefCount++;
+		return (char *)(this + 1);
+	}
+}
+
+inline void FStringData::Release()
+{
+	if (this == (FStringData *)&FString::NullString)
+	{
+		return;
+	}
+	assert (RefCount != 0);
+
+	if (--RefCount <= 0)
+	{
+		Dealloc();
+	}
+}
+
 bool operator == (const char *, const FString &) = delete;
 bool operator != (const char *, const FString &) = delete;
 bool operator <  (const char *, const FString &) = delete;